@@ -2,12 +2,23 @@ LOCAL_PATH := $(call my-dir)
 
 include $(LOCAL_PATH)/Makefile.sources
 
+gem_exec_trace_extra_sources := gem_exec_trace_file.c
+gem_exec_trace_tool_extra_sources := gem_exec_trace_file.c
+overlay_rgb2yuv_extra_sources := ../overlay/x11/rgb2yuv.c
+igt_lib_microbench_extra_sources := ../tools/intel_ascii85.c \
+    ../tools/intel_reg_decode.c ../tools/intel_reg_spec.c \
+    ../tools/netup_get_statistics.c ../overlay/debugfs.c \
+    ../overlay/gpu-freq.c ../overlay/gpu-perf.c ../overlay/perf.c \
+    ../overlay/power.c ../overlay/rc6.c ../overlay/reader.c
+
 #================#
 
 define add_benchmark
     include $(CLEAR_VARS)
 
-    LOCAL_SRC_FILES := $1.c
+    LOCAL_SRC_FILES := $1.c $($1_extra_sources)
+    LOCAL_C_INCLUDES += $(LOCAL_PATH)/../overlay/x11
+    LOCAL_C_INCLUDES += $(LOCAL_PATH)/..
 
     LOCAL_CFLAGS += -DHAVE_STRUCT_SYSINFO_TOTALRAM
     LOCAL_CFLAGS += -DANDROID -UNDEBUG -include "check-ndebug.h"
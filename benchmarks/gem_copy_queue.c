@@ -0,0 +1,173 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Measures the cost per rectangle of many small blitter copies or fills,
+ * either submitting every rectangle on its own or batching them with
+ * igt_copy_queue.
+ */
+
+#include "igt.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define WIDTH 1024
+#define HEIGHT 1024
+
+#define FILL 0x1
+#define QUEUE 0x2
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+static void emit_rects(struct igt_copy_queue *q, uint32_t *dst, int nobj,
+		       uint32_t src, int size, int count, unsigned flags)
+{
+	int per_row = WIDTH / size;
+	int per_obj = per_row * (HEIGHT / size);
+
+	for (int n = 0; n < count; n++) {
+		int i = n % per_obj;
+		int x = (i % per_row) * size;
+		int y = (i / per_row) * size;
+		uint32_t handle = dst[n % nobj];
+
+		if (flags & FILL)
+			igt_copy_queue_fill(q, handle, 4*WIDTH,
+					    I915_TILING_NONE, x, y,
+					    size, size, n);
+		else
+			igt_copy_queue_copy(q, src, 4*WIDTH,
+					    I915_TILING_NONE, x, y,
+					    size, size,
+					    handle, 4*WIDTH,
+					    I915_TILING_NONE, x, y);
+
+		if (!(flags & QUEUE))
+			igt_copy_queue_flush(q);
+	}
+
+	igt_copy_queue_flush(q);
+}
+
+static int run(int size, int count, int nobj, int reps, unsigned flags)
+{
+	struct igt_copy_queue *q;
+	uint32_t src, *dst;
+	int fd;
+
+	fd = drm_open_driver(DRIVER_INTEL);
+	q = igt_copy_queue_alloc(fd);
+
+	src = gem_create(fd, 4*WIDTH*HEIGHT);
+	dst = malloc(nobj * sizeof(*dst));
+	for (int n = 0; n < nobj; n++)
+		dst[n] = gem_create(fd, 4*WIDTH*HEIGHT);
+
+	/* warm up, binding every object into the GTT */
+	emit_rects(q, dst, nobj, src, size, nobj, flags);
+	gem_sync(fd, dst[0]);
+
+	while (reps--) {
+		struct timespec start, end;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		emit_rects(q, dst, nobj, src, size, count, flags);
+		for (int n = 0; n < nobj; n++)
+			gem_sync(fd, dst[n]);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		printf("%7.3f\n", 1e6 * elapsed(&start, &end) / count);
+	}
+
+	igt_copy_queue_free(q);
+	for (int n = 0; n < nobj; n++)
+		gem_close(fd, dst[n]);
+	gem_close(fd, src);
+	free(dst);
+
+	close(fd);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int size = 16;
+	int count = 10000;
+	int nobj = 1;
+	int reps = 13;
+	unsigned flags = QUEUE;
+	int c;
+
+	while ((c = getopt (argc, argv, "s:n:o:r:fS")) != -1) {
+		switch (c) {
+		case 's':
+			size = atoi(optarg);
+			if (size < 1)
+				size = 1;
+			if (size > WIDTH)
+				size = WIDTH;
+			break;
+
+		case 'n':
+			count = atoi(optarg);
+			if (count < 1)
+				count = 1;
+			break;
+
+		case 'o':
+			nobj = atoi(optarg);
+			if (nobj < 1)
+				nobj = 1;
+			break;
+
+		case 'r':
+			reps = atoi(optarg);
+			if (reps < 1)
+				reps = 1;
+			break;
+
+		case 'f':
+			flags |= FILL;
+			break;
+
+		case 'S':
+			/* submit every rectangle on its own */
+			flags &= ~QUEUE;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return run(size, count, nobj, reps, flags);
+}
@@ -42,6 +42,7 @@
 
 #define LOCAL_I915_EXEC_NO_RELOC (1<<11)
 #define LOCAL_I915_EXEC_HANDLE_LUT (1<<12)
+#define LOCAL_EXEC_OBJECT_PINNED (1<<4)
 
 #define SKIP_RELOC 0x1
 #define NO_RELOC 0x2
@@ -51,6 +52,7 @@
 #define SEQUENTIAL_OFFSET 0x20
 #define REVERSE_OFFSET 0x40
 #define RANDOM_OFFSET 0x80
+#define SOFTPIN 0x100
 
 static uint32_t
 hars_petruska_f54_1_random (void)
@@ -62,6 +64,22 @@ hars_petruska_f54_1_random (void)
 #undef rol
 }
 
+#define OBJECT_SIZE 4096
+
+/*
+ * Pinned objects start at the second page, followed by one slot per cycled
+ * batch. Every slot is rounded up to whole pages so that they never overlap.
+ */
+static uint64_t object_offset(int n)
+{
+	return (uint64_t)(n + 1) * ALIGN(OBJECT_SIZE, 4096);
+}
+
+static uint64_t batch_offset(int num_objects, unsigned batch_size, int c)
+{
+	return object_offset(num_objects) + (uint64_t)c * ALIGN(batch_size, 4096);
+}
+
 #define ELAPSED(a,b) (1e6*((b)->tv_sec - (a)->tv_sec) + ((b)->tv_usec - (a)->tv_usec))
 static int run(unsigned batch_size,
 	       unsigned flags,
@@ -87,7 +105,7 @@ static int run(unsigned batch_size,
 	fd = drm_open_driver(DRIVER_INTEL);
 
 	for (n = 0; n < num_objects; n++)
-		gem_exec[n].handle = gem_create(fd, 4096);
+		gem_exec[n].handle = gem_create(fd, OBJECT_SIZE);
 
 	for (n = 0; n < 16; n++) {
 		cycle[n] = gem_create(fd, batch_size);
@@ -130,6 +148,22 @@ static int run(unsigned batch_size,
 	gem_exec[num_objects].relocs_ptr = (uintptr_t)reloc;
 	objects = gem_exec;
 
+	if (flags & SOFTPIN) {
+		/*
+		 * Every object gets a fixed address, so the batch would carry
+		 * the same addresses without asking the kernel to patch them.
+		 */
+		igt_require(gem_has_softpin(fd));
+		for (n = 0; n < num_objects; n++) {
+			gem_exec[n].flags = LOCAL_EXEC_OBJECT_PINNED;
+			gem_exec[n].offset = object_offset(n);
+		}
+		gem_exec[num_objects].flags = LOCAL_EXEC_OBJECT_PINNED;
+		gem_exec[num_objects].relocation_count = 0;
+		gem_exec[num_objects].relocs_ptr = 0;
+		num_relocs = 0;
+	}
+
 	memset(&execbuf, 0, sizeof(execbuf));
 	execbuf.buffers_ptr = (uintptr_t)objects;
 	execbuf.buffer_count = num_objects + 1;
@@ -147,6 +181,11 @@ static int run(unsigned batch_size,
 		reloc[n].presumed_offset = -1;
 	}
 
+	if (flags & SOFTPIN) {
+		execbuf.flags |= LOCAL_I915_EXEC_NO_RELOC | LOCAL_I915_EXEC_HANDLE_LUT;
+		gem_exec[num_objects].offset = batch_offset(num_objects, batch_size, c);
+	}
+
 	gem_execbuf(fd, &execbuf);
 
 	while (reps--) {
@@ -158,6 +197,8 @@ static int run(unsigned batch_size,
 				if (flags & CYCLE_BATCH) {
 					c = (c + 1) % 16;
 					gem_exec[num_objects].handle = cycle[c];
+					gem_exec[num_objects].offset =
+						batch_offset(num_objects, batch_size, c);
 				}
 			}
 			if (flags & FAULT && reloc) {
@@ -222,6 +263,8 @@ int main(int argc, char **argv)
 				flags |= 0;
 			} else if (strcmp(optarg, "lut") == 0) {
 				flags |= LUT;
+			} else if (strcmp(optarg, "softpin") == 0) {
+				flags |= SOFTPIN;
 			} else {
 				abort();
 			}
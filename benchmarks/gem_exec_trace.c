@@ -37,6 +37,7 @@
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "drm.h"
 #include "ioctl_wrappers.h"
@@ -44,209 +45,549 @@
 #include "intel_io.h"
 #include "igt_stats.h"
 
-enum {
-	ADD_BO = 0,
-	DEL_BO,
-	EXEC,
-};
+#include "gem_exec_trace.h"
+
+struct replay {
+	int fd;
+	const struct trace *trace;
 
-struct trace_add_bo {
-	uint32_t handle;
-	uint64_t size;
-} __attribute__((packed));
-
-struct trace_del_bo {
-	uint32_t handle;
-} __attribute__((packed));
-
-struct trace_exec {
-	uint32_t object_count;
-	uint64_t flags;
-} __attribute__((packed));
-struct trace_exec_object {
-	uint32_t handle;
-	uint32_t relocation_count;
-	uint64_t alignment;
-	uint64_t flags;
-	uint64_t rsvd1;
-	uint64_t rsvd2;
-} __attribute__((packed));
-struct trace_exec_relocation {
-	uint32_t target_handle;
-	uint32_t delta;
-	uint64_t offset;
-	uint32_t read_domains;
-	uint32_t write_domain;
-} __attribute__((packed));
-
-static double elapsed(const struct timespec *start, const struct timespec *end)
-{
-	return 1e3*(end->tv_sec - start->tv_sec) + 1e-6*(end->tv_nsec - start->tv_nsec);
-}
-
-static void replay(const char *filename)
-{
-	struct timespec t_start, t_end;
-	struct drm_i915_gem_execbuffer2 eb = {};
+	struct drm_i915_gem_execbuffer2 eb;
 	struct bo {
 		uint32_t handle;
+		uint64_t size;
 		uint64_t offset;
+		uint64_t hash;
 
 		struct drm_i915_gem_relocation_entry *relocs;
 		uint32_t max_relocs;
-	} *bo = NULL, **offsets = NULL;
-	int num_bo = 0;
-	struct drm_i915_gem_exec_object2 *exec_objects = NULL;
-	int max_objects = 0;
-	struct stat st;
-	uint8_t *ptr, *end;
-	int fd;
+	} *bo, **offsets;
+	int num_bo;
+	struct drm_i915_gem_exec_object2 *exec_objects;
+	int max_objects;
+
+	uint32_t *ctx;
+	int num_ctx;
+
+	igt_stats_t latency;
+};
+
+static uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000,
+		.tv_nsec = ns % 1000000000,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
 
-	fd = open(filename, O_RDONLY);
-	if (fd < 0)
+static void replay_add_bo(struct replay *r, const struct trace_add_bo *t)
+{
+	uint32_t bb = 0xa << 23;
+
+	if (t->handle >= r->num_bo) {
+		int new_bo = (t->handle + 4096) & -4096;
+		r->bo = realloc(r->bo, sizeof(*r->bo)*new_bo);
+		memset(r->bo + r->num_bo, 0, sizeof(*r->bo)*(new_bo - r->num_bo));
+		r->num_bo = new_bo;
+	}
+
+	r->bo[t->handle].handle = gem_create(r->fd, t->size);
+	r->bo[t->handle].size = t->size;
+	r->bo[t->handle].hash = 0;
+	gem_write(r->fd, r->bo[t->handle].handle, 0, &bb, sizeof(bb));
+}
+
+static void replay_del_bo(struct replay *r, const struct trace_del_bo *t)
+{
+	struct bo *bo;
+
+	if (t->handle >= r->num_bo || !r->bo[t->handle].handle)
 		return;
 
-	if (fstat(fd, &st) < 0)
+	bo = &r->bo[t->handle];
+	gem_close(r->fd, bo->handle);
+	bo->handle = 0;
+
+	free(bo->relocs);
+	bo->relocs = NULL;
+	bo->max_relocs = 0;
+}
+
+static void replay_add_ctx(struct replay *r, const struct trace_ctx *t)
+{
+	if (t->ctx_id >= r->num_ctx) {
+		int new_ctx = (t->ctx_id + 64) & -64;
+		r->ctx = realloc(r->ctx, sizeof(*r->ctx)*new_ctx);
+		memset(r->ctx + r->num_ctx, 0, sizeof(*r->ctx)*(new_ctx - r->num_ctx));
+		r->num_ctx = new_ctx;
+	}
+
+	r->ctx[t->ctx_id] = gem_context_create(r->fd);
+}
+
+static void replay_del_ctx(struct replay *r, const struct trace_ctx *t)
+{
+	if (t->ctx_id >= r->num_ctx || !r->ctx[t->ctx_id])
 		return;
 
-	ptr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
-	close(fd);
+	gem_context_destroy(r->fd, r->ctx[t->ctx_id]);
+	r->ctx[t->ctx_id] = 0;
+}
 
-	if (ptr == MAP_FAILED)
+static void replay_bo_data(struct replay *r, const struct trace_bo_data *t)
+{
+	const struct blob *blob;
+	struct bo *bo;
+
+	if (t->handle >= r->num_bo)
+		return;
+
+	bo = &r->bo[t->handle];
+	if (!bo->handle || bo->hash == t->hash)
 		return;
 
-	madvise(ptr, st.st_size, MADV_SEQUENTIAL);
-
-	end = ptr + st.st_size;
-	fd = drm_open_driver(DRIVER_INTEL);
-
-	clock_gettime(CLOCK_MONOTONIC, &t_start);
-	do {
-		switch (*ptr++) {
-		case ADD_BO: {
-				     uint32_t bb = 0xa << 23;
-				     struct trace_add_bo *t = (void *)ptr;
-				     ptr = (void *)(t + 1);
-
-				     if (t->handle >= num_bo) {
-					     int new_bo = (t->handle + 4096) & -4096;
-					     bo = realloc(bo, sizeof(*bo)*new_bo);
-					     memset(bo + num_bo, 0, sizeof(*bo)*(new_bo - num_bo));
-					     num_bo = new_bo;
-				     }
-
-				     bo[t->handle].handle = gem_create(fd, t->size);
-				     gem_write(fd, bo[t->handle].handle, 0, &bb, sizeof(bb));
-				     break;
-			     }
-		case DEL_BO: {
-				     struct trace_del_bo *t = (void *)ptr;
-				     ptr = (void *)(t + 1);
-
-				     gem_close(fd, bo[t->handle].handle);
-				     bo[t->handle].handle = 0;
-
-				     free(bo[t->handle].relocs);
-				     bo[t->handle].relocs = NULL;
-				     bo[t->handle].max_relocs = 0;
-				     break;
-			     }
-		case EXEC: {
-				   struct trace_exec *t = (void *)ptr;
-				   uint32_t i, j;
-				   ptr = (void *)(t + 1);
-
-				   eb.buffer_count = t->object_count;
-				   eb.flags = t->flags & ~I915_EXEC_RING_MASK;
-
-				   if (eb.buffer_count > max_objects) {
-					   free(exec_objects);
-					   free(offsets);
-
-					   max_objects = ALIGN(eb.buffer_count, 4096);
-
-					   exec_objects = malloc(max_objects*sizeof(*exec_objects));
-					   offsets = malloc(max_objects*sizeof(*offsets));
-
-					   eb.buffers_ptr = (uintptr_t)exec_objects;
-				   }
-
-				   for (i = 0; i < eb.buffer_count; i++) {
-					   struct drm_i915_gem_relocation_entry *relocs;
-					   struct trace_exec_object *to = (void *)ptr;
-					   ptr = (void *)(to + 1);
-
-					   offsets[i] = &bo[to->handle];
-
-					   exec_objects[i].handle = bo[to->handle].handle;
-					   exec_objects[i].offset = bo[to->handle].offset;
-					   exec_objects[i].alignment = to->alignment;
-					   exec_objects[i].flags = to->flags;
-					   exec_objects[i].rsvd1 = to->rsvd1;
-					   exec_objects[i].rsvd2 = to->rsvd2;
-
-					   exec_objects[i].relocation_count = to->relocation_count;
-					   if (!to->relocation_count)
-						   continue;
-
-					   if (to->relocation_count > bo[to->handle].max_relocs) {
-						   free(bo[to->handle].relocs);
-
-						   bo[to->handle].max_relocs = ALIGN(to->relocation_count, 128);
-						   bo[to->handle].relocs = malloc(sizeof(*bo[to->handle].relocs)*bo[to->handle].max_relocs);
-					   }
-					   relocs = bo[to->handle].relocs;
-					   exec_objects[i].relocs_ptr = (uintptr_t)relocs;
-
-					   for (j = 0; j < to->relocation_count; j++) {
-						   struct trace_exec_relocation *tr = (void *)ptr;
-						   ptr = (void *)(tr + 1);
-
-						   if (eb.flags & I915_EXEC_HANDLE_LUT) {
-							   uint32_t handle;
-
-							   relocs[j].target_handle = tr->target_handle;
-
-							   handle = exec_objects[tr->target_handle].handle;
-							   relocs[j].presumed_offset = bo[handle].offset;
-						   } else {
-							   relocs[j].target_handle = bo[tr->target_handle].handle;
-							   relocs[j].presumed_offset = bo[tr->target_handle].offset;
-						   }
-						   relocs[j].delta = tr->delta;
-						   relocs[j].offset = tr->offset;
-						   relocs[j].read_domains = tr->read_domains;
-						   relocs[j].write_domain = tr->write_domain;
-					   }
-				   }
-
-				   gem_execbuf(fd, &eb);
-
-				   for (i = 0; i < eb.buffer_count; i++)
-					   offsets[i]->offset = exec_objects[i].offset;
-
-				   break;
-			   }
+	blob = trace_find_blob(r->trace, t->hash);
+	if (blob == NULL)
+		return;
+
+	gem_write(r->fd, bo->handle, 0, blob->data,
+		  blob->size < bo->size ? blob->size : bo->size);
+	bo->hash = t->hash;
+}
+
+static void replay_exec(struct replay *r, const struct trace_exec *t)
+{
+	struct drm_i915_gem_execbuffer2 *eb = &r->eb;
+	struct bo *bo = r->bo;
+	const uint8_t *ptr = (const void *)(t + 1);
+	uint64_t t0;
+	uint32_t i, j;
+
+	eb->buffer_count = t->object_count;
+	eb->flags = t->flags & ~I915_EXEC_RING_MASK;
+	eb->batch_start_offset = t->batch_start_offset;
+	eb->batch_len = t->batch_len;
+	eb->rsvd1 = 0;
+	if (t->context && t->context < r->num_ctx)
+		i915_execbuffer2_set_context_id(*eb, r->ctx[t->context]);
+
+	if (eb->buffer_count > r->max_objects) {
+		free(r->exec_objects);
+		free(r->offsets);
+
+		r->max_objects = ALIGN(eb->buffer_count, 4096);
+
+		r->exec_objects = malloc(r->max_objects*sizeof(*r->exec_objects));
+		r->offsets = malloc(r->max_objects*sizeof(*r->offsets));
+
+		eb->buffers_ptr = (uintptr_t)r->exec_objects;
+	}
+
+	for (i = 0; i < eb->buffer_count; i++) {
+		struct drm_i915_gem_exec_object2 *obj = &r->exec_objects[i];
+		struct drm_i915_gem_relocation_entry *relocs;
+		const struct trace_exec_object *to = (const void *)ptr;
+		ptr = (const void *)(to + 1);
+
+		r->offsets[i] = &bo[to->handle];
+
+		obj->handle = bo[to->handle].handle;
+		obj->offset = bo[to->handle].offset;
+		obj->alignment = to->alignment;
+		obj->flags = to->flags;
+		obj->rsvd1 = to->rsvd1;
+		obj->rsvd2 = to->rsvd2;
+
+		obj->relocation_count = to->relocation_count;
+		if (!to->relocation_count)
+			continue;
+
+		if (to->relocation_count > bo[to->handle].max_relocs) {
+			free(bo[to->handle].relocs);
+
+			bo[to->handle].max_relocs = ALIGN(to->relocation_count, 128);
+			bo[to->handle].relocs = malloc(sizeof(*bo[to->handle].relocs)*bo[to->handle].max_relocs);
 		}
-	} while (ptr < end);
-	clock_gettime(CLOCK_MONOTONIC, &t_end);
-	close(fd);
-	munmap(end-st.st_size, st.st_size);
+		relocs = bo[to->handle].relocs;
+		obj->relocs_ptr = (uintptr_t)relocs;
+
+		for (j = 0; j < to->relocation_count; j++) {
+			const struct trace_exec_relocation *tr = (const void *)ptr;
+			ptr = (const void *)(tr + 1);
+
+			if (eb->flags & I915_EXEC_HANDLE_LUT) {
+				uint32_t handle;
+
+				relocs[j].target_handle = tr->target_handle;
+
+				handle = r->exec_objects[tr->target_handle].handle;
+				relocs[j].presumed_offset = bo[handle].offset;
+			} else {
+				relocs[j].target_handle = bo[tr->target_handle].handle;
+				relocs[j].presumed_offset = bo[tr->target_handle].offset;
+			}
+			relocs[j].delta = tr->delta;
+			relocs[j].offset = tr->offset;
+			relocs[j].read_domains = tr->read_domains;
+			relocs[j].write_domain = tr->write_domain;
+		}
+	}
 
-	for (fd = 0; fd < num_bo; fd++)
-		free(bo[fd].relocs);
-	free(bo);
-	free(offsets);
+	t0 = gettime_ns();
+	gem_execbuf(r->fd, eb);
+	igt_stats_push(&r->latency, gettime_ns() - t0);
 
-	printf("%s: %.3f\n", filename, elapsed(&t_start, &t_end));
+	for (i = 0; i < eb->buffer_count; i++)
+		r->offsets[i]->offset = r->exec_objects[i].offset;
 }
 
-int main(int argc, char **argv)
+static void replay_event(struct replay *r, const struct trace_cmd *cmd)
+{
+	const void *payload = cmd + 1;
+
+	switch (cmd->cmd) {
+	case ADD_BO:
+		replay_add_bo(r, payload);
+		break;
+	case DEL_BO:
+		replay_del_bo(r, payload);
+		break;
+	case ADD_CTX:
+		replay_add_ctx(r, payload);
+		break;
+	case DEL_CTX:
+		replay_del_ctx(r, payload);
+		break;
+	case BO_DATA:
+		replay_bo_data(r, payload);
+		break;
+	case EXEC:
+		replay_exec(r, payload);
+		break;
+	}
+}
+
+/* Recreate the objects and contexts alive at the start of the window */
+static void replay_prime(struct replay *r)
+{
+	const struct trace *trace = r->trace;
+	unsigned n;
+
+	for (n = 0; n < trace->num_live_bo; n++) {
+		const struct trace_live_bo *live = &trace->live_bo[n];
+		struct trace_add_bo add = { live->handle, live->size };
+		struct trace_bo_data data = { live->handle, live->hash };
+
+		replay_add_bo(r, &add);
+		if (live->hash)
+			replay_bo_data(r, &data);
+	}
+
+	for (n = 0; n < trace->num_live_ctx; n++) {
+		struct trace_ctx ctx = { trace->live_ctx[n] };
+
+		replay_add_ctx(r, &ctx);
+	}
+}
+
+static void replay_fini(struct replay *r)
 {
 	int i;
 
-	for (i = 1; i < argc; i++)
-		replay(argv[i]);
+	for (i = 0; i < r->num_ctx; i++)
+		if (r->ctx[i])
+			gem_context_destroy(r->fd, r->ctx[i]);
+	free(r->ctx);
+
+	for (i = 0; i < r->num_bo; i++)
+		free(r->bo[i].relocs);
+	free(r->bo);
+	free(r->offsets);
+	free(r->exec_objects);
+
+	igt_stats_fini(&r->latency);
+	close(r->fd);
+}
+
+#define PACED	0x1
+#define PARALLEL	0x2
+#define VERBOSE	0x4
+
+struct client {
+	pthread_t thread;
+	const struct trace *trace;
+	unsigned copy;
+	unsigned flags;
+	double speed;
+
+	struct replay r;
+	uint64_t start;
+	uint64_t max_lag;
+	double elapsed;
+};
+
+/*
+ * Replay the whole trace for one client. In paced mode, each command is
+ * issued no earlier than its recorded offset from the first command
+ * (divided by the speed factor); if we fall behind we do not try to
+ * catch up by skipping, but remember the worst lag for the summary.
+ */
+static void *client_run(void *arg)
+{
+	struct client *c = arg;
+	const struct trace *trace = c->trace;
+	uint64_t first, end;
+	unsigned n;
+
+	if (trace->num_events == 0)
+		return NULL;
+
+	sleep_until(c->start);
+
+	first = trace->events[0].timestamp;
+	for (n = 0; n < trace->num_events; n++) {
+		const struct event *e = &trace->events[n];
+
+		if (c->flags & PACED) {
+			uint64_t target = c->start + (e->timestamp - first) / c->speed;
+			uint64_t now = gettime_ns();
+
+			if (now < target)
+				sleep_until(target);
+			else if (now - target > c->max_lag)
+				c->max_lag = now - target;
+		}
+
+		replay_event(&c->r, e->cmd);
+	}
+	end = gettime_ns();
+
+	c->elapsed = 1e-6 * (end - c->start);
+	return NULL;
+}
+
+static void print_histogram(igt_stats_t *stats)
+{
+	unsigned buckets[64] = {}, max = 0, n, i;
+
+	for (n = 0; n < stats->n_values; n++) {
+		uint64_t v = stats->values_u64[n] / 1000;
+
+		i = 0;
+		while (v) {
+			v >>= 1;
+			i++;
+		}
+		if (++buckets[i] > max)
+			max = buckets[i];
+	}
+
+	for (i = 0; i < 64; i++) {
+		char bar[41];
+		unsigned len;
+
+		if (!buckets[i])
+			continue;
+
+		len = (40 * buckets[i] + max - 1) / max;
+		memset(bar, '#', len);
+		bar[len] = '\0';
+
+		printf("    [%8lluus, %8lluus): %8u %s\n",
+		       i ? 1ull << (i - 1) : 0ull, 1ull << i,
+		       buckets[i], bar);
+	}
+}
+
+static void client_print(struct client *c)
+{
+	igt_stats_t *latency = &c->r.latency;
+	double q1, q2, q3;
+
+	if (c->copy)
+		printf("%s[%d]: %.3f\n", c->trace->filename, c->copy, c->elapsed);
+	else
+		printf("%s: %.3f\n", c->trace->filename, c->elapsed);
+
+	if (!(c->flags & VERBOSE))
+		return;
+
+	printf("  %u execs, %.1f execs/s",
+	       latency->n_values,
+	       c->elapsed ? 1e3 * latency->n_values / c->elapsed : 0.);
+	if (c->flags & PACED)
+		printf(", max lag %.3fms", 1e-6 * c->max_lag);
+	printf("\n");
+
+	if (!latency->n_values)
+		return;
+
+	igt_stats_get_quartiles(latency, &q1, &q2, &q3);
+	printf("  submission latency (us): min %.1f, q1 %.1f, median %.1f, q3 %.1f, max %.1f, mean %.1f\n",
+	       1e-3 * igt_stats_get_min(latency),
+	       1e-3 * q1, 1e-3 * q2, 1e-3 * q3,
+	       1e-3 * igt_stats_get_max(latency),
+	       1e-3 * igt_stats_get_mean(latency));
+	print_histogram(latency);
+}
+
+static void client_init(struct client *c, const struct trace *trace,
+			unsigned copy, unsigned flags, double speed)
+{
+	memset(c, 0, sizeof(*c));
+	c->trace = trace;
+	c->copy = copy;
+	c->flags = flags;
+	c->speed = speed;
+
+	c->r.trace = trace;
+	c->r.fd = drm_open_driver(DRIVER_INTEL);
+	igt_stats_init_with_size(&c->r.latency, trace->num_execs ?: 1);
+
+	replay_prime(&c->r);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] trace...\n"
+		"  -p        replay at the recorded pace\n"
+		"  -s SPEED  replay at SPEED times the recorded pace (implies -p)\n"
+		"  -c N      replay N copies of each trace, each on its own fd\n"
+		"  -P        replay all traces (and copies) concurrently\n"
+		"  -t START[:END]\n"
+		"            only replay the window between START and END seconds\n"
+		"            into the trace\n"
+		"  -v        print throughput and latency summary per client\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	struct trace *traces;
+	struct client *clients;
+	unsigned flags = 0;
+	uint64_t start = 0, end = TRACE_END;
+	double speed = 1.;
+	int copies = 1;
+	int ntraces, nclients;
+	int i, n, c;
+
+	while ((c = getopt(argc, argv, "ps:c:Pt:vh")) != -1) {
+		switch (c) {
+		case 'p':
+			flags |= PACED;
+			break;
+
+		case 's':
+			flags |= PACED;
+			speed = atof(optarg);
+			if (speed <= 0)
+				speed = 1.;
+			break;
+
+		case 'c':
+			/* Each copy is a separate client (fd) */
+			copies = atoi(optarg);
+			if (copies < 1)
+				copies = 1;
+			break;
+
+		case 'P':
+			flags |= PARALLEL;
+			break;
+
+		case 't': {
+			char *sep;
+
+			start = 1e9 * strtod(optarg, &sep);
+			if (*sep == ':')
+				end = 1e9 * strtod(sep + 1, NULL);
+			break;
+		}
+
+		case 'v':
+			flags |= VERBOSE;
+			break;
+
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	traces = calloc(argc - optind, sizeof(*traces));
+	ntraces = 0;
+	for (i = optind; i < argc; i++)
+		if (trace_load(&traces[ntraces], argv[i], start, end) == 0)
+			ntraces++;
+
+	nclients = ntraces * copies;
+	clients = calloc(nclients, sizeof(*clients));
+
+	if (flags & PARALLEL) {
+		uint64_t t0;
+
+		for (i = 0; i < ntraces; i++)
+			for (n = 0; n < copies; n++)
+				client_init(&clients[i * copies + n], &traces[i],
+					    copies > 1 ? n + 1 : 0, flags, speed);
+
+		/* Give every thread time to be scheduled before the off */
+		t0 = gettime_ns() + 10 * 1000 * 1000;
+		for (i = 0; i < nclients; i++) {
+			clients[i].start = t0;
+			pthread_create(&clients[i].thread, NULL,
+				       client_run, &clients[i]);
+		}
+		for (i = 0; i < nclients; i++)
+			pthread_join(clients[i].thread, NULL);
+
+		if (flags & VERBOSE && nclients > 1) {
+			uint64_t execs = 0;
+			double wall = 0;
+
+			for (i = 0; i < nclients; i++) {
+				execs += clients[i].r.latency.n_values;
+				if (clients[i].elapsed > wall)
+					wall = clients[i].elapsed;
+			}
+			printf("total: %d clients, %.3fms, %llu execs, %.1f execs/s\n",
+			       nclients, wall, (unsigned long long)execs,
+			       wall ? 1e3 * execs / wall : 0.);
+		}
+
+		for (i = 0; i < nclients; i++) {
+			client_print(&clients[i]);
+			replay_fini(&clients[i].r);
+		}
+	} else {
+		for (i = 0; i < nclients; i++) {
+			struct client *cl = &clients[i];
+
+			client_init(cl, &traces[i / copies],
+				    copies > 1 ? i % copies + 1 : 0, flags, speed);
+			cl->start = gettime_ns();
+			client_run(cl);
+			client_print(cl);
+			replay_fini(&cl->r);
+		}
+	}
+
+	for (i = 0; i < ntraces; i++)
+		trace_fini(&traces[i]);
+	free(traces);
+	free(clients);
 
 	return 0;
 }
@@ -0,0 +1,265 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef GEM_EXEC_TRACE_H
+#define GEM_EXEC_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * On-disk format shared by the gem_exec_tracer.so preload module and the
+ * gem_exec_trace replayer.
+ *
+ * A trace starts with a struct trace_header, followed by a sequence of
+ * blocks. Each block is the flushed contents of one thread's buffer: a
+ * struct trace_block followed by block->length bytes of records. Records
+ * within a block are in submission order for that thread; records from
+ * different threads are ordered by their timestamp (nanoseconds since
+ * trace_header.start_ns, CLOCK_MONOTONIC).
+ *
+ * Every record begins with a struct trace_cmd, followed by the payload
+ * for that command.
+ *
+ * Traces rewritten by gem_exec_trace_tool carry TRACE_INDEXED in the
+ * header flags and are laid out as
+ *
+ *   header | chunk 0 | ... | chunk N | blobs | live sets | index | footer
+ *
+ * where every chunk is a run of blocks holding a single timeline sorted by
+ * timestamp, the blob section holds every BLOB record of the trace, and
+ * the index describes each chunk along with the set of objects and
+ * contexts alive at its start. This allows a replay to seek straight to
+ * any chunk instead of walking the trace from the beginning.
+ */
+
+#define TRACE_MAGIC 0x43455847 /* "GXEC" */
+#define TRACE_VERSION 2
+
+#define TRACE_HAS_CONTENTS (1 << 0)
+#define TRACE_INDEXED (1 << 1)
+
+#define TRACE_INDEX_MAGIC 0x58444e49 /* "INDX" */
+
+enum {
+	ADD_BO = 0,
+	DEL_BO,
+	EXEC,
+	ADD_CTX,
+	DEL_CTX,
+	BO_DATA,
+	BLOB,
+};
+
+struct trace_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t pid;
+	uint64_t start_ns;
+} __attribute__((packed));
+
+struct trace_block {
+	uint32_t tid;
+	uint32_t length;
+} __attribute__((packed));
+
+struct trace_cmd {
+	uint8_t cmd;
+	uint64_t timestamp;
+} __attribute__((packed));
+
+struct trace_add_bo {
+	uint32_t handle;
+	uint64_t size;
+} __attribute__((packed));
+
+struct trace_del_bo {
+	uint32_t handle;
+} __attribute__((packed));
+
+/* followed by object_count * trace_exec_object (and their relocations) */
+struct trace_exec {
+	uint32_t object_count;
+	uint64_t flags;
+	uint32_t context;
+	uint32_t batch_start_offset;
+	uint32_t batch_len;
+} __attribute__((packed));
+
+/* followed by relocation_count * trace_exec_relocation */
+struct trace_exec_object {
+	uint32_t handle;
+	uint32_t relocation_count;
+	uint64_t alignment;
+	uint64_t flags;
+	uint64_t rsvd1;
+	uint64_t rsvd2;
+} __attribute__((packed));
+
+struct trace_exec_relocation {
+	uint32_t target_handle;
+	uint32_t delta;
+	uint64_t offset;
+	uint32_t read_domains;
+	uint32_t write_domain;
+} __attribute__((packed));
+
+struct trace_ctx {
+	uint32_t ctx_id;
+} __attribute__((packed));
+
+/*
+ * The contents of @handle at the time of the next EXEC from this thread
+ * are those of the BLOB with matching @hash. Each distinct BLOB is only
+ * written once per trace, before the first BO_DATA that refers to it.
+ */
+struct trace_bo_data {
+	uint32_t handle;
+	uint64_t hash;
+} __attribute__((packed));
+
+/* followed by size bytes of data */
+struct trace_blob {
+	uint64_t hash;
+	uint64_t size;
+} __attribute__((packed));
+
+struct trace_live_bo {
+	uint32_t handle;
+	uint64_t size;
+	uint64_t hash;
+} __attribute__((packed));
+
+struct trace_chunk {
+	uint64_t offset; /* of the first block */
+	uint64_t length; /* of all blocks in the chunk */
+	uint64_t first_timestamp;
+	/* num_live_bo * trace_live_bo followed by num_live_ctx * trace_ctx */
+	uint64_t live_offset;
+	uint32_t num_live_bo;
+	uint32_t num_live_ctx;
+} __attribute__((packed));
+
+/* Last bytes of an indexed trace */
+struct trace_footer {
+	uint64_t blob_offset;
+	uint64_t blob_length;
+	uint64_t index_offset; /* num_chunks * trace_chunk */
+	uint32_t num_chunks;
+	uint32_t magic;
+} __attribute__((packed));
+
+/*
+ * In-memory access to traces, see gem_exec_trace_file.c. This is not used
+ * by the tracer itself.
+ */
+
+struct event {
+	uint64_t timestamp;
+	uint64_t seq;
+	const struct trace_cmd *cmd;
+};
+
+struct blob {
+	uint64_t hash;
+	uint64_t size;
+	const void *data;
+};
+
+/* Objects and contexts alive at a point in the trace, indexed by id */
+struct trace_state {
+	struct trace_live_bo *bo;
+	unsigned num_bo;
+	uint8_t *ctx;
+	unsigned num_ctx;
+};
+
+struct trace {
+	const char *filename;
+	const struct trace_header *header;
+	void *map;
+	size_t size;
+
+	const struct trace_chunk *chunks;
+	unsigned num_chunks;
+
+	/* Commands within the loaded window, sorted by timestamp */
+	struct event *events;
+	unsigned num_events;
+	unsigned num_execs;
+
+	struct blob *blobs;
+	unsigned blob_mask;
+
+	/* What must exist before replaying the first event */
+	struct trace_live_bo *live_bo;
+	unsigned num_live_bo;
+	uint32_t *live_ctx;
+	unsigned num_live_ctx;
+};
+
+#define TRACE_END UINT64_MAX
+
+const void *trace_skip_record(const struct trace_cmd *cmd, const void *end);
+
+int trace_load(struct trace *trace, const char *filename,
+	       uint64_t start, uint64_t end);
+void trace_fini(struct trace *trace);
+const struct blob *trace_find_blob(const struct trace *trace, uint64_t hash);
+
+void trace_state_update(struct trace_state *state, const struct trace_cmd *cmd);
+void trace_state_fini(struct trace_state *state);
+
+struct trace_out {
+	int fd;
+	int error;
+	uint64_t offset;
+	uint64_t chunk_ns;
+
+	uint8_t *buf;
+	size_t len, size;
+	size_t pending;
+
+	struct trace_chunk *chunks;
+	unsigned num_chunks, max_chunks;
+
+	uint8_t *live;
+	size_t live_len, live_size;
+
+	struct blob *blobs;
+	unsigned num_blobs, blob_mask;
+
+	struct trace_state state;
+};
+
+int trace_out_open(struct trace_out *out, const char *filename,
+		   const struct trace_header *header, uint64_t chunk_ns);
+void *trace_out_reserve(struct trace_out *out, uint8_t cmd,
+			uint64_t timestamp, size_t len);
+void trace_out_commit(struct trace_out *out);
+void trace_out_blob(struct trace_out *out, const struct blob *blob);
+int trace_out_close(struct trace_out *out);
+
+#endif /* GEM_EXEC_TRACE_H */
@@ -0,0 +1,839 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Reading and writing of gem_exec_tracer traces, shared between the
+ * gem_exec_trace replayer and gem_exec_trace_tool.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "gem_exec_trace.h"
+
+#define OUT_BLOCK_SIZE (1 << 20)
+
+/* Advances @ptr over @size bytes, or returns NULL if they run past @end */
+static const uint8_t *trace_advance(const uint8_t *ptr, const uint8_t *end,
+				    uint64_t size)
+{
+	if (ptr > end || size > (uint64_t)(end - ptr))
+		return NULL;
+
+	return ptr + size;
+}
+
+const void *trace_skip_record(const struct trace_cmd *cmd, const void *end)
+{
+	const uint8_t *stop = end;
+	const uint8_t *ptr;
+
+	ptr = trace_advance((const uint8_t *)cmd, stop, sizeof(*cmd));
+	if (ptr == NULL)
+		return NULL;
+
+	switch (cmd->cmd) {
+	case ADD_BO:
+		return trace_advance(ptr, stop, sizeof(struct trace_add_bo));
+	case DEL_BO:
+		return trace_advance(ptr, stop, sizeof(struct trace_del_bo));
+	case ADD_CTX:
+	case DEL_CTX:
+		return trace_advance(ptr, stop, sizeof(struct trace_ctx));
+	case BO_DATA:
+		return trace_advance(ptr, stop, sizeof(struct trace_bo_data));
+	case BLOB: {
+		const struct trace_blob *t = (const void *)ptr;
+
+		ptr = trace_advance(ptr, stop, sizeof(*t));
+		if (ptr == NULL)
+			return NULL;
+
+		return trace_advance(ptr, stop, t->size);
+	}
+	case EXEC: {
+		const struct trace_exec *t = (const void *)ptr;
+		uint32_t i;
+
+		ptr = trace_advance(ptr, stop, sizeof(*t));
+		for (i = 0; ptr && i < t->object_count; i++) {
+			const struct trace_exec_object *to = (const void *)ptr;
+
+			ptr = trace_advance(ptr, stop, sizeof(*to));
+			if (ptr == NULL)
+				break;
+
+			ptr = trace_advance(ptr, stop,
+					    (uint64_t)to->relocation_count *
+					    sizeof(struct trace_exec_relocation));
+		}
+		return ptr;
+	}
+	default:
+		return NULL;
+	}
+}
+
+/* Returns the slot holding @hash, or the empty slot where it belongs */
+static struct blob *lookup_blob(struct blob *blobs, unsigned mask, uint64_t hash)
+{
+	unsigned i;
+
+	for (i = hash & mask; blobs[i].hash; i = (i + 1) & mask)
+		if (blobs[i].hash == hash)
+			break;
+
+	return &blobs[i];
+}
+
+static void add_blob(struct blob *blobs, unsigned mask, const struct blob *blob)
+{
+	struct blob *slot = lookup_blob(blobs, mask, blob->hash);
+
+	if (!slot->hash)
+		*slot = *blob;
+}
+
+const struct blob *trace_find_blob(const struct trace *trace, uint64_t hash)
+{
+	const struct blob *blob;
+
+	if (trace->blobs == NULL)
+		return NULL;
+
+	blob = lookup_blob(trace->blobs, trace->blob_mask, hash);
+	return blob->hash ? blob : NULL;
+}
+
+static int event_cmp(const void *A, const void *B)
+{
+	const struct event *a = A, *b = B;
+
+	if (a->timestamp != b->timestamp)
+		return a->timestamp < b->timestamp ? -1 : 1;
+
+	return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+/*
+ * Walk a run of blocks, recording every command other than BLOB (which
+ * are only counted).
+ */
+static int parse_blocks(struct trace *trace, unsigned *max_events,
+			const uint8_t *ptr, const uint8_t *end,
+			unsigned *num_blobs)
+{
+	while (ptr + sizeof(struct trace_block) <= end) {
+		const struct trace_block *block = (const void *)ptr;
+		const uint8_t *block_end = ptr + sizeof(*block) + block->length;
+
+		if (block_end > end)
+			return -EINVAL;
+
+		ptr = (const uint8_t *)(block + 1);
+		while (ptr < block_end) {
+			const struct trace_cmd *cmd = (const void *)ptr;
+			struct event *e;
+
+			ptr = trace_skip_record(cmd, block_end);
+			if (ptr == NULL || ptr > block_end)
+				return -EINVAL;
+
+			if (cmd->cmd == BLOB) {
+				(*num_blobs)++;
+				continue;
+			}
+
+			if (trace->num_events == *max_events) {
+				*max_events = *max_events ? 2 * *max_events : 4096;
+				e = realloc(trace->events, *max_events * sizeof(*e));
+				if (e == NULL)
+					return -ENOMEM;
+				trace->events = e;
+			}
+
+			e = &trace->events[trace->num_events];
+			e->timestamp = cmd->timestamp;
+			e->seq = trace->num_events++;
+			e->cmd = cmd;
+		}
+	}
+
+	return 0;
+}
+
+static int index_blobs(struct trace *trace,
+		       const uint8_t *ptr, const uint8_t *end,
+		       unsigned num_blobs)
+{
+	trace->blob_mask = 1;
+	while (trace->blob_mask < 2 * num_blobs)
+		trace->blob_mask <<= 1;
+	trace->blobs = calloc(trace->blob_mask, sizeof(*trace->blobs));
+	if (trace->blobs == NULL)
+		return -ENOMEM;
+	trace->blob_mask--;
+
+	if (!num_blobs)
+		return 0;
+
+	/* Already validated by parse_blocks() */
+	while (ptr < end) {
+		const struct trace_block *block = (const void *)ptr;
+		const uint8_t *block_end = ptr + sizeof(*block) + block->length;
+
+		ptr = (const uint8_t *)(block + 1);
+		while (ptr < block_end) {
+			const struct trace_cmd *cmd = (const void *)ptr;
+
+			ptr = trace_skip_record(cmd, block_end);
+			if (cmd->cmd == BLOB) {
+				const struct trace_blob *t = (const void *)(cmd + 1);
+				struct blob blob = { t->hash, t->size, t + 1 };
+
+				add_blob(trace->blobs, trace->blob_mask, &blob);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int grow(void **ptr, unsigned *count, unsigned idx,
+		size_t elem, unsigned align)
+{
+	unsigned new_count;
+	void *new;
+
+	if (idx < *count)
+		return 0;
+
+	new_count = (idx + align) & -align;
+	new = realloc(*ptr, elem * new_count);
+	if (new == NULL)
+		return -ENOMEM;
+
+	memset((char *)new + elem * *count, 0, elem * (new_count - *count));
+	*ptr = new;
+	*count = new_count;
+	return 0;
+}
+
+void trace_state_update(struct trace_state *state, const struct trace_cmd *cmd)
+{
+	const void *payload = cmd + 1;
+
+	switch (cmd->cmd) {
+	case ADD_BO: {
+		const struct trace_add_bo *t = payload;
+
+		if (grow((void **)&state->bo, &state->num_bo, t->handle,
+			 sizeof(*state->bo), 4096))
+			return;
+
+		state->bo[t->handle].handle = t->handle;
+		state->bo[t->handle].size = t->size;
+		state->bo[t->handle].hash = 0;
+		break;
+	}
+	case DEL_BO: {
+		const struct trace_del_bo *t = payload;
+
+		if (t->handle < state->num_bo)
+			state->bo[t->handle].handle = 0;
+		break;
+	}
+	case BO_DATA: {
+		const struct trace_bo_data *t = payload;
+
+		if (t->handle < state->num_bo && state->bo[t->handle].handle)
+			state->bo[t->handle].hash = t->hash;
+		break;
+	}
+	case ADD_CTX: {
+		const struct trace_ctx *t = payload;
+
+		if (grow((void **)&state->ctx, &state->num_ctx, t->ctx_id,
+			 sizeof(*state->ctx), 64))
+			return;
+
+		state->ctx[t->ctx_id] = 1;
+		break;
+	}
+	case DEL_CTX: {
+		const struct trace_ctx *t = payload;
+
+		if (t->ctx_id < state->num_ctx)
+			state->ctx[t->ctx_id] = 0;
+		break;
+	}
+	}
+}
+
+void trace_state_fini(struct trace_state *state)
+{
+	free(state->bo);
+	free(state->ctx);
+	memset(state, 0, sizeof(*state));
+}
+
+static int state_load(struct trace_state *state, const void *live,
+		      unsigned num_bo, unsigned num_ctx)
+{
+	const struct trace_live_bo *bo = live;
+	const struct trace_ctx *ctx = (const void *)(bo + num_bo);
+	unsigned n;
+
+	for (n = 0; n < num_bo; n++) {
+		if (grow((void **)&state->bo, &state->num_bo, bo[n].handle,
+			 sizeof(*state->bo), 4096))
+			return -ENOMEM;
+		state->bo[bo[n].handle] = bo[n];
+	}
+
+	for (n = 0; n < num_ctx; n++) {
+		if (grow((void **)&state->ctx, &state->num_ctx, ctx[n].ctx_id,
+			 sizeof(*state->ctx), 64))
+			return -ENOMEM;
+		state->ctx[ctx[n].ctx_id] = 1;
+	}
+
+	return 0;
+}
+
+static int state_save(const struct trace_state *state, struct trace *trace)
+{
+	unsigned n;
+
+	trace->live_bo = malloc(sizeof(*trace->live_bo) * (state->num_bo ?: 1));
+	trace->live_ctx = malloc(sizeof(*trace->live_ctx) * (state->num_ctx ?: 1));
+	if (trace->live_bo == NULL || trace->live_ctx == NULL)
+		return -ENOMEM;
+
+	for (n = 0; n < state->num_bo; n++)
+		if (state->bo[n].handle)
+			trace->live_bo[trace->num_live_bo++] = state->bo[n];
+
+	for (n = 0; n < state->num_ctx; n++)
+		if (state->ctx[n])
+			trace->live_ctx[trace->num_live_ctx++] = n;
+
+	return 0;
+}
+
+void trace_fini(struct trace *trace)
+{
+	free(trace->events);
+	free(trace->blobs);
+	free(trace->live_bo);
+	free(trace->live_ctx);
+	if (trace->map)
+		munmap(trace->map, trace->size);
+	memset(trace, 0, sizeof(*trace));
+}
+
+static int load_indexed(struct trace *trace, struct trace_state *state,
+			uint64_t start, uint64_t end, unsigned *max_events)
+{
+	const uint8_t *base = trace->map;
+	const struct trace_footer *footer;
+	const struct trace_chunk *chunk, *last;
+	unsigned num_blobs = 0;
+	int err;
+
+	if (trace->size < sizeof(*trace->header) + sizeof(*footer))
+		return -EINVAL;
+
+	footer = (const void *)(base + trace->size - sizeof(*footer));
+	if (footer->magic != TRACE_INDEX_MAGIC ||
+	    footer->index_offset + footer->num_chunks * sizeof(*chunk) > trace->size ||
+	    footer->blob_offset + footer->blob_length > trace->size)
+		return -EINVAL;
+
+	trace->chunks = (const void *)(base + footer->index_offset);
+	trace->num_chunks = footer->num_chunks;
+
+	if (trace->num_chunks) {
+		/* The chunk containing start, up to the chunk containing end */
+		chunk = trace->chunks;
+		while (chunk + 1 < trace->chunks + trace->num_chunks &&
+		       chunk[1].first_timestamp <= start)
+			chunk++;
+
+		last = chunk;
+		while (last + 1 < trace->chunks + trace->num_chunks &&
+		       last[1].first_timestamp <= end)
+			last++;
+
+		if (chunk->live_offset +
+		    chunk->num_live_bo * sizeof(struct trace_live_bo) +
+		    chunk->num_live_ctx * sizeof(struct trace_ctx) > trace->size ||
+		    last->offset + last->length > trace->size)
+			return -EINVAL;
+
+		err = state_load(state, base + chunk->live_offset,
+				 chunk->num_live_bo, chunk->num_live_ctx);
+		if (err)
+			return err;
+
+		err = parse_blocks(trace, max_events,
+				   base + chunk->offset,
+				   base + last->offset + last->length,
+				   &num_blobs);
+		if (err)
+			return err;
+	}
+
+	num_blobs = 0;
+	err = parse_blocks(trace, max_events,
+			   base + footer->blob_offset,
+			   base + footer->blob_offset + footer->blob_length,
+			   &num_blobs);
+	if (err)
+		return err;
+
+	return index_blobs(trace,
+			   base + footer->blob_offset,
+			   base + footer->blob_offset + footer->blob_length,
+			   num_blobs);
+}
+
+static int load_flat(struct trace *trace, unsigned *max_events)
+{
+	const uint8_t *ptr = (const uint8_t *)(trace->header + 1);
+	const uint8_t *end = (const uint8_t *)trace->map + trace->size;
+	unsigned num_blobs = 0;
+	int err;
+
+	err = parse_blocks(trace, max_events, ptr, end, &num_blobs);
+	if (err)
+		return err;
+
+	return index_blobs(trace, ptr, end, num_blobs);
+}
+
+/**
+ * trace_load:
+ * @trace: trace to initialise
+ * @filename: path of the trace file
+ * @start: first timestamp to load, relative to the trace start
+ * @end: last timestamp to load, or TRACE_END
+ *
+ * Maps the trace and collects every command with a timestamp within
+ * [@start, @end] into a single timeline. The objects and contexts that
+ * were created before @start and are still alive at that point are
+ * returned in @trace->live_bo and @trace->live_ctx.
+ *
+ * For indexed traces only the chunks overlapping the window are read,
+ * otherwise the whole trace has to be walked.
+ *
+ * Returns: 0 on success, a negative error code otherwise.
+ */
+int trace_load(struct trace *trace, const char *filename,
+	       uint64_t start, uint64_t end)
+{
+	struct trace_state state = {};
+	unsigned max_events = 0, n, count;
+	struct stat st;
+	int fd, err;
+
+	memset(trace, 0, sizeof(*trace));
+	trace->filename = filename;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		return -errno;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	trace->map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (trace->map == MAP_FAILED) {
+		trace->map = NULL;
+		return -errno;
+	}
+	trace->size = st.st_size;
+
+	trace->header = trace->map;
+	if (trace->size < sizeof(*trace->header) ||
+	    trace->header->magic != TRACE_MAGIC) {
+		fprintf(stderr, "%s: not an exec trace\n", filename);
+		trace_fini(trace);
+		return -EINVAL;
+	}
+
+	if (trace->header->version != TRACE_VERSION) {
+		fprintf(stderr, "%s: unsupported trace version %d\n",
+			filename, trace->header->version);
+		trace_fini(trace);
+		return -EINVAL;
+	}
+
+	if (trace->header->flags & TRACE_INDEXED) {
+		err = load_indexed(trace, &state, start, end, &max_events);
+	} else {
+		madvise(trace->map, trace->size, MADV_SEQUENTIAL);
+		err = load_flat(trace, &max_events);
+	}
+	if (err) {
+		fprintf(stderr, "%s: corrupt trace\n", filename);
+		goto err;
+	}
+
+	qsort(trace->events, trace->num_events, sizeof(struct event), event_cmp);
+
+	/* Fold everything before the window into the initial state */
+	count = 0;
+	for (n = 0; n < trace->num_events; n++) {
+		struct event *e = &trace->events[n];
+
+		if (e->timestamp < start) {
+			trace_state_update(&state, e->cmd);
+			continue;
+		}
+		if (e->timestamp > end)
+			break;
+
+		if (e->cmd->cmd == EXEC)
+			trace->num_execs++;
+		trace->events[count++] = *e;
+	}
+	trace->num_events = count;
+
+	err = state_save(&state, trace);
+	if (err)
+		goto err;
+
+	trace_state_fini(&state);
+	return 0;
+
+err:
+	trace_state_fini(&state);
+	trace_fini(trace);
+	return err;
+}
+
+static void out_write(struct trace_out *out, const void *data, size_t len)
+{
+	const uint8_t *ptr = data;
+
+	while (len && !out->error) {
+		ssize_t ret = write(out->fd, ptr, len);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			out->error = -errno;
+			break;
+		}
+
+		ptr += ret;
+		len -= ret;
+		out->offset += ret;
+	}
+}
+
+static void out_flush_block(struct trace_out *out)
+{
+	struct trace_block *block = (void *)out->buf;
+
+	if (out->len == sizeof(*block))
+		return;
+
+	block->tid = 0;
+	block->length = out->len - sizeof(*block);
+	out_write(out, out->buf, out->len);
+
+	out->chunks[out->num_chunks - 1].length += out->len;
+	out->len = sizeof(*block);
+}
+
+static void *out_live_alloc(struct trace_out *out, size_t len)
+{
+	void *ptr;
+
+	if (out->live_len + len > out->live_size) {
+		size_t size = out->live_size ? 2 * out->live_size : 4096;
+
+		while (size < out->live_len + len)
+			size *= 2;
+
+		ptr = realloc(out->live, size);
+		if (ptr == NULL) {
+			out->error = -ENOMEM;
+			return NULL;
+		}
+		out->live = ptr;
+		out->live_size = size;
+	}
+
+	ptr = out->live + out->live_len;
+	out->live_len += len;
+	return ptr;
+}
+
+static void out_begin_chunk(struct trace_out *out, uint64_t timestamp)
+{
+	const struct trace_state *state = &out->state;
+	struct trace_chunk *chunk;
+	unsigned n;
+
+	if (out->num_chunks)
+		out_flush_block(out);
+
+	if (out->num_chunks == out->max_chunks) {
+		unsigned max = out->max_chunks ? 2 * out->max_chunks : 64;
+
+		chunk = realloc(out->chunks, max * sizeof(*chunk));
+		if (chunk == NULL) {
+			out->error = -ENOMEM;
+			return;
+		}
+		out->chunks = chunk;
+		out->max_chunks = max;
+	}
+
+	chunk = &out->chunks[out->num_chunks++];
+	memset(chunk, 0, sizeof(*chunk));
+	chunk->offset = out->offset;
+	chunk->first_timestamp = timestamp;
+	/* Relative to the live section until trace_out_close() */
+	chunk->live_offset = out->live_len;
+
+	for (n = 0; n < state->num_bo; n++) {
+		struct trace_live_bo *bo;
+
+		if (!state->bo[n].handle)
+			continue;
+
+		bo = out_live_alloc(out, sizeof(*bo));
+		if (bo == NULL)
+			return;
+
+		*bo = state->bo[n];
+		chunk->num_live_bo++;
+	}
+
+	for (n = 0; n < state->num_ctx; n++) {
+		struct trace_ctx *ctx;
+
+		if (!state->ctx[n])
+			continue;
+
+		ctx = out_live_alloc(out, sizeof(*ctx));
+		if (ctx == NULL)
+			return;
+
+		ctx->ctx_id = n;
+		chunk->num_live_ctx++;
+	}
+}
+
+/**
+ * trace_out_open:
+ * @out: writer to initialise
+ * @filename: path of the trace to create
+ * @header: header to copy into the new trace
+ * @chunk_ns: duration of each indexed chunk, 0 for a single chunk
+ *
+ * Creates a new indexed trace. Records must then be appended in timestamp
+ * order using trace_out_reserve() and trace_out_commit(), and the blobs
+ * they reference added with trace_out_blob(), before finishing the trace
+ * with trace_out_close().
+ *
+ * Returns: 0 on success, a negative error code otherwise.
+ */
+int trace_out_open(struct trace_out *out, const char *filename,
+		   const struct trace_header *header, uint64_t chunk_ns)
+{
+	struct trace_header h = *header;
+
+	memset(out, 0, sizeof(*out));
+
+	out->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out->fd < 0) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		return -errno;
+	}
+
+	out->chunk_ns = chunk_ns ?: TRACE_END;
+	out->size = OUT_BLOCK_SIZE;
+	out->buf = malloc(out->size);
+	if (out->buf == NULL) {
+		close(out->fd);
+		return -ENOMEM;
+	}
+	out->len = sizeof(struct trace_block);
+
+	h.flags |= TRACE_INDEXED;
+	out_write(out, &h, sizeof(h));
+
+	return out->error;
+}
+
+void *trace_out_reserve(struct trace_out *out, uint8_t cmd,
+			uint64_t timestamp, size_t len)
+{
+	struct trace_cmd *t;
+
+	len += sizeof(*t);
+
+	if (out->num_chunks == 0 ||
+	    timestamp - out->chunks[out->num_chunks - 1].first_timestamp >= out->chunk_ns)
+		out_begin_chunk(out, timestamp);
+	else if (out->len + len > OUT_BLOCK_SIZE)
+		out_flush_block(out);
+
+	if (out->len + len > out->size) {
+		void *buf = realloc(out->buf, out->len + len);
+
+		if (buf == NULL) {
+			out->error = -ENOMEM;
+			return NULL;
+		}
+		out->buf = buf;
+		out->size = out->len + len;
+	}
+
+	t = (struct trace_cmd *)(out->buf + out->len);
+	t->cmd = cmd;
+	t->timestamp = timestamp;
+	out->pending = len;
+
+	return t + 1;
+}
+
+void trace_out_commit(struct trace_out *out)
+{
+	trace_state_update(&out->state, (void *)(out->buf + out->len));
+	out->len += out->pending;
+	out->pending = 0;
+}
+
+/**
+ * trace_out_blob:
+ * @out: trace writer
+ * @blob: contents referenced by a BO_DATA record
+ *
+ * Adds @blob to the trace if not already present. The data is only
+ * written out by trace_out_close(), so it must remain valid until then.
+ */
+void trace_out_blob(struct trace_out *out, const struct blob *blob)
+{
+	struct blob *slot;
+
+	if (2 * (out->num_blobs + 1) > out->blob_mask + 1) {
+		unsigned old_mask = out->blob_mask, n;
+		struct blob *old = out->blobs;
+
+		out->blob_mask = old ? 2 * old_mask + 1 : 255;
+		out->blobs = calloc(out->blob_mask + 1, sizeof(*out->blobs));
+		if (out->blobs == NULL) {
+			out->blobs = old;
+			out->blob_mask = old_mask;
+			out->error = -ENOMEM;
+			return;
+		}
+
+		for (n = 0; old && n <= old_mask; n++)
+			if (old[n].hash)
+				add_blob(out->blobs, out->blob_mask, &old[n]);
+		free(old);
+	}
+
+	slot = lookup_blob(out->blobs, out->blob_mask, blob->hash);
+	if (slot->hash)
+		return;
+
+	*slot = *blob;
+	out->num_blobs++;
+}
+
+int trace_out_close(struct trace_out *out)
+{
+	struct trace_footer footer = { .magic = TRACE_INDEX_MAGIC };
+	uint64_t live_offset;
+	unsigned n;
+	int err;
+
+	if (out->num_chunks)
+		out_flush_block(out);
+
+	footer.blob_offset = out->offset;
+	for (n = 0; out->blobs && n <= out->blob_mask; n++) {
+		const struct blob *blob = &out->blobs[n];
+		struct {
+			struct trace_block block;
+			struct trace_cmd cmd;
+			struct trace_blob blob;
+		} __attribute__((packed)) t = {
+			{ 0, sizeof(t.cmd) + sizeof(t.blob) + blob->size },
+			{ BLOB, 0 },
+			{ blob->hash, blob->size },
+		};
+
+		if (!blob->hash)
+			continue;
+
+		out_write(out, &t, sizeof(t));
+		out_write(out, blob->data, blob->size);
+	}
+	footer.blob_length = out->offset - footer.blob_offset;
+
+	live_offset = out->offset;
+	out_write(out, out->live, out->live_len);
+	for (n = 0; n < out->num_chunks; n++)
+		out->chunks[n].live_offset += live_offset;
+
+	footer.index_offset = out->offset;
+	footer.num_chunks = out->num_chunks;
+	out_write(out, out->chunks, out->num_chunks * sizeof(*out->chunks));
+	out_write(out, &footer, sizeof(footer));
+
+	err = out->error;
+	if (close(out->fd) && !err)
+		err = -errno;
+
+	trace_state_fini(&out->state);
+	free(out->buf);
+	free(out->chunks);
+	free(out->live);
+	free(out->blobs);
+	memset(out, 0, sizeof(*out));
+
+	return err;
+}
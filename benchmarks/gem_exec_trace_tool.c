@@ -0,0 +1,553 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Offline manipulation of gem_exec_tracer traces:
+ *
+ *   info TRACE			describe the trace and its index
+ *   index IN OUT		rewrite IN as an indexed, seekable trace
+ *   extract -t S:E IN OUT	copy the window [S, E] seconds into OUT
+ *   split -l LEN IN PREFIX	cut IN into self-contained pieces of LEN seconds
+ *   merge OUT IN...		interleave several traces into one
+ *
+ * Every trace written is indexed, with chunks of -d seconds (default 1).
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <i915_drm.h>
+
+#include "gem_exec_trace.h"
+
+#define NSEC_PER_SEC 1000000000ull
+
+static uint64_t chunk_ns = NSEC_PER_SEC;
+
+static uint64_t to_ns(const char *str, char **end)
+{
+	return NSEC_PER_SEC * strtod(str, end);
+}
+
+static size_t record_length(const struct trace *src, const struct trace_cmd *cmd)
+{
+	const uint8_t *end = trace_skip_record(cmd, (uint8_t *)src->map + src->size);
+
+	return end - (const uint8_t *)(cmd + 1);
+}
+
+/*
+ * Copy a record into @out, moving the object handles and context ids of
+ * @src by @handle_base and @ctx_base so that several traces can share one
+ * namespace. Contents referenced by the record are carried along.
+ */
+static void copy_record(struct trace_out *out, const struct trace *src,
+			const struct trace_cmd *cmd, uint64_t timestamp,
+			uint32_t handle_base, uint32_t ctx_base)
+{
+	size_t len = record_length(src, cmd);
+	void *payload;
+
+	payload = trace_out_reserve(out, cmd->cmd, timestamp, len);
+	if (payload == NULL)
+		return;
+
+	memcpy(payload, cmd + 1, len);
+
+	switch (cmd->cmd) {
+	case ADD_BO: {
+		struct trace_add_bo *t = payload;
+		t->handle += handle_base;
+		break;
+	}
+	case DEL_BO: {
+		struct trace_del_bo *t = payload;
+		t->handle += handle_base;
+		break;
+	}
+	case ADD_CTX:
+	case DEL_CTX: {
+		struct trace_ctx *t = payload;
+		t->ctx_id += ctx_base;
+		break;
+	}
+	case BO_DATA: {
+		struct trace_bo_data *t = payload;
+		const struct blob *blob = trace_find_blob(src, t->hash);
+
+		t->handle += handle_base;
+		if (blob)
+			trace_out_blob(out, blob);
+		break;
+	}
+	case EXEC: {
+		struct trace_exec *t = payload;
+		uint8_t *ptr = (uint8_t *)(t + 1);
+		uint32_t i, j;
+
+		if (t->context)
+			t->context += ctx_base;
+
+		for (i = 0; i < t->object_count; i++) {
+			struct trace_exec_object *to = (void *)ptr;
+			ptr = (uint8_t *)(to + 1);
+
+			to->handle += handle_base;
+			for (j = 0; j < to->relocation_count; j++) {
+				struct trace_exec_relocation *tr = (void *)ptr;
+				ptr = (uint8_t *)(tr + 1);
+
+				/* With a LUT, targets are indices into the object list */
+				if (!(t->flags & I915_EXEC_HANDLE_LUT))
+					tr->target_handle += handle_base;
+			}
+		}
+		break;
+	}
+	}
+
+	trace_out_commit(out);
+}
+
+static bool copy_live_ctx(struct trace_out *out, uint64_t timestamp,
+			  uint32_t ctx_id)
+{
+	struct trace_ctx *t;
+
+	t = trace_out_reserve(out, ADD_CTX, timestamp, sizeof(*t));
+	if (t == NULL)
+		return false;
+
+	t->ctx_id = ctx_id;
+	trace_out_commit(out);
+	return true;
+}
+
+static bool copy_live_bo(struct trace_out *out, const struct trace *src,
+			 const struct trace_live_bo *live, uint64_t timestamp,
+			 uint32_t handle_base)
+{
+	const struct blob *blob;
+	struct trace_add_bo *add;
+	struct trace_bo_data *data;
+
+	add = trace_out_reserve(out, ADD_BO, timestamp, sizeof(*add));
+	if (add == NULL)
+		return false;
+
+	add->handle = live->handle + handle_base;
+	add->size = live->size;
+	trace_out_commit(out);
+
+	blob = live->hash ? trace_find_blob(src, live->hash) : NULL;
+	if (blob == NULL)
+		return true;
+
+	data = trace_out_reserve(out, BO_DATA, timestamp, sizeof(*data));
+	if (data == NULL)
+		return false;
+
+	data->handle = live->handle + handle_base;
+	data->hash = live->hash;
+	trace_out_commit(out);
+
+	trace_out_blob(out, blob);
+	return true;
+}
+
+/* Emit the records recreating the state at the start of @src's window */
+static void copy_live(struct trace_out *out, const struct trace *src,
+		      uint64_t timestamp,
+		      uint32_t handle_base, uint32_t ctx_base)
+{
+	unsigned n;
+
+	for (n = 0; n < src->num_live_ctx; n++)
+		if (!copy_live_ctx(out, timestamp, src->live_ctx[n] + ctx_base))
+			return;
+
+	for (n = 0; n < src->num_live_bo; n++)
+		if (!copy_live_bo(out, src, &src->live_bo[n],
+				  timestamp, handle_base))
+			return;
+}
+
+static int write_window(const char *in, const char *filename,
+			uint64_t start, uint64_t end)
+{
+	struct trace_out out;
+	struct trace src;
+	unsigned n;
+	int err;
+
+	err = trace_load(&src, in, start, end);
+	if (err)
+		return err;
+
+	err = trace_out_open(&out, filename, src.header, chunk_ns);
+	if (err) {
+		trace_fini(&src);
+		return err;
+	}
+
+	copy_live(&out, &src, start, 0, 0);
+	for (n = 0; n < src.num_events; n++)
+		copy_record(&out, &src, src.events[n].cmd,
+			    src.events[n].timestamp, 0, 0);
+
+	err = trace_out_close(&out);
+	trace_fini(&src);
+
+	if (err)
+		fprintf(stderr, "%s: %s\n", filename, strerror(-err));
+	return err;
+}
+
+static int info(const char *filename)
+{
+	struct trace trace;
+	unsigned n, blobs = 0;
+	uint64_t duration;
+	int err;
+
+	err = trace_load(&trace, filename, 0, TRACE_END);
+	if (err)
+		return err;
+
+	for (n = 0; n <= trace.blob_mask; n++)
+		blobs += trace.blobs[n].hash != 0;
+
+	duration = trace.num_events ?
+		trace.events[trace.num_events - 1].timestamp : 0;
+
+	printf("%s: pid %u, version %u%s%s\n",
+	       filename, trace.header->pid, trace.header->version,
+	       trace.header->flags & TRACE_HAS_CONTENTS ? ", contents" : "",
+	       trace.header->flags & TRACE_INDEXED ? ", indexed" : "");
+	printf("  %.3fs, %u commands, %u execs, %u blobs\n",
+	       1e-9 * duration, trace.num_events, trace.num_execs, blobs);
+
+	for (n = 0; n < trace.num_chunks; n++) {
+		const struct trace_chunk *c = &trace.chunks[n];
+
+		printf("  chunk %u: %.3fs, offset %llu, %llu bytes, %u live objects, %u live contexts\n",
+		       n, 1e-9 * c->first_timestamp,
+		       (unsigned long long)c->offset,
+		       (unsigned long long)c->length,
+		       c->num_live_bo, c->num_live_ctx);
+	}
+
+	trace_fini(&trace);
+	return 0;
+}
+
+/*
+ * Write the events of @src from *@next up to @end into @filename, preceded
+ * by the records recreating @state, and advance @state along with them.
+ */
+static int write_piece(const struct trace *src, struct trace_state *state,
+		       unsigned *next, const char *filename,
+		       uint64_t start, uint64_t end)
+{
+	struct trace_out out;
+	unsigned n;
+	int err;
+
+	err = trace_out_open(&out, filename, src->header, chunk_ns);
+	if (err)
+		return err;
+
+	for (n = 0; n < state->num_ctx; n++)
+		if (state->ctx[n] && !copy_live_ctx(&out, start, n))
+			break;
+
+	for (n = 0; n < state->num_bo; n++)
+		if (state->bo[n].handle &&
+		    !copy_live_bo(&out, src, &state->bo[n], start, 0))
+			break;
+
+	for (n = *next; n < src->num_events; n++) {
+		const struct event *e = &src->events[n];
+
+		if (e->timestamp > end)
+			break;
+
+		copy_record(&out, src, e->cmd, e->timestamp, 0, 0);
+		trace_state_update(state, e->cmd);
+	}
+	*next = n;
+
+	err = trace_out_close(&out);
+	if (err)
+		fprintf(stderr, "%s: %s\n", filename, strerror(-err));
+	return err;
+}
+
+static int split(const char *in, const char *prefix, uint64_t length)
+{
+	struct trace_state state = {};
+	struct trace trace;
+	uint64_t last, start;
+	unsigned piece = 0, next = 0;
+	int err;
+
+	if (length == 0)
+		return -EINVAL;
+
+	/* Load and sort once, then carry the live state across the pieces */
+	err = trace_load(&trace, in, 0, TRACE_END);
+	if (err)
+		return err;
+
+	last = trace.num_events ? trace.events[trace.num_events - 1].timestamp : 0;
+	for (start = 0; start <= last; start += length) {
+		char filename[1024];
+
+		snprintf(filename, sizeof(filename), "%s.%03u", prefix, piece++);
+		err = write_piece(&trace, &state, &next, filename,
+				  start, start + length - 1);
+		if (err)
+			break;
+	}
+
+	trace_state_fini(&state);
+	trace_fini(&trace);
+	return err;
+}
+
+struct merge_event {
+	uint64_t timestamp;
+	uint64_t seq;
+	unsigned input;
+	const struct trace_cmd *cmd;
+};
+
+static int merge_cmp(const void *A, const void *B)
+{
+	const struct merge_event *a = A, *b = B;
+
+	if (a->timestamp != b->timestamp)
+		return a->timestamp < b->timestamp ? -1 : 1;
+
+	return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+/*
+ * Interleave several traces by their CLOCK_MONOTONIC timestamps into a
+ * single trace, giving each input its own range of handles and contexts
+ * so that the result can be replayed as one client.
+ */
+static int merge(const char *filename, char **inputs, int count)
+{
+	struct trace *traces;
+	struct merge_event *events;
+	uint32_t *handle_base, *ctx_base;
+	struct trace_header header;
+	struct trace_out out;
+	unsigned num_events = 0, n;
+	uint32_t next_handle = 0, next_ctx = 0;
+	int i, err = 0;
+
+	traces = calloc(count, sizeof(*traces));
+	handle_base = calloc(count, sizeof(*handle_base));
+	ctx_base = calloc(count, sizeof(*ctx_base));
+	if (!traces || !handle_base || !ctx_base)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		err = trace_load(&traces[i], inputs[i], 0, TRACE_END);
+		if (err) {
+			count = i;
+			goto out;
+		}
+		num_events += traces[i].num_events;
+	}
+
+	header = *traces[0].header;
+	header.pid = 0;
+	for (i = 0; i < count; i++) {
+		const struct trace *t = &traces[i];
+		uint32_t max_handle = 0, max_ctx = 0;
+
+		if (t->header->start_ns < header.start_ns)
+			header.start_ns = t->header->start_ns;
+		header.flags |= t->header->flags & TRACE_HAS_CONTENTS;
+
+		for (n = 0; n < t->num_events; n++) {
+			const struct trace_cmd *cmd = t->events[n].cmd;
+
+			if (cmd->cmd == ADD_BO) {
+				const struct trace_add_bo *add = (const void *)(cmd + 1);
+				if (add->handle > max_handle)
+					max_handle = add->handle;
+			} else if (cmd->cmd == ADD_CTX) {
+				const struct trace_ctx *ctx = (const void *)(cmd + 1);
+				if (ctx->ctx_id > max_ctx)
+					max_ctx = ctx->ctx_id;
+			}
+		}
+
+		handle_base[i] = next_handle;
+		ctx_base[i] = next_ctx;
+		next_handle += max_handle + 1;
+		next_ctx += max_ctx + 1;
+	}
+
+	events = malloc(sizeof(*events) * (num_events ?: 1));
+	if (events == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	num_events = 0;
+	for (i = 0; i < count; i++) {
+		const struct trace *t = &traces[i];
+		uint64_t shift = t->header->start_ns - header.start_ns;
+
+		for (n = 0; n < t->num_events; n++) {
+			struct merge_event *e = &events[num_events];
+
+			e->timestamp = t->events[n].timestamp + shift;
+			e->seq = num_events++;
+			e->input = i;
+			e->cmd = t->events[n].cmd;
+		}
+	}
+	qsort(events, num_events, sizeof(*events), merge_cmp);
+
+	err = trace_out_open(&out, filename, &header, chunk_ns);
+	if (err == 0) {
+		for (n = 0; n < num_events; n++)
+			copy_record(&out, &traces[events[n].input],
+				    events[n].cmd, events[n].timestamp,
+				    handle_base[events[n].input],
+				    ctx_base[events[n].input]);
+
+		err = trace_out_close(&out);
+		if (err)
+			fprintf(stderr, "%s: %s\n", filename, strerror(-err));
+	}
+	free(events);
+
+out:
+	for (i = 0; i < count; i++)
+		trace_fini(&traces[i]);
+	free(traces);
+	free(handle_base);
+	free(ctx_base);
+	return err;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-d CHUNK] COMMAND ...\n"
+		"  info TRACE\n"
+		"  index IN OUT\n"
+		"  extract -t START[:END] IN OUT\n"
+		"  split -l LENGTH IN PREFIX\n"
+		"  merge OUT IN...\n"
+		"All times are in seconds; indexed traces are written in chunks\n"
+		"of CHUNK seconds (default 1).\n",
+		name);
+}
+
+static uint64_t opt_start, opt_end = TRACE_END, opt_length;
+
+static int parse_options(int argc, char **argv, const char *opts)
+{
+	char *sep;
+	int c;
+
+	while ((c = getopt(argc, argv, opts)) != -1) {
+		switch (c) {
+		case 'd':
+			chunk_ns = to_ns(optarg, NULL);
+			break;
+
+		case 't':
+			opt_start = to_ns(optarg, &sep);
+			if (*sep == ':')
+				opt_end = to_ns(sep + 1, NULL);
+			break;
+
+		case 'l':
+			opt_length = to_ns(optarg, NULL);
+			break;
+
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *cmd;
+
+	if (parse_options(argc, argv, "+d:t:l:"))
+		return 1;
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	cmd = argv[optind++];
+
+	/* Allow the options to follow the command as well */
+	if (parse_options(argc, argv, "d:t:l:"))
+		return 1;
+
+	argc -= optind;
+	argv += optind;
+
+	if (strcmp(cmd, "info") == 0 && argc >= 1) {
+		int i, err = 0;
+
+		for (i = 0; i < argc; i++)
+			err |= info(argv[i]);
+		return !!err;
+	}
+
+	if (strcmp(cmd, "index") == 0 && argc == 2)
+		return !!write_window(argv[0], argv[1], 0, TRACE_END);
+
+	if (strcmp(cmd, "extract") == 0 && argc == 2)
+		return !!write_window(argv[0], argv[1], opt_start, opt_end);
+
+	if (strcmp(cmd, "split") == 0 && argc == 2 && opt_length)
+		return !!split(argv[0], argv[1], opt_length);
+
+	if (strcmp(cmd, "merge") == 0 && argc >= 2)
+		return !!merge(argv[0], argv + 1, argc - 1);
+
+	usage(argv[0]);
+	return 1;
+}
@@ -30,9 +30,13 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/mman.h>
@@ -41,53 +45,72 @@
 
 #include "intel_aub.h"
 #include "intel_chipset.h"
+#include "gem_exec_trace.h"
+
+/*
+ * Environment:
+ *  GEM_EXEC_TRACE_CONTENTS=batch|all
+ *	Snapshot the contents of the batch (or of every object) before
+ *	each execbuf. Identical contents are only stored once per trace.
+ *	Note that reading back the objects waits for the GPU, so this
+ *	perturbs the timing of the traced application.
+ */
+
+#define BUFFER_SIZE (256 << 10)
+#define MAX_CONTENTS_SIZE (64 << 20)
+
+#define gettid() syscall(__NR_gettid)
 
 static int (*libc_close)(int fd);
 static int (*libc_ioctl)(int fd, unsigned long request, void *argp);
 
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
 static int drm_fd = -1;
-static FILE *file;
+static int trace_fd = -1;
+static uint64_t trace_start;
 
-#define DRM_MAJOR 226
+static enum {
+	CONTENTS_NONE = 0,
+	CONTENTS_BATCH,
+	CONTENTS_ALL,
+} contents;
 
-enum {
-	ADD_BO = 0,
-	DEL_BO,
-	EXEC,
+/* Per-handle state, protected by trace_mutex */
+static struct bo {
+	uint64_t size;
+	uint64_t hash;
+} *bo;
+static unsigned num_bo;
+
+/* Set of BLOB hashes already written into this trace */
+static struct {
+	uint64_t *hash;
+	unsigned count;
+	unsigned mask;
+} blobs;
+
+/*
+ * Each thread accumulates its records in a private buffer which is
+ * written out as a single block when full, when the thread exits, or
+ * when the trace is closed. The trace file is opened with O_APPEND so
+ * that blocks from different threads do not interleave.
+ */
+struct writer {
+	struct writer *next;
+	pthread_mutex_t mutex;
+	uint32_t tid;
+	uint32_t len;
+	void *overflow;
+	void *scratch;
+	uint64_t scratch_size;
+	uint8_t data[BUFFER_SIZE];
 };
 
-struct trace_add_bo {
-	uint8_t cmd;
-	uint32_t handle;
-	uint64_t size;
-} __attribute__((packed));
-struct trace_del_bo {
-	uint8_t cmd;
-	uint32_t handle;
-}__attribute__((packed));
-
-struct trace_exec {
-	uint8_t cmd;
-	uint32_t object_count;
-	uint64_t flags;
-}__attribute__((packed));
-
-struct trace_exec_object {
-	uint32_t handle;
-	uint32_t relocation_count;
-	uint64_t alignment;
-	uint64_t flags;
-	uint64_t rsvd1;
-	uint64_t rsvd2;
-}__attribute__((packed));
-
-struct trace_exec_relocation {
-	uint32_t target_handle;
-	uint32_t delta;
-	uint64_t offset;
-	uint32_t read_domains;
-	uint32_t write_domain;
-}__attribute__((packed));
+static struct writer *writers;
+static pthread_key_t writer_key;
+static __thread struct writer *writer;
+
+#define DRM_MAJOR 226
 
 static void __attribute__ ((format(__printf__, 2, 3)))
 fail_if(int cond, const char *format, ...)
@@ -104,68 +127,439 @@ fail_if(int cond, const char *format, ...)
 	exit(1);
 }
 
+static uint64_t
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t
+hash_data(const void *data, uint64_t len)
+{
+	const uint64_t *p = data;
+	uint64_t h = 0xcbf29ce484222325ull ^ len;
+	uint64_t n;
+
+	for (n = 0; n < len / 8; n++) {
+		h = (h ^ p[n]) * 0x9e3779b97f4a7c15ull;
+		h ^= h >> 32;
+	}
+	if (len & 7) {
+		uint64_t tail = 0;
+
+		memcpy(&tail, p + n, len & 7);
+		h = (h ^ tail) * 0x9e3779b97f4a7c15ull;
+		h ^= h >> 32;
+	}
+
+	return h ?: 1;
+}
+
+/* Returns true if @hash was not yet present. Called with trace_mutex held. */
+static bool
+blob_insert(uint64_t hash)
+{
+	unsigned i;
+
+	if (2 * (blobs.count + 1) > blobs.mask + 1) {
+		unsigned old_size = blobs.mask + 1;
+		uint64_t *old = blobs.hash;
+
+		blobs.mask = blobs.hash ? 2 * old_size - 1 : 1023;
+		blobs.hash = calloc(blobs.mask + 1, sizeof(*blobs.hash));
+		fail_if(blobs.hash == NULL, "failed to allocate blob table\n");
+
+		for (i = 0; old && i < old_size; i++) {
+			unsigned j = old[i] & blobs.mask;
+
+			if (!old[i])
+				continue;
+
+			while (blobs.hash[j])
+				j = (j + 1) & blobs.mask;
+			blobs.hash[j] = old[i];
+		}
+		free(old);
+	}
+
+	for (i = hash & blobs.mask; blobs.hash[i]; i = (i + 1) & blobs.mask)
+		if (blobs.hash[i] == hash)
+			return false;
+
+	blobs.hash[i] = hash;
+	blobs.count++;
+	return true;
+}
+
 static void
-trace_exec(int fd, const struct drm_i915_gem_execbuffer2 *execbuffer2)
+writer_write(struct writer *w, const void *data, uint32_t len)
+{
+	struct trace_block block = { w->tid, len };
+	struct iovec iov[2] = {
+		{ &block, sizeof(block) },
+		{ (void *)data, len },
+	};
+	ssize_t ret;
+
+	if (trace_fd == -1)
+		return;
+
+	ret = writev(trace_fd, iov, 2);
+	fail_if(ret != sizeof(block) + len,
+		"failed to write trace: %s\n", strerror(errno));
+}
+
+/* Called with w->mutex held. */
+static void
+writer_flush(struct writer *w)
+{
+	if (!w->len)
+		return;
+
+	writer_write(w, w->data, w->len);
+	w->len = 0;
+}
+
+static void
+flush_all(void)
+{
+	struct writer *w;
+
+	for (w = writers; w; w = w->next) {
+		pthread_mutex_lock(&w->mutex);
+		writer_flush(w);
+		pthread_mutex_unlock(&w->mutex);
+	}
+}
+
+static void
+writer_destroy(void *arg)
+{
+	struct writer *w = arg, **prev;
+
+	pthread_mutex_lock(&trace_mutex);
+	for (prev = &writers; *prev; prev = &(*prev)->next) {
+		if (*prev == w) {
+			*prev = w->next;
+			break;
+		}
+	}
+	pthread_mutex_lock(&w->mutex);
+	writer_flush(w);
+	pthread_mutex_unlock(&w->mutex);
+	pthread_mutex_unlock(&trace_mutex);
+
+	free(w->scratch);
+	free(w);
+}
+
+static struct writer *
+get_writer(void)
+{
+	struct writer *w = writer;
+
+	if (w)
+		return w;
+
+	w = calloc(1, sizeof(*w));
+	fail_if(w == NULL, "failed to allocate trace buffer\n");
+	pthread_mutex_init(&w->mutex, NULL);
+	w->tid = gettid();
+
+	pthread_mutex_lock(&trace_mutex);
+	w->next = writers;
+	writers = w;
+	pthread_mutex_unlock(&trace_mutex);
+
+	pthread_setspecific(writer_key, w);
+	return writer = w;
+}
+
+/*
+ * Reserve space for a record of @len bytes (including its struct
+ * trace_cmd) in this thread's buffer and fill in the command header.
+ * Records too large for the buffer are written out as a block of their
+ * own by record_end().
+ */
+static void *
+record_begin(struct writer *w, uint8_t cmd, uint64_t ts, uint32_t len)
+{
+	struct trace_cmd *t;
+
+	pthread_mutex_lock(&w->mutex);
+
+	if (w->len + len > sizeof(w->data))
+		writer_flush(w);
+
+	if (len > sizeof(w->data)) {
+		w->overflow = malloc(len);
+		fail_if(w->overflow == NULL, "failed to allocate trace record\n");
+		t = w->overflow;
+	} else {
+		t = (struct trace_cmd *)(w->data + w->len);
+	}
+
+	t->cmd = cmd;
+	t->timestamp = ts - trace_start;
+	return t + 1;
+}
+
+static void
+record_end(struct writer *w, uint32_t len)
+{
+	if (w->overflow) {
+		writer_write(w, w->overflow, len);
+		free(w->overflow);
+		w->overflow = NULL;
+	} else {
+		w->len += len;
+	}
+
+	pthread_mutex_unlock(&w->mutex);
+}
+
+static void
+trace_close(void)
+{
+	flush_all();
+
+	if (trace_fd != -1)
+		libc_close(trace_fd);
+	trace_fd = -1;
+	drm_fd = -1;
+
+	if (bo)
+		memset(bo, 0, sizeof(*bo) * num_bo);
+
+	free(blobs.hash);
+	memset(&blobs, 0, sizeof(blobs));
+}
+
+static void
+trace_open(int fd)
+{
+	struct trace_header header = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.flags = contents ? TRACE_HAS_CONTENTS : 0,
+		.pid = getpid(),
+	};
+	char filename[80];
+
+	trace_close();
+
+	sprintf(filename, "/tmp/trace.%d", fd);
+	trace_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+	fail_if(trace_fd < 0, "failed to open %s\n", filename);
+
+	header.start_ns = trace_start = now();
+	fail_if(write(trace_fd, &header, sizeof(header)) != sizeof(header),
+		"failed to write trace header\n");
+
+	drm_fd = fd;
+}
+
+static void
+set_bo_size(uint32_t handle, uint64_t size)
+{
+	pthread_mutex_lock(&trace_mutex);
+	if (handle >= num_bo) {
+		unsigned new_bo = (handle + 4096) & -4096;
+
+		bo = realloc(bo, sizeof(*bo) * new_bo);
+		fail_if(bo == NULL, "failed to allocate bo table\n");
+		memset(bo + num_bo, 0, sizeof(*bo) * (new_bo - num_bo));
+		num_bo = new_bo;
+	}
+	bo[handle].size = size;
+	bo[handle].hash = 0;
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+static void
+trace_contents(int fd, uint32_t handle)
+{
+	struct writer *w = get_writer();
+	struct drm_i915_gem_pread pread;
+	struct trace_bo_data *data;
+	uint64_t size, hash;
+	bool new_blob;
+
+	pthread_mutex_lock(&trace_mutex);
+	size = handle < num_bo ? bo[handle].size : 0;
+	pthread_mutex_unlock(&trace_mutex);
+	if (size == 0 || size > MAX_CONTENTS_SIZE)
+		return;
+
+	if (size > w->scratch_size) {
+		free(w->scratch);
+		w->scratch = malloc(size);
+		w->scratch_size = w->scratch ? size : 0;
+		if (w->scratch == NULL)
+			return;
+	}
+
+	memset(&pread, 0, sizeof(pread));
+	pread.handle = handle;
+	pread.size = size;
+	pread.data_ptr = (uintptr_t)w->scratch;
+	if (libc_ioctl(fd, DRM_IOCTL_I915_GEM_PREAD, &pread))
+		return;
+
+	hash = hash_data(w->scratch, size);
+
+	pthread_mutex_lock(&trace_mutex);
+	if (bo[handle].hash == hash) {
+		pthread_mutex_unlock(&trace_mutex);
+		return;
+	}
+	bo[handle].hash = hash;
+	new_blob = blob_insert(hash);
+	pthread_mutex_unlock(&trace_mutex);
+
+	if (new_blob) {
+		uint32_t len = sizeof(struct trace_cmd) +
+			sizeof(struct trace_blob) + size;
+		struct trace_blob *blob = record_begin(w, BLOB, now(), len);
+
+		blob->hash = hash;
+		blob->size = size;
+		memcpy(blob + 1, w->scratch, size);
+		record_end(w, len);
+	}
+
+	data = record_begin(w, BO_DATA, now(),
+			    sizeof(struct trace_cmd) + sizeof(*data));
+	data->handle = handle;
+	data->hash = hash;
+	record_end(w, sizeof(struct trace_cmd) + sizeof(*data));
+}
+
+static void
+trace_exec_contents(int fd, const struct drm_i915_gem_execbuffer2 *execbuffer2)
 {
 	const struct drm_i915_gem_exec_object2 *exec_objects =
 		(struct drm_i915_gem_exec_object2 *)(uintptr_t)execbuffer2->buffers_ptr;
+	uint32_t count = execbuffer2->buffer_count;
+
+	if (count == 0)
+		return;
 
-	{
-		struct trace_exec t = {
-			EXEC, execbuffer2->buffer_count, execbuffer2->flags
-		};
-		fwrite(&t, sizeof(t), 1, file);
+	if (contents == CONTENTS_BATCH) {
+		trace_contents(fd, exec_objects[count - 1].handle);
+		return;
 	}
 
+	for (uint32_t i = 0; i < count; i++)
+		trace_contents(fd, exec_objects[i].handle);
+}
+
+static void
+trace_exec(int fd, const struct drm_i915_gem_execbuffer2 *execbuffer2)
+{
+	const struct drm_i915_gem_exec_object2 *exec_objects =
+		(struct drm_i915_gem_exec_object2 *)(uintptr_t)execbuffer2->buffers_ptr;
+	struct writer *w = get_writer();
+	struct trace_exec *t;
+	uint8_t *ptr;
+	uint32_t len;
+
+	len = sizeof(struct trace_cmd) + sizeof(*t);
+	for (uint32_t i = 0; i < execbuffer2->buffer_count; i++)
+		len += sizeof(struct trace_exec_object) +
+			exec_objects[i].relocation_count *
+			sizeof(struct trace_exec_relocation);
+
+	t = record_begin(w, EXEC, now(), len);
+	t->object_count = execbuffer2->buffer_count;
+	t->flags = execbuffer2->flags;
+	t->context = i915_execbuffer2_get_context_id(*execbuffer2);
+	t->batch_start_offset = execbuffer2->batch_start_offset;
+	t->batch_len = execbuffer2->batch_len;
+	ptr = (uint8_t *)(t + 1);
+
 	for (uint32_t i = 0; i < execbuffer2->buffer_count; i++) {
 		const struct drm_i915_gem_exec_object2 *obj = &exec_objects[i];
 		const struct drm_i915_gem_relocation_entry *relocs =
 			(struct drm_i915_gem_relocation_entry *)(uintptr_t)obj->relocs_ptr;
 		{
-			struct trace_exec_object t = {
-				obj->handle,
-				obj->relocation_count,
-				obj->alignment,
-				obj->flags,
-				obj->rsvd1,
-				obj->rsvd2
-			};
-			fwrite(&t, sizeof(t), 1, file);
+			struct trace_exec_object *to = (void *)ptr;
+
+			to->handle = obj->handle;
+			to->relocation_count = obj->relocation_count;
+			to->alignment = obj->alignment;
+			to->flags = obj->flags;
+			to->rsvd1 = obj->rsvd1;
+			to->rsvd2 = obj->rsvd2;
+			ptr = (uint8_t *)(to + 1);
 		}
 		for (uint32_t j = 0; j < obj->relocation_count; j++) {
-			struct trace_exec_relocation t = {
-				relocs[j].target_handle,
-				relocs[j].delta,
-				relocs[j].offset,
-				relocs[j].read_domains,
-				relocs[j].write_domain,
-			};
-			fwrite(&t, sizeof(t), 1, file);
+			struct trace_exec_relocation *tr = (void *)ptr;
+
+			tr->target_handle = relocs[j].target_handle;
+			tr->delta = relocs[j].delta;
+			tr->offset = relocs[j].offset;
+			tr->read_domains = relocs[j].read_domains;
+			tr->write_domain = relocs[j].write_domain;
+			ptr = (uint8_t *)(tr + 1);
 		}
 	}
 
-	fflush(file);
+	record_end(w, len);
 }
 
 static void
 trace_add(uint32_t handle, uint64_t size)
 {
-	struct trace_add_bo t = { ADD_BO, handle, size };
-	fwrite(&t, sizeof(t), 1, file);
+	struct writer *w = get_writer();
+	struct trace_add_bo *t;
+
+	if (contents)
+		set_bo_size(handle, size);
+
+	t = record_begin(w, ADD_BO, now(), sizeof(struct trace_cmd) + sizeof(*t));
+	t->handle = handle;
+	t->size = size;
+	record_end(w, sizeof(struct trace_cmd) + sizeof(*t));
+}
+
+static void
+trace_del(uint32_t handle, uint64_t ts)
+{
+	struct writer *w = get_writer();
+	struct trace_del_bo *t;
+
+	if (contents)
+		set_bo_size(handle, 0);
+
+	t = record_begin(w, DEL_BO, ts, sizeof(struct trace_cmd) + sizeof(*t));
+	t->handle = handle;
+	record_end(w, sizeof(struct trace_cmd) + sizeof(*t));
 }
 
 static void
-trace_del(uint32_t handle)
+trace_ctx(uint8_t cmd, uint32_t ctx_id, uint64_t ts)
 {
-	struct trace_del_bo t = { DEL_BO, handle };
-	fwrite(&t, sizeof(t), 1, file);
+	struct writer *w = get_writer();
+	struct trace_ctx *t;
+
+	t = record_begin(w, cmd, ts, sizeof(struct trace_cmd) + sizeof(*t));
+	t->ctx_id = ctx_id;
+	record_end(w, sizeof(struct trace_cmd) + sizeof(*t));
 }
 
 int
 close(int fd)
 {
-	if (fd == drm_fd)
-		drm_fd = -1;
+	if (fd == drm_fd) {
+		pthread_mutex_lock(&trace_mutex);
+		if (fd == drm_fd)
+			trace_close();
+		pthread_mutex_unlock(&trace_mutex);
+	}
 
 	return libc_close(fd);
 }
@@ -203,6 +597,7 @@ int
 ioctl(int fd, unsigned long request, ...)
 {
 	va_list args;
+	uint64_t ts = 0;
 	void *argp;
 	int ret;
 
@@ -210,27 +605,40 @@ ioctl(int fd, unsigned long request, ...)
 	argp = va_arg(args, void *);
 	va_end(args);
 
-	ret = libc_ioctl(fd, request, argp);
-	if (ret)
-		return ret;
-
 	if (_IOC_TYPE(request) != DRM_IOCTL_BASE)
-		return 0;
+		return libc_ioctl(fd, request, argp);
 
 	if (drm_fd != fd) {
-		char filename[80];
-
 		if (!is_i915(fd))
-			return 0;
+			return libc_ioctl(fd, request, argp);
 
-		if (file)
-			fclose(file);
+		pthread_mutex_lock(&trace_mutex);
+		if (drm_fd != fd)
+			trace_open(fd);
+		pthread_mutex_unlock(&trace_mutex);
+	}
 
-		sprintf(filename, "/tmp/trace.%d", fd);
-		file = fopen(filename, "w+");
-		drm_fd = fd;
+	switch (request) {
+	case DRM_IOCTL_I915_GEM_EXECBUFFER2:
+		/* Capture what the GPU will see, before it can modify it */
+		if (contents)
+			trace_exec_contents(fd, argp);
+		break;
+
+	case DRM_IOCTL_GEM_CLOSE:
+	case DRM_IOCTL_I915_GEM_CONTEXT_DESTROY:
+		/*
+		 * Timestamp before the id can be reused by another thread,
+		 * so that the release is always ordered before its reuse.
+		 */
+		ts = now();
+		break;
 	}
 
+	ret = libc_ioctl(fd, request, argp);
+	if (ret)
+		return ret;
+
 	switch (request) {
 	case DRM_IOCTL_I915_GEM_EXECBUFFER2:
 		trace_exec(fd, argp);
@@ -250,7 +658,7 @@ ioctl(int fd, unsigned long request, ...)
 
 	case DRM_IOCTL_GEM_CLOSE: {
 		struct drm_gem_close *close = argp;
-		trace_del(close->handle);
+		trace_del(close->handle, ts);
 		break;
 	}
 
@@ -273,6 +681,18 @@ ioctl(int fd, unsigned long request, ...)
 		trace_add(cmd->handle, size_for_fb(cmd));
 		break;
 	}
+
+	case DRM_IOCTL_I915_GEM_CONTEXT_CREATE: {
+		struct drm_i915_gem_context_create *create = argp;
+		trace_ctx(ADD_CTX, create->ctx_id, now());
+		break;
+	}
+
+	case DRM_IOCTL_I915_GEM_CONTEXT_DESTROY: {
+		struct drm_i915_gem_context_destroy *destroy = argp;
+		trace_ctx(DEL_CTX, destroy->ctx_id, ts);
+		break;
+	}
 	}
 
 	return 0;
@@ -281,8 +701,27 @@ ioctl(int fd, unsigned long request, ...)
 static void __attribute__ ((constructor))
 init(void)
 {
+	const char *env;
+
 	libc_close = dlsym(RTLD_NEXT, "close");
 	libc_ioctl = dlsym(RTLD_NEXT, "ioctl");
 	fail_if(libc_close == NULL || libc_ioctl == NULL,
 		"failed to get libc ioctl or close\n");
+
+	env = getenv("GEM_EXEC_TRACE_CONTENTS");
+	if (env && strcmp(env, "batch") == 0)
+		contents = CONTENTS_BATCH;
+	else if (env && strcmp(env, "all") == 0)
+		contents = CONTENTS_ALL;
+
+	fail_if(pthread_key_create(&writer_key, writer_destroy),
+		"failed to create trace buffer key\n");
+}
+
+static void __attribute__ ((destructor))
+fini(void)
+{
+	pthread_mutex_lock(&trace_mutex);
+	trace_close();
+	pthread_mutex_unlock(&trace_mutex);
 }
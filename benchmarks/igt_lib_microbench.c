@@ -0,0 +1,667 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * CPU-only micro-benchmarks of library and tool code that sits on hot
+ * paths: statistics, register map and device info lookups, register
+ * decoding, error state ascii85 decoding, the INSTDONE accounting of the
+ * GPU sampler and the netup_gpu_meter JSON formatter. None of them touch
+ * a GPU, so they can be run on any machine, e.g. in CI.
+ *
+ * Each benchmark is calibrated to run for a fixed time per sample, then
+ * sampled repeatedly; the mean cost per operation is reported with its 95%
+ * confidence interval. Results can be saved with -o and compared against
+ * with -b, in which case a benchmark is flagged as a regression when it is
+ * slower than the baseline by more than the threshold and the confidence
+ * intervals do not overlap; the exit status is then 1.
+ */
+
+#include <fnmatch.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "igt_stats.h"
+#include "i915_pciids.h"
+#include "intel_chipset.h"
+#include "intel_gpu_sampler.h"
+#include "intel_io.h"
+
+#include "tools/intel_ascii85.h"
+#include "tools/intel_reg_spec.h"
+#include "tools/netup_get_statistics.h"
+
+#define BENCH_DEVID 0x1912 /* SKL GT2, has all of the tables below */
+#define NUM_INPUTS 4096 /* power of two */
+
+static volatile uint64_t sink;
+
+static uint64_t rand_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rand64(void)
+{
+	/* xorshift64*, deterministic so runs are comparable */
+	rand_state ^= rand_state >> 12;
+	rand_state ^= rand_state << 25;
+	rand_state ^= rand_state >> 27;
+	return rand_state * 0x2545f4914f6cdd1dull;
+}
+
+/* hides a value from the optimiser, e.g. to stop it hoisting pure calls */
+static inline uint32_t opaque(uint32_t v)
+{
+	__asm__ __volatile__("" : "+r"(v));
+	return v;
+}
+
+/* igt_stats */
+
+static uint64_t stats_values[1024];
+
+static void stats_setup(void)
+{
+	for (int i = 0; i < ARRAY_SIZE(stats_values); i++)
+		stats_values[i] = rand64() % 1000000;
+}
+
+/*
+ * Pushes go into a fixed-size dataset that is rewound when full, so that
+ * the timing is of igt_stats_push() and not of growing and faulting in an
+ * array sized by the iteration count.
+ */
+#define STATS_PUSH_CAPACITY 4096
+
+static igt_stats_t push_stats;
+
+static void stats_push_setup(void)
+{
+	stats_setup();
+	igt_stats_init_with_size(&push_stats, STATS_PUSH_CAPACITY);
+}
+
+static void stats_push_teardown(void)
+{
+	igt_stats_fini(&push_stats);
+}
+
+static uint64_t stats_push(unsigned long iters)
+{
+	for (unsigned long i = 0; i < iters; i++) {
+		if (push_stats.n_values == STATS_PUSH_CAPACITY)
+			push_stats.n_values = 0;
+		igt_stats_push(&push_stats, stats_values[i & 1023]);
+	}
+
+	return push_stats.n_values;
+}
+
+static uint64_t stats_median(unsigned long iters)
+{
+	uint64_t ret = 0;
+
+	for (unsigned long i = 0; i < iters; i++) {
+		igt_stats_t stats;
+
+		igt_stats_init_with_size(&stats, ARRAY_SIZE(stats_values));
+		igt_stats_push_array(&stats, stats_values,
+				     ARRAY_SIZE(stats_values));
+		ret += igt_stats_get_median(&stats);
+		igt_stats_fini(&stats);
+	}
+
+	return ret;
+}
+
+static uint64_t stats_quartiles(unsigned long iters)
+{
+	uint64_t ret = 0;
+
+	for (unsigned long i = 0; i < iters; i++) {
+		igt_stats_t stats;
+		double q1, q2, q3;
+
+		igt_stats_init_with_size(&stats, ARRAY_SIZE(stats_values));
+		igt_stats_push_array(&stats, stats_values,
+				     ARRAY_SIZE(stats_values));
+		igt_stats_get_quartiles(&stats, &q1, &q2, &q3);
+		ret += q1 + q2 + q3;
+		igt_stats_fini(&stats);
+	}
+
+	return ret;
+}
+
+/* register map */
+
+static struct intel_register_map reg_map;
+static uint32_t reg_offsets[NUM_INPUTS];
+
+static void reg_range_setup(void)
+{
+	reg_map = intel_get_register_map(BENCH_DEVID);
+	for (int i = 0; i < NUM_INPUTS; i++)
+		reg_offsets[i] = (rand64() % reg_map.top) & ~3;
+}
+
+static uint64_t reg_range(unsigned long iters)
+{
+	uint64_t ret = 0;
+
+	for (unsigned long i = 0; i < iters; i++)
+		ret += intel_get_register_range(reg_map,
+						reg_offsets[i & (NUM_INPUTS - 1)],
+						INTEL_RANGE_READ) != NULL;
+
+	return ret;
+}
+
+/* device info */
+
+#undef INTEL_VGA_DEVICE
+#define INTEL_VGA_DEVICE(id, info) id
+
+static const uint16_t known_devids[] = {
+	INTEL_I915G_IDS(0),
+	INTEL_I965G_IDS(0),
+	INTEL_G45_IDS(0),
+	INTEL_IRONLAKE_D_IDS(0),
+	INTEL_SNB_D_IDS(0),
+	INTEL_IVB_D_IDS(0),
+	INTEL_HSW_D_IDS(0),
+	INTEL_VLV_D_IDS(0),
+	INTEL_BDW_D_IDS(0),
+	INTEL_CHV_IDS(0),
+	INTEL_SKL_IDS(0),
+	INTEL_BXT_IDS(0),
+	INTEL_KBL_IDS(0),
+};
+
+static uint16_t devids[NUM_INPUTS];
+
+static void devinfo_setup(void)
+{
+	for (int i = 0; i < NUM_INPUTS; i++)
+		devids[i] = known_devids[rand64() % ARRAY_SIZE(known_devids)];
+}
+
+static uint64_t devinfo_same(unsigned long iters)
+{
+	uint64_t ret = 0;
+
+	for (unsigned long i = 0; i < iters; i++)
+		ret += intel_get_device_info(opaque(BENCH_DEVID))->gen;
+
+	return ret;
+}
+
+static uint64_t devinfo_mixed(unsigned long iters)
+{
+	uint64_t ret = 0;
+
+	for (unsigned long i = 0; i < iters; i++)
+		ret += intel_get_device_info(devids[i & (NUM_INPUTS - 1)])->gen;
+
+	return ret;
+}
+
+/* register decoding, as done by intel_reg dump */
+
+static struct reg *spec_regs;
+static ssize_t spec_count;
+static uint32_t spec_values[NUM_INPUTS];
+
+static void reg_decode_setup(void)
+{
+	spec_count = intel_reg_spec_builtin(&spec_regs, BENCH_DEVID);
+	for (int i = 0; i < NUM_INPUTS; i++)
+		spec_values[i] = rand64();
+}
+
+static void reg_decode_teardown(void)
+{
+	intel_reg_spec_free(spec_regs, spec_count);
+}
+
+static uint64_t reg_decode(unsigned long iters)
+{
+	uint64_t ret = 0;
+	char buf[1024];
+
+	if (spec_count <= 0)
+		return 0;
+
+	for (unsigned long i = 0; i < iters; i++) {
+		intel_reg_spec_decode(buf, sizeof(buf),
+				      &spec_regs[i % spec_count],
+				      spec_values[i & (NUM_INPUTS - 1)],
+				      BENCH_DEVID);
+		ret += buf[0];
+	}
+
+	return ret;
+}
+
+/* error state decoding, one page per op */
+
+static char ascii85_page[5 * 1024 + 1];
+
+static void ascii85_setup(void)
+{
+	char *p = ascii85_page;
+
+	for (int i = 0; i < 1024; i++) {
+		/* a mostly empty object, as found in the error state */
+		uint32_t v = rand64() % 4 ? 0 : rand64();
+
+		if (v == 0) {
+			*p++ = 'z';
+			continue;
+		}
+
+		for (int j = 4; j >= 0; j--) {
+			p[j] = '!' + v % 85;
+			v /= 85;
+		}
+		p += 5;
+	}
+	*p = '\0';
+}
+
+static uint64_t ascii85(unsigned long iters)
+{
+	const char *end = ascii85_page + strlen(ascii85_page);
+	uint64_t ret = 0;
+
+	for (unsigned long i = 0; i < iters; i++) {
+		uint32_t *out;
+		int len;
+
+		len = ascii85_decode(ascii85_page, end, &out);
+		if (len)
+			ret += out[len - 1];
+		free(out);
+	}
+
+	return ret;
+}
+
+/* GPU sampler and netup_gpu_meter */
+
+static struct intel_gpu_sampler sampler;
+static uint32_t instdone_values[NUM_INPUTS];
+
+static void sampler_setup(void)
+{
+	if (sampler.has_stats)
+		intel_counters_fini(&sampler.stats);
+	memset(&sampler, 0, sizeof(sampler));
+	sampler.devid = BENCH_DEVID;
+
+	init_instdone_definitions(sampler.devid);
+	for (int i = 0; i < num_instdone_bits; i++) {
+		sampler.bits[i].bit = &instdone_bits[i];
+		sampler.bits[i].count = rand64() % 10000;
+	}
+	sampler.num_bits = num_instdone_bits;
+
+	for (int i = 0; i < SAMPLER_NUM_RINGS; i++) {
+		sampler.ring[i].name = "ring";
+		sampler.ring[i].size = 32 * 4096;
+		sampler.ring[i].full = rand64() % (1ull << 40);
+		sampler.ring[i].idle = rand64() % 10000;
+	}
+	sampler.samples = 10000;
+
+	sampler.has_stats = intel_counters_init(&sampler.stats,
+						intel_gpu_stats_regs,
+						STATS_COUNT) == 0;
+	if (sampler.has_stats) {
+		for (int i = 0; i < STATS_COUNT; i++) {
+			sampler.stats.last[i] = rand64() >> 8;
+			sampler.stats.values[i] = sampler.stats.last[i] +
+				(rand64() >> 40);
+		}
+		sampler.stats.last_timestamp = 1000000000;
+		sampler.stats.timestamp = 2000000000;
+	}
+
+	for (int i = 0; i < NUM_INPUTS; i++)
+		instdone_values[i] = rand64();
+}
+
+static uint64_t sampler_instdone(unsigned long iters)
+{
+	for (unsigned long i = 0; i < iters; i++)
+		intel_gpu_sampler_account_instdone(&sampler,
+						   instdone_values[i & (NUM_INPUTS - 1)],
+						   instdone_values[(i + 1) & (NUM_INPUTS - 1)]);
+
+	return sampler.bits[0].count;
+}
+
+static uint64_t netup_json(unsigned long iters)
+{
+	uint64_t ret = 0;
+
+	for (unsigned long i = 0; i < iters; i++) {
+		reset_params_values();
+		print_sampler_params(&sampler);
+		ret += out_buffer[0];
+	}
+
+	return ret;
+}
+
+static const struct bench {
+	const char *name;
+	const char *op;
+	void (*setup)(void);
+	uint64_t (*run)(unsigned long iters);
+	void (*teardown)(void);
+} benchmarks[] = {
+	{ "stats/push", "value", stats_push_setup, stats_push,
+	  stats_push_teardown },
+	{ "stats/median-1k", "1k values", stats_setup, stats_median },
+	{ "stats/quartiles-1k", "1k values", stats_setup, stats_quartiles },
+	{ "reg-map/range", "lookup", reg_range_setup, reg_range },
+	{ "device-info/same", "lookup", NULL, devinfo_same },
+	{ "device-info/mixed", "lookup", devinfo_setup, devinfo_mixed },
+	{ "reg-spec/decode", "register", reg_decode_setup, reg_decode,
+	  reg_decode_teardown },
+	{ "ascii85/decode", "4KiB page", ascii85_setup, ascii85 },
+	{ "sampler/instdone", "sample", sampler_setup, sampler_instdone },
+	{ "netup/json", "report", sampler_setup, netup_json },
+};
+
+struct result {
+	const char *name;
+	double mean, ci, median, min;
+	unsigned long iters;
+};
+
+static double elapsed_ns(const struct timespec *start,
+			 const struct timespec *end)
+{
+	return 1e9 * (end->tv_sec - start->tv_sec) +
+		(end->tv_nsec - start->tv_nsec);
+}
+
+static double time_run(const struct bench *b, unsigned long iters)
+{
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	sink += b->run(iters);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return elapsed_ns(&start, &end);
+}
+
+/* two-sided 95% quantiles of Student's t distribution */
+static double t95(int df)
+{
+	static const double t[] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+		2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+		2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064,
+		2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+	};
+
+	if (df < 1)
+		return 0;
+	if (df <= ARRAY_SIZE(t))
+		return t[df - 1];
+	return 1.960;
+}
+
+static void measure(const struct bench *b, double sample_ns, int samples,
+		    struct result *r)
+{
+	igt_stats_t stats;
+	unsigned long iters = 1;
+	double t;
+
+	if (b->setup)
+		b->setup();
+
+	/* grow the batch until one sample takes long enough to time */
+	while ((t = time_run(b, iters)) < sample_ns && iters < 1ul << 40) {
+		if (t < sample_ns / 16)
+			iters *= 16;
+		else
+			iters = iters * sample_ns / t + 1;
+	}
+
+	igt_stats_init_with_size(&stats, samples);
+	for (int i = 0; i < samples; i++)
+		igt_stats_push_float(&stats, time_run(b, iters) / iters);
+
+	r->name = b->name;
+	r->iters = iters;
+	r->mean = igt_stats_get_mean(&stats);
+	r->median = igt_stats_get_median(&stats);
+	r->min = stats.values_f[0];
+	for (int i = 1; i < samples; i++)
+		if (stats.values_f[i] < r->min)
+			r->min = stats.values_f[i];
+	r->ci = samples > 1 ?
+		t95(samples - 1) * igt_stats_get_std_deviation(&stats) / sqrt(samples) : 0;
+	igt_stats_fini(&stats);
+
+	if (b->teardown)
+		b->teardown();
+}
+
+static bool selected(const char *name, char **patterns, int count)
+{
+	if (!count)
+		return true;
+
+	for (int i = 0; i < count; i++)
+		if (fnmatch(patterns[i], name, 0) == 0)
+			return true;
+
+	return false;
+}
+
+struct baseline {
+	char name[64];
+	double mean, ci;
+};
+
+static int load_baseline(const char *path, struct baseline **out)
+{
+	struct baseline *base = NULL;
+	int count = 0, size = 0;
+	char line[256];
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (!file) {
+		perror(path);
+		exit(2);
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		struct baseline b;
+
+		if (line[0] == '#' ||
+		    sscanf(line, "%63s %lf %lf", b.name, &b.mean, &b.ci) != 3)
+			continue;
+
+		if (count == size) {
+			size = size ? 2 * size : 16;
+			base = realloc(base, size * sizeof(*base));
+		}
+		base[count++] = b;
+	}
+
+	fclose(file);
+
+	*out = base;
+	return count;
+}
+
+static const struct baseline *
+find_baseline(const struct baseline *base, int count, const char *name)
+{
+	for (int i = 0; i < count; i++)
+		if (strcmp(base[i].name, name) == 0)
+			return &base[i];
+
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options] [pattern...]\n"
+	       "  -l          list the benchmarks and exit\n"
+	       "  -n SAMPLES  samples per benchmark (default 15)\n"
+	       "  -t MS       target duration of a sample (default 20)\n"
+	       "  -o FILE     save the results as a baseline\n"
+	       "  -b FILE     compare against a saved baseline\n"
+	       "  -T PERCENT  slowdown to report as a regression (default 5)\n"
+	       "Patterns are shell wildcards matched against the names.\n",
+	       prog);
+}
+
+int main(int argc, char **argv)
+{
+	const char *save = NULL, *compare = NULL;
+	struct baseline *base = NULL;
+	int samples = 15, num_base = 0;
+	double sample_ms = 20, threshold = 5;
+	bool list = false;
+	int regressions = 0;
+	FILE *out = NULL;
+	int c;
+
+	while ((c = getopt(argc, argv, "ln:t:o:b:T:h")) != -1) {
+		switch (c) {
+		case 'l':
+			list = true;
+			break;
+		case 'n':
+			samples = atoi(optarg);
+			if (samples < 2)
+				samples = 2;
+			break;
+		case 't':
+			sample_ms = atof(optarg);
+			if (sample_ms <= 0)
+				sample_ms = 1;
+			break;
+		case 'o':
+			save = optarg;
+			break;
+		case 'b':
+			compare = optarg;
+			break;
+		case 'T':
+			threshold = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 2;
+		}
+	}
+
+	if (list) {
+		for (int i = 0; i < ARRAY_SIZE(benchmarks); i++)
+			if (selected(benchmarks[i].name,
+				     argv + optind, argc - optind))
+				printf("%-20s ns per %s\n",
+				       benchmarks[i].name, benchmarks[i].op);
+		return 0;
+	}
+
+	if (compare)
+		num_base = load_baseline(compare, &base);
+
+	if (save) {
+		out = fopen(save, "w");
+		if (!out) {
+			perror(save);
+			return 2;
+		}
+		fprintf(out, "# name mean_ns ci95_ns median_ns min_ns\n");
+	}
+
+	printf("%-20s %12s %10s %12s %12s %12s", "benchmark",
+	       "ns/op", "+/-95%", "median", "min", "iters");
+	if (compare)
+		printf(" %12s %8s", "baseline", "change");
+	printf("\n");
+
+	for (int i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+		const struct bench *b = &benchmarks[i];
+		const struct baseline *prev;
+		struct result r;
+
+		if (!selected(b->name, argv + optind, argc - optind))
+			continue;
+
+		measure(b, sample_ms * 1e6, samples, &r);
+
+		printf("%-20s %12.2f %10.2f %12.2f %12.2f %12lu",
+		       r.name, r.mean, r.ci, r.median, r.min, r.iters);
+
+		prev = compare ? find_baseline(base, num_base, r.name) : NULL;
+		if (prev && prev->mean > 0) {
+			double change = 100 * (r.mean - prev->mean) / prev->mean;
+			const char *verdict = "";
+
+			if (r.mean - r.ci > prev->mean + prev->ci) {
+				if (change > threshold) {
+					verdict = "  REGRESSION";
+					regressions++;
+				} else {
+					verdict = "  slower";
+				}
+			} else if (r.mean + r.ci < prev->mean - prev->ci) {
+				verdict = "  faster";
+			}
+
+			printf(" %12.2f %+7.1f%%%s", prev->mean, change, verdict);
+		} else if (compare) {
+			printf(" %12s", "-");
+		}
+		printf("\n");
+		fflush(stdout);
+
+		if (out)
+			fprintf(out, "%s %.3f %.3f %.3f %.3f\n",
+				r.name, r.mean, r.ci, r.median, r.min);
+	}
+
+	if (out)
+		fclose(out);
+	free(base);
+
+	return regressions ? 1 : 0;
+}
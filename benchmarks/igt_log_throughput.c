@@ -0,0 +1,117 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Measures how many lines per second N threads can push into the igt log
+ * buffer. The lines are logged at debug level, so they are only recorded
+ * for a failure dump and never printed.
+ */
+
+#include "igt.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+static int num_lines = 100000;
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+static void *logger(void *arg)
+{
+	int thread = (uintptr_t)arg;
+
+	for (int n = 0; n < num_lines; n++)
+		igt_debug("thread %d: line %d of %d\n", thread, n, num_lines);
+
+	return NULL;
+}
+
+static double run(int nthreads)
+{
+	pthread_t *threads = calloc(nthreads, sizeof(*threads));
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int n = 0; n < nthreads; n++)
+		pthread_create(&threads[n], NULL, logger, (void *)(uintptr_t)n);
+	for (int n = 0; n < nthreads; n++)
+		pthread_join(threads[n], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	free(threads);
+
+	return (double)nthreads * num_lines / elapsed(&start, &end);
+}
+
+int main(int argc, char **argv)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int reps = 5;
+	int c;
+
+	while ((c = getopt(argc, argv, "t:n:r:")) != -1) {
+		switch (c) {
+		case 't':
+			max_threads = atoi(optarg);
+			if (max_threads < 1)
+				max_threads = 1;
+			break;
+
+		case 'n':
+			num_lines = atoi(optarg);
+			if (num_lines < 1)
+				num_lines = 1;
+			break;
+
+		case 'r':
+			reps = atoi(optarg);
+			if (reps < 1)
+				reps = 1;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	for (int nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+		double best = 0;
+
+		for (int r = 0; r < reps; r++) {
+			double rate = run(nthreads);
+			if (rate > best)
+				best = rate;
+		}
+
+		printf("%d threads: %.3f Mlines/s\n", nthreads, best / 1e6);
+	}
+
+	return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Throughput of the overlay's RGB565 to YUV 4:2:0 converters */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "rgb2yuv.h"
+
+static const char *converters[] = { "generic", "sse2", "avx2" };
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+/* Something chart-like: a dark background with a few coloured bands */
+static void fill(uint16_t *rgb, int width, int height, int stride)
+{
+	int x, y;
+
+	for (y = 0; y < height; y++) {
+		uint16_t *row = (uint16_t *)((uint8_t *)rgb + y * stride);
+
+		for (x = 0; x < width; x++) {
+			uint16_t p = 0x18e3;
+
+			if ((x + y) % 97 < 8)
+				p = 0xf800 | (x & 0x3f) << 5;
+			else if (y % 31 == 0)
+				p = 0x07e0 | (y & 0x1f);
+			row[x] = p;
+		}
+	}
+}
+
+static double run(const uint8_t *rgb, int stride, uint8_t *yuv,
+		  int width, int height, int w, int h, double seconds)
+{
+	struct timespec start, end;
+	unsigned long count = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		for (int n = 0; n < 16; n++) {
+			int x = w < width ? (count * 37) % (width - w) : 0;
+			int y = h < height ? (count * 17) % (height - h) : 0;
+
+			rgb2yuv_rect(rgb, stride, yuv,
+				     width, (width + 1) / 2,
+				     width, height,
+				     x, y, w, h);
+			count++;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+	} while (elapsed(&start, &end) < seconds);
+
+	return count * (double)w * h / elapsed(&start, &end);
+}
+
+int main(int argc, char **argv)
+{
+	int width = 640, height = 236;
+	int w = 0, h = 0;
+	double seconds = 1;
+	uint8_t *rgb, *yuv, *ref;
+	int stride, size, c;
+
+	while ((c = getopt(argc, argv, "w:h:d:t:")) != -1) {
+		switch (c) {
+		case 'w':
+			width = atoi(optarg);
+			break;
+		case 'h':
+			height = atoi(optarg);
+			break;
+		case 'd':
+			if (sscanf(optarg, "%dx%d", &w, &h) != 2)
+				w = h = 0;
+			break;
+		case 't':
+			seconds = atof(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-w width] [-h height] [-d dirty WxH] [-t seconds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	if (width < 2 || height < 2)
+		return 1;
+	if (w <= 0 || w > width || h <= 0 || h > height) {
+		w = width;
+		h = height;
+	}
+
+	stride = (2 * width + 63) & -64;
+	size = width * height + 2 * ((width + 1) / 2) * (height / 2);
+	rgb = malloc(stride * height);
+	yuv = malloc(size);
+	ref = malloc(size);
+	if (!rgb || !yuv || !ref)
+		return 1;
+
+	fill((uint16_t *)rgb, width, height, stride);
+
+	rgb2yuv_select("generic");
+	rgb2yuv_rect(rgb, stride, ref, width, (width + 1) / 2,
+		     width, height, 0, 0, width, height);
+
+	for (c = 0; c < sizeof(converters) / sizeof(converters[0]); c++) {
+		double rate;
+
+		if (!rgb2yuv_select(converters[c]))
+			continue;
+
+		memset(yuv, 0, size);
+		rgb2yuv_rect(rgb, stride, yuv, width, (width + 1) / 2,
+			     width, height, 0, 0, width, height);
+		if (memcmp(yuv, ref, size)) {
+			fprintf(stderr, "%s: output differs from generic\n",
+				converters[c]);
+			return 1;
+		}
+
+		rate = run(rgb, stride, yuv, width, height, w, h, seconds);
+		printf("%s: %dx%d of %dx%d, %.1f Mpixels/s\n",
+		       converters[c], w, h, width, height, rate / 1e6);
+	}
+
+	free(ref);
+	free(yuv);
+	free(rgb);
+	return 0;
+}
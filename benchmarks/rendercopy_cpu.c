@@ -0,0 +1,185 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+/*
+ * CPU cost of the render copy helpers, run against the in-memory bufmgr
+ * from lib/stubs/drm so that no GPU is needed. For each platform this
+ * reports the bytes uploaded into buffer objects and the command bytes
+ * executed per copy, and the process CPU time per copy, which includes
+ * applying the relocations on execbuffer.
+ *
+ * Run it on two trees to compare a change to the render copy code, e.g.
+ *   rendercopy_cpu -n 200000
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "intel_chipset.h"
+#include "intel_batchbuffer.h"
+#include "intel_bufmgr.h"
+#include "intel_bufmgr_stub.h"
+
+static const struct {
+	const char *name;
+	uint32_t devid;
+} platforms[] = {
+	{ "snb", 0x0102 },
+	{ "ivb", 0x0166 },
+	{ "bdw", 0x1616 },
+	{ "skl", 0x1912 },
+};
+
+struct counts {
+	unsigned long execs;
+	uint64_t command_bytes;
+};
+
+static int count_exec(drm_intel_bo *bo, unsigned int used, void *priv)
+{
+	struct counts *c = priv;
+
+	c->execs++;
+	c->command_bytes += used;
+	return 0;
+}
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+static void init_buf(drm_intel_bufmgr *bufmgr, struct igt_buf *buf,
+		     int width, int height)
+{
+	memset(buf, 0, sizeof(*buf));
+
+	buf->bo = drm_intel_bo_alloc(bufmgr, "", width * height * 4, 4096);
+	buf->stride = width * 4;
+	buf->tiling = I915_TILING_NONE;
+	buf->size = width * height * 4;
+}
+
+static int run(const char *name, uint32_t devid, unsigned long count,
+	       int width, int height)
+{
+	igt_render_copyfunc_t copy = igt_get_render_copyfunc(devid);
+	struct intel_batchbuffer *batch;
+	drm_intel_bufmgr *bufmgr;
+	struct igt_buf src, dst;
+	struct counts c = {};
+	struct timespec start, end;
+	uint64_t uploaded;
+	unsigned long n;
+	double t;
+
+	if (copy == NULL)
+		return 0;
+
+	bufmgr = drm_intel_bufmgr_stub_init(devid, 4096);
+	if (bufmgr == NULL)
+		return 1;
+	drm_intel_bufmgr_fake_set_exec_callback(bufmgr, count_exec, &c);
+
+	batch = intel_batchbuffer_alloc(bufmgr, devid);
+	init_buf(bufmgr, &src, width, height);
+	init_buf(bufmgr, &dst, width, height);
+	if (batch == NULL || src.bo == NULL || dst.bo == NULL)
+		return 1;
+
+	/* Leave out the one-off setup of the first copy */
+	copy(batch, NULL, &src, 0, 0, width, height, &dst, 0, 0);
+	uploaded = drm_intel_bufmgr_stub_get_upload_bytes(bufmgr);
+	c.execs = 0;
+	c.command_bytes = 0;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+	for (n = 0; n < count; n++)
+		copy(batch, NULL, &src, 0, 0, width, height, &dst, 0, 0);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+
+	uploaded = drm_intel_bufmgr_stub_get_upload_bytes(bufmgr) - uploaded;
+	t = elapsed(&start, &end);
+
+	printf("%s: %lu %dx%d copies, %.0f bytes uploaded and %.0f command bytes per copy, %.0fns per copy\n",
+	       name, count, width, height,
+	       (double)uploaded / count,
+	       (double)c.command_bytes / (c.execs ?: 1),
+	       1e9 * t / count);
+
+	drm_intel_bo_unreference(src.bo);
+	drm_intel_bo_unreference(dst.bo);
+	intel_batchbuffer_free(batch);
+	drm_intel_bufmgr_destroy(bufmgr);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long count = 200000;
+	int width = 64, height = 64;
+	const char *only = NULL;
+	int c, n;
+
+	while ((c = getopt(argc, argv, "n:w:h:p:")) != -1) {
+		switch (c) {
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			width = atoi(optarg);
+			break;
+		case 'h':
+			height = atoi(optarg);
+			break;
+		case 'p':
+			only = optarg;
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-n copies] [-w width] [-h height] [-p platform]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	if (count == 0 || width <= 0 || height <= 0)
+		return 1;
+
+	for (n = 0; n < sizeof(platforms) / sizeof(platforms[0]); n++) {
+		if (only && strcmp(only, platforms[n].name))
+			continue;
+
+		if (run(platforms[n].name, platforms[n].devid,
+			count, width, height))
+			return 1;
+	}
+
+	return 0;
+}
@@ -34,6 +34,7 @@
 #include "igt_draw.h"
 #include "igt_fb.h"
 #include "igt_gt.h"
+#include "igt_ioctl_trace.h"
 #include "igt_kms.h"
 #include "igt_pm.h"
 #include "igt_stats.h"
@@ -57,6 +57,7 @@
 #include "igt_aux.h"
 #include "igt_debugfs.h"
 #include "igt_gt.h"
+#include "igt_ioctl_trace.h"
 #include "igt_rand.h"
 #include "config.h"
 #include "intel_reg.h"
@@ -109,6 +110,7 @@ static void sigiter(int sig, siginfo_t *info, void *arg)
 static int
 sig_ioctl(int fd, unsigned long request, void *arg)
 {
+	struct timespec start = {};
 	struct itimerspec its;
 	int ret;
 
@@ -118,10 +120,13 @@ sig_ioctl(int fd, unsigned long request, void *arg)
 	memset(&its, 0, sizeof(its));
 	if (timer_settime(__igt_sigiter.timer, 0, &its, NULL)) {
 		/* oops, we didn't undo the interrupter (i.e. !unwound abort) */
-		igt_ioctl = drmIoctl;
-		return drmIoctl(fd, request, arg);
+		igt_ioctl = __igt_ioctl;
+		return __igt_ioctl(fd, request, arg);
 	}
 
+	if (__igt_accounting | __igt_ioctl_tracing)
+		igt_nsec_elapsed(&start);
+
 	its.it_value = __igt_sigiter.offset;
 	do {
 		long serial;
@@ -156,6 +161,15 @@ sig_ioctl(int fd, unsigned long request, void *arg)
 	memset(&its, 0, sizeof(its));
 	timer_settime(__igt_sigiter.timer, 0, &its, NULL);
 
+	if (__igt_accounting | __igt_ioctl_tracing) {
+		uint64_t elapsed = igt_nsec_elapsed(&start);
+
+		if (__igt_accounting)
+			__igt_account_ioctl(elapsed);
+		if (__igt_ioctl_tracing)
+			__igt_ioctl_trace(request, arg, ret ? -1 : 0, elapsed);
+	}
+
 	errno = ret;
 	return ret ? -1 : 0;
 }
@@ -165,8 +179,8 @@ static bool igt_sigiter_start(struct __igt_sigiter *iter, bool enable)
 	/* Note that until we can automatically clean up on failed/skipped
 	 * tests, we cannot assume the state of the igt_ioctl indirection.
 	 */
-	SIG_ASSERT(igt_ioctl == drmIoctl);
-	igt_ioctl = drmIoctl;
+	SIG_ASSERT(igt_ioctl == __igt_ioctl);
+	igt_ioctl = __igt_ioctl;
 
 	if (enable) {
 		struct timespec start, end;
@@ -226,7 +240,7 @@ static bool igt_sigiter_stop(struct __igt_sigiter *iter, bool enable)
 
 		SIG_ASSERT(igt_ioctl == sig_ioctl);
 		SIG_ASSERT(__igt_sigiter.tid == gettid());
-		igt_ioctl = drmIoctl;
+		igt_ioctl = __igt_ioctl;
 
 		timer_delete(__igt_sigiter.timer);
 
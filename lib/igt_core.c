@@ -47,6 +47,7 @@
 #include <sys/types.h>
 #ifdef __linux__
 #include <sys/syscall.h>
+#include <sys/resource.h>
 #endif
 #include <pthread.h>
 #include <sys/utsname.h>
@@ -56,6 +57,7 @@
 #include <ctype.h>
 #include <limits.h>
 #include <locale.h>
+#include <inttypes.h>
 #include <uwildmat/uwildmat.h>
 
 #include "drmtest.h"
@@ -224,6 +226,18 @@
  * - 'basic*,advanced*' match any subtest starting basic or advanced
  * - '*,!basic*' match any subtest not starting basic
  * - 'basic*,!basic-render*' match any subtest starting basic but not starting basic-render
+ *
+ * If the IGT_ACCOUNTING environment variable names a file ("-" meaning
+ * stdout), a JSON record is appended to it for every subtest and fixture that
+ * ran, holding its wall time, CPU time, peak RSS, page faults, context
+ * switches and the number of and time spent in igt_ioctl() calls, e.g.
+ *
+ * |[<!-- language="json" -->
+ *	{"test": "gem_exec_basic", "subtest": "basic-default", "kind": "subtest", "result": "SUCCESS", "wall": 0.001804, ...}
+ * ]|
+ *
+ * Fixtures are named by their position in the test, "fixture-0" onwards.
+ * Tests without subtests get a single record with kind "test".
  */
 
 static unsigned int exit_handler_count;
@@ -264,68 +278,298 @@ static int igt_exitcode = IGT_EXIT_SUCCESS;
 static const char *command_str;
 
 static char* igt_log_domain_filter;
-static struct {
-	char *entries[256];
-	uint8_t start, end;
-} log_buffer;
-static pthread_mutex_t log_buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 const char *igt_test_name(void)
 {
 	return command_str;
 }
 
-static void _igt_log_buffer_append(char *line)
+/*
+ * Log buffer
+ *
+ * Every thread appends the lines it logs to a ring of its own, so logging
+ * never takes a lock nor allocates after the first line. A ring is only
+ * ever written by the thread owning it: the oldest records are dropped
+ * (by advancing tail) before new ones are written (and head advanced).
+ * Rings of exited threads keep their lines, and are only handed to new
+ * threads once LOG_MAX_RINGS rings exist.
+ *
+ * When a test fails, the rings are merged by timestamp, skipping anything
+ * logged before the last reset.
+ */
+
+#define LOG_RING_SIZE (64 << 10)
+#define LOG_RECORD_MAX (LOG_RING_SIZE / 4)
+#define LOG_MAX_RINGS 64
+
+struct log_ring {
+	struct log_ring *next;
+	int busy;
+	uint64_t head, tail; /* in bytes written since creation */
+	char data[LOG_RING_SIZE];
+};
+
+struct log_record {
+	uint64_t timestamp;
+	uint32_t length; /* of the text following the record */
+};
+
+static struct log_ring *log_rings;
+static int log_num_rings;
+static __thread struct log_ring *log_ring;
+static pthread_key_t log_ring_key;
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static uint64_t log_cutoff;
+static pid_t log_pid;
+
+static uint64_t log_timestamp(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t log_record_size(const struct log_record *rec)
+{
+	return ALIGN(sizeof(*rec) + rec->length, sizeof(uint64_t));
+}
+
+static void log_ring_release(void *arg)
+{
+	struct log_ring *ring = arg;
+
+	__atomic_store_n(&ring->busy, 0, __ATOMIC_RELEASE);
+}
+
+static void log_pid_reset(void)
+{
+	log_pid = 0;
+}
+
+static void log_init(void)
+{
+	pthread_key_create(&log_ring_key, log_ring_release);
+	pthread_atfork(NULL, NULL, log_pid_reset);
+}
+
+/* getpid() is a syscall, but only changes across fork() */
+static pid_t log_getpid(void)
 {
-	pthread_mutex_lock(&log_buffer_mutex);
+	pthread_once(&log_once, log_init);
 
-	free(log_buffer.entries[log_buffer.end]);
-	log_buffer.entries[log_buffer.end] = line;
-	log_buffer.end++;
-	if (log_buffer.end == log_buffer.start)
-		log_buffer.start++;
+	if (!log_pid)
+		log_pid = getpid();
 
-	pthread_mutex_unlock(&log_buffer_mutex);
+	return log_pid;
+}
+
+static struct log_ring *log_ring_get(void)
+{
+	struct log_ring *ring = log_ring;
+
+	if (ring)
+		return ring;
+
+	pthread_once(&log_once, log_init);
+
+	/* past the limit, reuse the ring of an exited thread if there is one */
+	if (__atomic_load_n(&log_num_rings, __ATOMIC_RELAXED) >= LOG_MAX_RINGS) {
+		for (ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+		     ring; ring = ring->next)
+			if (!ring->busy &&
+			    __sync_bool_compare_and_swap(&ring->busy, 0, 1))
+				goto out;
+	}
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->busy = 1;
+	do
+		ring->next = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+	while (!__sync_bool_compare_and_swap(&log_rings, ring->next, ring));
+	__sync_fetch_and_add(&log_num_rings, 1);
+
+out:
+	pthread_setspecific(log_ring_key, ring);
+	return log_ring = ring;
+}
+
+static void log_ring_write(struct log_ring *ring, uint64_t pos,
+			   const void *src, size_t len)
+{
+	size_t offset = pos % LOG_RING_SIZE;
+	size_t n = min(len, LOG_RING_SIZE - offset);
+
+	memcpy(ring->data + offset, src, n);
+	memcpy(ring->data, (const char *)src + n, len - n);
+}
+
+static void log_ring_read(const char *data, uint64_t pos,
+			  void *dst, size_t len)
+{
+	size_t offset = pos % LOG_RING_SIZE;
+	size_t n = min(len, LOG_RING_SIZE - offset);
+
+	memcpy(dst, data + offset, n);
+	memcpy((char *)dst + n, data, len - n);
+}
+
+static void _igt_log_buffer_append(const char *prefix, const char *line,
+				   size_t len)
+{
+	struct log_ring *ring = log_ring_get();
+	struct log_record rec;
+	size_t prefix_len = strlen(prefix);
+	uint64_t head, tail;
+
+	if (!ring)
+		return;
+
+	if (prefix_len + len > LOG_RECORD_MAX) {
+		prefix_len = min(prefix_len, LOG_RECORD_MAX);
+		len = LOG_RECORD_MAX - prefix_len;
+	}
+
+	rec.timestamp = log_timestamp();
+	rec.length = prefix_len + len;
+
+	head = ring->head;
+	tail = ring->tail;
+	while (head + log_record_size(&rec) - tail > LOG_RING_SIZE) {
+		struct log_record old;
+
+		log_ring_read(ring->data, tail, &old, sizeof(old));
+		tail += log_record_size(&old);
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	/*
+	 * Order the tail update before overwriting the records it dropped,
+	 * so a reader that copied any new byte also sees the new tail when
+	 * it re-checks; the release store alone only orders earlier stores.
+	 */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	log_ring_write(ring, head, &rec, sizeof(rec));
+	log_ring_write(ring, head + sizeof(rec), prefix, prefix_len);
+	log_ring_write(ring, head + sizeof(rec) + prefix_len, line, len);
+
+	__atomic_store_n(&ring->head, head + log_record_size(&rec),
+			 __ATOMIC_RELEASE);
 }
 
 static void _igt_log_buffer_reset(void)
 {
-	pthread_mutex_lock(&log_buffer_mutex);
+	__atomic_store_n(&log_cutoff, log_timestamp(), __ATOMIC_RELEASE);
+}
+
+struct log_snapshot {
+	char data[LOG_RING_SIZE];
+	uint64_t pos, end;
+	struct log_record rec;
+};
+
+static bool log_snapshot_next(struct log_snapshot *snap)
+{
+	while (snap->pos < snap->end) {
+		log_ring_read(snap->data, snap->pos, &snap->rec,
+			      sizeof(snap->rec));
+		if (snap->rec.timestamp >= log_cutoff)
+			return true;
+		snap->pos += log_record_size(&snap->rec);
+	}
+
+	return false;
+}
+
+/*
+ * Copies a consistent view of @ring, retrying whenever its owner dropped
+ * records while they were being copied.
+ */
+static bool log_snapshot_take(struct log_snapshot *snap, struct log_ring *ring)
+{
+	int retry;
+
+	for (retry = 0; retry < 8; retry++) {
+		uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+		memcpy(snap->data, ring->data, LOG_RING_SIZE);
+
+		/* keep the copy from sinking below the tail re-check */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&ring->tail, __ATOMIC_RELAXED) != tail)
+			continue;
 
-	log_buffer.start = log_buffer.end = 0;
+		snap->pos = tail;
+		snap->end = head;
+		return log_snapshot_next(snap);
+	}
 
-	pthread_mutex_unlock(&log_buffer_mutex);
+	return false;
 }
 
 static void _igt_log_buffer_dump(void)
 {
-	uint8_t i;
+	struct log_snapshot *snaps = NULL;
+	struct log_ring *ring;
+	int n, count = 0;
 
 	if (in_subtest)
 		fprintf(stderr, "Subtest %s failed.\n", in_subtest);
 	else
 		fprintf(stderr, "Test %s failed.\n", command_str);
 
-	if (log_buffer.start == log_buffer.end) {
+	for (ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+	     ring; ring = ring->next) {
+		struct log_snapshot *tmp;
+
+		tmp = realloc(snaps, (count + 1) * sizeof(*snaps));
+		if (!tmp)
+			break;
+		snaps = tmp;
+
+		if (log_snapshot_take(&snaps[count], ring))
+			count++;
+	}
+
+	if (count == 0) {
 		fprintf(stderr, "No log.\n");
+		free(snaps);
 		return;
 	}
 
-	pthread_mutex_lock(&log_buffer_mutex);
 	fprintf(stderr, "**** DEBUG ****\n");
 
-	i = log_buffer.start;
 	do {
-		char *last_line = log_buffer.entries[i];
-		fprintf(stderr, "%s", last_line);
-		i++;
-	} while (i != log_buffer.start && i != log_buffer.end);
+		struct log_snapshot *first = NULL;
+		char line[LOG_RECORD_MAX];
+
+		for (n = 0; n < count; n++) {
+			if (snaps[n].pos == snaps[n].end)
+				continue;
+			if (!first || snaps[n].rec.timestamp < first->rec.timestamp)
+				first = &snaps[n];
+		}
+		if (!first)
+			break;
+
+		log_ring_read(first->data, first->pos + sizeof(first->rec),
+			      line, first->rec.length);
+		fwrite(line, sizeof(char), first->rec.length, stderr);
+
+		first->pos += log_record_size(&first->rec);
+		log_snapshot_next(first);
+	} while (1);
 
 	/* reset the buffer */
-	log_buffer.start = log_buffer.end = 0;
+	_igt_log_buffer_reset();
 
 	fprintf(stderr, "****  END  ****\n");
-	pthread_mutex_unlock(&log_buffer_mutex);
+	free(snaps);
 }
 
 __attribute__((format(printf, 1, 2)))
@@ -415,6 +659,150 @@ uint64_t igt_nsec_elapsed(struct timespec *start)
 		(uint64_t)NSEC_PER_SEC*(now.tv_sec - start->tv_sec));
 }
 
+/*
+ * Accounting
+ */
+
+bool __igt_accounting;
+static FILE *accounting_file;
+static uint64_t accounting_ioctls, accounting_ioctl_ns;
+static int fixture_count;
+
+struct accounting {
+	struct timespec start;
+	struct rusage self, children;
+	uint64_t ioctls, ioctl_ns;
+};
+
+static struct accounting subtest_accounting, fixture_accounting;
+
+void __igt_account_ioctl(uint64_t elapsed_ns)
+{
+	__atomic_add_fetch(&accounting_ioctls, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&accounting_ioctl_ns, elapsed_ns, __ATOMIC_RELAXED);
+}
+
+static void accounting_init(void)
+{
+	const char *env = getenv("IGT_ACCOUNTING");
+
+	if (!env || list_subtests)
+		return;
+
+	if (strcmp(env, "-") == 0)
+		accounting_file = stdout;
+	else
+		accounting_file = fopen(env, "a");
+
+	if (!accounting_file) {
+		igt_warn("Could not open accounting file %s: %s\n",
+			 env, strerror(errno));
+		return;
+	}
+
+	setvbuf(accounting_file, NULL, _IOLBF, 0);
+	__igt_accounting = true;
+}
+
+static void accounting_start(struct accounting *a)
+{
+	int fd;
+
+	if (!__igt_accounting)
+		return;
+
+	/* reset VmHWM, so that the peak RSS is that of this subtest alone */
+	fd = open("/proc/self/clear_refs", O_WRONLY);
+	if (fd >= 0) {
+		igt_ignore_warn(write(fd, "5", 1));
+		close(fd);
+	}
+
+	getrusage(RUSAGE_SELF, &a->self);
+	getrusage(RUSAGE_CHILDREN, &a->children);
+	a->ioctls = __atomic_load_n(&accounting_ioctls, __ATOMIC_RELAXED);
+	a->ioctl_ns = __atomic_load_n(&accounting_ioctl_ns, __ATOMIC_RELAXED);
+	gettime(&a->start);
+}
+
+static long peak_rss_kb(const struct rusage *self)
+{
+	char buf[4096], *str;
+	long kb = self->ru_maxrss;
+	ssize_t len;
+	int fd;
+
+	fd = open("/proc/self/status", O_RDONLY);
+	if (fd < 0)
+		return kb;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return kb;
+	buf[len] = '\0';
+
+	str = strstr(buf, "VmHWM:");
+	if (str)
+		kb = strtol(str + 6, NULL, 10);
+
+	return kb;
+}
+
+static double tv_elapsed(const struct timeval *start, const struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) +
+		1e-6 * (end->tv_usec - start->tv_usec);
+}
+
+static void accounting_emit(struct accounting *a, const char *kind,
+			    const char *name, const char *result)
+{
+	struct rusage self, children;
+	struct timespec now;
+
+	if (!__igt_accounting || test_child)
+		return;
+
+	gettime(&now);
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &children);
+
+	fprintf(accounting_file,
+		"{\"test\": \"%s\", \"subtest\": \"%s\", \"kind\": \"%s\", "
+		"\"result\": \"%s\", \"wall\": %.6f, "
+		"\"user\": %.6f, \"sys\": %.6f, "
+		"\"children_user\": %.6f, \"children_sys\": %.6f, "
+		"\"peak_rss_kb\": %ld, \"minflt\": %ld, \"majflt\": %ld, "
+		"\"nvcsw\": %ld, \"nivcsw\": %ld, "
+		"\"ioctls\": %"PRIu64", \"ioctl_time\": %.6f}\n",
+		command_str, name, kind, result,
+		time_elapsed(&a->start, &now),
+		tv_elapsed(&a->self.ru_utime, &self.ru_utime),
+		tv_elapsed(&a->self.ru_stime, &self.ru_stime),
+		tv_elapsed(&a->children.ru_utime, &children.ru_utime),
+		tv_elapsed(&a->children.ru_stime, &children.ru_stime),
+		peak_rss_kb(&self),
+		self.ru_minflt - a->self.ru_minflt,
+		self.ru_majflt - a->self.ru_majflt,
+		self.ru_nvcsw - a->self.ru_nvcsw,
+		self.ru_nivcsw - a->self.ru_nivcsw,
+		__atomic_load_n(&accounting_ioctls, __ATOMIC_RELAXED) - a->ioctls,
+		1e-9 * (__atomic_load_n(&accounting_ioctl_ns, __ATOMIC_RELAXED) -
+			a->ioctl_ns));
+}
+
+static void accounting_emit_fixture(const char *result)
+{
+	char name[32];
+
+	if (!__igt_accounting)
+		return;
+
+	snprintf(name, sizeof(name), "fixture-%d", fixture_count++);
+	accounting_emit(&fixture_accounting, "fixture", name, result);
+}
+
 bool __igt_fixture(void)
 {
 	assert(!in_fixture);
@@ -425,6 +813,8 @@ bool __igt_fixture(void)
 	if (skip_subtests_henceforth)
 		return false;
 
+	accounting_start(&fixture_accounting);
+
 	in_fixture = true;
 	return true;
 }
@@ -433,6 +823,8 @@ void __igt_fixture_complete(void)
 {
 	assert(in_fixture);
 
+	accounting_emit_fixture("SUCCESS");
+
 	in_fixture = false;
 }
 
@@ -440,6 +832,9 @@ void __igt_fixture_end(void)
 {
 	assert(in_fixture);
 
+	accounting_emit_fixture(skip_subtests_henceforth == SKIP ?
+				"SKIP" : "FAIL");
+
 	in_fixture = false;
 	siglongjmp(igt_subtest_jmpbuf, 1);
 }
@@ -744,8 +1139,12 @@ out:
 	/* install exit handler, to ensure we clean up */
 	igt_install_exit_handler(common_exit_handler);
 
-	if (!test_with_subtests)
+	accounting_init();
+
+	if (!test_with_subtests) {
+		accounting_start(&subtest_accounting);
 		gettime(&subtest_time);
+	}
 
 	for (i = 0; (optind + i) < *argc; i++)
 		argv[i + 1] = argv[optind + i];
@@ -865,6 +1264,7 @@ bool __igt_run_subtest(const char *subtest_name)
 
 	_igt_log_buffer_reset();
 
+	accounting_start(&subtest_accounting);
 	gettime(&subtest_time);
 	return (in_subtest = subtest_name);
 }
@@ -917,6 +1317,8 @@ static void exit_subtest(const char *result)
 	       (!__igt_plain_output) ? "\x1b[0m" : "");
 	fflush(stdout);
 
+	accounting_emit(&subtest_accounting, "subtest", in_subtest, result);
+
 	in_subtest = NULL;
 	siglongjmp(igt_subtest_jmpbuf, 1);
 }
@@ -1199,6 +1601,8 @@ void igt_exit(void)
 
 		printf("%s (%.3fs)\n",
 		       result, time_elapsed(&subtest_time, &now));
+
+		accounting_emit(&subtest_accounting, "test", "", result);
 	}
 
 	exit(igt_exitcode);
@@ -1742,7 +2146,7 @@ void igt_log(const char *domain, enum igt_log_level level, const char *format, .
 void igt_vlog(const char *domain, enum igt_log_level level, const char *format, va_list args)
 {
 	FILE *file;
-	char *line, *formatted_line;
+	char prefix[256], buf[256], *line = buf;
 	const char *program_name;
 	const char *igt_log_level_str[] = {
 		"DEBUG",
@@ -1752,6 +2156,8 @@ void igt_vlog(const char *domain, enum igt_log_level level, const char *format,
 		"NONE"
 	};
 	static bool line_continuation = false;
+	va_list copy;
+	int len;
 
 	assert(format);
 
@@ -1764,23 +2170,26 @@ void igt_vlog(const char *domain, enum igt_log_level level, const char *format,
 	if (list_subtests && level <= IGT_LOG_WARN)
 		return;
 
-	if (vasprintf(&line, format, args) == -1)
+	/* only fall back to the heap for unusually long lines */
+	va_copy(copy, args);
+	len = vsnprintf(buf, sizeof(buf), format, copy);
+	va_end(copy);
+	if (len < 0)
+		return;
+	if (len >= sizeof(buf) && vasprintf(&line, format, args) == -1)
 		return;
 
-	if (line_continuation) {
-		formatted_line = strdup(line);
-		if (!formatted_line)
-			goto out;
-	} else if (asprintf(&formatted_line, "(%s:%d) %s%s%s: %s", program_name,
-		     getpid(), (domain) ? domain : "", (domain) ? "-" : "",
-		     igt_log_level_str[level], line) == -1) {
-		goto out;
-	}
+	if (line_continuation)
+		prefix[0] = '\0';
+	else
+		snprintf(prefix, sizeof(prefix), "(%s:%d) %s%s%s: ",
+			 program_name, log_getpid(), (domain) ? domain : "",
+			 (domain) ? "-" : "", igt_log_level_str[level]);
 
-	line_continuation = line[strlen(line) - 1] != '\n';
+	line_continuation = len && line[len - 1] != '\n';
 
 	/* append log buffer */
-	_igt_log_buffer_append(formatted_line);
+	_igt_log_buffer_append(prefix, line, len);
 
 	/* check print log level */
 	if (igt_log_level > level)
@@ -1807,13 +2216,12 @@ void igt_vlog(const char *domain, enum igt_log_level level, const char *format,
 	/* prepend all except information messages with process, domain and log
 	 * level information */
 	if (level != IGT_LOG_INFO)
-		fwrite(formatted_line, sizeof(char), strlen(formatted_line),
-		       file);
-	else
-		fwrite(line, sizeof(char), strlen(line), file);
+		fwrite(prefix, sizeof(char), strlen(prefix), file);
+	fwrite(line, sizeof(char), len, file);
 
 out:
-	free(line);
+	if (line != buf)
+		free(line);
 }
 
 static const char *timeout_op;
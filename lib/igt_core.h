@@ -854,6 +854,10 @@ static inline uint32_t igt_seconds_elapsed(struct timespec *start)
 	return igt_nsec_elapsed(start) >> 30;
 }
 
+/* used by the igt_ioctl() implementations to feed IGT_ACCOUNTING */
+extern bool __igt_accounting;
+void __igt_account_ioctl(uint64_t elapsed_ns);
+
 void igt_reset_timeout(void);
 
 FILE *__igt_fopen_data(const char* igt_srcdir, const char* igt_datadir,
@@ -32,6 +32,9 @@
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
 #include <i915_drm.h>
 
 #include "drmtest.h"
@@ -81,6 +84,10 @@ const char *kmstest_pipe_name(enum pipe pipe)
  * igt_assert_crc_equal() to inspect CRC values captured by the same
  * #igt_pipe_crc_t object.
  *
+ * For capturing the CRCs of every frame on several pipes at once, attach the
+ * #igt_pipe_crc_t objects to an #igt_crc_capture_t, which drains all of them
+ * from a background thread into per-pipe buffers. See igt_crc_capture_new().
+ *
  * # Other debugfs interface wrappers
  *
  * This covers the miscellaneous debugfs interface wrappers:
@@ -306,6 +313,8 @@ char *igt_crc_to_string(igt_crc_t *crc)
 #define PIPE_CRC_LINE_LEN       (6 * 8 + 5 + 1)
 /* account for \'0' */
 #define PIPE_CRC_BUFFER_LEN     (PIPE_CRC_LINE_LEN + 1)
+/* max number of lines fetched by a single read() */
+#define PIPE_CRC_READ_LINES     64
 
 struct _igt_pipe_crc {
 	int ctl_fd;
@@ -482,43 +491,113 @@ void igt_pipe_crc_free(igt_pipe_crc_t *pipe_crc)
 	free(pipe_crc);
 }
 
+static const char *parse_field(const char *s, int base, uint32_t *out)
+{
+	uint32_t v = 0;
+	int digits = 0;
+
+	while (*s == ' ')
+		s++;
+
+	for (;; s++, digits++) {
+		unsigned int c = *s;
+
+		if (c - '0' < 10)
+			c -= '0';
+		else if (base == 16 && (c | 0x20) - 'a' < 6)
+			c = (c | 0x20) - 'a' + 10;
+		else
+			break;
+
+		v = v * base + c;
+	}
+
+	*out = v;
+	return digits ? s : NULL;
+}
+
+/*
+ * The kernel prints every CRC as "%8u %8x %8x %8x %8x %8x\n", so a single
+ * pass over the line is all it takes.
+ */
 static bool pipe_crc_init_from_string(igt_crc_t *crc, const char *line)
 {
-	int n;
+	int i;
 
 	crc->n_words = 5;
-	n = sscanf(line, "%8u %8x %8x %8x %8x %8x", &crc->frame, &crc->crc[0],
-		   &crc->crc[1], &crc->crc[2], &crc->crc[3], &crc->crc[4]);
-	return n == 6;
+
+	line = parse_field(line, 10, &crc->frame);
+	for (i = 0; line && i < crc->n_words; i++)
+		line = parse_field(line, 16, &crc->crc[i]);
+
+	return line && (*line == '\n' || *line == '\0');
 }
 
-static int read_crc(igt_pipe_crc_t *pipe_crc, igt_crc_t *out)
+/*
+ * The kernel only ever hands out whole lines, as many as fit into the
+ * buffer, so one read() drains up to @max pending CRCs. Malformed lines are
+ * dropped. Returns the number of CRCs stored in @out, -EINVAL if only
+ * malformed lines were read, or a negative errno. Never asserts, so that it
+ * can be used from the capture thread.
+ */
+static int read_crcs(igt_pipe_crc_t *pipe_crc, igt_crc_t *out, int max)
 {
+	char buf[PIPE_CRC_READ_LINES * PIPE_CRC_LINE_LEN + 1];
 	ssize_t bytes_read;
-	char buf[pipe_crc->buffer_len];
+	int i, n;
+
+	if (max > PIPE_CRC_READ_LINES)
+		max = PIPE_CRC_READ_LINES;
+
+	bytes_read = read(pipe_crc->crc_fd, buf, max * pipe_crc->line_len);
+	if (bytes_read < 0)
+		return -errno;
+	if (bytes_read % pipe_crc->line_len)
+		return -EIO;
+	buf[bytes_read] = '\0';
+
+	for (i = n = 0; i < bytes_read; i += pipe_crc->line_len)
+		n += pipe_crc_init_from_string(&out[n], buf + i);
+
+	return n || !bytes_read ? n : -EINVAL;
+}
+
+static int read_crc(igt_pipe_crc_t *pipe_crc, igt_crc_t *out)
+{
+	int ret;
 
 	igt_set_timeout(5, "CRC reading");
-	bytes_read = read(pipe_crc->crc_fd, &buf, pipe_crc->line_len);
+	ret = read_crcs(pipe_crc, out, 1);
 	igt_reset_timeout();
 
-	if (bytes_read < 0 && errno == EAGAIN) {
+	if (ret == -EAGAIN) {
 		igt_assert(pipe_crc->flags & O_NONBLOCK);
-		bytes_read = 0;
+		ret = 0;
 	} else {
-		igt_assert_eq(bytes_read, pipe_crc->line_len);
+		igt_assert_f(ret == 1 || ret == -EINVAL,
+			     "CRC read failed: %d\n", ret);
 	}
-	buf[bytes_read] = '\0';
 
-	if (bytes_read && !pipe_crc_init_from_string(out, buf))
-		return -EINVAL;
-
-	return bytes_read;
+	return ret;
 }
 
 static void read_one_crc(igt_pipe_crc_t *pipe_crc, igt_crc_t *out)
 {
-	while (read_crc(pipe_crc, out) == 0)
-		usleep(1000);
+	struct pollfd pfd = { .fd = pipe_crc->crc_fd, .events = POLLIN };
+	bool polled = false;
+
+	while (read_crc(pipe_crc, out) == 0) {
+		/*
+		 * Kernels without poll support on the CRC files report them
+		 * as always readable, so nap rather than spin when a read
+		 * still finds nothing after poll() said there was something.
+		 */
+		if (polled)
+			usleep(1000);
+
+		igt_assert_f(poll(&pfd, 1, 5000) == 1, "CRC reading timed out\n");
+		polled = true;
+	}
 }
 
 /**
@@ -588,16 +667,23 @@ igt_pipe_crc_get_crcs(igt_pipe_crc_t *pipe_crc, int n_crcs,
 	crcs = calloc(n_crcs, sizeof(igt_crc_t));
 
 	do {
-		igt_crc_t *crc = &crcs[n];
 		int ret;
 
-		ret = read_crc(pipe_crc, crc);
-		if (ret < 0)
+		igt_set_timeout(5, "CRC reading");
+		ret = read_crcs(pipe_crc, crcs + n, n_crcs - n);
+		igt_reset_timeout();
+
+		if (ret == -EINVAL)
 			continue;
+		if (ret == -EAGAIN) {
+			igt_assert(pipe_crc->flags & O_NONBLOCK);
+			break;
+		}
+		igt_assert_f(ret >= 0, "CRC read failed: %d\n", ret);
 		if (ret == 0)
 			break;
 
-		n++;
+		n += ret;
 	} while (n < n_crcs);
 
 	*out_crcs = crcs;
@@ -651,6 +737,358 @@ void igt_pipe_crc_collect_crc(igt_pipe_crc_t *pipe_crc, igt_crc_t *out_crc)
 	crc_sanity_checks(out_crc);
 }
 
+/*
+ * Multi-pipe CRC capture
+ */
+
+struct crc_capture_pipe {
+	igt_pipe_crc_t *pipe_crc;
+	int fd_flags;
+	int skip;
+
+	/* power-of-two ring, head and tail are free-running counters */
+	igt_crc_t *ring;
+	unsigned int size;
+	unsigned int head;
+	unsigned int tail;
+};
+
+struct _igt_crc_capture {
+	struct crc_capture_pipe pipes[I915_MAX_PIPES];
+	int num_pipes;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int wake[2];
+	bool running;
+	int error;
+};
+
+static struct crc_capture_pipe *
+crc_capture_find(igt_crc_capture_t *cap, igt_pipe_crc_t *pipe_crc)
+{
+	int i;
+
+	for (i = 0; i < cap->num_pipes; i++)
+		if (cap->pipes[i].pipe_crc == pipe_crc)
+			return &cap->pipes[i];
+
+	return NULL;
+}
+
+static bool crc_capture_push(struct crc_capture_pipe *p,
+			     const igt_crc_t *crcs, int count)
+{
+	while (count && p->skip) {
+		crcs++;
+		count--;
+		p->skip--;
+	}
+
+	while (count--) {
+		if (p->head - p->tail == p->size) {
+			unsigned int size = p->size ? 2 * p->size : 256;
+			igt_crc_t *ring;
+			unsigned int i;
+
+			ring = malloc(size * sizeof(*ring));
+			if (!ring)
+				return false;
+
+			for (i = 0; i < p->size; i++)
+				ring[i] = p->ring[(p->tail + i) & (p->size - 1)];
+
+			free(p->ring);
+			p->ring = ring;
+			p->tail = 0;
+			p->head = p->size;
+			p->size = size;
+		}
+
+		p->ring[p->head++ & (p->size - 1)] = *crcs++;
+	}
+
+	return true;
+}
+
+static void *crc_capture_thread(void *data)
+{
+	igt_crc_capture_t *cap = data;
+	struct pollfd pfd[I915_MAX_PIPES + 1];
+	igt_crc_t crcs[PIPE_CRC_READ_LINES];
+	int error = 0;
+	int i;
+
+	for (i = 0; i < cap->num_pipes; i++) {
+		pfd[i].fd = cap->pipes[i].pipe_crc->crc_fd;
+		pfd[i].events = POLLIN;
+	}
+	pfd[i].fd = cap->wake[0];
+	pfd[i].events = POLLIN;
+
+	while (!error) {
+		bool idle = true;
+
+		if (poll(pfd, cap->num_pipes + 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			error = -errno;
+			break;
+		}
+
+		if (pfd[cap->num_pipes].revents)
+			break;
+
+		for (i = 0; i < cap->num_pipes && !error; i++) {
+			struct crc_capture_pipe *p = &cap->pipes[i];
+			int n;
+
+			if (!pfd[i].revents)
+				continue;
+
+			/* An empty read means the source is off or at EOF */
+			n = read_crcs(p->pipe_crc, crcs, ARRAY_SIZE(crcs));
+			if (n == 0 || n == -EAGAIN || n == -EINVAL)
+				continue;
+			if (n < 0) {
+				error = n;
+				break;
+			}
+
+			pthread_mutex_lock(&cap->mutex);
+			if (!crc_capture_push(p, crcs, n))
+				error = -ENOMEM;
+			pthread_cond_broadcast(&cap->cond);
+			pthread_mutex_unlock(&cap->mutex);
+
+			idle = false;
+		}
+
+		/*
+		 * Kernels without poll support on the CRC files report them
+		 * as always readable, as do disabled or exhausted sources.
+		 * Don't spin on those, but nap on the wakeup pipe for a
+		 * fraction of a frame instead.
+		 */
+		if (idle && !error &&
+		    poll(&pfd[cap->num_pipes], 1, 1) > 0)
+			break;
+	}
+
+	pthread_mutex_lock(&cap->mutex);
+	cap->error = error;
+	pthread_cond_broadcast(&cap->cond);
+	pthread_mutex_unlock(&cap->mutex);
+
+	return NULL;
+}
+
+/**
+ * igt_crc_capture_new:
+ *
+ * Allocates a capture engine which collects the CRCs of several pipes in the
+ * background. Pipes are attached with igt_crc_capture_add() before the
+ * capture is started with igt_crc_capture_start().
+ *
+ * Returns: A new CRC capture object.
+ */
+igt_crc_capture_t *igt_crc_capture_new(void)
+{
+	igt_crc_capture_t *cap;
+
+	cap = calloc(1, sizeof(*cap));
+	igt_assert(cap);
+
+	pthread_mutex_init(&cap->mutex, NULL);
+	pthread_cond_init(&cap->cond, NULL);
+	cap->wake[0] = cap->wake[1] = -1;
+
+	return cap;
+}
+
+/**
+ * igt_crc_capture_add:
+ * @cap: CRC capture object
+ * @pipe_crc: pipe CRC object
+ *
+ * Attaches @pipe_crc to @cap. The CRC file of @pipe_crc is switched to
+ * non-blocking mode for as long as it is attached, and @pipe_crc must not be
+ * read directly while the capture is running.
+ */
+void igt_crc_capture_add(igt_crc_capture_t *cap, igt_pipe_crc_t *pipe_crc)
+{
+	struct crc_capture_pipe *p;
+
+	igt_assert(!cap->running);
+	igt_assert(!crc_capture_find(cap, pipe_crc));
+	igt_assert(cap->num_pipes < I915_MAX_PIPES);
+
+	p = &cap->pipes[cap->num_pipes++];
+	p->pipe_crc = pipe_crc;
+	p->fd_flags = fcntl(pipe_crc->crc_fd, F_GETFL);
+	igt_assert(p->fd_flags != -1);
+	igt_assert(fcntl(pipe_crc->crc_fd, F_SETFL,
+			 p->fd_flags | O_NONBLOCK) == 0);
+}
+
+/**
+ * igt_crc_capture_start:
+ * @cap: CRC capture object
+ *
+ * Starts CRC generation on all pipes attached to @cap and spawns the thread
+ * collecting them. As with igt_pipe_crc_start() the first two CRCs of each
+ * pipe are discarded.
+ */
+void igt_crc_capture_start(igt_crc_capture_t *cap)
+{
+	int i;
+
+	igt_assert(!cap->running);
+	igt_assert(cap->num_pipes);
+
+	for (i = 0; i < cap->num_pipes; i++) {
+		struct crc_capture_pipe *p = &cap->pipes[i];
+
+		igt_assert(igt_pipe_crc_do_start(p->pipe_crc));
+		p->skip = 2;
+	}
+
+	igt_assert(pipe(cap->wake) == 0);
+	cap->error = 0;
+	igt_assert(pthread_create(&cap->thread, NULL,
+				  crc_capture_thread, cap) == 0);
+	cap->running = true;
+}
+
+/**
+ * igt_crc_capture_stop:
+ * @cap: CRC capture object
+ *
+ * Stops the capture thread and CRC generation on all pipes attached to @cap.
+ * CRCs collected so far can still be retrieved with igt_crc_capture_get().
+ */
+void igt_crc_capture_stop(igt_crc_capture_t *cap)
+{
+	int i;
+
+	if (!cap->running)
+		return;
+
+	igt_assert(write(cap->wake[1], "", 1) == 1);
+	pthread_join(cap->thread, NULL);
+	cap->running = false;
+
+	close(cap->wake[0]);
+	close(cap->wake[1]);
+	cap->wake[0] = cap->wake[1] = -1;
+
+	for (i = 0; i < cap->num_pipes; i++)
+		igt_pipe_crc_stop(cap->pipes[i].pipe_crc);
+}
+
+/**
+ * igt_crc_capture_free:
+ * @cap: CRC capture object
+ *
+ * Stops @cap if still running, restores the blocking mode of all attached
+ * pipe CRC objects and frees all resources associated with @cap. The pipe
+ * CRC objects themselves are not freed.
+ */
+void igt_crc_capture_free(igt_crc_capture_t *cap)
+{
+	int i;
+
+	if (!cap)
+		return;
+
+	igt_crc_capture_stop(cap);
+
+	for (i = 0; i < cap->num_pipes; i++) {
+		struct crc_capture_pipe *p = &cap->pipes[i];
+
+		fcntl(p->pipe_crc->crc_fd, F_SETFL, p->fd_flags);
+		free(p->ring);
+	}
+
+	pthread_cond_destroy(&cap->cond);
+	pthread_mutex_destroy(&cap->mutex);
+	free(cap);
+}
+
+/**
+ * igt_crc_capture_get:
+ * @cap: CRC capture object
+ * @pipe_crc: pipe CRC object attached to @cap
+ * @out_crcs: buffer for the captured CRC values, allocated by the caller
+ * @max: size of @out_crcs
+ *
+ * Moves up to @max CRCs collected for @pipe_crc so far into @out_crcs, oldest
+ * first. This function never blocks; use igt_crc_capture_wait() to wait for
+ * more CRCs to arrive.
+ *
+ * Returns: The number of CRCs stored in @out_crcs.
+ */
+int igt_crc_capture_get(igt_crc_capture_t *cap, igt_pipe_crc_t *pipe_crc,
+			igt_crc_t *out_crcs, int max)
+{
+	struct crc_capture_pipe *p = crc_capture_find(cap, pipe_crc);
+	int error, n;
+
+	igt_assert(p);
+
+	pthread_mutex_lock(&cap->mutex);
+	for (n = 0; n < max && p->tail != p->head; n++)
+		out_crcs[n] = p->ring[p->tail++ & (p->size - 1)];
+	error = cap->error;
+	pthread_mutex_unlock(&cap->mutex);
+
+	igt_assert_f(error == 0, "CRC capture failed: %s\n", strerror(-error));
+
+	return n;
+}
+
+/**
+ * igt_crc_capture_wait:
+ * @cap: CRC capture object
+ * @pipe_crc: pipe CRC object attached to @cap
+ * @n_crcs: number of CRCs to wait for
+ *
+ * Blocks until at least @n_crcs CRCs are pending for @pipe_crc. Fails the
+ * test if no new CRC arrives for 5 seconds.
+ */
+void igt_crc_capture_wait(igt_crc_capture_t *cap, igt_pipe_crc_t *pipe_crc,
+			  int n_crcs)
+{
+	struct crc_capture_pipe *p = crc_capture_find(cap, pipe_crc);
+	bool timedout = false;
+	int error;
+
+	igt_assert(p);
+	igt_assert(cap->running);
+
+	pthread_mutex_lock(&cap->mutex);
+	while (p->head - p->tail < (unsigned int)n_crcs &&
+	       cap->error == 0 && !timedout) {
+		unsigned int head = p->head;
+		struct timespec ts;
+
+		/* the timeout restarts whenever a new CRC arrives */
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 5;
+
+		while (p->head == head && cap->error == 0 && !timedout)
+			timedout = pthread_cond_timedwait(&cap->cond,
+							  &cap->mutex,
+							  &ts) == ETIMEDOUT;
+	}
+	error = cap->error;
+	pthread_mutex_unlock(&cap->mutex);
+
+	igt_assert_f(error == 0, "CRC capture failed: %s\n", strerror(-error));
+	igt_assert_f(!timedout, "CRC reading timed out\n");
+}
+
 /*
  * Drop caches
  */
@@ -125,6 +125,24 @@ int igt_pipe_crc_get_crcs(igt_pipe_crc_t *pipe_crc, int n_crcs,
 			  igt_crc_t **out_crcs);
 void igt_pipe_crc_collect_crc(igt_pipe_crc_t *pipe_crc, igt_crc_t *out_crc);
 
+/**
+ * igt_crc_capture_t:
+ *
+ * Opaque structure collecting the CRCs of several #igt_pipe_crc_t objects in
+ * a background thread. Needs to be allocated with igt_crc_capture_new().
+ */
+typedef struct _igt_crc_capture igt_crc_capture_t;
+
+igt_crc_capture_t *igt_crc_capture_new(void);
+void igt_crc_capture_add(igt_crc_capture_t *cap, igt_pipe_crc_t *pipe_crc);
+void igt_crc_capture_start(igt_crc_capture_t *cap);
+void igt_crc_capture_stop(igt_crc_capture_t *cap);
+void igt_crc_capture_free(igt_crc_capture_t *cap);
+int igt_crc_capture_get(igt_crc_capture_t *cap, igt_pipe_crc_t *pipe_crc,
+			igt_crc_t *out_crcs, int max);
+void igt_crc_capture_wait(igt_crc_capture_t *cap, igt_pipe_crc_t *pipe_crc,
+			  int n_crcs);
+
 /*
  * Drop caches
  */
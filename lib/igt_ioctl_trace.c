@@ -0,0 +1,617 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "drmtest.h"
+#include "i915_drm.h"
+#include "igt_core.h"
+#include "igt_ioctl_trace.h"
+#include "ioctl_wrappers.h"
+
+/**
+ * SECTION:igt_ioctl_trace
+ * @short_description: ioctl counters and latency histograms
+ * @title: ioctl tracing
+ * @include: igt.h
+ *
+ * Every ioctl issued through igt_ioctl() (and so through all of the
+ * ioctl_wrappers helpers) can be counted per request type, together with
+ * the bytes it moved and a log2 histogram of its latency. Tracing is off
+ * by default and costs a single branch then; it is switched on either by
+ * igt_ioctl_trace_enable() or by setting IGT_IOCTL_TRACE in the
+ * environment:
+ *
+ * |[
+ *	IGT_IOCTL_TRACE=- ./gem_exec_nop --run-subtest basic
+ * ]|
+ *
+ * The value names the file the statistics are appended to when the
+ * process exits, "-" being stderr. igt_ioctl_trace_snapshot() and
+ * igt_ioctl_trace_dump() give access to them at any point before that.
+ *
+ * Each thread records into its own table, so the hot path takes no locks
+ * and shares no cachelines; a snapshot sums up the tables of all the
+ * threads that have traced so far. When a thread exits, its table is
+ * folded into a common one for the exited threads and freed.
+ */
+
+/* per thread, a power of two; one extra slot collects the overflow */
+#define TRACE_SLOTS 64
+#define TRACE_OVERFLOW (~0ul)
+
+struct trace_slot {
+	unsigned long request; /* 0 until claimed, published last */
+	uint64_t count;
+	uint64_t errors;
+	uint64_t bytes;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t hist[IGT_IOCTL_TRACE_BUCKETS];
+};
+
+struct trace_thread {
+	struct trace_thread *next;
+	struct trace_slot slot[TRACE_SLOTS + 1];
+};
+
+bool __igt_ioctl_tracing;
+
+/* the live tables, and the exited threads summed up, under trace_lock */
+static struct trace_thread *trace_threads;
+static struct trace_thread trace_retired;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+static __thread struct trace_thread *trace_thread;
+static char *trace_dump_path;
+static pid_t trace_pid;
+
+static const struct {
+	unsigned long request;
+	const char *name;
+} trace_names[] = {
+#define CORE(x) { DRM_IOCTL_##x, #x }
+#define I915(x) { DRM_IOCTL_I915_##x, "I915_" #x }
+	CORE(VERSION),
+	CORE(GET_CAP),
+	CORE(SET_CLIENT_CAP),
+	CORE(GEM_CLOSE),
+	CORE(GEM_FLINK),
+	CORE(GEM_OPEN),
+	CORE(PRIME_HANDLE_TO_FD),
+	CORE(PRIME_FD_TO_HANDLE),
+	CORE(WAIT_VBLANK),
+	CORE(MODE_GETRESOURCES),
+	CORE(MODE_GETCRTC),
+	CORE(MODE_SETCRTC),
+	CORE(MODE_CURSOR),
+	CORE(MODE_GETENCODER),
+	CORE(MODE_GETCONNECTOR),
+	CORE(MODE_GETPROPERTY),
+	CORE(MODE_SETPROPERTY),
+	CORE(MODE_GETPROPBLOB),
+	CORE(MODE_ADDFB),
+	CORE(MODE_ADDFB2),
+	CORE(MODE_RMFB),
+	CORE(MODE_PAGE_FLIP),
+	CORE(MODE_DIRTYFB),
+	CORE(MODE_CREATE_DUMB),
+	CORE(MODE_MAP_DUMB),
+	CORE(MODE_DESTROY_DUMB),
+	CORE(MODE_GETPLANERESOURCES),
+	CORE(MODE_GETPLANE),
+	CORE(MODE_SETPLANE),
+	CORE(MODE_OBJ_GETPROPERTIES),
+	CORE(MODE_OBJ_SETPROPERTY),
+	CORE(MODE_CURSOR2),
+#ifdef DRM_IOCTL_MODE_ATOMIC
+	CORE(MODE_ATOMIC),
+	CORE(MODE_CREATEPROPBLOB),
+	CORE(MODE_DESTROYPROPBLOB),
+#endif
+	I915(GETPARAM),
+	I915(SETPARAM),
+	I915(GEM_EXECBUFFER2),
+	I915(GEM_BUSY),
+	I915(GEM_THROTTLE),
+	I915(GEM_CREATE),
+	I915(GEM_PREAD),
+	I915(GEM_PWRITE),
+	I915(GEM_MMAP),
+	I915(GEM_MMAP_GTT),
+	I915(GEM_SET_DOMAIN),
+	I915(GEM_SW_FINISH),
+	I915(GEM_SET_TILING),
+	I915(GEM_GET_TILING),
+	I915(GEM_GET_APERTURE),
+	I915(GEM_MADVISE),
+	I915(GEM_WAIT),
+	I915(GEM_SET_CACHING),
+	I915(GEM_GET_CACHING),
+	I915(GEM_CONTEXT_CREATE),
+	I915(GEM_CONTEXT_DESTROY),
+	I915(GET_PIPE_FROM_CRTC_ID),
+	I915(GET_SPRITE_COLORKEY),
+	I915(SET_SPRITE_COLORKEY),
+	I915(REG_READ),
+	I915(GET_RESET_STATS),
+	{ LOCAL_IOCTL_I915_GEM_USERPTR, "I915_GEM_USERPTR" },
+#undef I915
+#undef CORE
+};
+
+static const char *trace_name(unsigned long request)
+{
+	int i;
+
+	if (request == TRACE_OVERFLOW)
+		return "(other)";
+
+	for (i = 0; i < ARRAY_SIZE(trace_names); i++)
+		if (trace_names[i].request == request)
+			return trace_names[i].name;
+
+	return NULL;
+}
+
+static uint64_t trace_bytes(unsigned long request, const void *arg)
+{
+	switch (request) {
+	case DRM_IOCTL_I915_GEM_PREAD:
+		return ((const struct drm_i915_gem_pread *)arg)->size;
+	case DRM_IOCTL_I915_GEM_PWRITE:
+		return ((const struct drm_i915_gem_pwrite *)arg)->size;
+	case DRM_IOCTL_I915_GEM_EXECBUFFER2:
+		return ((const struct drm_i915_gem_execbuffer2 *)arg)->batch_len;
+	default:
+		return 0;
+	}
+}
+
+static int trace_bucket(uint64_t ns)
+{
+	int bucket;
+
+	if (ns <= 1)
+		return 0;
+
+	bucket = 63 - __builtin_clzll(ns);
+	if (bucket >= IGT_IOCTL_TRACE_BUCKETS)
+		bucket = IGT_IOCTL_TRACE_BUCKETS - 1;
+
+	return bucket;
+}
+
+static struct trace_slot *
+trace_slot_get(struct trace_thread *thread, unsigned long request)
+{
+	unsigned int idx = _IOC_NR(request) ^ _IOC_SIZE(request);
+	struct trace_slot *slot;
+	int n;
+
+	for (n = 0; n < TRACE_SLOTS; n++, idx++) {
+		slot = &thread->slot[idx & (TRACE_SLOTS - 1)];
+
+		if (slot->request == request)
+			return slot;
+
+		/* only the owner claims slots, readers skip unpublished ones */
+		if (!slot->request) {
+			__atomic_store_n(&slot->request, request,
+					 __ATOMIC_RELEASE);
+			return slot;
+		}
+	}
+
+	slot = &thread->slot[TRACE_SLOTS];
+	if (!slot->request)
+		__atomic_store_n(&slot->request, TRACE_OVERFLOW,
+				 __ATOMIC_RELEASE);
+	return slot;
+}
+
+/* single writer per slot; the atomic stores only stop readers seeing tears */
+static inline void trace_add(uint64_t *counter, uint64_t value)
+{
+	__atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static void trace_fold(struct trace_slot *dst, const struct trace_slot *src)
+{
+	int i;
+
+	trace_add(&dst->count, src->count);
+	trace_add(&dst->errors, src->errors);
+	trace_add(&dst->bytes, src->bytes);
+	trace_add(&dst->total_ns, src->total_ns);
+	if (src->max_ns > dst->max_ns)
+		__atomic_store_n(&dst->max_ns, src->max_ns, __ATOMIC_RELAXED);
+	for (i = 0; i < IGT_IOCTL_TRACE_BUCKETS; i++)
+		trace_add(&dst->hist[i], src->hist[i]);
+}
+
+/* Called at thread exit, and for the main thread at process exit */
+static void trace_thread_retire(void *data)
+{
+	struct trace_thread *thread = data, **prev;
+	struct trace_slot *dst;
+	int n;
+
+	pthread_mutex_lock(&trace_lock);
+
+	for (prev = &trace_threads; *prev != thread; prev = &(*prev)->next)
+		;
+	*prev = thread->next;
+
+	for (n = 0; n <= TRACE_SLOTS; n++) {
+		const struct trace_slot *slot = &thread->slot[n];
+
+		if (!slot->request)
+			continue;
+
+		if (n == TRACE_SLOTS) {
+			dst = &trace_retired.slot[TRACE_SLOTS];
+			__atomic_store_n(&dst->request, TRACE_OVERFLOW,
+					 __ATOMIC_RELEASE);
+		} else {
+			dst = trace_slot_get(&trace_retired, slot->request);
+		}
+		trace_fold(dst, slot);
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+
+	if (trace_thread == thread)
+		trace_thread = NULL;
+	free(thread);
+}
+
+static void trace_retire_at_exit(void)
+{
+	struct trace_thread *thread = trace_thread;
+
+	if (!thread)
+		return;
+
+	pthread_setspecific(trace_key, NULL);
+	trace_thread_retire(thread);
+}
+
+static void trace_setup(void)
+{
+	pthread_key_create(&trace_key, trace_thread_retire);
+	atexit(trace_retire_at_exit);
+}
+
+static struct trace_thread *trace_thread_get(void)
+{
+	struct trace_thread *thread = trace_thread;
+
+	if (thread)
+		return thread;
+
+	pthread_once(&trace_once, trace_setup);
+
+	thread = calloc(1, sizeof(*thread));
+	if (!thread)
+		return NULL;
+
+	pthread_mutex_lock(&trace_lock);
+	thread->next = trace_threads;
+	trace_threads = thread;
+	pthread_mutex_unlock(&trace_lock);
+
+	pthread_setspecific(trace_key, thread);
+
+	return trace_thread = thread;
+}
+
+/**
+ * __igt_ioctl_trace:
+ * @request: the ioctl request number
+ * @arg: the ioctl argument, after the call
+ * @ret: the return value of the ioctl
+ * @ns: its latency
+ *
+ * Records one ioctl into the calling thread's statistics. Called by the
+ * igt_ioctl() implementations when #__igt_ioctl_tracing is set.
+ */
+void __igt_ioctl_trace(unsigned long request, const void *arg,
+		       int ret, uint64_t ns)
+{
+	struct trace_thread *thread;
+	struct trace_slot *slot;
+
+	thread = trace_thread_get();
+	if (!thread)
+		return;
+
+	slot = trace_slot_get(thread, request);
+
+	trace_add(&slot->count, 1);
+	if (ret)
+		trace_add(&slot->errors, 1);
+	else if (arg)
+		trace_add(&slot->bytes, trace_bytes(request, arg));
+	trace_add(&slot->total_ns, ns);
+	if (ns > slot->max_ns)
+		__atomic_store_n(&slot->max_ns, ns, __ATOMIC_RELAXED);
+	trace_add(&slot->hist[trace_bucket(ns)], 1);
+}
+
+static FILE *trace_dump_open(const char *path)
+{
+	if (strcmp(path, "-") == 0)
+		return stderr;
+
+	return fopen(path, "a");
+}
+
+static void trace_exit_handler(void)
+{
+	FILE *file;
+
+	/* forked children inherit the parent's counts, leave it to report */
+	if (!trace_dump_path || getpid() != trace_pid)
+		return;
+
+	file = trace_dump_open(trace_dump_path);
+	if (!file)
+		return;
+
+	igt_ioctl_trace_dump(file);
+
+	if (file != stderr)
+		fclose(file);
+}
+
+/**
+ * igt_ioctl_trace_enable:
+ * @dump: where to write the statistics at exit, or NULL
+ *
+ * Starts tracing the ioctls issued through igt_ioctl() from all threads.
+ * If @dump is set, the statistics are appended to that file when the
+ * process exits, "-" meaning stderr. This is what setting IGT_IOCTL_TRACE
+ * in the environment does before main().
+ */
+void igt_ioctl_trace_enable(const char *dump)
+{
+	static bool registered;
+
+	if (dump) {
+		free(trace_dump_path);
+		trace_dump_path = strdup(dump);
+		trace_pid = getpid();
+
+		if (!registered) {
+			atexit(trace_exit_handler);
+			registered = true;
+		}
+	}
+
+	__atomic_store_n(&__igt_ioctl_tracing, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * igt_ioctl_trace_disable:
+ *
+ * Stops tracing ioctls. The statistics gathered so far are kept and are
+ * still dumped at exit if that was requested.
+ */
+void igt_ioctl_trace_disable(void)
+{
+	__atomic_store_n(&__igt_ioctl_tracing, false, __ATOMIC_RELEASE);
+}
+
+__attribute__((constructor))
+static void trace_init_from_env(void)
+{
+	const char *env = getenv("IGT_IOCTL_TRACE");
+
+	if (env && *env)
+		igt_ioctl_trace_enable(env);
+}
+
+static void trace_merge(igt_ioctl_stats_t *stats,
+			const struct trace_slot *slot)
+{
+	uint64_t max;
+	int i;
+
+	stats->count += __atomic_load_n(&slot->count, __ATOMIC_RELAXED);
+	stats->errors += __atomic_load_n(&slot->errors, __ATOMIC_RELAXED);
+	stats->bytes += __atomic_load_n(&slot->bytes, __ATOMIC_RELAXED);
+	stats->total_ns += __atomic_load_n(&slot->total_ns, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&slot->max_ns, __ATOMIC_RELAXED);
+	if (max > stats->max_ns)
+		stats->max_ns = max;
+
+	for (i = 0; i < IGT_IOCTL_TRACE_BUCKETS; i++)
+		stats->hist[i] += __atomic_load_n(&slot->hist[i],
+						  __ATOMIC_RELAXED);
+}
+
+/**
+ * igt_ioctl_trace_snapshot:
+ * @stats: array to fill in
+ * @max: the number of entries in @stats
+ *
+ * Sums up the statistics recorded so far by all threads, one entry per
+ * ioctl request. The threads may keep on tracing meanwhile, so the
+ * individual counters of an entry are only loosely consistent with each
+ * other. Subtracting two snapshots gives the activity in between.
+ *
+ * Returns: The number of entries stored in @stats, or -ENOSPC if more
+ * than @max distinct requests have been traced.
+ */
+int igt_ioctl_trace_snapshot(igt_ioctl_stats_t *stats, int max)
+{
+	struct trace_thread *thread;
+	int count = 0;
+
+	memset(stats, 0, max * sizeof(*stats));
+
+	pthread_mutex_lock(&trace_lock);
+	for (thread = &trace_retired; thread;
+	     thread = thread == &trace_retired ? trace_threads : thread->next) {
+		int n, i;
+
+		for (n = 0; n <= TRACE_SLOTS; n++) {
+			const struct trace_slot *slot = &thread->slot[n];
+			unsigned long request;
+
+			request = __atomic_load_n(&slot->request,
+						  __ATOMIC_ACQUIRE);
+			if (!request)
+				continue;
+
+			for (i = 0; i < count; i++)
+				if (stats[i].request == request)
+					break;
+
+			if (i == count) {
+				if (count == max) {
+					pthread_mutex_unlock(&trace_lock);
+					return -ENOSPC;
+				}
+
+				stats[count].request = request;
+				stats[count].name = trace_name(request);
+				count++;
+			}
+
+			trace_merge(&stats[i], slot);
+		}
+	}
+	pthread_mutex_unlock(&trace_lock);
+
+	return count;
+}
+
+/**
+ * igt_ioctl_stats_percentile:
+ * @stats: statistics of one request
+ * @percentile: between 0 and 1
+ *
+ * Estimates a latency percentile from the histogram of @stats. The result
+ * is the upper bound of the bucket the percentile falls into, so it is
+ * within a factor of two of the true value.
+ *
+ * Returns: The latency in nanoseconds.
+ */
+uint64_t igt_ioctl_stats_percentile(const igt_ioctl_stats_t *stats,
+				    double percentile)
+{
+	uint64_t total = 0, target, sum = 0;
+	int i;
+
+	for (i = 0; i < IGT_IOCTL_TRACE_BUCKETS; i++)
+		total += stats->hist[i];
+	if (!total)
+		return 0;
+
+	target = percentile * total + .5;
+	if (target < 1)
+		target = 1;
+
+	for (i = 0; i < IGT_IOCTL_TRACE_BUCKETS - 1; i++) {
+		sum += stats->hist[i];
+		if (sum >= target)
+			break;
+	}
+
+	if (i == IGT_IOCTL_TRACE_BUCKETS - 1 || 2ull << i > stats->max_ns)
+		return stats->max_ns;
+
+	return 2ull << i;
+}
+
+static int trace_cmp_total(const void *A, const void *B)
+{
+	const igt_ioctl_stats_t *a = A, *b = B;
+
+	if (a->total_ns != b->total_ns)
+		return a->total_ns < b->total_ns ? 1 : -1;
+
+	return a->count < b->count ? 1 : a->count > b->count ? -1 : 0;
+}
+
+/**
+ * igt_ioctl_trace_dump:
+ * @file: where to write
+ *
+ * Prints a table of the statistics gathered so far, the requests that
+ * took the most time in total first.
+ */
+void igt_ioctl_trace_dump(FILE *file)
+{
+	igt_ioctl_stats_t *stats = NULL;
+	int count, max = 0, i;
+
+	do {
+		free(stats);
+		max = max ? 2 * max : TRACE_SLOTS;
+		stats = malloc(max * sizeof(*stats));
+		if (!stats)
+			return;
+
+		count = igt_ioctl_trace_snapshot(stats, max);
+	} while (count == -ENOSPC);
+
+	qsort(stats, count, sizeof(*stats), trace_cmp_total);
+
+	fprintf(file, "ioctl trace of %s (pid %d):\n",
+		igt_test_name() ?: "?", (int)getpid());
+	fprintf(file, "%-28s %10s %8s %12s %10s %10s %10s %10s %14s\n",
+		"ioctl", "calls", "errors", "total ms",
+		"avg us", "p50 us", "p99 us", "max us", "bytes");
+
+	for (i = 0; i < count; i++) {
+		const igt_ioctl_stats_t *s = &stats[i];
+		char name[32];
+
+		if (s->name)
+			snprintf(name, sizeof(name), "%s", s->name);
+		else
+			snprintf(name, sizeof(name), "0x%08lx", s->request);
+
+		fprintf(file,
+			"%-28s %10"PRIu64" %8"PRIu64" %12.3f %10.2f %10.2f %10.2f %10.2f %14"PRIu64"\n",
+			name, s->count, s->errors, s->total_ns * 1e-6,
+			s->count ? s->total_ns * 1e-3 / s->count : 0.,
+			igt_ioctl_stats_percentile(s, .5) * 1e-3,
+			igt_ioctl_stats_percentile(s, .99) * 1e-3,
+			s->max_ns * 1e-3, s->bytes);
+	}
+
+	fflush(file);
+	free(stats);
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef IGT_IOCTL_TRACE_H
+#define IGT_IOCTL_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* bucket i counts latencies in [2^i, 2^(i+1)) ns, the last one is open */
+#define IGT_IOCTL_TRACE_BUCKETS 32
+
+/**
+ * igt_ioctl_stats_t:
+ * @request: the ioctl request number
+ * @name: symbolic name of @request, or NULL if unknown
+ * @count: number of calls
+ * @errors: number of calls that returned an error
+ * @bytes: data moved by pread, pwrite and execbuf (batch length)
+ * @total_ns: sum of the latencies
+ * @max_ns: the slowest call
+ * @hist: log2 latency histogram, see IGT_IOCTL_TRACE_BUCKETS
+ *
+ * Accumulated statistics for one ioctl request, as returned by
+ * igt_ioctl_trace_snapshot().
+ */
+typedef struct {
+	unsigned long request;
+	const char *name;
+	uint64_t count;
+	uint64_t errors;
+	uint64_t bytes;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t hist[IGT_IOCTL_TRACE_BUCKETS];
+} igt_ioctl_stats_t;
+
+extern bool __igt_ioctl_tracing;
+void __igt_ioctl_trace(unsigned long request, const void *arg,
+		       int ret, uint64_t ns);
+
+void igt_ioctl_trace_enable(const char *dump);
+void igt_ioctl_trace_disable(void);
+int igt_ioctl_trace_snapshot(igt_ioctl_stats_t *stats, int max);
+uint64_t igt_ioctl_stats_percentile(const igt_ioctl_stats_t *stats,
+				    double percentile);
+void igt_ioctl_trace_dump(FILE *file);
+
+#endif /* IGT_IOCTL_TRACE_H */
@@ -200,101 +200,252 @@ static const char *igt_connector_prop_names[IGT_NUM_CONNECTOR_PROPS] = {
 };
 
 /*
- * Retrieve all the properies specified in props_name and store them into
- * plane->atomic_props_plane.
+ * Property cache
+ *
+ * Looking up a property by name costs two ioctls for the object's property
+ * list plus one per property on it. Property definitions are shared between
+ * objects and never change, so igt_display_t keeps them, together with each
+ * object's property list, until the cache is invalidated.
  */
-static void
-igt_atomic_fill_plane_props(igt_display_t *display, igt_plane_t *plane,
-			int num_props, const char **prop_names)
+
+struct igt_kms_object_props {
+	uint32_t id;
+	uint32_t type;
+	int count;
+	drmModePropertyPtr *props;	/* points into igt_kms_prop_cache.props */
+	uint64_t *values;		/* values when the object was looked up */
+};
+
+struct igt_kms_prop_cache {
+	struct igt_kms_object_props *objects;
+	int num_objects;
+
+	drmModePropertyPtr *props;
+	int num_props;
+
+	unsigned int hotplug_serial;
+};
+
+/*
+ * Bumped by the helpers that force a hotplug, kmstest_force_connector() and
+ * kmstest_force_edid(), so that every display drops its property cache
+ * before the next lookup.
+ */
+static unsigned int kms_hotplug_serial;
+
+static drmModePropertyPtr prop_cache_get_prop(igt_display_t *display,
+					      uint32_t prop_id)
 {
-	drmModeObjectPropertiesPtr props;
-	int i, j, fd;
+	struct igt_kms_prop_cache *cache = display->prop_cache;
+	drmModePropertyPtr prop;
+	int i;
 
-	fd = display->drm_fd;
+	for (i = 0; i < cache->num_props; i++)
+		if (cache->props[i]->prop_id == prop_id)
+			return cache->props[i];
 
-	props = drmModeObjectGetProperties(fd, plane->drm_plane->plane_id, DRM_MODE_OBJECT_PLANE);
-	igt_assert(props);
+	prop = drmModeGetProperty(display->drm_fd, prop_id);
+	if (!prop)
+		return NULL;
 
-	for (i = 0; i < props->count_props; i++) {
-		drmModePropertyPtr prop =
-			drmModeGetProperty(fd, props->props[i]);
+	cache->props = realloc(cache->props,
+			       (cache->num_props + 1) * sizeof(*cache->props));
+	igt_assert(cache->props);
+	cache->props[cache->num_props++] = prop;
 
-		for (j = 0; j < num_props; j++) {
-			if (strcmp(prop->name, prop_names[j]) != 0)
-				continue;
+	return prop;
+}
 
-			plane->atomic_props_plane[j] = props->props[i];
-			break;
-		}
+static struct igt_kms_object_props *
+prop_cache_get_object(igt_display_t *display,
+		      uint32_t object_id, uint32_t object_type)
+{
+	struct igt_kms_prop_cache *cache = display->prop_cache;
+	struct igt_kms_object_props *obj;
+	drmModeObjectPropertiesPtr proplist;
+	int i;
 
-		drmModeFreeProperty(prop);
+	if (cache && cache->hotplug_serial != kms_hotplug_serial) {
+		igt_display_invalidate_properties(display);
+		cache = NULL;
 	}
 
-	drmModeFreeObjectProperties(props);
+	if (!cache) {
+		cache = display->prop_cache = calloc(1, sizeof(*cache));
+		igt_assert(cache);
+		cache->hotplug_serial = kms_hotplug_serial;
+	}
+
+	for (i = 0; i < cache->num_objects; i++) {
+		obj = &cache->objects[i];
+		if (obj->id == object_id && obj->type == object_type)
+			return obj;
+	}
+
+	proplist = drmModeObjectGetProperties(display->drm_fd,
+					      object_id, object_type);
+	if (!proplist)
+		return NULL;
+
+	cache->objects = realloc(cache->objects,
+				 (cache->num_objects + 1) * sizeof(*obj));
+	igt_assert(cache->objects);
+	obj = &cache->objects[cache->num_objects++];
+
+	obj->id = object_id;
+	obj->type = object_type;
+	obj->count = 0;
+	obj->props = calloc(proplist->count_props, sizeof(*obj->props));
+	obj->values = calloc(proplist->count_props, sizeof(*obj->values));
+	igt_assert(!proplist->count_props || (obj->props && obj->values));
+
+	for (i = 0; i < proplist->count_props; i++) {
+		drmModePropertyPtr prop;
+
+		prop = prop_cache_get_prop(display, proplist->props[i]);
+		if (!prop)
+			continue;
+
+		obj->props[obj->count] = prop;
+		obj->values[obj->count] = proplist->prop_values[i];
+		obj->count++;
+	}
+
+	drmModeFreeObjectProperties(proplist);
+	return obj;
 }
 
-/*
- * Retrieve all the properies specified in props_name and store them into
- * config->atomic_props_crtc and config->atomic_props_connector.
- */
-static void
-igt_atomic_fill_connector_props(igt_display_t *display, igt_output_t *output,
-			int num_connector_props, const char **conn_prop_names)
+static void prop_cache_invalidate_object(igt_display_t *display,
+					 uint32_t object_id,
+					 uint32_t object_type)
 {
-	drmModeObjectPropertiesPtr props;
-	int i, j, fd;
+	struct igt_kms_prop_cache *cache = display->prop_cache;
+	int i;
 
-	fd = display->drm_fd;
+	if (!cache)
+		return;
 
-	props = drmModeObjectGetProperties(fd, output->config.connector->connector_id, DRM_MODE_OBJECT_CONNECTOR);
-	igt_assert(props);
+	for (i = 0; i < cache->num_objects; i++) {
+		struct igt_kms_object_props *obj = &cache->objects[i];
 
-	for (i = 0; i < props->count_props; i++) {
-		drmModePropertyPtr prop =
-			drmModeGetProperty(fd, props->props[i]);
+		if (obj->id != object_id || obj->type != object_type)
+			continue;
 
-		for (j = 0; j < num_connector_props; j++) {
-			if (strcmp(prop->name, conn_prop_names[j]) != 0)
-				continue;
+		free(obj->props);
+		free(obj->values);
+		*obj = cache->objects[--cache->num_objects];
+		return;
+	}
+}
 
-			output->config.atomic_props_connector[j] = props->props[i];
-			break;
-		}
+/**
+ * igt_display_invalidate_properties:
+ * @display: a pointer to an #igt_display_t structure
+ *
+ * Drops all property definitions and per-object property lists cached by
+ * @display. They are looked up again from the kernel on next use. Property
+ * pointers returned by igt_display_get_property() become invalid.
+ *
+ * This happens automatically after kmstest_force_connector() and
+ * kmstest_force_edid(), and for a connector whose connection status changed
+ * when the outputs are refreshed. Tests must call this themselves after any
+ * other hotplug, e.g. a physical one.
+ */
+void igt_display_invalidate_properties(igt_display_t *display)
+{
+	struct igt_kms_prop_cache *cache = display->prop_cache;
+	int i;
+
+	if (!cache)
+		return;
 
-		drmModeFreeProperty(prop);
+	for (i = 0; i < cache->num_objects; i++) {
+		free(cache->objects[i].props);
+		free(cache->objects[i].values);
 	}
+	free(cache->objects);
 
-	drmModeFreeObjectProperties(props);
+	for (i = 0; i < cache->num_props; i++)
+		drmModeFreeProperty(cache->props[i]);
+	free(cache->props);
+
+	free(cache);
+	display->prop_cache = NULL;
 }
 
-static void
-igt_atomic_fill_pipe_props(igt_display_t *display, igt_pipe_t *pipe,
-			int num_crtc_props, const char **crtc_prop_names)
+/**
+ * igt_display_get_property:
+ * @display: a pointer to an #igt_display_t structure
+ * @object_id: object whose properties we're going to get
+ * @object_type: type of obj_id (DRM_MODE_OBJECT_*)
+ * @name: name of the property we're going to get
+ * @prop_id: if not NULL, returns the property id
+ * @value: if not NULL, returns the property value
+ * @prop: if not NULL, returns the property, including its flags and enum
+ *        values. It is owned by @display and must not be freed.
+ *
+ * Like kmstest_get_property(), but served from the property cache of
+ * @display. Note that @value is the value the property had when the object
+ * was first looked up, which is only guaranteed to be current for immutable
+ * properties.
+ *
+ * Returns: true in case we found something.
+ */
+bool igt_display_get_property(igt_display_t *display,
+			      uint32_t object_id, uint32_t object_type,
+			      const char *name, uint32_t *prop_id /* out */,
+			      uint64_t *value /* out */,
+			      drmModePropertyPtr *prop /* out */)
 {
-	drmModeObjectPropertiesPtr props;
-	int i, j, fd;
+	struct igt_kms_object_props *obj;
+	int i;
+
+	obj = prop_cache_get_object(display, object_id, object_type);
+	if (!obj)
+		return false;
+
+	for (i = 0; i < obj->count; i++) {
+		if (strcmp(obj->props[i]->name, name) != 0)
+			continue;
+
+		if (prop_id)
+			*prop_id = obj->props[i]->prop_id;
+		if (value)
+			*value = obj->values[i];
+		if (prop)
+			*prop = obj->props[i];
+
+		return true;
+	}
 
-	fd = display->drm_fd;
+	return false;
+}
 
-	props = drmModeObjectGetProperties(fd, pipe->crtc_id, DRM_MODE_OBJECT_CRTC);
-	igt_assert(props);
+/*
+ * Retrieve all the properies specified in prop_names and store their ids
+ * into prop_ids, e.g. plane->atomic_props_plane.
+ */
+static void
+igt_atomic_fill_props(igt_display_t *display,
+		      uint32_t object_id, uint32_t object_type,
+		      int num_props, const char **prop_names,
+		      uint32_t *prop_ids)
+{
+	struct igt_kms_object_props *obj;
+	int i, j;
 
-	for (i = 0; i < props->count_props; i++) {
-		drmModePropertyPtr prop =
-			drmModeGetProperty(fd, props->props[i]);
+	obj = prop_cache_get_object(display, object_id, object_type);
+	igt_assert(obj);
 
-		for (j = 0; j < num_crtc_props; j++) {
-			if (strcmp(prop->name, crtc_prop_names[j]) != 0)
+	for (i = 0; i < obj->count; i++) {
+		for (j = 0; j < num_props; j++) {
+			if (strcmp(obj->props[i]->name, prop_names[j]) != 0)
 				continue;
 
-			pipe->atomic_props_crtc[j] = props->props[i];
+			prop_ids[j] = obj->props[i]->prop_id;
 			break;
 		}
-
-		drmModeFreeProperty(prop);
 	}
-
-	drmModeFreeObjectProperties(props);
 }
 
 const unsigned char* igt_kms_get_alt_edid(void)
@@ -699,6 +850,7 @@ bool kmstest_force_connector(int drm_fd, drmModeConnector *connector,
 	 * redetection here. */
 	temp = drmModeGetConnector(drm_fd, connector->connector_id);
 	drmModeFreeConnector(temp);
+	kms_hotplug_serial++;
 
 	return true;
 }
@@ -739,6 +891,7 @@ void kmstest_force_edid(int drm_fd, drmModeConnector *connector,
 	 * redetection here. */
 	temp = drmModeGetConnector(drm_fd, connector->connector_id);
 	drmModeFreeConnector(temp);
+	kms_hotplug_serial++;
 
 	igt_assert(ret != -1);
 }
@@ -1219,10 +1372,14 @@ static void igt_output_refresh(igt_output_t *output)
 	igt_display_t *display = output->display;
 	bool ret;
 	unsigned long crtc_idx_mask;
+	drmModeConnection connection = 0;
 
 	/* we mask out the pipes already in use */
 	crtc_idx_mask = output->pending_crtc_idx_mask & ~display->pipes_in_use;
 
+	if (output->config.connector)
+		connection = output->config.connector->connection;
+
 	kmstest_free_connector_config(&output->config);
 
 	ret = kmstest_get_connector_config(display->drm_fd,
@@ -1241,9 +1398,19 @@ static void igt_output_refresh(igt_output_t *output)
 			       -1);
 	}
 
-	if (output->config.connector)
-		igt_atomic_fill_connector_props(display, output,
-			IGT_NUM_CONNECTOR_PROPS, igt_connector_prop_names);
+	if (output->config.connector) {
+		/* a hotplug may have changed the connector's properties */
+		if (connection &&
+		    connection != output->config.connector->connection)
+			prop_cache_invalidate_object(display, output->id,
+						     DRM_MODE_OBJECT_CONNECTOR);
+
+		igt_atomic_fill_props(display, output->id,
+				      DRM_MODE_OBJECT_CONNECTOR,
+				      IGT_NUM_CONNECTOR_PROPS,
+				      igt_connector_prop_names,
+				      output->config.atomic_props_connector);
+	}
 
 	if (!output->valid)
 		return;
@@ -1258,12 +1425,13 @@ static void igt_output_refresh(igt_output_t *output)
 }
 
 static bool
-get_plane_property(int drm_fd, uint32_t plane_id, const char *name,
+get_plane_property(igt_display_t *display, uint32_t plane_id, const char *name,
 		   uint32_t *prop_id /* out */, uint64_t *value /* out */,
 		   drmModePropertyPtr *prop /* out */)
 {
-	return kmstest_get_property(drm_fd, plane_id, DRM_MODE_OBJECT_PLANE,
-				    name, prop_id, value, prop);
+	return igt_display_get_property(display, plane_id,
+					DRM_MODE_OBJECT_PLANE,
+					name, prop_id, value, prop);
 }
 
 static int
@@ -1277,12 +1445,13 @@ igt_plane_set_property(igt_plane_t *plane, uint32_t prop_id, uint64_t value)
 }
 
 static bool
-get_crtc_property(int drm_fd, uint32_t crtc_id, const char *name,
+get_crtc_property(igt_display_t *display, uint32_t crtc_id, const char *name,
 		   uint32_t *prop_id /* out */, uint64_t *value /* out */,
 		   drmModePropertyPtr *prop /* out */)
 {
-	return kmstest_get_property(drm_fd, crtc_id, DRM_MODE_OBJECT_CRTC,
-				    name, prop_id, value, prop);
+	return igt_display_get_property(display, crtc_id,
+					DRM_MODE_OBJECT_CRTC,
+					name, prop_id, value, prop);
 }
 
 static void
@@ -1297,12 +1466,12 @@ igt_crtc_set_property(igt_pipe_t *pipe, uint32_t prop_id, uint64_t value)
  * find a type property, then the kernel doesn't support universal
  * planes and we know the plane is an overlay/sprite.
  */
-static int get_drm_plane_type(int drm_fd, uint32_t plane_id)
+static int get_drm_plane_type(igt_display_t *display, uint32_t plane_id)
 {
 	uint64_t value;
 	bool has_prop;
 
-	has_prop = get_plane_property(drm_fd, plane_id, "type",
+	has_prop = get_plane_property(display, plane_id, "type",
 				      NULL /* prop_id */, &value, NULL);
 	if (has_prop)
 		return (int)value;
@@ -1358,29 +1527,32 @@ void igt_display_init(igt_display_t *display, int drm_fd)
 		pipe->display = display;
 		pipe->pipe = i;
 
-		get_crtc_property(display->drm_fd, pipe->crtc_id,
+		get_crtc_property(display, pipe->crtc_id,
 				    "background_color",
 				    &pipe->background_property,
 				    &prop_value,
 				    NULL);
 		pipe->background = (uint32_t)prop_value;
-		get_crtc_property(display->drm_fd, pipe->crtc_id,
+		get_crtc_property(display, pipe->crtc_id,
 				  "DEGAMMA_LUT",
 				  &pipe->degamma_property,
 				  NULL,
 				  NULL);
-		get_crtc_property(display->drm_fd, pipe->crtc_id,
+		get_crtc_property(display, pipe->crtc_id,
 				  "CTM",
 				  &pipe->ctm_property,
 				  NULL,
 				  NULL);
-		get_crtc_property(display->drm_fd, pipe->crtc_id,
+		get_crtc_property(display, pipe->crtc_id,
 				  "GAMMA_LUT",
 				  &pipe->gamma_property,
 				  NULL,
 				  NULL);
 
-		igt_atomic_fill_pipe_props(display, pipe, IGT_NUM_CRTC_PROPS, igt_crtc_prop_names);
+		igt_atomic_fill_props(display, pipe->crtc_id,
+				      DRM_MODE_OBJECT_CRTC,
+				      IGT_NUM_CRTC_PROPS, igt_crtc_prop_names,
+				      pipe->atomic_props_crtc);
 
 		/* add the planes that can be used with that pipe */
 		for (j = 0; j < plane_resources->count_planes; j++) {
@@ -1395,7 +1567,7 @@ void igt_display_init(igt_display_t *display, int drm_fd)
 				continue;
 			}
 
-			type = get_drm_plane_type(display->drm_fd,
+			type = get_drm_plane_type(display,
 						  plane_resources->planes[j]);
 			switch (type) {
 			case DRM_PLANE_TYPE_PRIMARY:
@@ -1429,10 +1601,15 @@ void igt_display_init(igt_display_t *display, int drm_fd)
 
 			if (is_atomic == 0) {
 				display->is_atomic = 1;
-				igt_atomic_fill_plane_props(display, plane, IGT_NUM_PLANE_PROPS, igt_plane_prop_names);
+				igt_atomic_fill_props(display,
+						      drm_plane->plane_id,
+						      DRM_MODE_OBJECT_PLANE,
+						      IGT_NUM_PLANE_PROPS,
+						      igt_plane_prop_names,
+						      plane->atomic_props_plane);
 			}
 
-			get_plane_property(display->drm_fd, drm_plane->plane_id,
+			get_plane_property(display, drm_plane->plane_id,
 					   "rotation",
 					   &plane->rotation_property,
 					   &prop_value,
@@ -1561,6 +1738,8 @@ void igt_display_fini(igt_display_t *display)
 		igt_output_fini(&display->outputs[i]);
 	free(display->outputs);
 	display->outputs = NULL;
+
+	igt_display_invalidate_properties(display);
 }
 
 static void igt_display_refresh(igt_display_t *display)
@@ -1655,10 +1834,10 @@ bool igt_pipe_get_property(igt_pipe_t *pipe, const char *name,
 			   uint32_t *prop_id, uint64_t *value,
 			   drmModePropertyPtr *prop)
 {
-	return get_crtc_property(pipe->display->drm_fd,
-				 pipe->crtc_id,
-				 name,
-				 prop_id, value, prop);
+	/* callers want the current value and own @prop, so bypass the cache */
+	return kmstest_get_property(pipe->display->drm_fd,
+				    pipe->crtc_id, DRM_MODE_OBJECT_CRTC,
+				    name, prop_id, value, prop);
 }
 
 static uint32_t igt_plane_get_fb_id(igt_plane_t *plane)
@@ -313,6 +313,7 @@ struct igt_display {
 	igt_pipe_t pipes[I915_MAX_PIPES];
 	bool has_universal_planes;
 	bool is_atomic;
+	struct igt_kms_prop_cache *prop_cache;
 };
 
 void igt_display_init(igt_display_t *display, int drm_fd);
@@ -323,6 +324,11 @@ int  igt_display_try_commit_atomic(igt_display_t *display, uint32_t flags, void
 void igt_display_commit_atomic(igt_display_t *display, uint32_t flags, void *user_data);
 int  igt_display_try_commit2(igt_display_t *display, enum igt_commit_style s);
 int  igt_display_get_n_pipes(igt_display_t *display);
+bool igt_display_get_property(igt_display_t *display,
+			      uint32_t object_id, uint32_t object_type,
+			      const char *name, uint32_t *prop_id,
+			      uint64_t *value, drmModePropertyPtr *prop);
+void igt_display_invalidate_properties(igt_display_t *display);
 
 const char *igt_output_name(igt_output_t *output);
 drmModeModeInfo *igt_output_get_mode(igt_output_t *output);
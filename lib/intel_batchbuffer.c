@@ -45,6 +45,9 @@
 
 #include <i915_drm.h>
 
+#define LOCAL_I915_EXEC_NO_RELOC (1<<11)
+#define LOCAL_I915_EXEC_HANDLE_LUT (1<<12)
+
 /**
  * SECTION:intel_batchbuffer
  * @short_description: Batchbuffer and blitter support
@@ -65,6 +68,131 @@
  * library as a dependency.
  */
 
+/*
+ * Softpin mode
+ *
+ * Objects are handed out addresses by a bump allocator and never move, so
+ * they are tracked in a small open-addressed set holding a reference each.
+ * Batches rotate through SOFTPIN_BATCHES pinned buffers instead of being
+ * allocated afresh, which would leak address space. The targets of the
+ * current batch are remembered to decide whether its execbuf can go without
+ * relocations.
+ */
+
+#define SOFTPIN_BATCHES 4
+
+struct intel_batchbuffer_softpin {
+	uint64_t next, end;
+
+	drm_intel_bo **bos;
+	unsigned int count, mask;
+
+	drm_intel_bo *batch[SOFTPIN_BATCHES];
+	unsigned int next_batch;
+
+	/* every relocation takes at least a dword of the batch */
+	drm_intel_bo *targets[BATCH_SZ / 4];
+	unsigned int num_targets;
+};
+
+static unsigned int softpin_hash(const drm_intel_bo *bo)
+{
+	return ((uintptr_t)bo >> 4) * 0x9e3779b1;
+}
+
+static bool softpin_insert(struct intel_batchbuffer_softpin *softpin,
+			   drm_intel_bo *bo)
+{
+	unsigned int i = softpin_hash(bo) & softpin->mask;
+
+	while (softpin->bos[i]) {
+		if (softpin->bos[i] == bo)
+			return false;
+		i = (i + 1) & softpin->mask;
+	}
+
+	softpin->bos[i] = bo;
+	softpin->count++;
+	return true;
+}
+
+static void softpin_grow(struct intel_batchbuffer_softpin *softpin)
+{
+	drm_intel_bo **old = softpin->bos;
+	unsigned int n, size = old ? softpin->mask + 1 : 0;
+
+	softpin->mask = size ? 2 * size - 1 : 63;
+	softpin->bos = calloc(softpin->mask + 1, sizeof(*softpin->bos));
+	igt_assert(softpin->bos);
+	softpin->count = 0;
+
+	for (n = 0; n < size; n++)
+		if (old[n])
+			softpin_insert(softpin, old[n]);
+	free(old);
+}
+
+static void softpin_bo(struct intel_batchbuffer_softpin *softpin,
+		       drm_intel_bo *bo)
+{
+	uint64_t offset;
+
+	if (2 * (softpin->count + 1) > softpin->mask + 1)
+		softpin_grow(softpin);
+
+	if (!softpin_insert(softpin, bo))
+		return;
+
+	offset = softpin->next;
+	igt_assert(offset + bo->size <= softpin->end);
+	softpin->next = ALIGN(offset + bo->size, 4096);
+
+	if (softpin->next > 1ull << 32)
+		do_or_die(drm_intel_bo_use_48b_address_range(bo, 1));
+	do_or_die(drm_intel_bo_set_softpin_offset(bo, offset));
+	drm_intel_bo_reference(bo);
+}
+
+static drm_intel_bo *softpin_next_batch(struct intel_batchbuffer *batch)
+{
+	struct intel_batchbuffer_softpin *softpin = batch->softpin;
+	unsigned int idx = softpin->next_batch++ % SOFTPIN_BATCHES;
+	drm_intel_bo *bo = softpin->batch[idx];
+
+	if (bo == NULL) {
+		bo = drm_intel_bo_alloc(batch->bufmgr, "batchbuffer",
+					BATCH_SZ, 4096);
+		softpin_bo(softpin, bo);
+		softpin->batch[idx] = bo;
+	} else {
+		/* Forget the targets of its previous execution */
+		drm_intel_gem_bo_clear_relocs(bo, 0);
+	}
+	softpin->num_targets = 0;
+
+	drm_intel_bo_reference(bo);
+	return bo;
+}
+
+static void softpin_free(struct intel_batchbuffer_softpin *softpin)
+{
+	unsigned int n;
+
+	if (softpin == NULL)
+		return;
+
+	for (n = 0; softpin->bos && n <= softpin->mask; n++)
+		if (softpin->bos[n])
+			drm_intel_bo_unreference(softpin->bos[n]);
+	free(softpin->bos);
+
+	/* drop the allocation references of the pinned batches */
+	for (n = 0; n < SOFTPIN_BATCHES; n++)
+		drm_intel_bo_unreference(softpin->batch[n]);
+
+	free(softpin);
+}
+
 /**
  * intel_batchbuffer_reset:
  * @batch: batchbuffer object
@@ -79,8 +207,11 @@ intel_batchbuffer_reset(struct intel_batchbuffer *batch)
 		batch->bo = NULL;
 	}
 
-	batch->bo = drm_intel_bo_alloc(batch->bufmgr, "batchbuffer",
-				       BATCH_SZ, 4096);
+	if (batch->softpin)
+		batch->bo = softpin_next_batch(batch);
+	else
+		batch->bo = drm_intel_bo_alloc(batch->bufmgr, "batchbuffer",
+					       BATCH_SZ, 4096);
 
 	memset(batch->buffer, 0, sizeof(batch->buffer));
 	batch->ctx = NULL;
@@ -121,13 +252,96 @@ intel_batchbuffer_alloc(drm_intel_bufmgr *bufmgr, uint32_t devid)
 void
 intel_batchbuffer_free(struct intel_batchbuffer *batch)
 {
+	if (batch->render_state) {
+		drm_intel_bo_unreference(batch->render_state->bo);
+		free(batch->render_state);
+	}
 	drm_intel_bo_unreference(batch->bo);
 	batch->bo = NULL;
+	softpin_free(batch->softpin);
 	free(batch);
 }
 
+/**
+ * intel_batchbuffer_enable_softpin:
+ * @batch: batchbuffer object
+ * @start: first GTT address to hand out
+ * @end: end of the GTT range to hand out
+ *
+ * Switches @batch to softpin mode: every object referenced through
+ * intel_batchbuffer_emit_reloc() or intel_batchbuffer_softpin_bo() is
+ * assigned a fixed address within [@start, @end) the first time it is seen,
+ * and the batches themselves are recycled from a small pool of pinned
+ * buffers. Batches which end up without any relocation are submitted with
+ * I915_EXEC_NO_RELOC and I915_EXEC_HANDLE_LUT.
+ *
+ * Pinned objects stay referenced until @batch is freed, and must not be used
+ * with another softpin batch on the same address space. The caller is
+ * responsible for checking gem_has_softpin(), and for only handing out
+ * addresses above 4GiB when the kernel supports 48b addressing.
+ */
+void
+intel_batchbuffer_enable_softpin(struct intel_batchbuffer *batch,
+				 uint64_t start, uint64_t end)
+{
+	struct intel_batchbuffer_softpin *softpin;
+
+	igt_assert(batch->softpin == NULL);
+	igt_assert(start < end);
+
+	softpin = calloc(1, sizeof(*softpin));
+	igt_assert(softpin);
+
+	softpin->next = ALIGN(start, 4096);
+	softpin->end = end;
+	batch->softpin = softpin;
+
+	/* Replace the unpinned batch, dropping anything already emitted */
+	intel_batchbuffer_reset(batch);
+}
+
+/**
+ * intel_batchbuffer_softpin_bo:
+ * @batch: batchbuffer object
+ * @bo: libdrm buffer object
+ *
+ * Assigns @bo its fixed address if @batch is in softpin mode, so that
+ * bo->offset64 can be written into a batch directly. Does nothing
+ * otherwise, or if @bo has already been pinned by @batch.
+ */
+void
+intel_batchbuffer_softpin_bo(struct intel_batchbuffer *batch,
+			     drm_intel_bo *bo)
+{
+	if (batch->softpin)
+		softpin_bo(batch->softpin, bo);
+}
+
 #define CMD_POLY_STIPPLE_OFFSET       0x7906
 
+static unsigned int exec_flags(struct intel_batchbuffer *batch)
+{
+	struct intel_batchbuffer_softpin *softpin = batch->softpin;
+	unsigned int n;
+
+	if (!softpin)
+		return 0;
+
+	/*
+	 * Pinned targets are not relocations, but any object reached through
+	 * a raw drm_intel_bo_emit_reloc(), from the batch or from one of its
+	 * targets, is not pinned and still needs relocating by the kernel.
+	 */
+	if (drm_intel_gem_bo_get_reloc_count(batch->bo))
+		return 0;
+
+	for (n = 0; n < softpin->num_targets; n++)
+		if (drm_intel_gem_bo_get_reloc_count(softpin->targets[n]))
+			return 0;
+
+	return LOCAL_I915_EXEC_NO_RELOC | LOCAL_I915_EXEC_HANDLE_LUT;
+}
+
 static unsigned int
 flush_on_ring_common(struct intel_batchbuffer *batch, int ring)
 {
@@ -181,7 +395,8 @@ intel_batchbuffer_flush_on_ring(struct intel_batchbuffer *batch, int ring)
 	ctx = batch->ctx;
 	if (ring != I915_EXEC_RENDER)
 		ctx = NULL;
-	do_or_die(drm_intel_gem_bo_context_exec(batch->bo, ctx, used, ring));
+	do_or_die(drm_intel_gem_bo_context_exec(batch->bo, ctx, used,
+						ring | exec_flags(batch)));
 
 	intel_batchbuffer_reset(batch);
 }
@@ -217,7 +432,8 @@ intel_batchbuffer_flush_with_context(struct intel_batchbuffer *batch,
 	batch->ptr = NULL;
 
 	ret = drm_intel_gem_bo_context_exec(batch->bo, context, used,
-					    I915_EXEC_RENDER);
+					    I915_EXEC_RENDER |
+					    exec_flags(batch));
 	igt_assert(ret == 0);
 
 	intel_batchbuffer_reset(batch);
@@ -270,7 +486,18 @@ intel_batchbuffer_emit_reloc(struct intel_batchbuffer *batch,
 			 batch->ptr, batch->buffer,
 			 (int)(batch->ptr - batch->buffer), BATCH_SZ);
 
-	if (fenced)
+	if (batch->softpin && buffer != batch->bo) {
+		struct intel_batchbuffer_softpin *softpin = batch->softpin;
+
+		softpin_bo(softpin, buffer);
+		igt_assert(softpin->num_targets < ARRAY_SIZE(softpin->targets));
+		softpin->targets[softpin->num_targets++] = buffer;
+	}
+
+	/* A pinned batch is always part of its own execbuf */
+	if (batch->softpin && buffer == batch->bo)
+		ret = 0;
+	else if (fenced)
 		ret = drm_intel_bo_emit_reloc_fence(batch->bo, batch->ptr - batch->buffer,
 						    buffer, delta,
 						    read_domains, write_domain);
@@ -558,7 +785,8 @@ fill_object(struct drm_i915_gem_exec_object2 *obj, uint32_t gem_handle,
 
 static void exec_blit(int fd,
 		      struct drm_i915_gem_exec_object2 *objs, uint32_t count,
-		      uint32_t batch_len /* in dwords */)
+		      uint32_t batch_len /* in dwords */,
+		      unsigned int ring)
 {
 	struct drm_i915_gem_execbuffer2 exec;
 
@@ -569,7 +797,7 @@ static void exec_blit(int fd,
 	exec.DR1 = exec.DR4 = 0;
 	exec.num_cliprects = 0;
 	exec.cliprects_ptr = 0;
-	exec.flags = I915_EXEC_BLT;
+	exec.flags = ring;
 	i915_execbuffer2_set_context_id(exec, 0);
 	exec.rsvd2 = 0;
 
@@ -658,7 +886,7 @@ void igt_blitter_fast_copy__raw(int fd,
 	fill_object(&objs[1], src_handle, NULL, 0);
 	fill_object(&objs[2], batch_handle, relocs, 2);
 
-	exec_blit(fd, objs, 3, ARRAY_SIZE(batch));
+	exec_blit(fd, objs, 3, ARRAY_SIZE(batch), I915_EXEC_BLT);
 
 	gem_close(fd, batch_handle);
 }
@@ -717,6 +945,280 @@ void igt_blitter_fast_copy(struct intel_batchbuffer *batch,
 	intel_batchbuffer_flush(batch);
 }
 
+/*
+ * Copy queue
+ *
+ * Every operation is appended to a CPU copy of the batch; the objects it
+ * touches are added once to the execbuffer object list. The queue is only
+ * submitted once the batch, object list or relocation array runs out of
+ * room, or on an explicit igt_copy_queue_flush().
+ */
+
+#define COPY_QUEUE_MAX_OBJECTS 64
+
+struct igt_copy_queue {
+	int fd;
+	int gen;
+	unsigned int ring;
+
+	uint32_t batch[BATCH_SZ / sizeof(uint32_t)];
+	unsigned int len; /* in dwords */
+
+	struct drm_i915_gem_exec_object2 objs[COPY_QUEUE_MAX_OBJECTS + 1];
+	unsigned int num_objs;
+
+	/* every command carries at most one address per 4 dwords */
+	struct drm_i915_gem_relocation_entry relocs[BATCH_SZ / 16];
+	unsigned int num_relocs;
+};
+
+/**
+ * igt_copy_queue_alloc:
+ * @fd: file descriptor of the i915 driver
+ *
+ * Allocates a queue for batching many blitter copies and fills into as few
+ * execbuffers as possible. Operations are only guaranteed to have been
+ * submitted after igt_copy_queue_flush() or igt_copy_queue_free().
+ *
+ * Returns:
+ * The allocated and initialized copy queue.
+ */
+struct igt_copy_queue *igt_copy_queue_alloc(int fd)
+{
+	struct igt_copy_queue *q;
+	uint32_t devid = intel_get_drm_devid(fd);
+
+	q = calloc(1, sizeof(*q));
+	igt_assert(q);
+
+	q->fd = fd;
+	q->gen = intel_gen(devid);
+	q->ring = HAS_BLT_RING(devid) ? I915_EXEC_BLT : 0;
+
+	return q;
+}
+
+/**
+ * igt_copy_queue_free:
+ * @q: copy queue
+ *
+ * Submits any pending operations and frees @q.
+ */
+void igt_copy_queue_free(struct igt_copy_queue *q)
+{
+	igt_copy_queue_flush(q);
+	free(q);
+}
+
+/**
+ * igt_copy_queue_flush:
+ * @q: copy queue
+ *
+ * Submits all queued operations with a single execbuffer. Does nothing if
+ * the queue is empty.
+ */
+void igt_copy_queue_flush(struct igt_copy_queue *q)
+{
+	struct drm_i915_gem_exec_object2 *batch_obj;
+	uint32_t batch_handle;
+
+	if (q->len == 0)
+		return;
+
+	q->batch[q->len++] = MI_BATCH_BUFFER_END;
+	if (q->len & 1)
+		q->batch[q->len++] = MI_NOOP;
+
+	batch_handle = gem_create(q->fd, BATCH_SZ);
+	gem_write(q->fd, batch_handle, 0, q->batch, q->len * 4);
+
+	batch_obj = &q->objs[q->num_objs];
+	fill_object(batch_obj, batch_handle, q->relocs, q->num_relocs);
+
+	exec_blit(q->fd, q->objs, q->num_objs + 1, q->len, q->ring);
+
+	gem_close(q->fd, batch_handle);
+
+	q->len = 0;
+	q->num_objs = 0;
+	q->num_relocs = 0;
+}
+
+/* Makes room for a command of @len dwords referencing two objects */
+static void copy_queue_reserve(struct igt_copy_queue *q, unsigned int len)
+{
+	/* leave space for MI_BATCH_BUFFER_END and padding */
+	if (q->len + len + 2 > ARRAY_SIZE(q->batch) ||
+	    q->num_objs + 2 > COPY_QUEUE_MAX_OBJECTS ||
+	    q->num_relocs + 2 > ARRAY_SIZE(q->relocs))
+		igt_copy_queue_flush(q);
+}
+
+static void copy_queue_add_object(struct igt_copy_queue *q, uint32_t handle)
+{
+	unsigned int i;
+
+	/* most callers hit the same few objects, search from the end */
+	for (i = q->num_objs; i--; )
+		if (q->objs[i].handle == handle)
+			return;
+
+	fill_object(&q->objs[q->num_objs++], handle, NULL, 0);
+}
+
+static void copy_queue_emit_reloc(struct igt_copy_queue *q, uint32_t handle,
+				  uint32_t write_domain)
+{
+	copy_queue_add_object(q, handle);
+
+	fill_relocation(&q->relocs[q->num_relocs++], handle, q->len,
+			I915_GEM_DOMAIN_RENDER, write_domain);
+
+	q->batch[q->len++] = 0;
+	if (q->gen >= 8)
+		q->batch[q->len++] = 0;
+}
+
+/**
+ * igt_copy_queue_copy:
+ * @q: copy queue
+ * @src_handle: GEM handle of the source buffer
+ * @src_stride: Stride (in bytes) of the source buffer
+ * @src_tiling: Tiling mode of the source buffer
+ * @src_x: X coordinate of the source region to copy
+ * @src_y: Y coordinate of the source region to copy
+ * @width: Width of the region to copy
+ * @height: Height of the region to copy
+ * @dst_handle: GEM handle of the destination buffer
+ * @dst_stride: Stride (in bytes) of the destination buffer
+ * @dst_tiling: Tiling mode of the destination buffer
+ * @dst_x: X coordinate of destination
+ * @dst_y: Y coordinate of destination
+ *
+ * Queues a 32bpp copy from @src_handle to @dst_handle. Linear and X-tiled
+ * surfaces are copied with XY_SRC_COPY_BLT, any other tiling mode requires
+ * the gen9 fast copy blitter.
+ */
+void igt_copy_queue_copy(struct igt_copy_queue *q,
+			 /* src */
+			 uint32_t src_handle,
+			 unsigned int src_stride,
+			 unsigned int src_tiling,
+			 unsigned int src_x, unsigned src_y,
+
+			 /* size */
+			 unsigned int width, unsigned int height,
+
+			 /* dst */
+			 uint32_t dst_handle,
+			 unsigned int dst_stride,
+			 unsigned int dst_tiling,
+			 unsigned int dst_x, unsigned dst_y)
+{
+	uint32_t dword0, dword1;
+	uint32_t src_pitch, dst_pitch;
+	bool fast;
+
+	fast = (src_tiling != I915_TILING_NONE &&
+		src_tiling != I915_TILING_X) ||
+	       (dst_tiling != I915_TILING_NONE &&
+		dst_tiling != I915_TILING_X);
+	igt_assert(!fast || q->gen >= 9);
+
+	src_pitch = src_stride;
+	dst_pitch = dst_stride;
+	if (fast || q->gen >= 4) {
+		src_pitch = fast_copy_pitch(src_stride, src_tiling);
+		dst_pitch = fast_copy_pitch(dst_stride, dst_tiling);
+	}
+
+#define CHECK_RANGE(x)	((x) >= 0 && (x) < (1 << 15))
+	igt_assert(CHECK_RANGE(src_x) && CHECK_RANGE(src_y) &&
+		   CHECK_RANGE(dst_x) && CHECK_RANGE(dst_y) &&
+		   CHECK_RANGE(width) && CHECK_RANGE(height) &&
+		   CHECK_RANGE(src_x + width) && CHECK_RANGE(src_y + height) &&
+		   CHECK_RANGE(dst_x + width) && CHECK_RANGE(dst_y + height) &&
+		   CHECK_RANGE(src_pitch) && CHECK_RANGE(dst_pitch));
+#undef CHECK_RANGE
+
+	if (fast) {
+		dword0 = fast_copy_dword0(src_tiling, dst_tiling);
+		dword1 = fast_copy_dword1(src_tiling, dst_tiling);
+	} else {
+		dword0 = XY_SRC_COPY_BLT_CMD |
+			 XY_SRC_COPY_BLT_WRITE_ALPHA |
+			 XY_SRC_COPY_BLT_WRITE_RGB |
+			 (6 + 2 * (q->gen >= 8));
+		if (src_tiling != I915_TILING_NONE)
+			dword0 |= XY_SRC_COPY_BLT_SRC_TILED;
+		if (dst_tiling != I915_TILING_NONE)
+			dword0 |= XY_SRC_COPY_BLT_DST_TILED;
+		dword1 = (3 << 24) | /* 32 bits */
+			 (0xcc << 16); /* copy ROP */
+	}
+
+	copy_queue_reserve(q, 10);
+
+	q->batch[q->len++] = dword0;
+	q->batch[q->len++] = dword1 | dst_pitch;
+	q->batch[q->len++] = (dst_y << 16) | dst_x; /* dst x1,y1 */
+	q->batch[q->len++] = ((dst_y + height) << 16) | (dst_x + width); /* dst x2,y2 */
+	copy_queue_emit_reloc(q, dst_handle, I915_GEM_DOMAIN_RENDER);
+	q->batch[q->len++] = (src_y << 16) | src_x; /* src x1,y1 */
+	q->batch[q->len++] = src_pitch;
+	copy_queue_emit_reloc(q, src_handle, 0);
+}
+
+/**
+ * igt_copy_queue_fill:
+ * @q: copy queue
+ * @handle: GEM handle of the destination buffer
+ * @stride: Stride (in bytes) of the destination buffer
+ * @tiling: Tiling mode of the destination buffer, either linear or X-tiled
+ * @x: X coordinate of the region to fill
+ * @y: Y coordinate of the region to fill
+ * @width: Width of the region to fill
+ * @height: Height of the region to fill
+ * @color: 32bpp fill value
+ *
+ * Queues a solid fill of a rectangle of @handle with XY_COLOR_BLT.
+ */
+void igt_copy_queue_fill(struct igt_copy_queue *q,
+			 uint32_t handle,
+			 unsigned int stride,
+			 unsigned int tiling,
+			 unsigned int x, unsigned int y,
+			 unsigned int width, unsigned int height,
+			 uint32_t color)
+{
+	uint32_t dword0, pitch;
+
+	igt_assert(tiling == I915_TILING_NONE || tiling == I915_TILING_X);
+
+	pitch = stride;
+	if (tiling != I915_TILING_NONE && q->gen >= 4)
+		pitch /= 4;
+
+	igt_assert(x + width < (1 << 15) && y + height < (1 << 15) &&
+		   pitch < (1 << 15));
+
+	dword0 = XY_COLOR_BLT_CMD_NOLEN |
+		 XY_COLOR_BLT_WRITE_ALPHA |
+		 XY_COLOR_BLT_WRITE_RGB |
+		 (4 + (q->gen >= 8));
+	if (tiling != I915_TILING_NONE)
+		dword0 |= XY_COLOR_BLT_TILED;
+
+	copy_queue_reserve(q, 7);
+
+	q->batch[q->len++] = dword0;
+	q->batch[q->len++] = (3 << 24) | (0xf0 << 16) | pitch;
+	q->batch[q->len++] = (y << 16) | x;
+	q->batch[q->len++] = ((y + height) << 16) | (x + width);
+	copy_queue_emit_reloc(q, handle, I915_GEM_DOMAIN_RENDER);
+	q->batch[q->len++] = color;
+}
+
 /**
  * igt_get_render_copyfunc:
  * @devid: pci device id
@@ -11,6 +11,26 @@
 #define BATCH_SZ 4096
 #define BATCH_RESERVED 16
 
+/*
+ * Static state of the gen8+ render copies: the indirect state in its own bo,
+ * its offsets there, and the commands referencing it as recorded on the
+ * first copy. Built on first use and freed with the batchbuffer.
+ */
+struct intel_render_state {
+	drm_intel_bo *bo;
+
+	uint32_t sampler;
+	uint32_t kernel;
+	uint32_t cc_state;
+	uint32_t blend_state;
+	uint32_t cc_viewport;
+	uint32_t sf_clip_viewport;
+	uint32_t scissor;
+
+	uint32_t cmds[256];
+	uint32_t cmds_len;
+};
+
 struct intel_batchbuffer {
 	drm_intel_bufmgr *bufmgr;
 	uint32_t devid;
@@ -22,6 +42,12 @@ struct intel_batchbuffer {
 	uint8_t buffer[BATCH_SZ];
 	uint8_t *ptr, *end;
 	uint8_t *state;
+
+	/* Static state shared by the gen8+ render copies */
+	struct intel_render_state *render_state;
+
+	/* Userspace GTT allocator, see intel_batchbuffer_enable_softpin() */
+	struct intel_batchbuffer_softpin *softpin;
 };
 
 struct intel_batchbuffer *intel_batchbuffer_alloc(drm_intel_bufmgr *bufmgr,
@@ -33,6 +59,11 @@ void intel_batchbuffer_set_context(struct intel_batchbuffer *batch,
 
 void intel_batchbuffer_free(struct intel_batchbuffer *batch);
 
+void intel_batchbuffer_enable_softpin(struct intel_batchbuffer *batch,
+				      uint64_t start, uint64_t end);
+void intel_batchbuffer_softpin_bo(struct intel_batchbuffer *batch,
+				  drm_intel_bo *bo);
+
 
 void intel_batchbuffer_flush(struct intel_batchbuffer *batch);
 void intel_batchbuffer_flush_on_ring(struct intel_batchbuffer *batch, int ring);
@@ -246,6 +277,36 @@ void igt_blitter_fast_copy__raw(int fd,
 				unsigned int dst_tiling,
 				unsigned int dst_x, unsigned dst_y);
 
+struct igt_copy_queue;
+
+struct igt_copy_queue *igt_copy_queue_alloc(int fd);
+void igt_copy_queue_free(struct igt_copy_queue *q);
+void igt_copy_queue_flush(struct igt_copy_queue *q);
+
+void igt_copy_queue_copy(struct igt_copy_queue *q,
+			 /* src */
+			 uint32_t src_handle,
+			 unsigned int src_stride,
+			 unsigned int src_tiling,
+			 unsigned int src_x, unsigned src_y,
+
+			 /* size */
+			 unsigned int width, unsigned int height,
+
+			 /* dst */
+			 uint32_t dst_handle,
+			 unsigned int dst_stride,
+			 unsigned int dst_tiling,
+			 unsigned int dst_x, unsigned dst_y);
+
+void igt_copy_queue_fill(struct igt_copy_queue *q,
+			 uint32_t handle,
+			 unsigned int stride,
+			 unsigned int tiling,
+			 unsigned int x, unsigned int y,
+			 unsigned int width, unsigned int height,
+			 uint32_t color);
+
 /**
  * igt_render_copyfunc_t:
  * @batch: batchbuffer object
@@ -68,6 +68,35 @@ struct intel_device_info {
 
 const struct intel_device_info *intel_get_device_info(uint16_t devid) __attribute__((pure));
 
+#define INTEL_RING_RENDER	(1 << 0)
+#define INTEL_RING_BSD		(1 << 1)
+#define INTEL_RING_BLT		(1 << 2)
+#define INTEL_RING_VEBOX	(1 << 3)
+
+/**
+ * intel_device_caps:
+ * @info: the device info
+ * @gen: the GFX generation, 0 for an unknown device
+ * @gt: the GT size
+ * @rings: mask of the INTEL_RING_* engines the device has
+ * @has_pipeline_stats: whether the pipeline statistics registers exist
+ * @instdone: offset of the main INSTDONE register
+ * @instdone1: offset of the second INSTDONE register, or 0 before gen4
+ *
+ * Properties of a device derived from its id, see intel_get_device_caps().
+ */
+struct intel_device_caps {
+	const struct intel_device_info *info;
+	unsigned gen;
+	unsigned gt;
+	unsigned rings;
+	bool has_pipeline_stats;
+	uint32_t instdone;
+	uint32_t instdone1;
+};
+
+const struct intel_device_caps *intel_get_device_caps(uint16_t devid) __attribute__((pure));
+
 unsigned intel_gen(uint16_t devid) __attribute__((pure));
 unsigned intel_gt(uint16_t devid) __attribute__((pure));
 
@@ -0,0 +1,179 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "intel_io.h"
+#include "intel_counters.h"
+
+/**
+ * SECTION:intel_counters
+ * @short_description: Coherent snapshots of 64-bit MMIO counters
+ * @title: MMIO counters
+ * @include: intel_counters.h
+ *
+ * The GPU exposes its 64-bit counters, such as the pipeline statistics,
+ * as pairs of 32-bit registers which cannot be read atomically. Reading
+ * the high, low and high dwords again of one counter after the other
+ * samples each counter at a different instant, and a busy GPU makes the
+ * loop retry often.
+ *
+ * intel_counters_snapshot() instead reads the high dwords of all the
+ * counters, then all the low dwords, then all the high dwords again, so
+ * the low dwords that matter most are read back to back. Only counters
+ * whose high dword changed meanwhile are read again. Each snapshot is
+ * timestamped, and intel_counters_rate() turns the difference from the
+ * previous one into a per-second rate.
+ *
+ * MMIO access must have been set up, e.g. with intel_register_access_init().
+ */
+
+static uint64_t counters_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * intel_counters_init:
+ * @c: counters to initialise
+ * @regs: offsets of the low dwords of the counters, must stay valid
+ * @count: number of entries in @regs
+ *
+ * Prepares @c for sampling the counters at @regs. No snapshot is taken.
+ *
+ * Returns: 0 on success, -ENOMEM on failure.
+ */
+int intel_counters_init(struct intel_counters *c,
+			const uint32_t *regs, int count)
+{
+	memset(c, 0, sizeof(*c));
+
+	c->regs = regs;
+	c->count = count;
+
+	c->values = calloc(count, sizeof(*c->values));
+	c->last = calloc(count, sizeof(*c->last));
+	c->high = calloc(count, sizeof(*c->high));
+	if (!c->values || !c->last || !c->high) {
+		intel_counters_fini(c);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/**
+ * intel_counters_fini:
+ * @c: counters
+ *
+ * Frees the memory allocated by intel_counters_init().
+ */
+void intel_counters_fini(struct intel_counters *c)
+{
+	free(c->values);
+	free(c->last);
+	free(c->high);
+	memset(c, 0, sizeof(*c));
+}
+
+/**
+ * intel_counters_snapshot:
+ * @c: counters
+ *
+ * Reads all the counters of @c as close together as possible, see the
+ * section description. The previous values and timestamp move to @c->last
+ * and @c->last_timestamp.
+ */
+void intel_counters_snapshot(struct intel_counters *c)
+{
+	uint64_t *tmp, start;
+	int i;
+
+	tmp = c->last;
+	c->last = c->values;
+	c->values = tmp;
+	c->last_timestamp = c->timestamp;
+	c->retries = 0;
+
+	for (i = 0; i < c->count; i++)
+		c->high[i] = INREG(c->regs[i] + 4);
+
+	start = counters_time();
+	for (i = 0; i < c->count; i++)
+		c->values[i] = INREG(c->regs[i]);
+	c->timestamp = (start + counters_time()) / 2;
+
+	for (i = 0; i < c->count; i++) {
+		uint32_t high = INREG(c->regs[i] + 4);
+		uint32_t low;
+
+		/* the low dword wrapped around between the reads, try again */
+		while (high != c->high[i]) {
+			c->high[i] = high;
+			low = INREG(c->regs[i]);
+			high = INREG(c->regs[i] + 4);
+			c->values[i] = low;
+			c->retries++;
+		}
+
+		c->values[i] |= (uint64_t)high << 32;
+	}
+}
+
+/**
+ * intel_counters_delta:
+ * @c: counters
+ * @i: index of the counter
+ *
+ * Returns: How much counter @i advanced between the last two snapshots.
+ */
+uint64_t intel_counters_delta(const struct intel_counters *c, int i)
+{
+	if (!c->last_timestamp)
+		return 0;
+
+	return c->values[i] - c->last[i];
+}
+
+/**
+ * intel_counters_rate:
+ * @c: counters
+ * @i: index of the counter
+ *
+ * Returns: The rate of counter @i per second between the last two
+ * snapshots, or 0 before the second snapshot.
+ */
+double intel_counters_rate(const struct intel_counters *c, int i)
+{
+	if (!c->last_timestamp || c->timestamp <= c->last_timestamp)
+		return 0;
+
+	return intel_counters_delta(c, i) * 1e9 /
+		(c->timestamp - c->last_timestamp);
+}
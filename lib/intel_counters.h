@@ -0,0 +1,64 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef INTEL_COUNTERS_H
+#define INTEL_COUNTERS_H
+
+#include <stdint.h>
+
+/**
+ * intel_counters:
+ * @regs: offsets of the low dwords of the counters, the high dwords follow
+ * @count: number of counters
+ * @values: the counters at the latest snapshot
+ * @last: the counters at the snapshot before
+ * @timestamp: CLOCK_MONOTONIC time of the latest snapshot, in ns
+ * @last_timestamp: time of the snapshot before, 0 if there was none
+ * @retries: number of counters that had to be read again in the latest
+ *   snapshot because their high dword changed meanwhile
+ *
+ * A set of 64-bit MMIO counters sampled together, see
+ * intel_counters_snapshot().
+ */
+struct intel_counters {
+	const uint32_t *regs;
+	int count;
+
+	uint64_t *values;
+	uint64_t *last;
+	uint64_t timestamp;
+	uint64_t last_timestamp;
+	int retries;
+
+	/*< private >*/
+	uint32_t *high;
+};
+
+int intel_counters_init(struct intel_counters *c,
+			const uint32_t *regs, int count);
+void intel_counters_fini(struct intel_counters *c);
+void intel_counters_snapshot(struct intel_counters *c);
+uint64_t intel_counters_delta(const struct intel_counters *c, int i);
+double intel_counters_rate(const struct intel_counters *c, int i);
+
+#endif /* INTEL_COUNTERS_H */
@@ -1,6 +1,9 @@
 #include "intel_chipset.h"
+#include "intel_reg.h"
 #include "i915_pciids.h"
 
+#include <pthread.h>
+#include <stdlib.h>
 #include <strings.h> /* ffs() */
 
 #define BIT(x) (1<<(x))
@@ -242,6 +245,157 @@ static const struct pci_id_match intel_device_match[] = {
 	INTEL_VGA_DEVICE(PCI_MATCH_ANY, &intel_generic_info),
 };
 
+/*
+ * intel_device_match is in the order of the id lists, which is convenient
+ * to maintain but not to search. On first use it is copied into a table
+ * sorted by device id, with the capabilities of each device worked out
+ * once, and looked up by binary search from then on.
+ */
+struct intel_device_entry {
+	uint16_t devid;
+	uint16_t order; /* in intel_device_match, the first match wins */
+	struct intel_device_caps caps;
+};
+
+static struct intel_device_entry *device_table;
+static int device_count;
+static struct intel_device_entry generic_entry;
+static const struct intel_device_entry *last_entry = &generic_entry;
+static pthread_once_t device_table_once = PTHREAD_ONCE_INIT;
+
+static void init_caps(struct intel_device_caps *caps, uint16_t devid,
+		      const struct intel_device_info *info)
+{
+	unsigned gt_mask;
+
+	caps->info = info;
+	caps->gen = ffs(info->gen);
+
+	if (caps->gen >= 8)
+		gt_mask = 0xf;
+	else if (caps->gen >= 6)
+		gt_mask = 0x3;
+	else
+		gt_mask = 0;
+	caps->gt = (devid >> 4) & gt_mask;
+
+	caps->rings = INTEL_RING_RENDER;
+	if (caps->gen >= 5)
+		caps->rings |= INTEL_RING_BSD;
+	if (caps->gen >= 6)
+		caps->rings |= INTEL_RING_BLT;
+	if (caps->gen >= 8 || info->is_haswell)
+		caps->rings |= INTEL_RING_VEBOX;
+
+	caps->has_pipeline_stats = caps->gen >= 4;
+
+	if (caps->gen >= 4) {
+		caps->instdone = INSTDONE_I965;
+		caps->instdone1 = INSTDONE_1;
+	} else {
+		caps->instdone = INSTDONE;
+		caps->instdone1 = 0;
+	}
+}
+
+static int device_entry_cmp(const void *A, const void *B)
+{
+	const struct intel_device_entry *a = A, *b = B;
+
+	if (a->devid != b->devid)
+		return (int)a->devid - (int)b->devid;
+
+	return (int)a->order - (int)b->order;
+}
+
+static void device_table_init(void)
+{
+	int n, i, j;
+
+	init_caps(&generic_entry.caps, 0, &intel_generic_info);
+
+	for (n = 0; intel_device_match[n].device_id != PCI_MATCH_ANY; n++)
+		;
+
+	device_table = malloc(n * sizeof(*device_table));
+	if (!device_table)
+		return;
+
+	for (i = 0; i < n; i++) {
+		const struct intel_device_info *info =
+			(void *)intel_device_match[i].match_data;
+
+		device_table[i].devid = intel_device_match[i].device_id;
+		device_table[i].order = i;
+		init_caps(&device_table[i].caps, device_table[i].devid, info);
+	}
+
+	qsort(device_table, n, sizeof(*device_table), device_entry_cmp);
+
+	/* drop later duplicates so that bsearch cannot land on them */
+	for (i = j = 0; i < n; i++)
+		if (j == 0 || device_table[i].devid != device_table[j - 1].devid)
+			device_table[j++] = device_table[i];
+
+	device_count = j;
+}
+
+static const struct intel_device_entry *search_device(uint16_t devid)
+{
+	const struct intel_device_entry *entry;
+	int lo, hi;
+
+	pthread_once(&device_table_once, device_table_init);
+
+	lo = 0;
+	hi = device_count;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		entry = &device_table[mid];
+		if (entry->devid == devid) {
+			__atomic_store_n(&last_entry, entry, __ATOMIC_RELAXED);
+			return entry;
+		}
+
+		if (entry->devid < devid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return &generic_entry;
+}
+
+static inline const struct intel_device_entry *lookup_device(uint16_t devid)
+{
+	const struct intel_device_entry *entry;
+
+	/* callers mostly ask about the same device over and over */
+	entry = __atomic_load_n(&last_entry, __ATOMIC_RELAXED);
+	if (entry->devid == devid && entry != &generic_entry)
+		return entry;
+
+	return search_device(devid);
+}
+
+/**
+ * intel_get_device_caps:
+ * @devid: pci device id
+ *
+ * Looks up the capabilities of the given device id. They are computed
+ * once per device, so that code sampling the hardware in a loop can test
+ * plain fields rather than go through the IS_GEN() style macros.
+ *
+ * Returns:
+ * The capabilities of @devid, those of a generic device with gen 0 if it
+ * is unknown.
+ */
+const struct intel_device_caps *intel_get_device_caps(uint16_t devid)
+{
+	return &lookup_device(devid)->caps;
+}
+
 /**
  * intel_get_device_info:
  * @devid: pci device id
@@ -253,24 +407,7 @@ static const struct pci_id_match intel_device_match[] = {
  */
 const struct intel_device_info *intel_get_device_info(uint16_t devid)
 {
-	static const struct intel_device_info *cache = &intel_generic_info;
-	static uint16_t cached_devid;
-	int i;
-
-	if (cached_devid == devid)
-		goto out;
-
-	/* XXX Presort table and bsearch! */
-	for (i = 0; intel_device_match[i].device_id != PCI_MATCH_ANY; i++) {
-		if (devid == intel_device_match[i].device_id)
-			break;
-	}
-
-	cached_devid = devid;
-	cache = (void *)intel_device_match[i].match_data;
-
-out:
-	return cache;
+	return lookup_device(devid)->caps.info;
 }
 
 /**
@@ -284,7 +421,7 @@ out:
  */
 unsigned intel_gen(uint16_t devid)
 {
-	return ffs(intel_get_device_info(devid)->gen);
+	return lookup_device(devid)->caps.gen;
 }
 
 /**
@@ -298,14 +435,5 @@ unsigned intel_gen(uint16_t devid)
  */
 unsigned intel_gt(uint16_t devid)
 {
-	unsigned mask = intel_gen(devid);
-
-	if (mask >= 8)
-		mask = 0xf;
-	else if (mask >= 6)
-		mask = 0x3;
-	else
-		mask = 0;
-
-	return (devid >> 4) & mask;
+	return lookup_device(devid)->caps.gt;
 }
@@ -0,0 +1,255 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "intel_io.h"
+#include "intel_reg.h"
+#include "intel_chipset.h"
+#include "intel_counters.h"
+#include "intel_gpu_sampler.h"
+
+/**
+ * SECTION:intel_gpu_sampler
+ * @short_description: MMIO sampling of ring and unit activity
+ * @title: GPU sampler
+ * @include: intel_gpu_sampler.h
+ *
+ * Polls the ring head/tail and INSTDONE registers at a fixed rate over one
+ * second periods to estimate how busy each ring and each unit of the GPU
+ * is, and reads the pipeline statistics counters at the end of each period.
+ */
+
+const uint32_t intel_gpu_stats_regs[STATS_COUNT] = {
+	IA_VERTICES_COUNT_QW,
+	IA_PRIMITIVES_COUNT_QW,
+	VS_INVOCATION_COUNT_QW,
+	GS_INVOCATION_COUNT_QW,
+	GS_PRIMITIVES_COUNT_QW,
+	CL_INVOCATION_COUNT_QW,
+	CL_PRIMITIVES_COUNT_QW,
+	PS_INVOCATION_COUNT_QW,
+	PS_DEPTH_COUNT_QW,
+};
+
+const char *intel_gpu_stats_names[STATS_COUNT] = {
+	"vert fetch",
+	"prim fetch",
+	"VS invocations",
+	"GS invocations",
+	"GS prims",
+	"CL invocations",
+	"CL prims",
+	"PS invocations",
+	"PS depth pass",
+};
+
+static const struct {
+	const char *name;
+	uint32_t mmio;
+} rings[SAMPLER_NUM_RINGS] = {
+	[SAMPLER_RING_RENDER] = { "render", 0x2030 },
+	[SAMPLER_RING_BSD] = { "bitstream", 0x4030 },
+	[SAMPLER_RING_BSD6] = { "bitstream", 0x12030 },
+	[SAMPLER_RING_BLT] = { "blitter", 0x22030 },
+};
+
+static uint64_t gettime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static uint32_t ring_read(struct intel_gpu_sampler_ring *ring, uint32_t reg)
+{
+	return INREG(ring->mmio + reg);
+}
+
+static void ring_init(struct intel_gpu_sampler_ring *ring)
+{
+	ring->size = (((ring_read(ring, RING_LEN) & RING_NR_PAGES) >> 12) + 1) * 4096;
+}
+
+static void ring_reset(struct intel_gpu_sampler_ring *ring)
+{
+	ring->idle = ring->full = 0;
+}
+
+static void ring_sample(struct intel_gpu_sampler_ring *ring)
+{
+	int full;
+
+	if (!ring->size)
+		return;
+
+	ring->head = ring_read(ring, RING_HEAD) & HEAD_ADDR;
+	ring->tail = ring_read(ring, RING_TAIL) & TAIL_ADDR;
+
+	if (ring->tail == ring->head)
+		ring->idle++;
+
+	full = ring->tail - ring->head;
+	if (full < 0)
+		full += ring->size;
+	ring->full += full;
+}
+
+/**
+ * intel_gpu_sampler_init:
+ * @s: sampler to initialise
+ * @pci_dev: the GPU, as returned by intel_get_pci_device()
+ *
+ * Maps the registers of @pci_dev, takes register access and finds out
+ * which rings are present.
+ */
+void intel_gpu_sampler_init(struct intel_gpu_sampler *s,
+			    struct pci_device *pci_dev)
+{
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	s->devid = pci_dev->device_id;
+	s->caps = intel_get_device_caps(s->devid);
+
+	intel_mmio_use_pci_bar(pci_dev);
+	init_instdone_definitions(s->devid);
+
+	for (i = 0; i < num_instdone_bits; i++)
+		s->bits[i].bit = &instdone_bits[i];
+	s->num_bits = num_instdone_bits;
+
+	for (i = 0; i < SAMPLER_NUM_RINGS; i++) {
+		s->ring[i].name = rings[i].name;
+		s->ring[i].mmio = rings[i].mmio;
+	}
+
+	intel_register_access_init(pci_dev, 0);
+
+	ring_init(&s->ring[SAMPLER_RING_RENDER]);
+	if (s->caps->gen == 4 || s->caps->gen == 5)
+		ring_init(&s->ring[SAMPLER_RING_BSD]);
+	if (s->caps->gen >= 6) {
+		ring_init(&s->ring[SAMPLER_RING_BSD6]);
+		ring_init(&s->ring[SAMPLER_RING_BLT]);
+	}
+
+	s->has_stats = s->caps->has_pipeline_stats &&
+		intel_counters_init(&s->stats, intel_gpu_stats_regs,
+				    STATS_COUNT) == 0;
+	if (s->has_stats)
+		intel_counters_snapshot(&s->stats);
+}
+
+/**
+ * intel_gpu_sampler_fini:
+ * @s: sampler
+ *
+ * Releases the register access and memory taken by intel_gpu_sampler_init().
+ */
+void intel_gpu_sampler_fini(struct intel_gpu_sampler *s)
+{
+	if (s->has_stats)
+		intel_counters_fini(&s->stats);
+	intel_register_access_fini();
+}
+
+/**
+ * intel_gpu_sampler_account_instdone:
+ * @s: sampler
+ * @instdone: value of INSTDONE (INSTDONE_I965 on gen4+)
+ * @instdone1: value of INSTDONE_1, or 0 before gen4
+ *
+ * Counts one sample of INSTDONE against every unit found busy in it. This
+ * is the per-sample work of intel_gpu_sampler_run(), split out so that it
+ * can be exercised without a GPU.
+ */
+void intel_gpu_sampler_account_instdone(struct intel_gpu_sampler *s,
+					uint32_t instdone, uint32_t instdone1)
+{
+	int i;
+
+	for (i = 0; i < s->num_bits; i++) {
+		struct intel_gpu_sampler_bit *b = &s->bits[i];
+		uint32_t reg = b->bit->reg == INSTDONE_1 ? instdone1 : instdone;
+
+		if ((reg & b->bit->bit) == 0)
+			b->count++;
+	}
+}
+
+/**
+ * intel_gpu_sampler_run:
+ * @s: sampler
+ * @samples_per_sec: polling rate
+ *
+ * Samples the rings and INSTDONE for one second, or @samples_per_sec
+ * samples if sooner, then reads the pipeline statistics. The results
+ * replace those of the previous period, @s->samples is the number of
+ * samples actually taken.
+ */
+void intel_gpu_sampler_run(struct intel_gpu_sampler *s, int samples_per_sec)
+{
+	uint64_t def_sleep = 1000000 / samples_per_sec;
+	uint64_t t1, ti, tf;
+	int i, j;
+
+	for (i = 0; i < SAMPLER_NUM_RINGS; i++)
+		ring_reset(&s->ring[i]);
+	for (i = 0; i < s->num_bits; i++)
+		s->bits[i].count = 0;
+
+	s->samples = samples_per_sec;
+
+	t1 = gettime();
+	for (i = 0; i < samples_per_sec; i++) {
+		uint32_t instdone, instdone1 = 0;
+		int64_t interval;
+
+		ti = gettime();
+		instdone = INREG(s->caps->instdone);
+		if (s->caps->instdone1)
+			instdone1 = INREG(s->caps->instdone1);
+
+		intel_gpu_sampler_account_instdone(s, instdone, instdone1);
+
+		for (j = 0; j < SAMPLER_NUM_RINGS; j++)
+			ring_sample(&s->ring[j]);
+
+		tf = gettime();
+		if (tf - t1 >= 1000000) {
+			/* We are out of sync, bail out */
+			s->samples = i + 1;
+			break;
+		}
+		interval = def_sleep - (tf - ti);
+		if (interval > 0)
+			usleep(interval);
+	}
+
+	if (s->has_stats)
+		intel_counters_snapshot(&s->stats);
+}
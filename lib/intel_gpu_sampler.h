@@ -0,0 +1,105 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef INTEL_GPU_SAMPLER_H
+#define INTEL_GPU_SAMPLER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "instdone.h"
+#include "intel_counters.h"
+
+struct pci_device;
+struct intel_device_caps;
+
+enum intel_gpu_stats {
+	IA_VERTICES,
+	IA_PRIMITIVES,
+	VS_INVOCATION,
+	GS_INVOCATION,
+	GS_PRIMITIVES,
+	CL_INVOCATION,
+	CL_PRIMITIVES,
+	PS_INVOCATION,
+	PS_DEPTH,
+	STATS_COUNT
+};
+
+extern const uint32_t intel_gpu_stats_regs[STATS_COUNT];
+extern const char *intel_gpu_stats_names[STATS_COUNT];
+
+enum intel_gpu_sampler_rings {
+	SAMPLER_RING_RENDER,
+	SAMPLER_RING_BSD,
+	SAMPLER_RING_BSD6,
+	SAMPLER_RING_BLT,
+	SAMPLER_NUM_RINGS
+};
+
+/**
+ * intel_gpu_sampler:
+ * @devid: PCI device id of the GPU
+ * @caps: capabilities of @devid
+ * @ring: occupancy of each ring, a ring with a zero size is not present
+ * @bits: how many samples each INSTDONE unit was found busy
+ * @num_bits: number of entries in @bits
+ * @samples: number of samples taken during the last period
+ * @has_stats: whether the pipeline statistics registers are available
+ * @stats: pipeline statistics at the end of the last period and the one
+ *   before, indexed by #intel_gpu_stats
+ *
+ * State of the MMIO sampler shared by intel_gpu_top and netup_gpu_meter.
+ */
+struct intel_gpu_sampler {
+	uint32_t devid;
+	const struct intel_device_caps *caps;
+
+	struct intel_gpu_sampler_ring {
+		const char *name;
+		uint32_t mmio;
+		int head, tail, size;
+		uint64_t full;
+		int idle;
+	} ring[SAMPLER_NUM_RINGS];
+
+	struct intel_gpu_sampler_bit {
+		struct instdone_bit *bit;
+		int count;
+	} bits[MAX_INSTDONE_BITS];
+	int num_bits;
+
+	int samples;
+
+	bool has_stats;
+	struct intel_counters stats;
+};
+
+void intel_gpu_sampler_init(struct intel_gpu_sampler *s,
+			    struct pci_device *pci_dev);
+void intel_gpu_sampler_fini(struct intel_gpu_sampler *s);
+void intel_gpu_sampler_account_instdone(struct intel_gpu_sampler *s,
+					uint32_t instdone, uint32_t instdone1);
+void intel_gpu_sampler_run(struct intel_gpu_sampler *s, int samples_per_sec);
+
+#endif /* INTEL_GPU_SAMPLER_H */
@@ -77,6 +77,7 @@ static struct _mmio_data {
 	int inited;
 	bool safe;
 	uint32_t i915_devid;
+	const struct intel_device_caps *caps;
 	struct intel_register_map map;
 	int key;
 } mmio_data;
@@ -181,6 +182,7 @@ intel_register_access_init(struct pci_device *pci_dev, int safe)
 	mmio_data.safe = (safe != 0 &&
 			intel_gen(pci_dev->device_id) >= 4) ? true : false;
 	mmio_data.i915_devid = pci_dev->device_id;
+	mmio_data.caps = intel_get_device_caps(mmio_data.i915_devid);
 	if (mmio_data.safe)
 		mmio_data.map = intel_get_register_map(mmio_data.i915_devid);
 
@@ -249,7 +251,7 @@ intel_register_read(uint32_t reg)
 
 	igt_assert(mmio_data.inited);
 
-	if (intel_gen(mmio_data.i915_devid) >= 6)
+	if (mmio_data.caps->gen >= 6)
 		igt_assert(mmio_data.key != -1);
 
 	if (!mmio_data.safe)
@@ -289,7 +291,7 @@ intel_register_write(uint32_t reg, uint32_t val)
 
 	igt_assert(mmio_data.inited);
 
-	if (intel_gen(mmio_data.i915_devid) >= 6)
+	if (mmio_data.caps->gen >= 6)
 		igt_assert(mmio_data.key != -1);
 
 	if (!mmio_data.safe)
@@ -54,6 +54,7 @@
 #include "intel_chipset.h"
 #include "intel_io.h"
 #include "igt_debugfs.h"
+#include "igt_ioctl_trace.h"
 #include "config.h"
 
 #include "ioctl_wrappers.h"
@@ -77,7 +78,42 @@
  * distinguish them.
  */
 
-int (*igt_ioctl)(int fd, unsigned long request, void *arg) = drmIoctl;
+/**
+ * __igt_ioctl:
+ * @fd: file descriptor
+ * @request: IOCTL request number
+ * @arg: argument pointer
+ *
+ * The default implementation of igt_ioctl(): drmIoctl(), timed for the
+ * per-subtest accounting and the ioctl trace if either is enabled.
+ *
+ * Returns: The return value of drmIoctl().
+ */
+int __igt_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct timespec start = {};
+	uint64_t elapsed;
+	int ret, err;
+
+	if (!(__igt_accounting | __igt_ioctl_tracing))
+		return drmIoctl(fd, request, arg);
+
+	igt_nsec_elapsed(&start);
+	ret = drmIoctl(fd, request, arg);
+	err = errno;
+	elapsed = igt_nsec_elapsed(&start);
+
+	if (__igt_accounting)
+		__igt_account_ioctl(elapsed);
+	if (__igt_ioctl_tracing)
+		__igt_ioctl_trace(request, arg, ret, elapsed);
+
+	/* callers look at errno after a failure, the hooks may clobber it */
+	errno = err;
+	return ret;
+}
+
+int (*igt_ioctl)(int fd, unsigned long request, void *arg) = __igt_ioctl;
 
 
 /**
@@ -42,9 +42,10 @@
  * @arg: argument pointer
  *
  * This is a wrapper around drmIoctl(), which can be augmented with special code
- * blocks like #igt_while_interruptible.
+ * blocks like #igt_while_interruptible. It defaults to __igt_ioctl().
  */
 extern int (*igt_ioctl)(int fd, unsigned long request, void *arg);
+int __igt_ioctl(int fd, unsigned long request, void *arg);
 
 /* libdrm interfacing */
 drm_intel_bo * gem_handle_to_libdrm_bo(drm_intel_bufmgr *bufmgr, int fd,
@@ -26,6 +26,7 @@
 #include <intel_aub.h>
 
 #define VERTEX_SIZE (3*4)
+#define BATCH_STATE_SPLIT 2048
 
 #if DEBUG_RENDERCPY
 static void dump_batch(struct intel_batchbuffer *batch) {
@@ -39,15 +40,13 @@ static void dump_batch(struct intel_batchbuffer *batch) {
 #define dump_batch(x) do { } while(0)
 #endif
 
-struct {
-	uint32_t cc_state;
-	uint32_t blend_state;
-} cc;
-
-struct {
-	uint32_t cc_state;
-	uint32_t sf_clip_state;
-} viewport;
+/*
+ * Apart from the surfaces and the rectangle, every copy uses the same state.
+ * The indirect state is built once per batchbuffer into its own bo
+ * (batch->render_state), which the dynamic state and instruction base
+ * addresses point at, and the commands referencing it are recorded on the
+ * first copy and copied into every following batch.
+ */
 
 /* see shaders/ps/blit.g7a */
 static const uint32_t ps_kernel[][4] = {
@@ -167,11 +166,16 @@ batch_copy(struct intel_batchbuffer *batch, const void *ptr, uint32_t size, uint
 
 static void
 gen6_render_flush(struct intel_batchbuffer *batch,
-		  drm_intel_context *context, uint32_t batch_end)
+		  drm_intel_context *context, uint32_t batch_end,
+		  uint32_t state_end)
 {
 	int ret;
 
-	ret = drm_intel_bo_subdata(batch->bo, 0, 4096, batch->buffer);
+	ret = drm_intel_bo_subdata(batch->bo, 0, batch_end, batch->buffer);
+	if (ret == 0)
+		ret = drm_intel_bo_subdata(batch->bo, BATCH_STATE_SPLIT,
+					   state_end - BATCH_STATE_SPLIT,
+					   batch->buffer + BATCH_STATE_SPLIT);
 	if (ret == 0)
 		ret = drm_intel_gem_bo_context_exec(batch->bo, context,
 						    batch_end, 0);
@@ -208,7 +212,9 @@ gen8_bind_buf(struct intel_batchbuffer *batch, struct igt_buf *buf,
 	else if (buf->tiling == I915_TILING_Y)
 		ss->ss0.tiled_mode = 3;
 
-	ss->ss8.base_addr = buf->bo->offset;
+	intel_batchbuffer_softpin_bo(batch, buf->bo);
+	ss->ss8.base_addr = buf->bo->offset64;
+	ss->ss9.base_addr_hi = buf->bo->offset64 >> 32;
 
 	ret = drm_intel_bo_emit_reloc(batch->bo,
 				      batch_offset(batch, ss) + 8 * 4,
@@ -528,7 +534,8 @@ gen9_emit_state_base_address(struct intel_batchbuffer *batch) {
 	OUT_RELOC(batch->bo, I915_GEM_DOMAIN_SAMPLER, 0, BASE_ADDRESS_MODIFY);
 
 	/* dynamic */
-	OUT_RELOC(batch->bo, I915_GEM_DOMAIN_RENDER | I915_GEM_DOMAIN_INSTRUCTION,
+	OUT_RELOC(batch->render_state->bo,
+		  I915_GEM_DOMAIN_RENDER | I915_GEM_DOMAIN_INSTRUCTION,
 		  0, BASE_ADDRESS_MODIFY);
 
 	/* indirect */
@@ -536,7 +543,8 @@ gen9_emit_state_base_address(struct intel_batchbuffer *batch) {
 	OUT_BATCH(0);
 
 	/* instruction */
-	OUT_RELOC(batch->bo, I915_GEM_DOMAIN_INSTRUCTION, 0, BASE_ADDRESS_MODIFY);
+	OUT_RELOC(batch->render_state->bo, I915_GEM_DOMAIN_INSTRUCTION,
+		  0, BASE_ADDRESS_MODIFY);
 
 	/* general state buffer size */
 	OUT_BATCH(0xfffff000 | 1);
@@ -573,10 +581,10 @@ gen7_emit_urb(struct intel_batchbuffer *batch) {
 static void
 gen8_emit_cc(struct intel_batchbuffer *batch) {
 	OUT_BATCH(GEN7_3DSTATE_BLEND_STATE_POINTERS);
-	OUT_BATCH(cc.blend_state | 1);
+	OUT_BATCH(batch->render_state->blend_state | 1);
 
 	OUT_BATCH(GEN6_3DSTATE_CC_STATE_POINTERS);
-	OUT_BATCH(cc.cc_state | 1);
+	OUT_BATCH(batch->render_state->cc_state | 1);
 }
 
 static void
@@ -895,6 +903,98 @@ static void gen8_emit_primitive(struct intel_batchbuffer *batch, uint32_t offset
 	OUT_BATCH(0);	/* index buffer offset, ignored */
 }
 
+static struct intel_render_state *
+gen9_create_static_state(struct intel_batchbuffer *batch)
+{
+	struct intel_render_state *rs;
+	uint32_t size;
+	int ret;
+
+	rs = calloc(1, sizeof(*rs));
+	assert(rs);
+
+	/* Build the state in the empty batch, then move it to its own bo */
+	batch->ptr = batch->buffer + 64;
+
+	rs->sampler = gen8_create_sampler(batch);
+	rs->kernel = gen8_fill_ps(batch, ps_kernel, sizeof(ps_kernel));
+	rs->cc_state = gen6_create_cc_state(batch);
+	rs->blend_state = gen8_create_blend_state(batch);
+	rs->cc_viewport = gen6_create_cc_viewport(batch);
+	rs->sf_clip_viewport = gen7_create_sf_clip_viewport(batch);
+	rs->scissor = gen6_create_scissor_rect(batch);
+
+	size = batch_align(batch, 64);
+	assert(size <= 4096);
+
+	rs->bo = drm_intel_bo_alloc(batch->bufmgr, "render state", 4096, 4096);
+	assert(rs->bo);
+	ret = drm_intel_bo_subdata(rs->bo, 0, size, batch->buffer);
+	assert(ret == 0);
+
+	memset(batch->buffer, 0, size);
+	batch->ptr = batch->buffer;
+
+	return rs;
+}
+
+/* All the commands that only depend on batch->render_state */
+static void
+gen9_emit_static_state(struct intel_batchbuffer *batch)
+{
+	struct intel_render_state *rs = batch->render_state;
+	uint8_t *start = batch->ptr;
+
+	if (rs->cmds_len) {
+		memcpy(batch->ptr, rs->cmds, rs->cmds_len);
+		batch->ptr += rs->cmds_len;
+		return;
+	}
+
+	OUT_BATCH(GEN7_3DSTATE_VIEWPORT_STATE_POINTERS_CC);
+	OUT_BATCH(rs->cc_viewport);
+	OUT_BATCH(GEN7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP);
+	OUT_BATCH(rs->sf_clip_viewport);
+
+	gen7_emit_urb(batch);
+
+	gen8_emit_cc(batch);
+
+	gen8_emit_multisample(batch);
+
+	gen8_emit_null_state(batch);
+
+	OUT_BATCH(GEN7_3DSTATE_STREAMOUT | (5 - 2));
+	OUT_BATCH(0);
+	OUT_BATCH(0);
+	OUT_BATCH(0);
+	OUT_BATCH(0);
+
+	gen7_emit_clip(batch);
+
+	gen8_emit_sf(batch);
+
+	gen8_emit_ps(batch, rs->kernel);
+
+	OUT_BATCH(GEN7_3DSTATE_SAMPLER_STATE_POINTERS_PS);
+	OUT_BATCH(rs->sampler);
+
+	OUT_BATCH(GEN6_3DSTATE_SCISSOR_STATE_POINTERS);
+	OUT_BATCH(rs->scissor);
+
+	gen9_emit_depth(batch);
+
+	gen7_emit_clear(batch);
+
+	gen6_emit_vertex_elements(batch);
+
+	gen8_emit_vf_topology(batch);
+
+	assert((size_t)(batch->ptr - start) <= sizeof(rs->cmds));
+	memcpy(rs->cmds, start, batch->ptr - start);
+	rs->cmds_len = batch->ptr - start;
+}
+
 /* The general rule is if it's named gen6 it is directly copied from
  * gen6_render_copyfunc.
  *
@@ -906,8 +1006,8 @@ static void gen8_emit_primitive(struct intel_batchbuffer *batch, uint32_t offset
  * +---------------+ <---- 4096
  * |       ^       |
  * |       |       |
- * |    various    |
- * |      state    |
+ * |   surfaces    |
+ * |   vertices    |
  * |       |       |
  * |_______|_______| <---- 2048 + ?
  * |       ^       |
@@ -921,25 +1021,26 @@ static void gen8_emit_primitive(struct intel_batchbuffer *batch, uint32_t offset
  * The batch commands point to state within tthe batch, so all state offsets should be
  * 0 < offset < 4096. Both commands and state build upwards, and are constructed
  * in that order. This means too many batch commands can delete state if not
- * careful.
+ * careful. The static state (sampler, kernel, cc, blend, viewports, scissor)
+ * lives in batch->render_state instead.
  *
  */
 
-#define BATCH_STATE_SPLIT 2048
-
 void gen9_render_copyfunc(struct intel_batchbuffer *batch,
 			  drm_intel_context *context,
 			  struct igt_buf *src, unsigned src_x, unsigned src_y,
 			  unsigned width, unsigned height,
 			  struct igt_buf *dst, unsigned dst_x, unsigned dst_y)
 {
-	uint32_t ps_sampler_state, ps_kernel_off, ps_binding_table;
-	uint32_t scissor_state;
+	uint32_t ps_binding_table;
 	uint32_t vertex_buffer;
-	uint32_t batch_end;
+	uint32_t batch_end, state_end;
 
 	intel_batchbuffer_flush_with_context(batch, context);
 
+	if (batch->render_state == NULL)
+		batch->render_state = gen9_create_static_state(batch);
+
 	batch_align(batch, 8);
 
 	batch->ptr = &batch->buffer[BATCH_STATE_SPLIT];
@@ -947,20 +1048,13 @@ void gen9_render_copyfunc(struct intel_batchbuffer *batch,
 	annotation_init(&aub_annotations);
 
 	ps_binding_table  = gen8_bind_surfaces(batch, src, dst);
-	ps_sampler_state  = gen8_create_sampler(batch);
-	ps_kernel_off = gen8_fill_ps(batch, ps_kernel, sizeof(ps_kernel));
 	vertex_buffer = gen7_fill_vertex_buffer_data(batch, src,
 						     src_x, src_y,
 						     dst_x, dst_y,
 						     width, height);
-	cc.cc_state = gen6_create_cc_state(batch);
-	cc.blend_state = gen8_create_blend_state(batch);
-	viewport.cc_state = gen6_create_cc_viewport(batch);
-	viewport.sf_clip_state = gen7_create_sf_clip_viewport(batch);
-	scissor_state = gen6_create_scissor_rect(batch);
-	/* TODO: theree is other state which isn't setup */
 
-	assert(batch->ptr < &batch->buffer[4095]);
+	state_end = batch_used(batch);
+	assert(state_end < 4095);
 
 	batch->ptr = batch->buffer;
 
@@ -975,50 +1069,15 @@ void gen9_render_copyfunc(struct intel_batchbuffer *batch,
 
 	gen9_emit_state_base_address(batch);
 
-	OUT_BATCH(GEN7_3DSTATE_VIEWPORT_STATE_POINTERS_CC);
-	OUT_BATCH(viewport.cc_state);
-	OUT_BATCH(GEN7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP);
-	OUT_BATCH(viewport.sf_clip_state);
-
-	gen7_emit_urb(batch);
-
-	gen8_emit_cc(batch);
-
-	gen8_emit_multisample(batch);
-
-	gen8_emit_null_state(batch);
-
-	OUT_BATCH(GEN7_3DSTATE_STREAMOUT | (5 - 2));
-	OUT_BATCH(0);
-	OUT_BATCH(0);
-	OUT_BATCH(0);
-	OUT_BATCH(0);
-
-	gen7_emit_clip(batch);
-
-	gen8_emit_sf(batch);
-
-	gen8_emit_ps(batch, ps_kernel_off);
+	gen9_emit_static_state(batch);
 
 	OUT_BATCH(GEN7_3DSTATE_BINDING_TABLE_POINTERS_PS);
 	OUT_BATCH(ps_binding_table);
 
-	OUT_BATCH(GEN7_3DSTATE_SAMPLER_STATE_POINTERS_PS);
-	OUT_BATCH(ps_sampler_state);
-
-	OUT_BATCH(GEN6_3DSTATE_SCISSOR_STATE_POINTERS);
-	OUT_BATCH(scissor_state);
-
-	gen9_emit_depth(batch);
-
-	gen7_emit_clear(batch);
-
 	gen6_emit_drawing_rectangle(batch, dst);
 
 	gen7_emit_vertex_buffer(batch, vertex_buffer);
-	gen6_emit_vertex_elements(batch);
 
-	gen8_emit_vf_topology(batch);
 	gen8_emit_primitive(batch, vertex_buffer);
 
 	OUT_BATCH(MI_BATCH_BUFFER_END);
@@ -1031,6 +1090,6 @@ void gen9_render_copyfunc(struct intel_batchbuffer *batch,
 
 	annotation_flush(&aub_annotations, batch);
 
-	gen6_render_flush(batch, context, batch_end);
+	gen6_render_flush(batch, context, batch_end, state_end);
 	intel_batchbuffer_reset(batch);
 }
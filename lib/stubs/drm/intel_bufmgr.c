@@ -1,269 +1,723 @@
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <i915_drm.h>
 
 #include "igt_core.h"
+#include "intel_chipset.h"
 #include "intel_bufmgr.h"
+#include "intel_bufmgr_stub.h"
+
+/*
+ * Without libdrm_intel we cannot talk to the kernel, but everything that
+ * only builds batches (intel_batchbuffer, rendercopy, media and gpgpu fill)
+ * can still run against an in-memory buffer manager. Buffer objects are
+ * backed by anonymous memory and given fixed addresses; relocations are
+ * recorded and written into the buffers on execbuffer, and the final batch
+ * is handed to the callback registered with
+ * drm_intel_bufmgr_fake_set_exec_callback() instead of being submitted.
+ *
+ * Such a bufmgr can only be created with drm_intel_bufmgr_stub_init(), so
+ * tests opening a real device keep skipping as before.
+ */
 
 const char * const missing_support_str = "Not compiled with libdrm_intel support\n";
 
+#define STUB_ADDRESS_START 0x100000
+#define STUB_MAX_CACHED 64
+
+struct stub_reloc {
+	uint32_t offset;
+	uint32_t delta;
+	drm_intel_bo *target;
+	uint32_t read_domains;
+	uint32_t write_domain;
+	bool softpin;
+};
+
+struct stub_bo {
+	drm_intel_bo bo;
+	struct stub_bo *next, *prev;
+
+	int refcount;
+	bool userptr;
+	bool softpin;
+	uint32_t name;
+	uint32_t tiling, stride;
+	unsigned long map_size;
+	unsigned exec_serial;
+	unsigned search_serial;
+
+	/* softpinned targets are kept here too, but are not relocations */
+	struct stub_reloc *relocs;
+	int num_relocs, max_relocs;
+	int num_softpin;
+};
+
+struct _drm_intel_bufmgr {
+	uint32_t devid;
+	unsigned gen;
+
+	struct stub_bo bos;
+	struct stub_bo *cache;
+	int num_cached;
+	int next_handle;
+	uint64_t next_offset;
+	uint64_t address_mask;
+	unsigned exec_serial;
+	unsigned search_serial;
+	uint64_t upload_bytes;
+
+	int (*exec)(drm_intel_bo *bo, unsigned int used, void *priv);
+	void *exec_priv;
+};
+
+struct _drm_intel_context {
+	drm_intel_bufmgr *bufmgr;
+	uint32_t ctx_id;
+};
+
+static inline struct stub_bo *to_stub_bo(drm_intel_bo *bo)
+{
+	return (struct stub_bo *)bo;
+}
+
+drm_intel_bufmgr *drm_intel_bufmgr_stub_init(uint32_t devid, int batch_size)
+{
+	drm_intel_bufmgr *bufmgr;
+
+	bufmgr = calloc(1, sizeof(*bufmgr));
+	if (bufmgr == NULL)
+		return NULL;
+
+	bufmgr->devid = devid;
+	bufmgr->gen = intel_gen(devid);
+	bufmgr->bos.next = bufmgr->bos.prev = &bufmgr->bos;
+	bufmgr->next_handle = 1;
+	bufmgr->next_offset = STUB_ADDRESS_START;
+	bufmgr->address_mask = bufmgr->gen >= 8 ? (1ull << 48) - 1 : (1ull << 32) - 1;
+
+	return bufmgr;
+}
+
+uint64_t drm_intel_bufmgr_stub_get_upload_bytes(drm_intel_bufmgr *bufmgr)
+{
+	return bufmgr->upload_bytes;
+}
+
 drm_intel_bufmgr *drm_intel_bufmgr_gem_init(int fd, int batch_size)
 {
 	igt_require_f(false, missing_support_str);
 	return (drm_intel_bufmgr *) NULL;
 }
 
-void drm_intel_bo_unreference(drm_intel_bo *bo)
+void drm_intel_bufmgr_fake_set_exec_callback(drm_intel_bufmgr *bufmgr,
+					     int (*exec) (drm_intel_bo *bo,
+							  unsigned int used,
+							  void *priv),
+					     void *priv)
 {
-	igt_require_f(false, missing_support_str);
+	bufmgr->exec = exec;
+	bufmgr->exec_priv = priv;
+}
+
+static uint64_t stub_assign_offset(drm_intel_bufmgr *bufmgr,
+				   unsigned long size, unsigned long align)
+{
+	uint64_t offset;
+
+	if (align < 4096)
+		align = 4096;
+
+	offset = (bufmgr->next_offset + align - 1) & ~(uint64_t)(align - 1);
+	if (offset + size > bufmgr->address_mask) {
+		/* Wrap around; addresses only need to be plausible */
+		offset = STUB_ADDRESS_START;
+	}
+	bufmgr->next_offset = offset + size;
+
+	return offset;
+}
+
+/*
+ * Like libdrm, keep released buffers around for reuse (contents and address
+ * included), as page faulting fresh anonymous memory would otherwise
+ * dominate the cost of building a batch.
+ */
+static struct stub_bo *stub_bo_from_cache(drm_intel_bufmgr *bufmgr,
+					  unsigned long size,
+					  unsigned long align)
+{
+	struct stub_bo *bo, **prev;
+
+	for (prev = &bufmgr->cache; (bo = *prev) != NULL; prev = &bo->next) {
+		if (bo->map_size != size)
+			continue;
+		if (align && bo->bo.offset64 & (align - 1))
+			continue;
+
+		*prev = bo->next;
+		bufmgr->num_cached--;
+		return bo;
+	}
+
+	return NULL;
+}
+
+static drm_intel_bo *stub_bo_create(drm_intel_bufmgr *bufmgr,
+				    unsigned long size, unsigned long align,
+				    void *userptr)
+{
+	struct stub_bo *bo;
+
+	size = (size + 4095) & ~4095ul;
+	if (userptr == NULL) {
+		bo = stub_bo_from_cache(bufmgr, size, align);
+		if (bo) {
+			bo->refcount = 1;
+			goto link;
+		}
+	}
+
+	bo = calloc(1, sizeof(*bo));
+	if (bo == NULL)
+		return NULL;
+
+	if (userptr) {
+		bo->bo.virtual = userptr;
+		bo->userptr = true;
+	} else {
+		bo->bo.virtual = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (bo->bo.virtual == MAP_FAILED) {
+			free(bo);
+			return NULL;
+		}
+		bo->map_size = size;
+	}
+
+	bo->bo.size = size;
+	bo->bo.align = align;
+	bo->bo.bufmgr = bufmgr;
+	bo->bo.handle = bufmgr->next_handle++;
+	bo->bo.offset64 = stub_assign_offset(bufmgr, size, align);
+	bo->bo.offset = bo->bo.offset64;
+	bo->refcount = 1;
+
+link:
+	bo->next = bufmgr->bos.next;
+	bo->prev = &bufmgr->bos;
+	bo->next->prev = bo;
+	bufmgr->bos.next = bo;
+
+	return &bo->bo;
 }
 
 drm_intel_bo *drm_intel_bo_alloc(drm_intel_bufmgr *bufmgr, const char *name,
 				 unsigned long size, unsigned int alignment)
 {
-	igt_require_f(false, missing_support_str);
-	return (drm_intel_bo *) NULL;
+	return stub_bo_create(bufmgr, size, alignment, NULL);
 }
 
-int drm_intel_bo_subdata(drm_intel_bo *bo, unsigned long offset,
-			 unsigned long size, const void *data)
+drm_intel_bo *drm_intel_bo_alloc_for_render(drm_intel_bufmgr *bufmgr,
+					    const char *name,
+					    unsigned long size,
+					    unsigned int alignment)
 {
-	igt_require_f(false, missing_support_str);
-	return 0;
+	return stub_bo_create(bufmgr, size, alignment, NULL);
 }
 
-int drm_intel_gem_bo_context_exec(drm_intel_bo *bo, drm_intel_context *ctx,
-				  int used, unsigned int flags)
+drm_intel_bo *drm_intel_bo_alloc_userptr(drm_intel_bufmgr *bufmgr,
+					 const char *name,
+					 void *addr, uint32_t tiling_mode,
+					 uint32_t stride, unsigned long size,
+					 unsigned long flags)
 {
-	igt_require_f(false, missing_support_str);
-	return 0;
+	drm_intel_bo *bo;
+
+	if (tiling_mode != I915_TILING_NONE)
+		return NULL;
+
+	bo = stub_bo_create(bufmgr, size, 0, addr);
+	if (bo)
+		bo->size = size;
+
+	return bo;
 }
 
-int drm_intel_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
-				drm_intel_bo *target_bo, uint32_t target_offset,
-				uint32_t read_domains, uint32_t write_domain)
+drm_intel_bo *drm_intel_bo_alloc_tiled(drm_intel_bufmgr *bufmgr,
+				       const char *name,
+				       int x, int y, int cpp,
+				       uint32_t *tiling_mode,
+				       unsigned long *pitch,
+				       unsigned long flags)
 {
-	igt_require_f(false, missing_support_str);
-	return 0;
+	unsigned long stride, height, tile_width, tile_height;
+	drm_intel_bo *bo;
+
+	switch (*tiling_mode) {
+	case I915_TILING_X:
+		tile_width = 512;
+		tile_height = 8;
+		break;
+	case I915_TILING_Y:
+		tile_width = 128;
+		tile_height = 32;
+		break;
+	default:
+		*tiling_mode = I915_TILING_NONE;
+		tile_width = 64;
+		tile_height = 2;
+		break;
+	}
+
+	stride = ((unsigned long)x * cpp + tile_width - 1) & ~(tile_width - 1);
+	height = ((unsigned long)y + tile_height - 1) & ~(tile_height - 1);
+
+	bo = stub_bo_create(bufmgr, stride * height, 0, NULL);
+	if (bo == NULL)
+		return NULL;
+
+	to_stub_bo(bo)->tiling = *tiling_mode;
+	to_stub_bo(bo)->stride = stride;
+	*pitch = stride;
+
+	return bo;
 }
 
-int drm_intel_bo_emit_reloc_fence(drm_intel_bo *bo, uint32_t offset,
-				  drm_intel_bo *target_bo,
-				  uint32_t target_offset,
-				  uint32_t read_domains, uint32_t write_domain)
+void drm_intel_bo_reference(drm_intel_bo *bo)
 {
-	igt_require_f(false, missing_support_str);
-	return 0;
+	to_stub_bo(bo)->refcount++;
 }
 
-int drm_intel_bo_get_tiling(drm_intel_bo *bo, uint32_t * tiling_mode,
-			    uint32_t * swizzle_mode)
+void drm_intel_bo_unreference(drm_intel_bo *bo)
+{
+	struct stub_bo *stub;
+	int n;
+
+	if (bo == NULL)
+		return;
+
+	stub = to_stub_bo(bo);
+	igt_assert(stub->refcount > 0);
+	if (--stub->refcount)
+		return;
+
+	for (n = 0; n < stub->num_relocs; n++)
+		if (stub->relocs[n].target != bo)
+			drm_intel_bo_unreference(stub->relocs[n].target);
+	stub->num_relocs = 0;
+	stub->num_softpin = 0;
+
+	stub->next->prev = stub->prev;
+	stub->prev->next = stub->next;
+
+	if (!stub->userptr && bo->bufmgr->num_cached < STUB_MAX_CACHED) {
+		stub->name = 0;
+		stub->softpin = false;
+		stub->tiling = I915_TILING_NONE;
+		stub->stride = 0;
+
+		stub->next = bo->bufmgr->cache;
+		bo->bufmgr->cache = stub;
+		bo->bufmgr->num_cached++;
+		return;
+	}
+
+	free(stub->relocs);
+	if (!stub->userptr)
+		munmap(bo->virtual, stub->map_size);
+	free(stub);
+}
+
+int drm_intel_bo_map(drm_intel_bo *bo, int write_enable)
 {
-	igt_require_f(false, missing_support_str);
 	return 0;
 }
 
-int drm_intel_bo_mrb_exec(drm_intel_bo *bo, int used,
-			  struct drm_clip_rect *cliprects, int num_cliprects,
-			  int DR4, unsigned int flags)
+int drm_intel_bo_unmap(drm_intel_bo *bo)
 {
-	igt_require_f(false, missing_support_str);
 	return 0;
 }
 
-void drm_intel_bufmgr_gem_set_aub_annotations(drm_intel_bo *bo,
-					      drm_intel_aub_annotation *annotations,
-					      unsigned count)
+int drm_intel_gem_bo_map_gtt(drm_intel_bo *bo)
 {
-	igt_require_f(false, missing_support_str);
+	return 0;
 }
 
-void drm_intel_bufmgr_gem_enable_reuse(drm_intel_bufmgr *bufmgr)
+int drm_intel_gem_bo_map_unsynchronized(drm_intel_bo *bo)
 {
-	igt_require_f(false, missing_support_str);
+	return 0;
 }
 
-int drm_intel_bo_exec(drm_intel_bo *bo, int used,
-		      struct drm_clip_rect *cliprects, int num_cliprects, int DR4)
+int drm_intel_gem_bo_unmap_gtt(drm_intel_bo *bo)
 {
-	igt_require_f(false, missing_support_str);
 	return 0;
 }
 
-void drm_intel_bufmgr_destroy(drm_intel_bufmgr *bufmgr)
+void drm_intel_gem_bo_start_gtt_access(drm_intel_bo *bo, int write_enable)
 {
-	igt_require_f(false, missing_support_str);
 }
 
-void drm_intel_bo_wait_rendering(drm_intel_bo *bo)
+int drm_intel_bo_subdata(drm_intel_bo *bo, unsigned long offset,
+			 unsigned long size, const void *data)
 {
-	igt_require_f(false, missing_support_str);
+	if (offset > bo->size || size > bo->size - offset)
+		return -EINVAL;
+
+	memcpy((char *)bo->virtual + offset, data, size);
+	bo->bufmgr->upload_bytes += size;
+	return 0;
 }
 
 int drm_intel_bo_get_subdata(drm_intel_bo *bo, unsigned long offset,
 			     unsigned long size, void *data)
 {
-	igt_require_f(false, missing_support_str);
+	if (offset > bo->size || size > bo->size - offset)
+		return -EINVAL;
+
+	memcpy(data, (char *)bo->virtual + offset, size);
 	return 0;
 }
 
-int drm_intel_bo_map(drm_intel_bo *bo, int write_enable)
+void drm_intel_bo_wait_rendering(drm_intel_bo *bo)
+{
+}
+
+int drm_intel_gem_bo_wait(drm_intel_bo *bo, int64_t timeout_ns)
 {
-	igt_require_f(false, missing_support_str);
 	return 0;
 }
 
-int drm_intel_gem_bo_map_gtt(drm_intel_bo *bo)
+int drm_intel_bo_busy(drm_intel_bo *bo)
 {
-	igt_require_f(false, missing_support_str);
 	return 0;
 }
 
-void drm_intel_bufmgr_gem_enable_fenced_relocs(drm_intel_bufmgr *bufmgr)
+int drm_intel_bo_madvise(drm_intel_bo *bo, int madv)
 {
-	igt_require_f(false, missing_support_str);
+	return 1;
 }
 
-int drm_intel_bo_unmap(drm_intel_bo *bo)
+int drm_intel_bo_pin(drm_intel_bo *bo, uint32_t alignment)
 {
-	igt_require_f(false, missing_support_str);
 	return 0;
 }
 
-int drm_intel_bo_flink(drm_intel_bo *bo, uint32_t * name)
+int drm_intel_bo_unpin(drm_intel_bo *bo)
 {
-	igt_require_f(false, missing_support_str);
 	return 0;
 }
 
-drm_intel_bo *drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
-						const char *name,
-						unsigned int handle)
+int drm_intel_bo_use_48b_address_range(drm_intel_bo *bo, uint32_t enable)
 {
-	igt_require_f(false, missing_support_str);
-	return (drm_intel_bo *) NULL;
+	return 0;
 }
 
-int drm_intel_bo_gem_export_to_prime(drm_intel_bo *bo, int *prime_fd)
+int drm_intel_bo_set_softpin_offset(drm_intel_bo *bo, uint64_t offset)
 {
-	igt_require_f(false, missing_support_str);
+	to_stub_bo(bo)->softpin = true;
+	bo->offset64 = offset;
+	bo->offset = offset;
 	return 0;
 }
 
-drm_intel_bo *drm_intel_bo_gem_create_from_prime(drm_intel_bufmgr *bufmgr,
-						 int prime_fd, int size)
+int drm_intel_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
+			    drm_intel_bo *target_bo, uint32_t target_offset,
+			    uint32_t read_domains, uint32_t write_domain)
+{
+	struct stub_bo *stub = to_stub_bo(bo);
+	struct stub_reloc *reloc;
+
+	if (offset > bo->size - 4)
+		return -EINVAL;
+
+	if (stub->num_relocs == stub->max_relocs) {
+		int max = stub->max_relocs ? 2 * stub->max_relocs : 64;
+
+		reloc = realloc(stub->relocs, max * sizeof(*reloc));
+		if (reloc == NULL)
+			return -ENOMEM;
+
+		stub->relocs = reloc;
+		stub->max_relocs = max;
+	}
+
+	reloc = &stub->relocs[stub->num_relocs++];
+	reloc->offset = offset;
+	reloc->delta = target_offset;
+	reloc->target = target_bo;
+	reloc->read_domains = read_domains;
+	reloc->write_domain = write_domain;
+	reloc->softpin = to_stub_bo(target_bo)->softpin;
+	stub->num_softpin += reloc->softpin;
+
+	/* Self-relocations must not keep the buffer alive */
+	if (target_bo != bo)
+		drm_intel_bo_reference(target_bo);
+	return 0;
+}
+
+int drm_intel_bo_emit_reloc_fence(drm_intel_bo *bo, uint32_t offset,
+				  drm_intel_bo *target_bo,
+				  uint32_t target_offset,
+				  uint32_t read_domains, uint32_t write_domain)
 {
-	igt_require_f(false, missing_support_str);
-	return (drm_intel_bo *) NULL;
+	return drm_intel_bo_emit_reloc(bo, offset, target_bo, target_offset,
+				       read_domains, write_domain);
 }
 
-void drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr,
-					     int limit)
+int drm_intel_gem_bo_get_reloc_count(drm_intel_bo *bo)
 {
-	igt_require_f(false, missing_support_str);
+	struct stub_bo *stub = to_stub_bo(bo);
+
+	return stub->num_relocs - stub->num_softpin;
 }
 
-int drm_intel_gem_bo_unmap_gtt(drm_intel_bo *bo)
+void drm_intel_gem_bo_clear_relocs(drm_intel_bo *bo, int start)
 {
-	igt_require_f(false, missing_support_str);
-	return 0;
+	struct stub_bo *stub = to_stub_bo(bo);
+	int n, count = 0, kept = 0;
+
+	/* Like libdrm, this also forgets every softpinned target */
+	for (n = 0; n < stub->num_relocs; n++) {
+		struct stub_reloc *reloc = &stub->relocs[n];
+
+		if (!reloc->softpin && count++ < start) {
+			stub->relocs[kept++] = *reloc;
+			continue;
+		}
+
+		if (reloc->target != bo)
+			drm_intel_bo_unreference(reloc->target);
+	}
+
+	stub->num_relocs = kept;
+	stub->num_softpin = 0;
 }
 
-drm_intel_context *drm_intel_gem_context_create(drm_intel_bufmgr *bufmgr)
+/* Relocations may form cycles, so each bo is only visited once per search */
+static bool stub_references(struct stub_bo *stub, drm_intel_bo *target_bo,
+			    unsigned serial)
 {
-	igt_require_f(false, missing_support_str);
-	return (drm_intel_bo *) NULL;
+	int n;
+
+	if (stub->search_serial == serial)
+		return false;
+	stub->search_serial = serial;
+
+	for (n = 0; n < stub->num_relocs; n++) {
+		if (stub->relocs[n].target == target_bo)
+			return true;
+		if (stub_references(to_stub_bo(stub->relocs[n].target),
+				    target_bo, serial))
+			return true;
+	}
+
+	return false;
 }
 
-void drm_intel_gem_context_destroy(drm_intel_context *ctx)
+int drm_intel_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo)
 {
-	igt_require_f(false, missing_support_str);
+	return stub_references(to_stub_bo(bo), target_bo,
+			       ++bo->bufmgr->search_serial);
 }
 
-drm_intel_bo *drm_intel_bo_alloc_tiled(drm_intel_bufmgr *bufmgr,
-				       const char *name,
-				       int x, int y, int cpp,
-				       uint32_t *tiling_mode,
-				       unsigned long *pitch,
-				       unsigned long flags)
+static void stub_apply_relocs(struct stub_bo *stub, unsigned serial, bool wide)
 {
-	igt_require_f(false, missing_support_str);
-	return (drm_intel_bo *) NULL;
+	int n;
+
+	if (stub->exec_serial == serial)
+		return;
+	stub->exec_serial = serial;
+
+	for (n = 0; n < stub->num_relocs; n++) {
+		const struct stub_reloc *reloc = &stub->relocs[n];
+		uint64_t address = reloc->target->offset64 + reloc->delta;
+		char *ptr = (char *)stub->bo.virtual + reloc->offset;
+
+		/* softpinned addresses were already written by the caller */
+		if (!reloc->softpin) {
+			if (wide && reloc->offset + 8 <= stub->bo.size)
+				memcpy(ptr, &address, 8);
+			else
+				memcpy(ptr, &address, 4);
+		}
+
+		stub_apply_relocs(to_stub_bo(reloc->target), serial, wide);
+	}
 }
 
-void drm_intel_bufmgr_gem_set_aub_filename(drm_intel_bufmgr *bufmgr,
-					  const char *filename)
+static int stub_exec(drm_intel_bo *bo, int used)
 {
-	igt_require_f(false, missing_support_str);
+	drm_intel_bufmgr *bufmgr = bo->bufmgr;
+
+	if (used < 0 || (unsigned long)used > bo->size)
+		return -EINVAL;
+
+	stub_apply_relocs(to_stub_bo(bo), ++bufmgr->exec_serial,
+			  bufmgr->gen >= 8);
+
+	if (bufmgr->exec)
+		return bufmgr->exec(bo, used, bufmgr->exec_priv);
+
+	return 0;
 }
 
-void drm_intel_bufmgr_gem_set_aub_dump(drm_intel_bufmgr *bufmgr, int enable)
+int drm_intel_bo_exec(drm_intel_bo *bo, int used,
+		      struct drm_clip_rect *cliprects, int num_cliprects, int DR4)
 {
-	igt_require_f(false, missing_support_str);
+	return stub_exec(bo, used);
 }
 
-void drm_intel_gem_bo_aub_dump_bmp(drm_intel_bo *bo,
-				   int x1, int y1, int width, int height,
-				   enum aub_dump_bmp_format format,
-				   int pitch, int offset)
+int drm_intel_bo_mrb_exec(drm_intel_bo *bo, int used,
+			  struct drm_clip_rect *cliprects, int num_cliprects,
+			  int DR4, unsigned int flags)
 {
-	igt_require_f(false, missing_support_str);
+	return stub_exec(bo, used);
 }
 
-void drm_intel_gem_bo_start_gtt_access(drm_intel_bo *bo, int write_enable)
+int drm_intel_gem_bo_context_exec(drm_intel_bo *bo, drm_intel_context *ctx,
+				  int used, unsigned int flags)
 {
-	igt_require_f(false, missing_support_str);
+	return stub_exec(bo, used);
+}
+
+int drm_intel_bo_get_tiling(drm_intel_bo *bo, uint32_t * tiling_mode,
+			    uint32_t * swizzle_mode)
+{
+	*tiling_mode = to_stub_bo(bo)->tiling;
+	*swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+	return 0;
 }
 
 int drm_intel_bo_set_tiling(drm_intel_bo *bo, uint32_t * tiling_mode,
 				uint32_t stride)
 {
-	igt_require_f(false, missing_support_str);
+	to_stub_bo(bo)->tiling = *tiling_mode;
+	to_stub_bo(bo)->stride = stride;
 	return 0;
 }
 
-int drm_intel_bo_disable_reuse(drm_intel_bo *bo)
+int drm_intel_bo_flink(drm_intel_bo *bo, uint32_t * name)
 {
-	igt_require_f(false, missing_support_str);
+	struct stub_bo *stub = to_stub_bo(bo);
+
+	if (stub->name == 0)
+		stub->name = bo->handle;
+
+	*name = stub->name;
 	return 0;
 }
 
-void drm_intel_bo_reference(drm_intel_bo *bo)
+drm_intel_bo *drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
+						const char *name,
+						unsigned int handle)
 {
-	igt_require_f(false, missing_support_str);
+	struct stub_bo *bo;
+
+	for (bo = bufmgr->bos.next; bo != &bufmgr->bos; bo = bo->next) {
+		if (bo->name && bo->name == handle) {
+			drm_intel_bo_reference(&bo->bo);
+			return &bo->bo;
+		}
+	}
+
+	return NULL;
 }
 
-int drm_intel_bufmgr_gem_get_devid(drm_intel_bufmgr *bufmgr)
+int drm_intel_bo_gem_export_to_prime(drm_intel_bo *bo, int *prime_fd)
 {
-	igt_require_f(false, missing_support_str);
-	return 0;
+	return -ENODEV;
 }
 
-drm_intel_bo *drm_intel_bo_alloc_for_render(drm_intel_bufmgr *bufmgr,
-					    const char *name,
-					    unsigned long size,
-					    unsigned int alignment)
+drm_intel_bo *drm_intel_bo_gem_create_from_prime(drm_intel_bufmgr *bufmgr,
+						 int prime_fd, int size)
 {
-	igt_require_f(false, missing_support_str);
-	return (drm_intel_bo *) NULL;
+	return NULL;
 }
 
-int drm_intel_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo)
+int drm_intel_bo_disable_reuse(drm_intel_bo *bo)
 {
-	igt_require_f(false, missing_support_str);
 	return 0;
 }
 
-int drm_intel_gem_bo_wait(drm_intel_bo *bo, int64_t timeout_ns)
+int drm_intel_bo_is_reusable(drm_intel_bo *bo)
 {
-	igt_require_f(false, missing_support_str);
 	return 0;
 }
 
-drm_intel_bo *drm_intel_bo_alloc_userptr(drm_intel_bufmgr *bufmgr,
-					 const char *name,
-					 void *addr, uint32_t tiling_mode,
-					 uint32_t stride, unsigned long size,
-					 unsigned long flags)
+void drm_intel_bufmgr_gem_enable_reuse(drm_intel_bufmgr *bufmgr)
+{
+}
+
+void drm_intel_bufmgr_gem_enable_fenced_relocs(drm_intel_bufmgr *bufmgr)
+{
+}
+
+void drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr,
+					     int limit)
+{
+}
+
+int drm_intel_bufmgr_gem_get_devid(drm_intel_bufmgr *bufmgr)
+{
+	return bufmgr->devid;
+}
+
+void drm_intel_bufmgr_destroy(drm_intel_bufmgr *bufmgr)
+{
+	struct stub_bo *bo;
+
+	while ((bo = bufmgr->cache) != NULL) {
+		bufmgr->cache = bo->next;
+		free(bo->relocs);
+		munmap(bo->bo.virtual, bo->map_size);
+		free(bo);
+	}
+
+	free(bufmgr);
+}
+
+drm_intel_context *drm_intel_gem_context_create(drm_intel_bufmgr *bufmgr)
+{
+	static uint32_t next_ctx_id = 1;
+	drm_intel_context *ctx;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL)
+		return NULL;
+
+	ctx->bufmgr = bufmgr;
+	ctx->ctx_id = next_ctx_id++;
+	return ctx;
+}
+
+void drm_intel_gem_context_destroy(drm_intel_context *ctx)
+{
+	free(ctx);
+}
+
+void drm_intel_bufmgr_gem_set_aub_annotations(drm_intel_bo *bo,
+					      drm_intel_aub_annotation *annotations,
+					      unsigned count)
+{
+}
+
+void drm_intel_bufmgr_gem_set_aub_filename(drm_intel_bufmgr *bufmgr,
+					  const char *filename)
+{
+}
+
+void drm_intel_bufmgr_gem_set_aub_dump(drm_intel_bufmgr *bufmgr, int enable)
+{
+}
+
+void drm_intel_gem_bo_aub_dump_bmp(drm_intel_bo *bo,
+				   int x1, int y1, int width, int height,
+				   enum aub_dump_bmp_format format,
+				   int pitch, int offset)
 {
-	igt_require_f(false, missing_support_str);
-	return NULL;
 }
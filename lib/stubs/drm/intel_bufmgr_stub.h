@@ -0,0 +1,41 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef INTEL_BUFMGR_STUB_H
+#define INTEL_BUFMGR_STUB_H
+
+#include <stdint.h>
+
+#include "intel_bufmgr.h"
+
+/*
+ * Entry points only provided by the in-memory bufmgr used when building
+ * without libdrm_intel, see intel_bufmgr.c. Batches executed on it are
+ * passed to the callback set with drm_intel_bufmgr_fake_set_exec_callback().
+ */
+drm_intel_bufmgr *drm_intel_bufmgr_stub_init(uint32_t devid, int batch_size);
+
+/* Bytes written with drm_intel_bo_subdata() since the bufmgr was created */
+uint64_t drm_intel_bufmgr_stub_get_upload_bytes(drm_intel_bufmgr *bufmgr);
+
+#endif /* INTEL_BUFMGR_STUB_H */
@@ -0,0 +1,148 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Testcase: Test the log buffer dumped on failure.
+ *
+ * Several threads log far more than fits into their rings before the test
+ * fails; the dump must contain, for every thread, an uninterrupted run of
+ * its most recent lines, and nothing logged before the subtest started.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <errno.h>
+
+#include "drmtest.h"
+#include "igt_core.h"
+
+/*
+ * We need to hide assert from the cocci igt test refactor spatch.
+ *
+ * IMPORTANT: Test infrastructure tests are the only valid places where using
+ * assert is allowed.
+ */
+#define internal_assert assert
+
+#define NUM_THREADS 4
+#define NUM_LINES 10000
+
+char test[] = "test";
+char *argv_run[] = { test };
+
+static void *logger(void *arg)
+{
+	int thread = (uintptr_t)arg;
+	int n;
+
+	for (n = 0; n < NUM_LINES; n++)
+		igt_debug("thread %d line %d\n", thread, n);
+
+	return NULL;
+}
+
+static void __attribute__((noreturn)) child(void)
+{
+	pthread_t threads[NUM_THREADS];
+	int argc = 1;
+	int n;
+
+	igt_subtest_init(argc, argv_run);
+
+	igt_debug("before the subtest\n");
+
+	igt_subtest("A") {
+		for (n = 0; n < NUM_THREADS; n++)
+			pthread_create(&threads[n], NULL,
+				       logger, (void *)(uintptr_t)n);
+		for (n = 0; n < NUM_THREADS; n++)
+			pthread_join(threads[n], NULL);
+
+		igt_fail(IGT_EXIT_FAILURE);
+	}
+
+	igt_exit();
+}
+
+int main(int argc, char **argv)
+{
+	int last[NUM_THREADS];
+	int pipefd[2], status, n;
+	bool dumped = false;
+	char line[256];
+	FILE *file;
+	pid_t pid;
+
+	internal_assert(pipe(pipefd) == 0);
+
+	switch (pid = fork()) {
+	case -1:
+		internal_assert(0);
+	case 0:
+		close(pipefd[0]);
+		dup2(pipefd[1], STDERR_FILENO);
+		child();
+	default:
+		close(pipefd[1]);
+	}
+
+	for (n = 0; n < NUM_THREADS; n++)
+		last[n] = -1;
+
+	file = fdopen(pipefd[0], "r");
+	while (fgets(line, sizeof(line), file)) {
+		const char *str;
+		int thread, num;
+
+		if (strcmp(line, "**** DEBUG ****\n") == 0)
+			dumped = true;
+		internal_assert(!strstr(line, "before the subtest"));
+
+		str = strstr(line, "DEBUG: thread ");
+		if (!str)
+			continue;
+
+		internal_assert(sscanf(str, "DEBUG: thread %d line %d",
+				       &thread, &num) == 2);
+		internal_assert(thread >= 0 && thread < NUM_THREADS);
+		internal_assert(last[thread] < 0 || num == last[thread] + 1);
+		last[thread] = num;
+	}
+	fclose(file);
+
+	while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+		;
+	internal_assert(WIFEXITED(status));
+	internal_assert(WEXITSTATUS(status) == IGT_EXIT_FAILURE);
+
+	internal_assert(dumped);
+	for (n = 0; n < NUM_THREADS; n++)
+		internal_assert(last[n] == NUM_LINES - 1);
+
+	return 0;
+}
@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# Copyright © 2016 Intel Corporation
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice (including the next
+# paragraph) shall be included in all copies or substantial portions of the
+# Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+
+#
+# Check that scripts/igt-runner.py enumerates, schedules and reports the
+# GPU-free tests in this directory correctly
+#
+
+PYTHON=`which python3 2> /dev/null`
+if [ -z "$PYTHON" ]; then
+	echo "python3 not found, skipping"
+	exit 77
+fi
+
+RUNNER="$PYTHON $top_srcdir/scripts/igt-runner.py"
+RESULTS=`mktemp -d`
+trap "rm -rf $RESULTS" EXIT
+
+echo "igt_runner_fixture/exclusive-*	display" > $RESULTS/resources.txt
+
+# igt_timeout fails, so the runner must report failure
+$RUNNER -j 4 -r $RESULTS -m $RESULTS/resources.txt \
+	./igt_runner_fixture ./igt_stats ./igt_timeout && exit 1
+
+$PYTHON - $RESULTS <<'EOF_PY' || exit 1
+import json, sys
+
+results = {}
+for line in open(sys.argv[1] + '/results.jsonl'):
+    r = json.loads(line)
+    results[r['name']] = r
+
+expected = {
+    'igt_runner_fixture/pass': 'pass',
+    'igt_runner_fixture/skip': 'skip',
+    'igt_runner_fixture/slow': 'pass',
+    'igt_runner_fixture/exclusive-a': 'pass',
+    'igt_runner_fixture/exclusive-b': 'pass',
+    'igt_stats': 'pass',
+    'igt_timeout': 'fail',
+}
+for name, result in expected.items():
+    assert results[name]['result'] == result, (name, results[name]['result'])
+assert len(results) == len(expected)
+
+# jobs claiming the same resource must not overlap
+a = results['igt_runner_fixture/exclusive-a']
+b = results['igt_runner_fixture/exclusive-b']
+assert a['end'] <= b['start'] or b['end'] <= a['start']
+
+# igt_core accounts for every subtest it ran
+slow = results['igt_runner_fixture/slow']['accounting']
+assert [a['kind'] for a in slow] == ['subtest'] and slow[0]['wall'] >= 0.5
+
+timings = json.load(open(sys.argv[1] + '/timings.json'))
+assert timings['igt_runner_fixture/slow'] >= 0.5
+EOF_PY
+
+# the recorded timings put the slowest job first next time
+FIRST=`$RUNNER -r $RESULTS -l ./igt_runner_fixture | sed -n 1p`
+[ "$FIRST" = "igt_runner_fixture/slow" ] || exit 1
+
+# a resumed run has nothing left to do
+$RUNNER -R -r $RESULTS -m $RESULTS/resources.txt \
+	./igt_runner_fixture ./igt_stats || exit 1
@@ -0,0 +1,214 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "drmtest.h"
+#include "igt_core.h"
+#include "intel_chipset.h"
+#include "intel_batchbuffer.h"
+#include "intel_bufmgr.h"
+#include "intel_bufmgr_stub.h"
+
+/*
+ * Exercises the in-memory bufmgr used when building without libdrm_intel:
+ * relocations must be applied on execbuffer and batches built by the
+ * render copy helpers must be captured with their final addresses.
+ */
+
+#define WIDTH 64
+#define HEIGHT 64
+
+struct capture {
+	int execs;
+	uint32_t batch[BATCH_SZ / 4];
+	unsigned int used;
+	int relocs;
+};
+
+static int capture_exec(drm_intel_bo *bo, unsigned int used, void *priv)
+{
+	struct capture *c = priv;
+
+	/* Indirect state lives in the same bo, past the commands */
+	igt_assert(bo->size >= sizeof(c->batch));
+	drm_intel_bo_get_subdata(bo, 0, sizeof(c->batch), c->batch);
+	c->used = used;
+	c->relocs = drm_intel_gem_bo_get_reloc_count(bo);
+	c->execs++;
+
+	return 0;
+}
+
+static bool batch_references(const struct capture *c, uint64_t address)
+{
+	unsigned int n;
+
+	for (n = 0; n < ARRAY_SIZE(c->batch); n++)
+		if (c->batch[n] == (uint32_t)address)
+			return true;
+
+	return false;
+}
+
+static void test_relocations(uint32_t devid)
+{
+	drm_intel_bufmgr *bufmgr;
+	drm_intel_bo *batch, *target, *other;
+	struct capture c = {};
+	uint64_t value = 0;
+
+	bufmgr = drm_intel_bufmgr_stub_init(devid, 4096);
+	igt_assert(bufmgr);
+	drm_intel_bufmgr_fake_set_exec_callback(bufmgr, capture_exec, &c);
+
+	batch = drm_intel_bo_alloc(bufmgr, "batch", BATCH_SZ, 4096);
+	target = drm_intel_bo_alloc(bufmgr, "target", 4096, 4096);
+	igt_assert(batch && target);
+	igt_assert(batch->offset64 != target->offset64);
+
+	memset(batch->virtual, 0xff, BATCH_SZ);
+	igt_assert_eq(drm_intel_bo_emit_reloc(batch, 8, target, 0x10, 0, 0), 0);
+	igt_assert_eq(drm_intel_gem_bo_get_reloc_count(batch), 1);
+	igt_assert(drm_intel_bo_references(batch, target));
+
+	igt_assert_eq(drm_intel_bo_exec(batch, 16, NULL, 0, 0), 0);
+	igt_assert_eq(c.execs, 1);
+	igt_assert_eq(c.used, 16);
+
+	memcpy(&value, &c.batch[2], intel_gen(devid) >= 8 ? 8 : 4);
+	igt_assert_eq_u64(value, target->offset64 + 0x10);
+
+	/* A reloc cycle must not send the search round in circles */
+	other = drm_intel_bo_alloc(bufmgr, "other", 4096, 4096);
+	igt_assert(other);
+	igt_assert_eq(drm_intel_bo_emit_reloc(target, 0, batch, 0, 0, 0), 0);
+	igt_assert(drm_intel_bo_references(target, batch));
+	igt_assert(!drm_intel_bo_references(batch, other));
+	drm_intel_gem_bo_clear_relocs(target, 0);
+
+	drm_intel_bo_unreference(other);
+	drm_intel_bo_unreference(target);
+	drm_intel_bo_unreference(batch);
+	drm_intel_bufmgr_destroy(bufmgr);
+}
+
+static void init_buf(drm_intel_bufmgr *bufmgr, struct igt_buf *buf)
+{
+	memset(buf, 0, sizeof(*buf));
+
+	buf->bo = drm_intel_bo_alloc(bufmgr, "", WIDTH * HEIGHT * 4, 4096);
+	igt_assert(buf->bo);
+	buf->stride = WIDTH * 4;
+	buf->tiling = I915_TILING_NONE;
+	buf->size = WIDTH * HEIGHT * 4;
+}
+
+static void test_render_copy(uint32_t devid)
+{
+	igt_render_copyfunc_t copy = igt_get_render_copyfunc(devid);
+	struct intel_batchbuffer *batch;
+	drm_intel_bufmgr *bufmgr;
+	struct igt_buf src, dst;
+	struct capture c = {};
+
+	igt_assert(copy);
+
+	bufmgr = drm_intel_bufmgr_stub_init(devid, 4096);
+	igt_assert(bufmgr);
+	drm_intel_bufmgr_fake_set_exec_callback(bufmgr, capture_exec, &c);
+
+	batch = intel_batchbuffer_alloc(bufmgr, devid);
+	init_buf(bufmgr, &src);
+	init_buf(bufmgr, &dst);
+
+	copy(batch, NULL, &src, 0, 0, WIDTH, HEIGHT, &dst, 0, 0);
+
+	igt_assert_eq(c.execs, 1);
+	igt_assert(batch_references(&c, src.bo->offset64));
+	igt_assert(batch_references(&c, dst.bo->offset64));
+
+	drm_intel_bo_unreference(src.bo);
+	drm_intel_bo_unreference(dst.bo);
+	intel_batchbuffer_free(batch);
+	drm_intel_bufmgr_destroy(bufmgr);
+}
+
+static void test_softpin(uint32_t devid)
+{
+	igt_render_copyfunc_t copy = igt_get_render_copyfunc(devid);
+	const uint64_t start = 1ull << 32;
+	struct intel_batchbuffer *batch;
+	drm_intel_bufmgr *bufmgr;
+	struct igt_buf src, dst;
+	struct capture c = {};
+	uint64_t address;
+	int n;
+
+	bufmgr = drm_intel_bufmgr_stub_init(devid, 4096);
+	igt_assert(bufmgr);
+	drm_intel_bufmgr_fake_set_exec_callback(bufmgr, capture_exec, &c);
+
+	batch = intel_batchbuffer_alloc(bufmgr, devid);
+	intel_batchbuffer_enable_softpin(batch, start, start << 1);
+	init_buf(bufmgr, &src);
+	init_buf(bufmgr, &dst);
+
+	/* Cycle through all the pinned batches and back */
+	for (n = 1; n <= 6; n++) {
+		copy(batch, NULL, &src, 0, 0, WIDTH, HEIGHT, &dst, 0, 0);
+		if (n == 1)
+			address = dst.bo->offset64;
+
+		igt_assert_eq(c.execs, n);
+		igt_assert_eq(c.relocs, 0);
+		igt_assert_eq_u64(dst.bo->offset64, address);
+		igt_assert(src.bo->offset64 >= start);
+		igt_assert(dst.bo->offset64 >= start);
+		igt_assert(batch_references(&c, src.bo->offset64));
+		igt_assert(batch_references(&c, dst.bo->offset64));
+	}
+
+	drm_intel_bo_unreference(src.bo);
+	drm_intel_bo_unreference(dst.bo);
+	intel_batchbuffer_free(batch);
+	drm_intel_bufmgr_destroy(bufmgr);
+}
+
+igt_simple_main
+{
+	static const uint32_t devids[] = {
+		0x0102, /* snb */
+		0x0166, /* ivb */
+		0x1616, /* bdw */
+		0x1912, /* skl */
+	};
+	unsigned int n;
+
+	for (n = 0; n < ARRAY_SIZE(devids); n++) {
+		test_relocations(devids[n]);
+		test_render_copy(devids[n]);
+		if (intel_gen(devids[n]) >= 8)
+			test_softpin(devids[n]);
+	}
+}
@@ -25,12 +25,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <math.h>
 #include <cairo.h>
 
 #include <stdio.h>
 
 #include "chart.h"
 
+static int default_cached;
+
 int chart_init(struct chart *chart, const char *name, int num_samples)
 {
 	memset(chart, 0, sizeof(*chart));
@@ -43,6 +46,7 @@ int chart_init(struct chart *chart, const char *name, int num_samples)
 	chart->range_automatic = 1;
 	chart->stroke_width = 2;
 	chart->smooth = CHART_CURVE;
+	chart->cached = default_cached;
 	return 0;
 }
 
@@ -96,6 +100,21 @@ void chart_set_range(struct chart *chart, double min, double max)
 	chart->range_automatic = 0;
 }
 
+/*
+ * Keep the chart drawn in a surface of its own and only draw the new
+ * samples into it on each chart_draw(), instead of the whole history.
+ */
+void chart_set_cached(struct chart *chart, int cached)
+{
+	chart->cached = cached;
+}
+
+/* Whether charts initialised from now on use chart_set_cached() */
+void chart_set_default_cached(int cached)
+{
+	default_cached = cached;
+}
+
 void chart_get_range(struct chart *chart, double *range)
 {
 	int n, max = chart->current_sample;
@@ -160,6 +179,171 @@ static double gradient_at(struct chart *chart, int n)
 	return (y1 - y0) / 2.;
 }
 
+static void chart_paint(struct chart *chart, cairo_t *cr)
+{
+	cairo_set_line_width(cr, chart->stroke_width);
+	switch (chart->mode) {
+	case CHART_STROKE:
+		cairo_set_source_rgba(cr, chart->stroke_rgb[0], chart->stroke_rgb[1], chart->stroke_rgb[2], chart->stroke_rgb[3]);
+		cairo_stroke(cr);
+		break;
+	case CHART_FILL:
+		cairo_set_source_rgba(cr, chart->fill_rgb[0], chart->fill_rgb[1], chart->fill_rgb[2], chart->fill_rgb[3]);
+		cairo_fill(cr);
+		break;
+	case CHART_FILL_STROKE:
+		cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
+		cairo_set_source_rgba(cr, chart->fill_rgb[0], chart->fill_rgb[1], chart->fill_rgb[2], chart->fill_rgb[3]);
+		cairo_fill_preserve(cr);
+		cairo_set_antialias(cr, CAIRO_ANTIALIAS_DEFAULT);
+		cairo_set_source_rgba(cr, chart->stroke_rgb[0], chart->stroke_rgb[1], chart->stroke_rgb[2], chart->stroke_rgb[3]);
+		cairo_stroke(cr);
+		break;
+	}
+}
+
+/* Path through samples first..last, x being the sample number */
+static void chart_path(struct chart *chart, cairo_t *cr, int first, int last)
+{
+	int n;
+
+	cairo_new_path(cr);
+	if (chart->mode != CHART_STROKE) {
+		cairo_move_to(cr, first, 0);
+		cairo_line_to(cr, first, value_at(chart, first));
+	} else
+		cairo_move_to(cr, first, value_at(chart, first));
+	for (n = first + 1; n <= last; n++) {
+		switch (chart->smooth) {
+		case CHART_LINE:
+			cairo_line_to(cr, n, value_at(chart, n));
+			break;
+		case CHART_CURVE:
+			cairo_curve_to(cr,
+				       n-2/3., value_at(chart, n - 1) + gradient_at(chart, n - 1)/3.,
+				       n-1/3., value_at(chart, n) - gradient_at(chart, n)/3.,
+				       n, value_at(chart, n));
+			break;
+		}
+	}
+	if (chart->mode != CHART_STROKE)
+		cairo_line_to(cr, last, 0);
+}
+
+static int chart_cache_valid(struct chart *chart, int w, int h)
+{
+	if (chart->cache[0] == NULL)
+		return 0;
+
+	if (chart->cache_w != w || chart->cache_h != h)
+		return 0;
+
+	if (chart->cache_range[0] != chart->range[0] ||
+	    chart->cache_range[1] != chart->range[1])
+		return 0;
+
+	/* too many new samples, cheaper to start over */
+	if (chart->cache_sample > chart->current_sample ||
+	    chart->current_sample - chart->cache_sample > chart->num_samples / 2)
+		return 0;
+
+	return 1;
+}
+
+static void chart_draw_cached(struct chart *chart, cairo_t *cr)
+{
+	const int last = chart->current_sample - 1;
+	const int m = chart->stroke_width + 2;
+	const int w = chart->w + 2*m, h = chart->h + 2*m;
+	const double sx = chart->w / (double)(chart->num_samples-1);
+	const double sy = chart->h / (chart->range[1] - chart->range[0]);
+	/* cache x of sample s is m + s*sx - left, the newest at m + chart->w */
+	int left = floor(last*sx + .5) - chart->w;
+	int first, clip = 0, n;
+	cairo_t *cc;
+
+	if (!chart_cache_valid(chart, w, h)) {
+		for (n = 0; n < 2; n++) {
+			if (chart->cache[n] &&
+			    (chart->cache_w != w || chart->cache_h != h)) {
+				cairo_surface_destroy(chart->cache[n]);
+				chart->cache[n] = NULL;
+			}
+			if (chart->cache[n] == NULL)
+				chart->cache[n] = cairo_surface_create_similar(cairo_get_target(cr),
+									      CAIRO_CONTENT_COLOR_ALPHA,
+									      w, h);
+		}
+		chart->cache_w = w;
+		chart->cache_h = h;
+		chart->cache_margin = m;
+		chart->cache_range[0] = chart->range[0];
+		chart->cache_range[1] = chart->range[1];
+
+		cc = cairo_create(chart->cache[chart->cache_current]);
+		cairo_set_operator(cc, CAIRO_OPERATOR_CLEAR);
+		cairo_paint(cc);
+		cairo_set_operator(cc, CAIRO_OPERATOR_OVER);
+
+		first = last - (chart->num_samples - 1);
+		if (first < 0)
+			first = 0;
+	} else if (chart->cache_sample != chart->current_sample) {
+		/* scroll the old samples into the other surface */
+		cc = cairo_create(chart->cache[!chart->cache_current]);
+		cairo_set_operator(cc, CAIRO_OPERATOR_SOURCE);
+		cairo_set_source_surface(cc, chart->cache[chart->cache_current],
+					 chart->cache_left - left, 0);
+		cairo_paint(cc);
+		cairo_set_operator(cc, CAIRO_OPERATOR_OVER);
+		chart->cache_current = !chart->cache_current;
+
+		/*
+		 * Redraw from the previous last sample, widened by the margin
+		 * so that the stroke of its closing edge in CHART_FILL_STROKE
+		 * and of its joins is redrawn too. The path has to start far
+		 * enough left of the clip for its own opening edge to stay
+		 * outside of it.
+		 */
+		clip = floor(m + (chart->cache_sample - 1)*sx - left) - m;
+		if (clip < 0)
+			clip = 0;
+		first = floor((clip - 2*m + left) / sx);
+		if (first > chart->cache_sample - 2)
+			first = chart->cache_sample - 2;
+		if (first < 0)
+			first = 0;
+
+		cairo_save(cc);
+		cairo_rectangle(cc, clip, 0, w - clip, h);
+		cairo_set_operator(cc, CAIRO_OPERATOR_CLEAR);
+		cairo_fill(cc);
+		cairo_restore(cc);
+
+		cairo_rectangle(cc, clip, 0, w - clip, h);
+		cairo_clip(cc);
+	} else
+		goto paint;
+
+	cairo_translate(cc, m - left, m + chart->h);
+	cairo_scale(cc, sx, -sy);
+	cairo_translate(cc, 0, -chart->range[0]);
+	chart_path(chart, cc, first, last);
+	cairo_identity_matrix(cc);
+	chart_paint(chart, cc);
+	cairo_destroy(cc);
+
+	chart->cache_sample = chart->current_sample;
+	chart->cache_left = left;
+
+paint:
+	cairo_save(cr);
+	cairo_set_source_surface(cr, chart->cache[chart->cache_current],
+				 chart->x - m, chart->y - m);
+	cairo_paint(cr);
+	cairo_restore(cr);
+}
+
 void chart_draw(struct chart *chart, cairo_t *cr)
 {
 	int i, n, max, x;
@@ -173,6 +357,11 @@ void chart_draw(struct chart *chart, cairo_t *cr)
 	if (chart->range[1] <= chart->range[0])
 		return;
 
+	if (chart->cached && chart->num_samples > 1) {
+		chart_draw_cached(chart, cr);
+		return;
+	}
+
 	cairo_save(cr);
 
 	cairo_translate(cr, chart->x, chart->y + chart->h);
@@ -212,29 +401,16 @@ void chart_draw(struct chart *chart, cairo_t *cr)
 		cairo_line_to(cr, n-1, 0);
 
 	cairo_identity_matrix(cr);
-	cairo_set_line_width(cr, chart->stroke_width);
-	switch (chart->mode) {
-	case CHART_STROKE:
-		cairo_set_source_rgba(cr, chart->stroke_rgb[0], chart->stroke_rgb[1], chart->stroke_rgb[2], chart->stroke_rgb[3]);
-		cairo_stroke(cr);
-		break;
-	case CHART_FILL:
-		cairo_set_source_rgba(cr, chart->fill_rgb[0], chart->fill_rgb[1], chart->fill_rgb[2], chart->fill_rgb[3]);
-		cairo_fill(cr);
-		break;
-	case CHART_FILL_STROKE:
-		cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
-		cairo_set_source_rgba(cr, chart->fill_rgb[0], chart->fill_rgb[1], chart->fill_rgb[2], chart->fill_rgb[3]);
-		cairo_fill_preserve(cr);
-		cairo_set_antialias(cr, CAIRO_ANTIALIAS_DEFAULT);
-		cairo_set_source_rgba(cr, chart->stroke_rgb[0], chart->stroke_rgb[1], chart->stroke_rgb[2], chart->stroke_rgb[3]);
-		cairo_stroke(cr);
-		break;
-	}
+	chart_paint(chart, cr);
 	cairo_restore(cr);
 }
 
 void chart_fini(struct chart *chart)
 {
+	int n;
+
+	for (n = 0; n < 2; n++)
+		if (chart->cache[n])
+			cairo_surface_destroy(chart->cache[n]);
 	free(chart->samples);
 }
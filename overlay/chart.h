@@ -45,6 +45,19 @@ struct chart {
 	double stroke_width;
 	double range[2];
 	double *samples;
+
+	/*
+	 * Incremental rendering: the chart as last drawn, where only the
+	 * samples added since are drawn after scrolling the old contents.
+	 * Two surfaces are used to scroll from one into the other.
+	 */
+	int cached;
+	cairo_surface_t *cache[2];
+	int cache_current;
+	int cache_sample;
+	int cache_left;
+	int cache_w, cache_h, cache_margin;
+	double cache_range[2];
 };
 
 int chart_init(struct chart *chart, const char *name, int num_samples);
@@ -56,6 +69,8 @@ void chart_set_stroke_rgba(struct chart *chart, float red, float green, float bl
 void chart_set_position(struct chart *chart, int x, int y);
 void chart_set_size(struct chart *chart, int w, int h);
 void chart_set_range(struct chart *chart, double min, double max);
+void chart_set_cached(struct chart *chart, int cached);
+void chart_set_default_cached(int cached);
 void chart_add_sample(struct chart *chart, double value);
 void chart_draw(struct chart *chart, cairo_t *cr);
 void chart_fini(struct chart *chart);
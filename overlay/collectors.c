@@ -0,0 +1,196 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "collectors.h"
+#include "debugfs.h"
+
+const char *collector_names[NUM_COLLECTORS] = {
+	[COLLECTOR_CPU_TOP] = "cpu-top",
+	[COLLECTOR_GPU_TOP] = "gpu-top",
+	[COLLECTOR_GPU_PERF] = "gpu-perf",
+	[COLLECTOR_GPU_FREQ] = "gpu-freq",
+	[COLLECTOR_RC6] = "rc6",
+	[COLLECTOR_POWER] = "power",
+	[COLLECTOR_GEM_OBJECTS] = "gem-objects",
+	[COLLECTOR_GEM_INTERRUPTS] = "gem-interrupts",
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Returns whether collector @n initialised */
+static int init_one(struct collectors *c, int n)
+{
+	switch (n) {
+	case COLLECTOR_CPU_TOP:
+		return cpu_top_init(&c->cpu_top) == 0;
+	case COLLECTOR_GPU_TOP:
+		gpu_top_init(&c->gpu_top);
+		return c->gpu_top.fd >= 0;
+	case COLLECTOR_GPU_PERF:
+		gpu_perf_init(&c->gpu_perf, 0);
+		return c->gpu_perf.error == NULL;
+	case COLLECTOR_GPU_FREQ:
+		return gpu_freq_init(&c->gpu_freq) == 0;
+	case COLLECTOR_RC6:
+		return rc6_init(&c->rc6) == 0;
+	case COLLECTOR_POWER:
+		return power_init(&c->power) == 0;
+	case COLLECTOR_GEM_OBJECTS:
+		return gem_objects_init(&c->gem_objects) == 0;
+	case COLLECTOR_GEM_INTERRUPTS:
+		return gem_interrupts_init(&c->gem_interrupts) == 0;
+	}
+
+	return 0;
+}
+
+/* Returns whether collector @n has new data */
+static int update_one(struct collectors *c, int n)
+{
+	switch (n) {
+	case COLLECTOR_CPU_TOP:
+		return cpu_top_update(&c->cpu_top) == 0;
+	case COLLECTOR_GPU_TOP:
+		return gpu_top_update(&c->gpu_top) != 0;
+	case COLLECTOR_GPU_PERF:
+		return gpu_perf_update(&c->gpu_perf) != 0;
+	case COLLECTOR_GPU_FREQ:
+		return gpu_freq_update(&c->gpu_freq) == 0;
+	case COLLECTOR_RC6:
+		return rc6_update(&c->rc6) == 0;
+	case COLLECTOR_POWER:
+		return power_update(&c->power) == 0;
+	case COLLECTOR_GEM_OBJECTS:
+		return gem_objects_update(&c->gem_objects) == 0;
+	case COLLECTOR_GEM_INTERRUPTS:
+		return gem_interrupts_update(&c->gem_interrupts) == 0;
+	}
+
+	return 0;
+}
+
+/*
+ * Initialises the collectors selected by @mask. Returns the mask of those
+ * that are available on this system.
+ */
+unsigned collectors_init(struct collectors *c, unsigned mask)
+{
+	int n;
+
+	memset(c, 0, sizeof(*c));
+	debugfs_init();
+
+	for (n = 0; n < NUM_COLLECTORS; n++) {
+		if (mask & (1 << n) && init_one(c, n))
+			c->enabled |= 1 << n;
+	}
+
+	return c->enabled;
+}
+
+/*
+ * Polls every enabled collector once, recording how long each took.
+ * Returns the mask of collectors that produced new values.
+ */
+unsigned collectors_update(struct collectors *c)
+{
+	int n;
+
+	c->updated = 0;
+	for (n = 0; n < NUM_COLLECTORS; n++) {
+		uint64_t start;
+
+		if (!(c->enabled & (1 << n)))
+			continue;
+
+		start = now_ns();
+		if (update_one(c, n))
+			c->updated |= 1 << n;
+		c->cost_ns[n] = now_ns() - start;
+	}
+
+	return c->updated;
+}
+
+void collectors_snapshot(const struct collectors *c,
+			 struct collectors_sample *sample)
+{
+	int n;
+
+	memset(sample, 0, sizeof(*sample));
+	sample->timestamp = now_ns();
+	sample->updated = c->updated;
+	for (n = 0; n < NUM_COLLECTORS; n++)
+		sample->cost_ns[n] = c->cost_ns[n] > UINT32_MAX ? UINT32_MAX : c->cost_ns[n];
+
+	if (c->enabled & (1 << COLLECTOR_CPU_TOP)) {
+		sample->cpu_busy = c->cpu_top.busy;
+		sample->nr_cpu = c->cpu_top.nr_cpu;
+		sample->nr_running = c->cpu_top.nr_running;
+	}
+
+	if (c->enabled & (1 << COLLECTOR_GPU_TOP)) {
+		for (n = 0; n < c->gpu_top.num_rings && n < MAX_RINGS; n++) {
+			sample->ring_busy[n] = c->gpu_top.ring[n].u.u.busy;
+			sample->ring_wait[n] = c->gpu_top.ring[n].u.u.wait;
+			sample->ring_sema[n] = c->gpu_top.ring[n].u.u.sema;
+		}
+	}
+
+	if (c->enabled & (1 << COLLECTOR_GPU_PERF)) {
+		sample->nr_clients = c->gpu_perf.nr_comm;
+		sample->perf = c->gpu_perf.total;
+	}
+
+	if (c->enabled & (1 << COLLECTOR_GPU_FREQ)) {
+		sample->freq_current = c->gpu_freq.current;
+		sample->freq_request = c->gpu_freq.request;
+	}
+
+	if (c->enabled & (1 << COLLECTOR_RC6)) {
+		sample->rc6 = c->rc6.rc6;
+		sample->rc6p = c->rc6.rc6p;
+		sample->rc6pp = c->rc6.rc6pp;
+		sample->rc6_combined = c->rc6.rc6_combined;
+	}
+
+	if (c->enabled & (1 << COLLECTOR_POWER))
+		sample->power_mW = c->power.power_mW;
+
+	if (c->enabled & (1 << COLLECTOR_GEM_INTERRUPTS))
+		sample->interrupts = c->gem_interrupts.count;
+
+	if (c->enabled & (1 << COLLECTOR_GEM_OBJECTS)) {
+		sample->gem_bytes = c->gem_objects.total_bytes;
+		sample->gem_count = c->gem_objects.total_count;
+	}
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef COLLECTORS_H
+#define COLLECTORS_H
+
+#include <stdint.h>
+
+#include "cpu-top.h"
+#include "gem-interrupts.h"
+#include "gem-objects.h"
+#include "gpu-freq.h"
+#include "gpu-top.h"
+#include "gpu-perf.h"
+#include "power.h"
+#include "rc6.h"
+
+enum collector {
+	COLLECTOR_CPU_TOP,
+	COLLECTOR_GPU_TOP,
+	COLLECTOR_GPU_PERF,
+	COLLECTOR_GPU_FREQ,
+	COLLECTOR_RC6,
+	COLLECTOR_POWER,
+	COLLECTOR_GEM_OBJECTS,
+	COLLECTOR_GEM_INTERRUPTS,
+	NUM_COLLECTORS
+};
+
+#define COLLECTORS_ALL ((1u << NUM_COLLECTORS) - 1)
+
+extern const char *collector_names[NUM_COLLECTORS];
+
+/*
+ * All the data sources of the overlay behind a single interface, with
+ * nothing to do with drawing. The individual collectors remain directly
+ * accessible for their detailed state.
+ */
+struct collectors {
+	unsigned enabled; /* mask of collectors that initialised */
+	unsigned updated; /* mask of collectors with new data after update */
+	uint64_t cost_ns[NUM_COLLECTORS]; /* time spent in the last update */
+
+	struct cpu_top cpu_top;
+	struct gpu_top gpu_top;
+	struct gpu_perf gpu_perf;
+	struct gpu_freq gpu_freq;
+	struct rc6 rc6;
+	struct power power;
+	struct gem_objects gem_objects;
+	struct gem_interrupts gem_interrupts;
+};
+
+/* A flattened copy of the values of every collector at one instant */
+struct collectors_sample {
+	uint64_t timestamp; /* ns, CLOCK_MONOTONIC */
+	uint32_t updated;
+	uint32_t cost_ns[NUM_COLLECTORS];
+
+	uint8_t cpu_busy;
+	uint8_t nr_cpu;
+	uint16_t nr_running;
+
+	uint8_t ring_busy[MAX_RINGS];
+	uint8_t ring_wait[MAX_RINGS];
+	uint8_t ring_sema[MAX_RINGS];
+
+	uint32_t nr_clients;
+	struct gpu_perf_stats perf;
+
+	uint16_t freq_current;
+	uint16_t freq_request;
+
+	uint8_t rc6;
+	uint8_t rc6p;
+	uint8_t rc6pp;
+	uint8_t rc6_combined;
+
+	uint32_t power_mW;
+
+	uint64_t interrupts;
+
+	uint64_t gem_bytes;
+	uint64_t gem_count;
+} __attribute__((packed));
+
+unsigned collectors_init(struct collectors *c, unsigned mask);
+unsigned collectors_update(struct collectors *c);
+void collectors_snapshot(const struct collectors *c,
+			 struct collectors_sample *sample);
+
+#endif /* COLLECTORS_H */
@@ -37,7 +37,7 @@ int cpu_top_init(struct cpu_top *cpu)
 
 	cpu->nr_cpu = sysconf(_SC_NPROCESSORS_ONLN);
 
-	return 0;
+	return reader_open(&cpu->proc_stat, "/proc/stat");
 }
 
 int cpu_top_update(struct cpu_top *cpu)
@@ -45,31 +45,26 @@ int cpu_top_update(struct cpu_top *cpu)
 	struct cpu_stat *s = &cpu->stat[cpu->count++&1];
 	struct cpu_stat *d = &cpu->stat[cpu->count&1];
 	uint64_t d_total, d_idle;
-	char buf[4096], *b;
-	int fd, len = -1;
-
-	fd = open("/proc/stat", 0);
-	if (fd < 0)
-		return errno;
+	const char *b;
+	int err;
 
-	len = read(fd, buf, sizeof(buf)-1);
-	close(fd);
+	err = reader_read(&cpu->proc_stat);
+	if (err)
+		return err;
 
-	if (len < 0)
+	/* cpu  user nice system idle ... */
+	b = scan_after(cpu->proc_stat.buf, "cpu ");
+	if (b == NULL)
 		return EIO;
-	buf[len] = '\0';
 
-#ifdef __x86_64__
-	sscanf(buf, "cpu %lu %lu %lu %lu",
-	       &s->user, &s->nice, &s->sys, &s->idle);
-#else
-	sscanf(buf, "cpu %llu %llu %llu %llu",
-	       &s->user, &s->nice, &s->sys, &s->idle);
-#endif
+	s->user = scan_u64(&b);
+	s->nice = scan_u64(&b);
+	s->sys = scan_u64(&b);
+	s->idle = scan_u64(&b);
 
-	b = strstr(buf, "procs_running");
+	b = scan_after(b, "procs_running");
 	if (b)
-		cpu->nr_running = atoi(b+sizeof("procs_running")) - 1;
+		cpu->nr_running = scan_u64(&b) - 1;
 
 	s->total = s->user + s->nice + s->sys + s->idle;
 	if (cpu->count == 1)
@@ -27,6 +27,8 @@
 
 #include <stdint.h>
 
+#include "reader.h"
+
 struct cpu_top {
 	uint8_t busy;
 	int nr_cpu;
@@ -37,6 +39,8 @@ struct cpu_top {
 		uint64_t user, nice, sys, idle;
 		uint64_t total;
 	} stat[2];
+
+	struct reader proc_stat;
 };
 
 int cpu_top_init(struct cpu_top *cpu);
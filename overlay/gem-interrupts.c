@@ -29,7 +29,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 
 #include "gem-interrupts.h"
 #include "debugfs.h"
@@ -49,85 +48,84 @@ static int perf_open(void)
 	return perf_event_open(&attr, -1, 0, -1, 0);
 }
 
-static long long debugfs_read(void)
+static long long debugfs_parse(const char *buf)
 {
-	char buf[8192], *b;
-	int fd, len;
+	const char *b;
 
-	sprintf(buf, "%s/i915_gem_interrupt", debugfs_dri_path);
-	fd = open(buf, 0);
-	if (fd < 0)
-		return -1;
-
-	len = read(fd, buf, sizeof(buf)-1);
-	close(fd);
-
-	if (len < 0)
-		return -1;
-
-	buf[len] = '\0';
-
-	b = strstr(buf, "Interrupts received:");
+	b = scan_after(buf, "Interrupts received:");
 	if (b == NULL)
 		return -1;
 
-	return strtoull(b + sizeof("Interrupts received:"), 0, 0);
+	return scan_u64(&b);
 }
 
-static long long procfs_read(void)
+static long long procfs_parse(const char *buf)
 {
-	char buf[8192], *b;
-	int fd, len;
+	const char *b, *i915;
 	unsigned long long val;
 
 /* 44:         51      42446          0          0   PCI-MSI-edge      i915*/
-	fd = open("/proc/interrupts", 0);
-	if (fd < 0)
+	i915 = scan_after(buf, "i915");
+	if (i915 == NULL)
 		return -1;
 
-	len = read(fd, buf, sizeof(buf)-1);
-	close(fd);
-
-	if (len < 0)
-		return -1;
-
-	buf[len] = '\0';
-
-	b = strstr(buf, "i915");
-	if (b == NULL)
+	b = i915 - sizeof("i915") + 1;
+	while (b > buf && *b != ':' && *b != '\n')
+		b--;
+	if (*b != ':')
 		return -1;
-	while (*--b != ':')
-		;
 
 	val = 0;
+	b++;
 	do {
-		while (isspace(*++b))
-			;
-		if (!isdigit(*b))
+		while (*b == ' ' || *b == '\t')
+			b++;
+		if (*b < '0' || *b > '9')
 			break;
 
-		val += strtoull(b, &b, 0);
-	} while(1);
+		val += scan_u64(&b);
+	} while (1);
 
 	return val;
 }
 
-static long long interrupts_read(void)
+static long long interrupts_read(struct gem_interrupts *irqs)
 {
-	long long val;
+	if (reader_read(&irqs->reader))
+		return -1;
 
-	val = debugfs_read();
-	if (val < 0)
-		val = procfs_read();
-	return val;
+	return irqs->parse(irqs->reader.buf);
+}
+
+static int interrupts_open(struct gem_interrupts *irqs,
+			   const char *path,
+			   long long (*parse)(const char *buf))
+{
+	if (reader_open(&irqs->reader, path))
+		return 0;
+
+	irqs->parse = parse;
+	if (interrupts_read(irqs) < 0) {
+		reader_close(&irqs->reader);
+		return 0;
+	}
+
+	return 1;
 }
 
 int gem_interrupts_init(struct gem_interrupts *irqs)
 {
+	char path[1024];
+
 	memset(irqs, 0, sizeof(*irqs));
 
 	irqs->fd = perf_open();
-	if (irqs->fd < 0 && interrupts_read() < 0)
+	if (irqs->fd >= 0)
+		return 0;
+
+	sprintf(path, "%s/i915_gem_interrupt", debugfs_dri_path);
+	if (!interrupts_open(irqs, path, debugfs_parse) &&
+	    !interrupts_open(irqs, "/proc/interrupts", procfs_parse))
 		irqs->error = ENODEV;
 
 	return irqs->error;
@@ -143,7 +141,7 @@ int gem_interrupts_update(struct gem_interrupts *irqs)
 
 	if (irqs->fd < 0) {
 		long long ret;
-		ret = interrupts_read();
+		ret = interrupts_read(irqs);
 		if (ret < 0)
 			return irqs->error = ENODEV;
 		else
@@ -27,10 +27,15 @@
 
 #include <stdint.h>
 
+#include "reader.h"
+
 struct gem_interrupts {
 	long unsigned last_count, count, delta;
 	int error;
 	int fd;
+
+	struct reader reader;
+	long long (*parse)(const char *buf);
 };
 
 int gem_interrupts_init(struct gem_interrupts *irqs);
@@ -48,36 +48,38 @@
 
 int gem_objects_init(struct gem_objects *obj)
 {
-	char buf[8192], *b;
-	int fd, len;
+	char path[1024];
+	const char *b;
+	int err;
 
 	memset(obj, 0, sizeof(*obj));
 
-	sprintf(buf, "%s/i915_gem_objects", debugfs_dri_path);
-	fd = open(buf, 0);
-	if (fd < 0)
-		return errno;
-	len = read(fd, buf+1, sizeof(buf)-2);
-	close(fd);
+	sprintf(path, "%s/i915_gem_objects", debugfs_dri_path);
+	err = reader_open(&obj->reader, path);
+	if (err)
+		return err;
 
-	if (len < 0)
-		return EIO;
+	err = reader_read(&obj->reader);
+	if (err)
+		goto err;
 
-	/* Add sentinel values for the string searches */
-	buf[0] = '\n';
-	buf[len+1] = '\0';
-
-	b = strstr(buf, "gtt total");
-	if (b == NULL)
-		return EIO;
+	b = scan_after(obj->reader.buf, "gtt total");
+	if (b == NULL) {
+		err = EIO;
+		goto err;
+	}
 
-	while (*b != '\n')
+	while (b > obj->reader.buf && b[-1] != '\n')
 		b--;
 
-	sscanf(b, "%ld [%ld]",
-	       &obj->max_gtt, &obj->max_aperture);
+	obj->max_gtt = scan_u64(&b);
+	obj->max_aperture = scan_u64(&b);
 
 	return 0;
+
+err:
+	reader_close(&obj->reader);
+	return err;
 }
 
 static void insert_sorted(struct gem_objects *obj,
@@ -93,88 +95,79 @@ static void insert_sorted(struct gem_objects *obj,
 	*prev = comm;
 }
 
-int gem_objects_update(struct gem_objects *obj)
+static struct gem_objects_comm *get_comm(struct gem_objects *obj, int n)
 {
-	char buf[8192], *b;
-	struct gem_objects_comm *comm;
-	struct gem_objects_comm *freed;
-	int fd, len, ret;
+	if (n == obj->pool_size) {
+		int size = obj->pool_size ? 2 * obj->pool_size : 16;
+		struct gem_objects_comm *pool;
 
-	freed = obj->comm;
-	obj->comm = NULL;
+		pool = realloc(obj->pool, size * sizeof(*pool));
+		if (pool == NULL)
+			return NULL;
 
-	sprintf(buf, "%s/i915_gem_objects", debugfs_dri_path);
-	fd = open(buf, 0);
-	if (fd < 0) {
-		ret = errno;
-		goto done;
+		obj->pool = pool;
+		obj->pool_size = size;
 	}
-	len = read(fd, buf, sizeof(buf)-1);
-	close(fd);
 
-	if (len < 0) {
-		ret = EIO;
-		goto done;
-	}
+	return &obj->pool[n];
+}
 
-	buf[len] = '\0';
-	while (buf[--len] == '\n')
-		buf[len] = '\0';
+int gem_objects_update(struct gem_objects *obj)
+{
+	const char *b, *colon;
+	int n, i, err;
 
-	b = buf;
+	obj->comm = NULL;
 
-	sscanf(b, "%lu objects, %lu bytes",
-	       &obj->total_count, &obj->total_bytes);
+	err = reader_read(&obj->reader);
+	if (err)
+		return err;
 
-	b = strchr(b, '\n');
-	sscanf(b, "%*d [%*d] objects, %lu [%lu] bytes in gtt",
-	       &obj->total_gtt, &obj->total_aperture);
+	b = obj->reader.buf;
 
-	ret = 0;
-	b = strchr(b, ':');
-	if (b == NULL)
-		goto done;
+	obj->total_count = scan_u64(&b);
+	obj->total_bytes = scan_u64(&b);
 
-	while (*b != '\n')
-		b--;
-	b++;
+	/* n [n] objects, total_gtt [total_aperture] bytes in gtt */
+	b = scan_next_line(b);
+	scan_u64(&b);
+	scan_u64(&b);
+	obj->total_gtt = scan_u64(&b);
+	obj->total_aperture = scan_u64(&b);
 
-	do {
-		char *eol, *colon;
+	/*
+	 * Parse the per-client lines into the pool first and link them
+	 * afterwards, as growing the pool may move the entries.
+	 */
+	n = 0;
+	for (; b != NULL; b = scan_next_line(b)) {
+		struct gem_objects_comm *comm;
+		int len;
+
+		/* Xorg: 35 objects, 16347136 bytes (0 active, 12103680 inactive, 0 unbound) */
+		for (colon = b; *colon && *colon != '\n' && *colon != ':'; colon++)
+			;
+		if (*colon != ':')
+			continue;
 
-		comm = freed;
-		if (comm)
-			freed = comm->next;
-		else
-			comm = malloc(sizeof(*comm));
+		comm = get_comm(obj, n);
 		if (comm == NULL)
 			break;
 
-		/* Xorg: 35 objects, 16347136 bytes (0 active, 12103680 inactive, 0 unbound) */
-		eol = strchr(b, '\n');
-		if (eol) {
-			do {
-			*eol++ = '\0';
-			} while (*eol == '\n');
-		}
-
-		colon = strchr(b, ':');
-		memcpy(comm->name, b, colon-b+1);
-		comm->name[colon-b+1] = '\0';
-
-		sscanf(colon + 1, "%lu objects, %lu bytes",
-		       &comm->count, &comm->bytes);
-
-		insert_sorted(obj, comm);
-		b = eol;
-	} while (b != NULL);
-
-done:
-	while (freed) {
-		comm = freed;
-		freed = comm->next;
-		free(comm);
+		len = colon - b + 1;
+		if (len > (int)sizeof(comm->name) - 1)
+			len = sizeof(comm->name) - 1;
+		memcpy(comm->name, b, len);
+		comm->name[len] = '\0';
+
+		b = colon + 1;
+		comm->count = scan_u64(&b);
+		comm->bytes = scan_u64(&b);
+		n++;
 	}
 
-	return ret;
+	for (i = 0; i < n; i++)
+		insert_sorted(obj, &obj->pool[i]);
+
+	return 0;
 }
@@ -27,6 +27,8 @@
 
 #include <stdint.h>
 
+#include "reader.h"
+
 struct gem_objects {
 	long unsigned total_bytes, total_count;
 	long unsigned total_gtt, total_aperture;
@@ -37,6 +39,10 @@ struct gem_objects {
 		long unsigned bytes;
 		long unsigned count;
 	} *comm;
+
+	struct gem_objects_comm *pool;
+	int pool_size;
+	struct reader reader;
 };
 
 int gem_objects_init(struct gem_objects *obj);
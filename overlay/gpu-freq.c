@@ -22,6 +22,7 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -55,6 +56,9 @@ static int perf_open(void)
 	int fd;
 
 	fd = perf_i915_open(I915_PERF_ACTUAL_FREQUENCY, -1);
+	if (fd < 0)
+		return -1;
+
 	if (perf_i915_open(I915_PERF_REQUESTED_FREQUENCY, fd) < 0) {
 		close(fd);
 		fd = -1;
@@ -63,72 +67,144 @@ static int perf_open(void)
 	return fd;
 }
 
-int gpu_freq_init(struct gpu_freq *gf)
+static int freq_info_open(struct reader *r)
 {
-	char buf[4096], *s;
-	int fd, len = -1;
+	char path[1024];
 
-	memset(gf, 0, sizeof(*gf));
+	sprintf(path, "%s/i915_frequency_info", debugfs_dri_path);
+	if (reader_open(r, path) == 0)
+		return 0;
 
-	gf->fd = perf_open();
+	sprintf(path, "%s/i915_cur_delayinfo", debugfs_dri_path);
+	return reader_open(r, path);
+}
+
+static int scan_freq(const char *buf, const char *key, int *freq)
+{
+	const char *s;
 
-	sprintf(buf, "%s/i915_frequency_info", debugfs_dri_path);
-	fd = open(buf, 0);
-	if (fd < 0) {
-		sprintf(buf, "%s/i915_cur_delayinfo", debugfs_dri_path);
-		fd = open(buf, 0);
+	s = scan_after(buf, key);
+	if (s == NULL)
+		return 0;
+
+	*freq = scan_u64(&s);
+	return 1;
+}
+
+static int sysfs_freq(const char *name, int *freq)
+{
+	struct reader r;
+	char path[1024];
+	const char *s;
+	int err;
+
+	sprintf(path, "/sys/class/drm/card0/%s", name);
+	err = reader_open(&r, path);
+	if (err == 0)
+		err = reader_read(&r);
+	if (err == 0) {
+		s = r.buf;
+		*freq = scan_u64(&s);
 	}
-	if (fd < 0)
-		return gf->error = errno;
+	reader_close(&r);
 
-	len = read(fd, buf, sizeof(buf)-1);
-	close(fd);
-	if (len < 0)
-		goto err;
+	return err;
+}
 
-	buf[len] = '\0';
+/*
+ * The frequency limits and, lacking perf counters, the current and
+ * requested frequency from sysfs. Each read there is a register read,
+ * where debugfs regenerates its whole report.
+ */
+static int sysfs_init(struct gpu_freq *gf)
+{
+	int err;
+
+	if ((err = sysfs_freq("gt_RPn_freq_mhz", &gf->rpn)) ||
+	    (err = sysfs_freq("gt_RP1_freq_mhz", &gf->rp1)) ||
+	    (err = sysfs_freq("gt_RP0_freq_mhz", &gf->rp0)) ||
+	    (err = sysfs_freq("gt_max_freq_mhz", &gf->max)))
+		return err;
+	gf->min = gf->rpn;
+
+	if (gf->fd >= 0)
+		return 0;
+
+	if ((err = reader_open(&gf->act, "/sys/class/drm/card0/gt_act_freq_mhz")) ||
+	    (err = reader_open(&gf->req, "/sys/class/drm/card0/gt_cur_freq_mhz"))) {
+		reader_close(&gf->act);
+		reader_close(&gf->req);
+		return err;
+	}
+
+	return 0;
+}
 
-	if (strstr(buf, "PUNIT_REG_GPU_FREQ_STS")) {
+static int debugfs_init_freq(struct gpu_freq *gf)
+{
+	const char *buf;
+	int err;
+
+	err = freq_info_open(&gf->info);
+	if (err)
+		return err;
+
+	err = reader_read(&gf->info);
+	if (err)
+		goto err;
+
+	buf = gf->info.buf;
+	if (scan_after(buf, "PUNIT_REG_GPU_FREQ_STS")) {
 		/* Baytrail is special, ofc. */
 		gf->is_byt = 1;
 
-		s = strstr(buf, "max");
-		if (s != NULL)
-			sscanf(s, "max GPU freq: %d MHz", &gf->max);
-
-		s = strstr(buf, "min");
-		if (s != NULL)
-			sscanf(s, "min GPU freq: %d MHz", &gf->min);
+		scan_freq(buf, "max GPU freq:", &gf->max);
+		scan_freq(buf, "min GPU freq:", &gf->min);
 
 		gf->rp0 = gf->rp1 = gf->max;
 		gf->rpn = gf->min;
 	} else {
-		s = strstr(buf, "(RPN)");
-		if (s == NULL)
+		if (!scan_freq(buf, "(RPN) frequency:", &gf->rpn) ||
+		    !scan_freq(buf, "(RP1) frequency:", &gf->rp1) ||
+		    !scan_freq(buf, "(RP0) frequency:", &gf->rp0) ||
+		    !scan_freq(buf, "Max overclocked frequency:", &gf->max)) {
+			err = EIO;
 			goto err;
-		sscanf(s, "(RPN) frequency: %dMHz", &gf->rpn);
-
-		s = strstr(s, "(RP1)");
-		if (s == NULL)
-			goto err;
-		sscanf(s, "(RP1) frequency: %dMHz", &gf->rp1);
-
-		s = strstr(s, "(RP0)");
-		if (s == NULL)
-			goto err;
-		sscanf(s, "(RP0) frequency: %dMHz", &gf->rp0);
-
-		s = strstr(s, "Max");
-		if (s == NULL)
-			goto err;
-		sscanf(s, "Max overclocked frequency: %dMHz", &gf->max);
+		}
 		gf->min = gf->rpn;
 	}
 
+	/* Only keep sampling debugfs if we have no perf counters */
+	if (gf->fd >= 0)
+		reader_close(&gf->info);
+
 	return 0;
 
 err:
-	return gf->error = EIO;
+	reader_close(&gf->info);
+	return err;
+}
+
+int gpu_freq_init(struct gpu_freq *gf)
+{
+	int err;
+
+	memset(gf, 0, sizeof(*gf));
+	reader_init(&gf->info);
+	reader_init(&gf->act);
+	reader_init(&gf->req);
+
+	gf->fd = perf_open();
+
+	err = sysfs_init(gf);
+	if (err)
+		err = debugfs_init_freq(gf);
+	if (err) {
+		gpu_freq_fini(gf);
+		return gf->error = err;
+	}
+
+	return 0;
 }
 
 int gpu_freq_update(struct gpu_freq *gf)
@@ -136,39 +212,30 @@ int gpu_freq_update(struct gpu_freq *gf)
 	if (gf->error)
 		return gf->error;
 
-	if (gf->fd < 0) {
-		char buf[4096], *s;
-		int fd, len = -1;
+	if (gf->fd < 0 && reader_is_open(&gf->act)) {
+		const char *s;
+		int err;
 
-		sprintf(buf, "%s/i915_frequency_info", debugfs_dri_path);
-		fd = open(buf, 0);
-		if (fd < 0) {
-			sprintf(buf, "%s/i915_cur_delayinfo", debugfs_dri_path);
-			fd = open(buf, 0);
-		}
-		if (fd < 0)
-			return gf->error = errno;
+		if ((err = reader_read(&gf->act)) || (err = reader_read(&gf->req)))
+			return gf->error = err;
 
-		len = read(fd, buf, sizeof(buf)-1);
-		close(fd);
-		if (len < 0)
-			return gf->error = EIO;
+		s = gf->act.buf;
+		gf->current = scan_u64(&s);
+		s = gf->req.buf;
+		gf->request = scan_u64(&s);
+	} else if (gf->fd < 0) {
+		int err;
 
-		buf[len] = '\0';
+		err = reader_read(&gf->info);
+		if (err)
+			return gf->error = err;
 
 		if (gf->is_byt) {
-			s = strstr(buf, "current");
-			if (s)
-				sscanf(s, "current GPU freq: %d MHz", &gf->current);
+			scan_freq(gf->info.buf, "current GPU freq:", &gf->current);
 			gf->request = gf->current;
 		} else {
-			s = strstr(buf, "RPNSWREQ:");
-			if (s)
-				sscanf(s, "RPNSWREQ: %dMHz", &gf->request);
-
-			s = strstr(buf, "CAGF:");
-			if (s)
-				sscanf(s, "CAGF: %dMHz", &gf->current);
+			scan_freq(gf->info.buf, "RPNSWREQ:", &gf->request);
+			scan_freq(gf->info.buf, "CAGF:", &gf->current);
 		}
 	} else {
 		struct gpu_freq_stat *s = &gf->stat[gf->count++&1];
@@ -199,3 +266,14 @@ int gpu_freq_update(struct gpu_freq *gf)
 
 	return 0;
 }
+
+void gpu_freq_fini(struct gpu_freq *gf)
+{
+	if (gf->fd >= 0)
+		close(gf->fd);
+	gf->fd = -1;
+
+	reader_close(&gf->info);
+	reader_close(&gf->act);
+	reader_close(&gf->req);
+}
@@ -27,6 +27,8 @@
 
 #include <stdint.h>
 
+#include "reader.h"
+
 struct gpu_freq {
 	struct gpu_freq_stat {
 		uint64_t act, req;
@@ -40,9 +42,13 @@ struct gpu_freq {
 	int request;
 	int current;
 	int error;
+
+	struct reader info;
+	struct reader act, req; /* sysfs, when there are no perf counters */
 };
 
 int gpu_freq_init(struct gpu_freq *gf);
 int gpu_freq_update(struct gpu_freq *gf);
+void gpu_freq_fini(struct gpu_freq *gf);
 
 #endif /* GPU_FREQ_H */
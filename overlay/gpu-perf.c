@@ -22,6 +22,7 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <stdint.h>
 #include <stdbool.h>
 #include <sys/types.h>
@@ -33,22 +34,30 @@
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
+#include <time.h>
 
 #include "perf.h"
 #include "gpu-perf.h"
 #include "debugfs.h"
 
 #if defined(__i386__)
-#define rmb()           asm volatile("lock; addl $0,0(%%esp)" ::: "memory")
-#define wmb()           asm volatile("lock; addl $0,0(%%esp)" ::: "memory")
+#define rmb()           __asm__ __volatile__("lock; addl $0,0(%%esp)" ::: "memory")
+#define wmb()           __asm__ __volatile__("lock; addl $0,0(%%esp)" ::: "memory")
 #endif
 
 #if defined(__x86_64__)
-#define rmb()           asm volatile("lfence" ::: "memory")
-#define wmb()           asm volatile("sfence" ::: "memory")
+#define rmb()           __asm__ __volatile__("lfence" ::: "memory")
+#define wmb()           __asm__ __volatile__("sfence" ::: "memory")
+#endif
+
+#ifndef rmb
+#define rmb()           __sync_synchronize()
+#define wmb()           __sync_synchronize()
 #endif
 
 #define N_PAGES 32
+#define MAX_WAITS 1024
 
 struct sample_event {
 	struct perf_event_header header;
@@ -179,37 +188,179 @@ static int get_comm(pid_t pid, char *comm, int len)
 	return len;
 }
 
+static inline unsigned pid_hash(const struct gpu_perf *gp, pid_t pid)
+{
+	return ((uint32_t)pid * 0x9e3779b1u) >> (32 - gp->comm_bits);
+}
+
+static int comm_hash_grow(struct gpu_perf *gp)
+{
+	struct gpu_perf_comm **old = gp->comm_hash;
+	unsigned old_size = old ? 1 << gp->comm_bits : 0;
+	unsigned i, mask;
+
+	gp->comm_bits = old ? gp->comm_bits + 1 : 6;
+	gp->comm_hash = calloc(1 << gp->comm_bits, sizeof(*gp->comm_hash));
+	if (gp->comm_hash == NULL) {
+		gp->comm_hash = old;
+		gp->comm_bits--;
+		return ENOMEM;
+	}
+
+	mask = (1 << gp->comm_bits) - 1;
+	for (i = 0; i < old_size; i++) {
+		unsigned j;
+
+		if (old[i] == NULL)
+			continue;
+
+		for (j = pid_hash(gp, old[i]->pid); gp->comm_hash[j]; j = (j + 1) & mask)
+			;
+		gp->comm_hash[j] = old[i];
+	}
+
+	free(old);
+	return 0;
+}
+
+static void comm_hash_remove(struct gpu_perf *gp, struct gpu_perf_comm *comm)
+{
+	unsigned mask = (1 << gp->comm_bits) - 1;
+	unsigned i, j, k;
+
+	for (i = pid_hash(gp, comm->pid); gp->comm_hash[i] != comm; i = (i + 1) & mask)
+		;
+
+	/* Close the gap by moving back any later entry not anchored after it */
+	for (j = (i + 1) & mask; gp->comm_hash[j]; j = (j + 1) & mask) {
+		k = pid_hash(gp, gp->comm_hash[j]->pid);
+		if (i < j ? (k <= i || k > j) : (k <= i && k > j)) {
+			gp->comm_hash[i] = gp->comm_hash[j];
+			i = j;
+		}
+	}
+
+	gp->comm_hash[i] = NULL;
+	gp->nr_comm--;
+}
+
+/*
+ * Called for every sample, so this must not touch /proc: new clients are
+ * named in one pass by update_comms() once the samples are processed.
+ */
 static struct gpu_perf_comm *
 lookup_comm(struct gpu_perf *gp, pid_t pid)
 {
 	struct gpu_perf_comm *comm;
+	unsigned i, mask;
 
 	if (pid == 0)
 		return NULL;
 
-	for (comm = gp->comm; comm != NULL; comm = comm->next) {
-		if (comm->pid == pid)
-			break;
+	if ((gp->comm_hash == NULL || 2 * gp->nr_comm >= 1u << gp->comm_bits) &&
+	    comm_hash_grow(gp))
+		return NULL;
+
+	mask = (1 << gp->comm_bits) - 1;
+	for (i = pid_hash(gp, pid); (comm = gp->comm_hash[i]) != NULL; i = (i + 1) & mask) {
+		if (comm->pid == pid) {
+			comm->last_seen = gp->now;
+			return comm;
+		}
 	}
-	if (comm == NULL) {
-		comm = calloc(1, sizeof(*comm));
-		if (comm == NULL)
-			return NULL;
-
-		if (get_comm(pid, comm->name, sizeof(comm->name)) < 0) {
-			free(comm);
-			return NULL;
+
+	comm = calloc(1, sizeof(*comm));
+	if (comm == NULL)
+		return NULL;
+
+	comm->pid = pid;
+	comm->last_seen = gp->now;
+	comm->next = gp->comm;
+	gp->comm = comm;
+
+	gp->comm_hash[i] = comm;
+	gp->nr_comm++;
+
+	return comm;
+}
+
+static void free_comm(struct gpu_perf *gp, struct gpu_perf_comm *comm)
+{
+	comm_hash_remove(gp, comm);
+	if (comm->user_data && gp->free_user_data)
+		gp->free_user_data(comm->user_data);
+	free(comm);
+}
+
+/*
+ * Name the clients first seen since the last update, and forget those
+ * that have gone quiet for too long or have exited. A client cannot go
+ * away while it is waiting as the wait refers to it.
+ */
+static void update_comms(struct gpu_perf *gp)
+{
+	struct gpu_perf_comm *comm, **prev;
+
+	for (prev = &gp->comm; (comm = *prev) != NULL; ) {
+		bool dead = false;
+
+		if (!comm->resolved) {
+			dead = get_comm(comm->pid, comm->name, sizeof(comm->name)) < 0;
+			comm->resolved = true;
+		} else if (comm->last_seen != gp->now) {
+			dead = gp->now - comm->last_seen > gp->expire ||
+				(kill(comm->pid, 0) && errno == ESRCH);
 		}
 
-		comm->pid = pid;
-		comm->next = gp->comm;
-		gp->comm = comm;
+		if (dead && !comm->active) {
+			*prev = comm->next;
+			free_comm(gp, comm);
+		} else
+			prev = &comm->next;
+	}
+}
+
+int gpu_perf_get_clients(struct gpu_perf *gp,
+			 struct gpu_perf_client *clients, int max)
+{
+	struct gpu_perf_comm *comm;
+	int n = 0;
+
+	for (comm = gp->comm; comm != NULL; comm = comm->next) {
+		if (comm->name[0] == '\0')
+			continue;
+
+		if (n < max) {
+			clients[n].pid = comm->pid;
+			memcpy(clients[n].name, comm->name, sizeof(clients[n].name));
+			clients[n].stats = comm->total;
+		}
+		n++;
 	}
 
-	return comm;
+	return n;
 }
 
 static int request_add(struct gpu_perf *gp, const void *event)
+{
+	const struct sample_event *sample = event;
+	struct gpu_perf_comm *comm;
+	uint32_t ring = sample->raw[1];
+
+	if (ring >= MAX_RINGS)
+		return 0;
+
+	comm = lookup_comm(gp, sample->pid);
+	if (comm == NULL)
+		return 0;
+
+	comm->nr_requests[ring]++;
+	comm->total.requests[ring]++;
+	gp->total.requests[ring]++;
+	return 1;
+}
+
+static int flip_request(struct gpu_perf *gp, const void *event)
 {
 	const struct sample_event *sample = event;
 	struct gpu_perf_comm *comm;
@@ -218,7 +369,9 @@ static int request_add(struct gpu_perf *gp, const void *event)
 	if (comm == NULL)
 		return 0;
 
-	comm->nr_requests[sample->raw[1]]++;
+	comm->nr_flips++;
+	comm->total.flips++;
+	gp->total.flips++;
 	return 1;
 }
 
@@ -248,6 +401,8 @@ static int ring_sync(struct gpu_perf *gp, const void *event)
 		return 0;
 
 	comm->nr_sema++;
+	comm->total.semaphores++;
+	gp->total.semaphores++;
 	return 1;
 }
 
@@ -257,6 +412,10 @@ static int wait_begin(struct gpu_perf *gp, const void *event)
 	struct gpu_perf_comm *comm;
 	struct gpu_perf_time *wait;
 
+	/* A wait whose end was lost to a ring overflow is never freed */
+	if (sample->raw[1] >= MAX_RINGS || gp->nr_waits >= MAX_WAITS)
+		return 0;
+
 	comm = lookup_comm(gp, sample->pid);
 	if (comm == NULL)
 		return 0;
@@ -266,11 +425,14 @@ static int wait_begin(struct gpu_perf *gp, const void *event)
 		return 0;
 
 	wait->comm = comm;
-	wait->comm->active = true;
+	wait->comm->active++;
+	wait->comm->total.waits++;
+	gp->total.waits++;
 	wait->seqno = sample->raw[2];
 	wait->time = sample->time;
 	wait->next = gp->wait[sample->raw[1]];
 	gp->wait[sample->raw[1]] = wait;
+	gp->nr_waits++;
 
 	return 0;
 }
@@ -280,15 +442,21 @@ static int wait_end(struct gpu_perf *gp, const void *event)
 	const struct sample_event *sample = event;
 	struct gpu_perf_time *wait, **prev;
 
+	if (sample->raw[1] >= MAX_RINGS)
+		return 0;
+
 	for (prev = &gp->wait[sample->raw[1]]; (wait = *prev) != NULL; prev = &wait->next) {
 		if (wait->seqno != sample->raw[2])
 			continue;
 
 		wait->comm->wait_time += sample->time - wait->time;
-		wait->comm->active = false;
+		wait->comm->total.wait_time += sample->time - wait->time;
+		gp->total.wait_time += sample->time - wait->time;
+		wait->comm->active--;
 
 		*prev = wait->next;
 		free(wait);
+		gp->nr_waits--;
 		return 1;
 	}
 
@@ -300,10 +468,12 @@ void gpu_perf_init(struct gpu_perf *gp, unsigned flags)
 	memset(gp, 0, sizeof(*gp));
 	gp->nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
 	gp->page_size = getpagesize();
+	gp->expire = 30;
 
 	perf_tracepoint_open(gp, "i915", "i915_gem_request_add", request_add);
 	if (perf_tracepoint_open(gp, "i915", "i915_gem_request_wait_begin", wait_begin) == 0)
 		perf_tracepoint_open(gp, "i915", "i915_gem_request_wait_end", wait_end);
+	perf_tracepoint_open(gp, "i915", "i915_flip_request", flip_request);
 	perf_tracepoint_open(gp, "i915", "i915_flip_complete", flip_complete);
 	perf_tracepoint_open(gp, "i915", "i915_gem_ring_sync_to", ring_sync);
 	perf_tracepoint_open(gp, "i915", "i915_gem_ring_switch_context", ctx_switch);
@@ -317,6 +487,48 @@ void gpu_perf_init(struct gpu_perf *gp, unsigned flags)
 		return;
 }
 
+/*
+ * Releases the perf rings and every client and outstanding wait, leaving
+ * @gp ready for another gpu_perf_init().
+ */
+void gpu_perf_fini(struct gpu_perf *gp)
+{
+	struct gpu_perf_comm *comm;
+	int n;
+
+	if (gp->map) {
+		for (n = 0; n < gp->nr_cpus; n++)
+			munmap(gp->map[n], (1 + N_PAGES) * gp->page_size);
+		free(gp->map);
+	}
+
+	if (gp->fd) {
+		for (n = 0; n < gp->nr_events * gp->nr_cpus; n++)
+			close(gp->fd[n]);
+		free(gp->fd);
+	}
+	free(gp->sample);
+
+	for (n = 0; n < MAX_RINGS; n++) {
+		struct gpu_perf_time *wait;
+
+		while ((wait = gp->wait[n]) != NULL) {
+			gp->wait[n] = wait->next;
+			free(wait);
+		}
+	}
+
+	while ((comm = gp->comm) != NULL) {
+		gp->comm = comm->next;
+		if (comm->user_data && gp->free_user_data)
+			gp->free_user_data(comm->user_data);
+		free(comm);
+	}
+	free(gp->comm_hash);
+
+	memset(gp, 0, sizeof(*gp));
+}
+
 static int process_sample(struct gpu_perf *gp, int cpu,
 			  const struct perf_event_header *header)
 {
@@ -347,6 +559,8 @@ int gpu_perf_update(struct gpu_perf *gp)
 	if (gp->map == NULL)
 		return 0;
 
+	gp->now = time(NULL);
+
 	for (n = 0; n < gp->nr_cpus; n++) {
 		struct perf_event_mmap_page *mmap = gp->map[n];
 		const uint8_t *data;
@@ -404,5 +618,7 @@ int gpu_perf_update(struct gpu_perf *gp)
 	}
 
 	free(buffer);
+
+	update_comms(gp);
 	return update;
 }
@@ -27,9 +27,19 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
 
 #define MAX_RINGS 4
 
+struct gpu_perf_stats {
+	uint64_t requests[MAX_RINGS];
+	uint64_t waits;
+	uint64_t wait_time;
+	uint64_t semaphores;
+	uint64_t flips;
+};
+
 struct gpu_perf {
 	const char *error;
 	int page_size;
@@ -45,18 +55,26 @@ struct gpu_perf {
 	unsigned flip_complete[MAX_RINGS];
 	unsigned ctx_switch[MAX_RINGS];
 
+	/* running totals over all clients */
+	struct gpu_perf_stats total;
+
 	struct gpu_perf_comm {
 		struct gpu_perf_comm *next;
 		char name[256];
 		pid_t pid;
-		bool active;
-		int nr_requests[4];
+		unsigned active; /* outstanding waits */
+		bool resolved;
+		int nr_requests[MAX_RINGS];
 		void *user_data;
 
 		uint64_t wait_time;
 		uint32_t nr_sema;
+		uint32_t nr_flips;
+
+		/* running totals since the client was first seen */
+		struct gpu_perf_stats total;
 
-		time_t show;
+		time_t last_seen;
 	} *comm;
 	struct gpu_perf_time {
 		struct gpu_perf_time *next;
@@ -64,9 +82,33 @@ struct gpu_perf {
 		uint32_t seqno;
 		uint64_t time;
 	} *wait[MAX_RINGS];
+	unsigned nr_waits;
+
+	/* open-addressed by pid, 1 << comm_bits slots */
+	struct gpu_perf_comm **comm_hash;
+	unsigned comm_bits;
+	unsigned nr_comm;
+
+	/*
+	 * Clients without events for this many seconds, or whose process
+	 * has exited, are forgotten. free_user_data is called for any
+	 * user_data still attached.
+	 */
+	int expire;
+	void (*free_user_data)(void *user_data);
+	time_t now;
+};
+
+struct gpu_perf_client {
+	pid_t pid;
+	char name[256];
+	struct gpu_perf_stats stats;
 };
 
 void gpu_perf_init(struct gpu_perf *gp, unsigned flags);
 int gpu_perf_update(struct gpu_perf *gp);
+void gpu_perf_fini(struct gpu_perf *gp);
+int gpu_perf_get_clients(struct gpu_perf *gp,
+			 struct gpu_perf_client *clients, int max);
 
 #endif /* GPU_PERF_H */
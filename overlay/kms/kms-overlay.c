@@ -112,11 +112,29 @@ static int detach_from_crtc(int fd, int crtc)
 	return drmIoctl(fd, DRM_IOCTL_MODE_SETPLANE, &s) == 0;
 }
 
-static void kms_overlay_show(struct overlay *overlay)
+static void kms_overlay_show(struct overlay *overlay,
+			     const cairo_region_t *damage)
 {
 	struct kms_overlay *priv = to_kms_overlay(overlay);
 
-	memcpy(priv->image.map, priv->mem, priv->size);
+	if (damage && priv->visible) {
+		int n, y;
+
+		for (n = 0; n < cairo_region_num_rectangles(damage); n++) {
+			cairo_rectangle_int_t r;
+			int offset;
+
+			cairo_region_get_rectangle(damage, n, &r);
+			offset = r.y * priv->image.stride + r.x * 4;
+			for (y = 0; y < r.height; y++) {
+				memcpy((uint8_t *)priv->image.map + offset,
+				       (uint8_t *)priv->mem + offset,
+				       r.width * 4);
+				offset += priv->image.stride;
+			}
+		}
+	} else
+		memcpy(priv->image.map, priv->mem, priv->size);
 
 	if (!priv->visible) {
 		attach_to_crtc(priv->fd, priv->crtc, priv->x, priv->y, &priv->image);
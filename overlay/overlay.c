@@ -49,6 +49,8 @@
 #include "gpu-perf.h"
 #include "power.h"
 #include "rc6.h"
+#include "collectors.h"
+#include "record.h"
 
 #define is_power_of_two(x)  (((x) & ((x)-1)) == 0)
 
@@ -60,7 +62,98 @@
 
 const cairo_user_data_key_t overlay_key;
 
-static void overlay_show(cairo_surface_t *surface)
+#define DAMAGE_TILE 32
+
+/*
+ * The surface as last shown, compared against tile by tile to find out
+ * which parts of the surface have to be uploaded again.
+ */
+struct overlay_damage {
+	uint8_t *shadow;
+	int stride, height;
+	cairo_region_t *region;
+};
+
+static int format_cpp(cairo_format_t format)
+{
+	switch (format) {
+	case CAIRO_FORMAT_ARGB32:
+	case CAIRO_FORMAT_RGB24:
+		return 4;
+	case CAIRO_FORMAT_RGB16_565:
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+static const cairo_region_t *
+overlay_damage(struct overlay_damage *damage, cairo_surface_t *surface)
+{
+	const uint8_t *data;
+	int width, height, stride, cpp;
+	int x, y, row;
+
+	if (cairo_surface_get_type(surface) != CAIRO_SURFACE_TYPE_IMAGE)
+		return NULL;
+
+	cpp = format_cpp(cairo_image_surface_get_format(surface));
+	if (cpp == 0)
+		return NULL;
+
+	cairo_surface_flush(surface);
+	data = cairo_image_surface_get_data(surface);
+	width = cairo_image_surface_get_width(surface);
+	height = cairo_image_surface_get_height(surface);
+	stride = cairo_image_surface_get_stride(surface);
+
+	if (damage->shadow == NULL ||
+	    damage->stride != stride || damage->height != height) {
+		free(damage->shadow);
+		damage->shadow = malloc(stride * height);
+		if (damage->shadow == NULL)
+			return NULL;
+
+		memcpy(damage->shadow, data, stride * height);
+		damage->stride = stride;
+		damage->height = height;
+		return NULL;
+	}
+
+	if (damage->region)
+		cairo_region_destroy(damage->region);
+	damage->region = cairo_region_create();
+
+	for (y = 0; y < height; y += DAMAGE_TILE) {
+		int h = height - y < DAMAGE_TILE ? height - y : DAMAGE_TILE;
+
+		for (x = 0; x < width; x += DAMAGE_TILE) {
+			int w = width - x < DAMAGE_TILE ? width - x : DAMAGE_TILE;
+			cairo_rectangle_int_t r = { x, y, w, h };
+			int offset = y * stride + x * cpp;
+
+			for (row = 0; row < h; row++) {
+				if (memcmp(data + offset + row * stride,
+					   damage->shadow + offset + row * stride,
+					   w * cpp))
+					break;
+			}
+			if (row == h)
+				continue;
+
+			for (; row < h; row++)
+				memcpy(damage->shadow + offset + row * stride,
+				       data + offset + row * stride,
+				       w * cpp);
+			cairo_region_union_rectangle(damage->region, &r);
+		}
+	}
+
+	return damage->region;
+}
+
+static void overlay_show(cairo_surface_t *surface,
+			 struct overlay_damage *damage)
 {
 	struct overlay *overlay;
 
@@ -68,7 +161,7 @@ static void overlay_show(cairo_surface_t *surface)
 	if (overlay == NULL)
 		return;
 
-	overlay->show(overlay);
+	overlay->show(overlay, overlay_damage(damage, surface));
 }
 
 #if 0
@@ -138,6 +231,8 @@ struct overlay_context {
 	struct overlay_gpu_perf gpu_perf;
 	struct overlay_gpu_freq gpu_freq;
 	struct overlay_gem_objects gem_objects;
+
+	struct overlay_damage damage;
 };
 
 static void init_gpu_top(struct overlay_context *ctx,
@@ -273,34 +368,23 @@ static void show_gpu_top(struct overlay_context *ctx, struct overlay_gpu_top *gt
 	}
 }
 
+static void free_comm_chart(void *user_data)
+{
+	chart_fini(user_data);
+	free(user_data);
+}
+
 static void init_gpu_perf(struct overlay_context *ctx,
 			  struct overlay_gpu_perf *gp)
 {
 	gpu_perf_init(&gp->gpu_perf, 0);
+	gp->gpu_perf.expire = IDLE_TIME;
+	gp->gpu_perf.free_user_data = free_comm_chart;
 
 	gp->show_ctx = 0;
 	gp->show_flips = 0;
 }
 
-static char *get_comm(pid_t pid, char *comm, int len)
-{
-	char filename[1024];
-	int fd;
-
-	*comm = '\0';
-	snprintf(filename, sizeof(filename), "/proc/%d/comm", pid);
-
-	fd = open(filename, 0);
-	if (fd >= 0) {
-		len = read(fd, comm, len);
-		if (len >= 0)
-			comm[len-1] = '\0';
-		close(fd);
-	}
-
-	return comm;
-}
-
 static void show_gpu_perf(struct overlay_context *ctx, struct overlay_gpu_perf *gp)
 {
 	static int last_color;
@@ -310,7 +394,7 @@ static void show_gpu_perf(struct overlay_context *ctx, struct overlay_gpu_perf *
 		{ 0.25, 0.25, 1, 1 },
 		{ 1, 1, 1, 1 },
 	};
-	struct gpu_perf_comm *comm, **prev;
+	struct gpu_perf_comm *comm;
 	const char *ring_name[] = {
 		"R",
 		"V",
@@ -425,7 +509,7 @@ static void show_gpu_perf(struct overlay_context *ctx, struct overlay_gpu_perf *
 	cairo_pattern_destroy(linear);
 	cairo_fill(ctx->cr);
 
-	for (prev = &gp->gpu_perf.comm; (comm = *prev) != NULL; ) {
+	for (comm = gp->gpu_perf.comm; comm != NULL; comm = comm->next) {
 		int need_comma = 0, len;
 
 		if (comm->user_data == NULL)
@@ -437,7 +521,6 @@ static void show_gpu_perf(struct overlay_context *ctx, struct overlay_gpu_perf *
 				continue;
 			len += sprintf(buf + len, "%s %d%s", need_comma ? "," : "", comm->nr_requests[n], ring_name[n]);
 			need_comma = true;
-			comm->show = ctx->time;
 		}
 		if (comm->wait_time) {
 			if (comm->wait_time > 1000*1000) {
@@ -455,7 +538,6 @@ static void show_gpu_perf(struct overlay_context *ctx, struct overlay_gpu_perf *
 			}
 			need_comma = true;
 			comm->wait_time = 0;
-			comm->show = ctx->time;
 		}
 		if (comm->nr_sema) {
 			len += sprintf(buf + len, "%s %d syncs",
@@ -463,7 +545,13 @@ static void show_gpu_perf(struct overlay_context *ctx, struct overlay_gpu_perf *
 				       comm->nr_sema);
 			need_comma = true;
 			comm->nr_sema = 0;
-			comm->show = ctx->time;
+		}
+		if (comm->nr_flips) {
+			len += sprintf(buf + len, "%s %d flips",
+				       need_comma ? "," : "",
+				       comm->nr_flips);
+			need_comma = true;
+			comm->nr_flips = 0;
 		}
 
 		if (comm->user_data) {
@@ -481,17 +569,6 @@ static void show_gpu_perf(struct overlay_context *ctx, struct overlay_gpu_perf *
 
 skip_comm:
 		memset(comm->nr_requests, 0, sizeof(comm->nr_requests));
-		if (!comm->active &&
-		    (comm->show < ctx->time - IDLE_TIME ||
-		     strcmp(comm->name, get_comm(comm->pid, buf, sizeof(buf))))) {
-			*prev = comm->next;
-			if (comm->user_data) {
-				chart_fini(comm->user_data);
-				free(comm->user_data);
-			}
-			free(comm);
-		} else
-			prev = &comm->next;
 	}
 
 	cairo_set_source_rgba(ctx->cr, 1, 1, 1, 1);
@@ -809,7 +886,7 @@ static void signal_snapshot(int sig)
 	take_snapshot = sig;
 }
 
-static int get_sample_period(struct config *config)
+static int get_sample_period(struct config *config, int def)
 {
 	const char *value;
 
@@ -821,7 +898,18 @@ static int get_sample_period(struct config *config)
 	if (value && atoi(value) > 0)
 		return 1000000 / atoi(value);
 
-	return 500000;
+	return def;
+}
+
+static int get_incremental(struct config *config)
+{
+	const char *value;
+
+	value = config_get_value(config, "render", "incremental");
+	if (value)
+		return atoi(value);
+
+	return 1;
 }
 
 static void overlay_snapshot(struct overlay_context *ctx)
@@ -839,6 +927,8 @@ static void usage(const char *progname)
 	printf("\t--geometry|-G <width>x<height>+<x-offset>+<y-offset>\tExact window placement and size\n");
 	printf("\t--position|-P (top|middle|bottom)-(left|centre|right)\tPlace the window in a particular corner\n");
 	printf("\t--size|-S <width>x<height> | <scale>%%\t\t\tWindow size\n");
+	printf("\t--record|-R <filename>\t\t\t\t\tRecord all statistics to a file without displaying them\n");
+	printf("\t--dump|-D <filename>\t\t\t\t\tPrint a recording as tab separated values\n");
 	printf("\t--help|-h\t\t\t\t\t\tThis help message\n");
 }
 
@@ -849,12 +939,15 @@ int main(int argc, char **argv)
 		{"geometry", 1, 0, 'G'},
 		{"position", 1, 0, 'P'},
 		{"size", 1, 0, 'S'},
+		{"record", 1, 0, 'R'},
+		{"dump", 1, 0, 'D'},
 		{"help", 0, 0, 'h'},
 		{NULL, 0, 0, 0,}
 	};
 	struct overlay_context ctx;
 	struct config config;
 	int index, sample_period;
+	const char *record = NULL;
 	int daemonize = 1, renice = 0;
 	int i;
 
@@ -862,7 +955,7 @@ int main(int argc, char **argv)
 	config_init(&config);
 
 	opterr = 0;
-	while ((i = getopt_long(argc, argv, "c:G:fhn?", long_options, &index)) != -1) {
+	while ((i = getopt_long(argc, argv, "c:G:R:D:fhn?", long_options, &index)) != -1) {
 		switch (i) {
 		case 'c':
 			config_parse_string(&config, optarg);
@@ -884,12 +977,29 @@ int main(int argc, char **argv)
 			if (optarg)
 				renice = atoi(optarg);
 			break;
+		case 'R':
+			record = optarg;
+			break;
+		case 'D':
+			return record_dump(optarg, stdout);
 		case 'h':
 			usage(argv[0]);
 			return 0;
 		}
 	}
 
+	if (record) {
+		if (renice && (nice(renice) == -1))
+			fprintf(stderr, "Could not renice: %s\n", strerror(errno));
+
+		i = record_run(record, COLLECTORS_ALL,
+			       get_sample_period(&config, 10000));
+		if (i)
+			fprintf(stderr, "Failed to record to %s: %s\n",
+				record, strerror(i));
+		return i;
+	}
+
 	if (argc > optind) {
 		x11_overlay_stop();
 		return 0;
@@ -898,6 +1008,7 @@ int main(int argc, char **argv)
 	ctx.width = 640;
 	ctx.height = 236;
 	ctx.surface = NULL;
+	memset(&ctx.damage, 0, sizeof(ctx.damage));
 	if (ctx.surface == NULL)
 		ctx.surface = x11_overlay_create(&config, &ctx.width, &ctx.height);
 	if (ctx.surface == NULL)
@@ -917,12 +1028,14 @@ int main(int argc, char **argv)
 
 	debugfs_init();
 
+	chart_set_default_cached(get_incremental(&config));
+
 	init_gpu_top(&ctx, &ctx.gpu_top);
 	init_gpu_perf(&ctx, &ctx.gpu_perf);
 	init_gpu_freq(&ctx, &ctx.gpu_freq);
 	init_gem_objects(&ctx, &ctx.gem_objects);
 
-	sample_period = get_sample_period(&config);
+	sample_period = get_sample_period(&config, 500000);
 
 	i = 0;
 	while (1) {
@@ -953,7 +1066,7 @@ int main(int argc, char **argv)
 
 		cairo_destroy(ctx.cr);
 
-		overlay_show(ctx.surface);
+		overlay_show(ctx.surface, &ctx.damage);
 
 		if (take_snapshot) {
 			overlay_snapshot(&ctx);
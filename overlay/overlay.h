@@ -57,7 +57,8 @@ enum position {
 
 struct overlay {
 	cairo_surface_t *surface;
-	void (*show)(struct overlay *);
+	/* damage is what changed since the last show, NULL for everything */
+	void (*show)(struct overlay *, const cairo_region_t *damage);
 	void (*hide)(struct overlay *);
 };
 
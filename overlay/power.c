@@ -22,6 +22,7 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -52,10 +53,21 @@ static int perf_open(void)
 	return perf_event_open(&attr, -1, 0, -1, 0);
 }
 
+static uint64_t reader_to_u64(struct reader *r)
+{
+	const char *s;
+
+	if (reader_read(r))
+		return 0;
+
+	s = r->buf;
+	return scan_u64(&s);
+}
+
 int power_init(struct power *power)
 {
-	char buf[4096];
-	int fd, len;
+	char path[1024];
+	int err;
 
 	memset(power, 0, sizeof(*power));
 
@@ -63,45 +75,19 @@ int power_init(struct power *power)
 	if (power->fd != -1)
 		return 0;
 
-	sprintf(buf, "%s/i915_energy_uJ", debugfs_dri_path);
-	fd = open(buf, 0);
-	if (fd < 0)
-		return power->error = errno;
-
-	len = read(fd, buf, sizeof(buf));
-	close(fd);
+	sprintf(path, "%s/i915_energy_uJ", debugfs_dri_path);
+	err = reader_open(&power->energy, path);
+	if (err)
+		return power->error = err;
 
-	if (len < 0)
-		return power->error = errno;
-
-	buf[len] = '\0';
-	if (strtoull(buf, 0, 0) == 0)
+	if (reader_to_u64(&power->energy) == 0) {
+		reader_close(&power->energy);
 		return power->error = EINVAL;
+	}
 
 	return 0;
 }
 
-static uint64_t file_to_u64(const char *name)
-{
-	char buf[4096];
-	int fd, len;
-
-	sprintf(buf, "%s/%s", debugfs_dri_path, name);
-	fd = open(buf, 0);
-	if (fd < 0)
-		return 0;
-
-	len = read(fd, buf, sizeof(buf)-1);
-	close(fd);
-
-	if (len < 0)
-		return 0;
-
-	buf[len] = '\0';
-
-	return strtoull(buf, 0, 0);
-}
-
 static uint64_t clock_ms_to_u64(void)
 {
 	struct timespec tv;
@@ -132,7 +118,7 @@ int power_update(struct power *power)
 		s->energy = data[0];
 		s->timestamp = data[1] / (1000*1000);
 	} else {
-		s->energy = file_to_u64("i915_energy_uJ");
+		s->energy = reader_to_u64(&power->energy);
 		s->timestamp = clock_ms_to_u64();
 	}
 
@@ -140,7 +126,22 @@ int power_update(struct power *power)
 		return EAGAIN;
 
 	d_time = s->timestamp - d->timestamp;
-	power->power_mW = (s->energy - d->energy) / d_time;
+	if (d_time == 0) {
+		power->count--;
+		return EAGAIN;
+	}
+
+	power->energy_uJ = s->energy - d->energy;
+	power->power_mW = power->energy_uJ / d_time;
 	power->new_sample = 1;
 	return 0;
 }
+
+void power_fini(struct power *power)
+{
+	if (power->fd != -1)
+		close(power->fd);
+	else
+		reader_close(&power->energy);
+	power->fd = -1;
+}
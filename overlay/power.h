@@ -27,6 +27,8 @@
 
 #include <stdint.h>
 
+#include "reader.h"
+
 struct power {
 	struct power_stat {
 		uint64_t energy;
@@ -37,11 +39,14 @@ struct power {
 	int error;
 	int count;
 	int new_sample;
+	struct reader energy;
 
 	uint64_t power_mW;
+	uint64_t energy_uJ; /* consumed over the last period */
 };
 
 int power_init(struct power *power);
 int power_update(struct power *power);
+void power_fini(struct power *power);
 
 #endif /* POWER_H */
@@ -22,6 +22,7 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <sys/stat.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -80,32 +81,40 @@ int rc6_init(struct rc6 *rc6)
 
 	rc6->fd = perf_open(&rc6->flags);
 	if (rc6->fd == -1) {
+		static const char * const names[] = {
+			"rc6_residency_ms",
+			"rc6p_residency_ms",
+			"rc6pp_residency_ms",
+		};
+		char path[1024];
 		struct stat st;
+		int n;
+
+		for (n = 0; n < 3; n++)
+			reader_init(&rc6->residency[n]);
+
 		if (stat("/sys/class/drm/card0/power", &st) < 0)
 			return rc6->error = errno;
+
+		/* Missing files are reported by rc6_update() */
+		for (n = 0; n < 3; n++) {
+			sprintf(path, "/sys/class/drm/card0/power/%s", names[n]);
+			reader_open(&rc6->residency[n], path);
+		}
 	}
 
 	return 0;
 }
 
-static uint64_t file_to_u64(const char *path)
+static uint64_t reader_to_u64(struct reader *r)
 {
-	char buf[4096];
-	int fd, len;
-
-	fd = open(path, 0);
-	if (fd < 0)
-		return -1;
+	const char *s;
 
-	len = read(fd, buf, sizeof(buf)-1);
-	close(fd);
-
-	if (len < 0)
+	if (reader_read(r))
 		return -1;
 
-	buf[len] = '\0';
-
-	return strtoull(buf, 0, 0);
+	s = r->buf;
+	return scan_u64(&s);
 }
 
 static uint64_t clock_ms_to_u64(void)
@@ -128,14 +137,12 @@ int rc6_update(struct rc6 *rc6)
 		return rc6->error;
 
 	if (rc6->fd == -1) {
-		struct stat st;
-
-		if (stat("/sys/class/drm/card0/power/rc6_residency_ms", &st) < 0)
+		if (!reader_is_open(&rc6->residency[0]))
 			return rc6->error = ENOENT;
 
-		s->rc6_residency = file_to_u64("/sys/class/drm/card0/power/rc6_residency_ms");
-		s->rc6p_residency = file_to_u64("/sys/class/drm/card0/power/rc6p_residency_ms");
-		s->rc6pp_residency = file_to_u64("/sys/class/drm/card0/power/rc6pp_residency_ms");
+		s->rc6_residency = reader_to_u64(&rc6->residency[0]);
+		s->rc6p_residency = reader_to_u64(&rc6->residency[1]);
+		s->rc6pp_residency = reader_to_u64(&rc6->residency[2]);
 		s->timestamp = clock_ms_to_u64();
 	} else {
 		uint64_t data[5];
@@ -177,3 +184,16 @@ int rc6_update(struct rc6 *rc6)
 	rc6->rc6_combined = (100 * (d_rc6 + d_rc6p + d_rc6pp) + d_time/2) / d_time;
 	return 0;
 }
+
+void rc6_fini(struct rc6 *rc6)
+{
+	int n;
+
+	if (rc6->fd != -1) {
+		close(rc6->fd);
+	} else {
+		for (n = 0; n < 3; n++)
+			reader_close(&rc6->residency[n]);
+	}
+	rc6->fd = -1;
+}
@@ -27,6 +27,8 @@
 
 #include <stdint.h>
 
+#include "reader.h"
+
 struct rc6 {
 	struct rc6_stat {
 		uint64_t rc6_residency;
@@ -40,6 +42,7 @@ struct rc6 {
 	int error;
 
 	unsigned flags;
+	struct reader residency[3];
 
 	uint8_t rc6;
 	uint8_t rc6p;
@@ -49,5 +52,6 @@ struct rc6 {
 
 int rc6_init(struct rc6 *rc6);
 int rc6_update(struct rc6 *rc6);
+void rc6_fini(struct rc6 *rc6);
 
 #endif /* RC6_H */
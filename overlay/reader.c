@@ -0,0 +1,109 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include "reader.h"
+
+#define READER_INITIAL_SIZE 4096
+
+void reader_init(struct reader *r)
+{
+	r->fd = -1;
+	r->buf = NULL;
+	r->size = 0;
+	r->len = 0;
+}
+
+int reader_open(struct reader *r, const char *path)
+{
+	reader_init(r);
+
+	r->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (r->fd < 0)
+		return errno;
+
+	r->size = READER_INITIAL_SIZE;
+	r->buf = malloc(r->size);
+	if (r->buf == NULL) {
+		close(r->fd);
+		r->fd = -1;
+		return ENOMEM;
+	}
+
+	r->buf[0] = '\0';
+	return 0;
+}
+
+int reader_read(struct reader *r)
+{
+	size_t len = 0;
+
+	if (r->fd < 0)
+		return ENOENT;
+
+	/*
+	 * seq_file iterators such as /proc/interrupts hand out about a page
+	 * per read, so keep reading from where we left off until EOF,
+	 * growing the buffer as we go.
+	 */
+	for (;;) {
+		ssize_t ret;
+
+		if (len == r->size - 1) {
+			char *buf = realloc(r->buf, 2 * r->size);
+			if (buf == NULL)
+				break;
+
+			r->buf = buf;
+			r->size *= 2;
+		}
+
+		ret = pread(r->fd, r->buf + len, r->size - 1 - len, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (ret == 0)
+			break;
+
+		len += ret;
+	}
+
+	r->buf[len] = '\0';
+	r->len = len;
+	return 0;
+}
+
+void reader_close(struct reader *r)
+{
+	if (r->fd >= 0)
+		close(r->fd);
+	free(r->buf);
+	reader_init(r);
+}
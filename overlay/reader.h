@@ -0,0 +1,109 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef READER_H
+#define READER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * A reader keeps a procfs/sysfs/debugfs file open across samples and
+ * re-reads it with pread() from the start, so that sampling does not pay
+ * for path lookup and open/close each time. The buffer grows until the
+ * whole file fits and is always NUL-terminated.
+ */
+struct reader {
+	int fd;
+	char *buf;
+	size_t size;
+	size_t len;
+};
+
+void reader_init(struct reader *r);
+int reader_open(struct reader *r, const char *path);
+int reader_read(struct reader *r);
+void reader_close(struct reader *r);
+
+static inline int reader_is_open(const struct reader *r)
+{
+	return r->fd >= 0;
+}
+
+/*
+ * Minimal scanners for the text we read, replacing sscanf/strstr on the
+ * sampling path. All of them work on NUL-terminated strings and return
+ * NULL when there is nothing left to scan.
+ */
+
+static inline const char *scan_after(const char *s, const char *key)
+{
+	const char *k;
+
+	if (s == NULL)
+		return NULL;
+
+	for (; *s; s++) {
+		if (*s != *key)
+			continue;
+
+		for (k = key + 1; *k && s[k - key] == *k; k++)
+			;
+		if (*k == '\0')
+			return s + (k - key);
+	}
+
+	return NULL;
+}
+
+static inline const char *scan_next_line(const char *s)
+{
+	if (s == NULL)
+		return NULL;
+
+	while (*s && *s != '\n')
+		s++;
+
+	return *s ? s + 1 : NULL;
+}
+
+/* Skips to the next digit on the current line and parses a decimal */
+static inline uint64_t scan_u64(const char **ps)
+{
+	const char *s = *ps;
+	uint64_t v = 0;
+
+	if (s == NULL)
+		return 0;
+
+	while (*s && *s != '\n' && (*s < '0' || *s > '9'))
+		s++;
+
+	while (*s >= '0' && *s <= '9')
+		v = 10 * v + (*s++ - '0');
+
+	*ps = s;
+	return v;
+}
+
+#endif /* READER_H */
@@ -0,0 +1,181 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+#include "collectors.h"
+#include "record.h"
+
+#define RECORD_BUFFER_SIZE (1 << 20)
+
+static volatile sig_atomic_t record_stop;
+
+static void signal_stop(int sig)
+{
+	record_stop = sig;
+}
+
+static void timespec_add_us(struct timespec *ts, int us)
+{
+	ts->tv_nsec += (long)us * 1000;
+	while (ts->tv_nsec >= 1000000000) {
+		ts->tv_nsec -= 1000000000;
+		ts->tv_sec++;
+	}
+}
+
+/*
+ * Samples the collectors every @period_us, on an absolute schedule so that
+ * the time spent collecting does not skew the rate, and appends the
+ * samples to @filename until interrupted by SIGINT or SIGTERM.
+ */
+int record_run(const char *filename, unsigned collectors, int period_us)
+{
+	static struct collectors c;
+	struct record_header header;
+	struct collectors_sample sample;
+	struct timespec next;
+	char *buf;
+	FILE *file;
+	int ret = 0;
+
+	file = fopen(filename, "w");
+	if (file == NULL)
+		return errno;
+
+	buf = malloc(RECORD_BUFFER_SIZE);
+	if (buf)
+		setvbuf(file, buf, _IOFBF, RECORD_BUFFER_SIZE);
+
+	memset(&header, 0, sizeof(header));
+	header.magic = RECORD_MAGIC;
+	header.version = RECORD_VERSION;
+	header.sample_size = sizeof(sample);
+	header.collectors = collectors_init(&c, collectors);
+	header.period_us = period_us;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	header.start = (uint64_t)next.tv_sec * 1000000000 + next.tv_nsec;
+	if (fwrite(&header, sizeof(header), 1, file) != 1)
+		ret = EIO;
+
+	signal(SIGINT, signal_stop);
+	signal(SIGTERM, signal_stop);
+
+	while (!ret && !record_stop) {
+		collectors_update(&c);
+		collectors_snapshot(&c, &sample);
+		if (fwrite(&sample, sizeof(sample), 1, file) != 1) {
+			ret = EIO;
+			break;
+		}
+
+		timespec_add_us(&next, period_us);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				       &next, NULL) == EINTR && !record_stop)
+			;
+	}
+
+	if (fclose(file) && !ret)
+		ret = errno;
+	free(buf);
+
+	return ret;
+}
+
+/* Writes a recording out as tab separated values, one sample per line */
+int record_dump(const char *filename, FILE *out)
+{
+	struct record_header header;
+	struct collectors_sample sample;
+	char *buf;
+	FILE *file;
+	int n;
+
+	file = fopen(filename, "r");
+	if (file == NULL)
+		return errno;
+
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    header.magic != RECORD_MAGIC ||
+	    header.version != RECORD_VERSION ||
+	    header.sample_size < sizeof(sample)) {
+		fclose(file);
+		return EINVAL;
+	}
+
+	buf = malloc(header.sample_size);
+	if (buf == NULL) {
+		fclose(file);
+		return ENOMEM;
+	}
+
+	fprintf(out, "# time\tupdated");
+	for (n = 0; n < NUM_COLLECTORS; n++)
+		fprintf(out, "\t%s-ns", collector_names[n]);
+	fprintf(out, "\tcpu\tnr_running");
+	for (n = 0; n < MAX_RINGS; n++)
+		fprintf(out, "\tbusy%d\twait%d\tsema%d", n, n, n);
+	fprintf(out, "\tclients\twaits\twait_time\tsemaphores\tflips");
+	fprintf(out, "\tfreq\trequest\trc6\trc6p\trc6pp\tpower_mW");
+	fprintf(out, "\tinterrupts\tgem_bytes\tgem_count\n");
+
+	while (fread(buf, header.sample_size, 1, file) == 1) {
+		memcpy(&sample, buf, sizeof(sample));
+
+		fprintf(out, "%.6f\t%#x",
+			(sample.timestamp - header.start) / 1e9,
+			sample.updated);
+		for (n = 0; n < NUM_COLLECTORS; n++)
+			fprintf(out, "\t%u", sample.cost_ns[n]);
+		fprintf(out, "\t%u\t%u", sample.cpu_busy, sample.nr_running);
+		for (n = 0; n < MAX_RINGS; n++)
+			fprintf(out, "\t%u\t%u\t%u",
+				sample.ring_busy[n],
+				sample.ring_wait[n],
+				sample.ring_sema[n]);
+		fprintf(out, "\t%u\t%llu\t%llu\t%llu\t%llu",
+			sample.nr_clients,
+			(unsigned long long)sample.perf.waits,
+			(unsigned long long)sample.perf.wait_time,
+			(unsigned long long)sample.perf.semaphores,
+			(unsigned long long)sample.perf.flips);
+		fprintf(out, "\t%u\t%u\t%u\t%u\t%u\t%u",
+			sample.freq_current, sample.freq_request,
+			sample.rc6, sample.rc6p, sample.rc6pp,
+			sample.power_mW);
+		fprintf(out, "\t%llu\t%llu\t%llu\n",
+			(unsigned long long)sample.interrupts,
+			(unsigned long long)sample.gem_bytes,
+			(unsigned long long)sample.gem_count);
+	}
+
+	free(buf);
+	fclose(file);
+	return 0;
+}
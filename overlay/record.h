@@ -0,0 +1,53 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Headless recording of the collectors. A recording is a struct
+ * record_header followed by fixed size struct collectors_sample records,
+ * sample_size bytes each, so that newer readers can skip fields added
+ * after the file was written.
+ */
+
+#define RECORD_MAGIC 0x52475049 /* "IPGR" */
+#define RECORD_VERSION 1
+
+struct record_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sample_size;
+	uint32_t collectors; /* mask of enabled collectors */
+	uint32_t period_us;
+	uint32_t pad;
+	uint64_t start; /* ns, CLOCK_MONOTONIC */
+} __attribute__((packed));
+
+int record_run(const char *filename, unsigned collectors, int period_us);
+int record_dump(const char *filename, FILE *out);
+
+#endif /* RECORD_H */
@@ -23,107 +23,391 @@
  */
 
 #include <stdint.h>
-#include <stdlib.h>
+#include <string.h>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "igt_x86.h"
 #include "rgb2yuv.h"
 
-static int RGB2YUV_YR[256], RGB2YUV_YG[256], RGB2YUV_YB[256];
-static int RGB2YUV_UR[256], RGB2YUV_UG[256], RGB2YUV_UBVR[256];
-static int RGB2YUV_VG[256], RGB2YUV_VB[256];
+/*
+ * BT.601 studio range, in fixed point with 15 fractional bits so that
+ * every coefficient fits a signed 16 bit multiplier.
+ */
+#define YR 8382	/* 65.481 */
+#define YG 16455	/* 128.553 */
+#define YB 3196	/* 24.966 */
+#define UR 4838	/* 37.797 */
+#define UG 9498	/* 74.203 */
+#define UBVR 14336	/* 112 */
+#define VG 12005	/* 93.786 */
+#define VB 2331	/* 18.214 */
+
+#define Y_OFFSET (16 << 15)
+#define UV_OFFSET (128 << 15)
 
-void rgb2yuv_init(void)
+typedef void (*convert_rows_func)(const uint16_t *rgb0, const uint16_t *rgb1,
+				  uint8_t *y0, uint8_t *y1,
+				  uint8_t *u, uint8_t *v, int width);
+
+static inline void expand565(uint16_t p, int *r, int *g, int *b)
+{
+	*r = (p >> 11) & 0x1f;
+	*g = (p >> 5) & 0x3f;
+	*b = (p >> 0) & 0x1f;
+
+	*r = *r << 3 | *r >> 2;
+	*g = *g << 2 | *g >> 4;
+	*b = *b << 3 | *b >> 2;
+}
+
+static inline uint8_t luma(uint16_t p)
+{
+	int r, g, b;
+
+	expand565(p, &r, &g, &b);
+	return (YR*r + YG*g + YB*b + Y_OFFSET) >> 15;
+}
+
+static inline void chroma(uint16_t p, int *u, int *v)
 {
-	int i;
+	int r, g, b;
+
+	expand565(p, &r, &g, &b);
+	*u += (-UR*r - UG*g + UBVR*b + UV_OFFSET) >> 15;
+	*v += (UBVR*r - VG*g - VB*b + UV_OFFSET) >> 15;
+}
 
-	for (i = 0; i < 256; i++)
-		RGB2YUV_YR[i] = 65.481 * (i << 8);
+/*
+ * Converts two rows of width (even) pixels, averaging the chroma of each
+ * 2x2 block straight into the U and V planes.
+ */
+static void convert_rows_generic(const uint16_t *rgb0, const uint16_t *rgb1,
+				 uint8_t *y0, uint8_t *y1,
+				 uint8_t *u, uint8_t *v, int width)
+{
+	int n;
 
-	for (i = 0; i < 256; i++)
-		RGB2YUV_YG[i] = 128.553 * (i << 8);
+	for (n = 0; n < width; n += 2) {
+		int su = 0, sv = 0;
 
-	for (i = 0; i < 256; i++)
-		RGB2YUV_YB[i] = 24.966 * (i << 8);
+		y0[n] = luma(rgb0[n]);
+		y0[n+1] = luma(rgb0[n+1]);
+		y1[n] = luma(rgb1[n]);
+		y1[n+1] = luma(rgb1[n+1]);
 
-	for (i = 0; i < 256; i++)
-		RGB2YUV_UR[i] = 37.797 * (i << 8);
+		chroma(rgb0[n], &su, &sv);
+		chroma(rgb0[n+1], &su, &sv);
+		chroma(rgb1[n], &su, &sv);
+		chroma(rgb1[n+1], &su, &sv);
 
-	for (i = 0; i < 256; i++)
-		RGB2YUV_UG[i] = 74.203 * (i << 8);
+		u[n/2] = su >> 2;
+		v[n/2] = sv >> 2;
+	}
+}
 
-	for (i = 0; i < 256; i++)
-		RGB2YUV_VG[i] = 93.786 * (i << 8);
+#if defined(__x86_64__)
+#define PAIR(a, b) ((uint32_t)(uint16_t)(a) | (uint32_t)(uint16_t)(b) << 16)
 
-	for (i = 0; i < 256; i++)
-		RGB2YUV_VB[i] = 18.214 * (i << 8);
+__attribute__((target("sse2")))
+static inline void sse2_expand(__m128i p, __m128i *r, __m128i *g, __m128i *b)
+{
+	__m128i r5 = _mm_srli_epi16(p, 11);
+	__m128i g6 = _mm_and_si128(_mm_srli_epi16(p, 5), _mm_set1_epi16(0x3f));
+	__m128i b5 = _mm_and_si128(p, _mm_set1_epi16(0x1f));
 
-	for (i = 0; i < 256; i++)
-		RGB2YUV_UBVR[i] = 112 * (i << 8);
+	*r = _mm_or_si128(_mm_slli_epi16(r5, 3), _mm_srli_epi16(r5, 2));
+	*g = _mm_or_si128(_mm_slli_epi16(g6, 2), _mm_srli_epi16(g6, 4));
+	*b = _mm_or_si128(_mm_slli_epi16(b5, 3), _mm_srli_epi16(b5, 2));
 }
 
-int rgb2yuv(cairo_surface_t *surface, XvImage *image, uint8_t *yuv)
+/* (c0*r + c1*g + c2*b + offset) >> 15 of 8 pixels */
+__attribute__((target("sse2")))
+static inline __m128i sse2_dot(__m128i r, __m128i g, __m128i b,
+			       __m128i rg, __m128i b0, __m128i offset)
 {
-	uint8_t *data = cairo_image_surface_get_data(surface);
-	int rgb_stride = cairo_image_surface_get_stride(surface);
-	int width = cairo_image_surface_get_width(surface);
-	int height = cairo_image_surface_get_height(surface);
-	int y_stride = image->pitches[0];
-	int uv_stride = image->pitches[1];
-	uint8_t *tmp, *tl, *tr, *bl, *br;
-	int i, j;
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo, hi;
 
-	tmp = malloc(2*width*height);
-	if (tmp == NULL)
-		return 0;
+	lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), rg),
+			   _mm_madd_epi16(_mm_unpacklo_epi16(b, zero), b0));
+	hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), rg),
+			   _mm_madd_epi16(_mm_unpackhi_epi16(b, zero), b0));
 
-	tl = tmp;
-	bl = tmp + width*height;
+	lo = _mm_srai_epi32(_mm_add_epi32(lo, offset), 15);
+	hi = _mm_srai_epi32(_mm_add_epi32(hi, offset), 15);
 
-	for (i = 0; i < height; i++) {
-		uint16_t *rgb = (uint16_t *)(data + i * rgb_stride);
-		for (j = 0; j < width; j++) {
-			uint8_t r = (rgb[j] >> 11) & 0x1f;
-			uint8_t g = (rgb[j] >>  5) & 0x3f;
-			uint8_t b = (rgb[j] >>  0) & 0x1f;
+	return _mm_packs_epi32(lo, hi);
+}
 
-			r = r<<3 | r>>2;
-			g = g<<2 | g>>4;
-			b = b<<3 | b>>2;
+/* Y of 8 pixels, and the U and V sums of their 4 pixel pairs */
+__attribute__((target("sse2")))
+static inline void sse2_pixels(__m128i p, __m128i *y, __m128i *u, __m128i *v)
+{
+	__m128i r, g, b;
 
-			yuv[j] = (RGB2YUV_YR[r] + RGB2YUV_YG[g] + RGB2YUV_YB[b] + 1048576) >> 16;
-			*tl++ = (-RGB2YUV_UR[r] - RGB2YUV_UG[g] + RGB2YUV_UBVR[b] + 8388608) >> 16;
-			*bl++ = (RGB2YUV_UBVR[r] - RGB2YUV_VG[g] - RGB2YUV_VB[b] + 8388608) >> 16;
+	sse2_expand(p, &r, &g, &b);
+	*y = sse2_dot(r, g, b,
+		      _mm_set1_epi32(PAIR(YR, YG)), _mm_set1_epi32(PAIR(YB, 0)),
+		      _mm_set1_epi32(Y_OFFSET));
+	*u = sse2_dot(r, g, b,
+		      _mm_set1_epi32(PAIR(-UR, -UG)), _mm_set1_epi32(PAIR(UBVR, 0)),
+		      _mm_set1_epi32(UV_OFFSET));
+	*v = sse2_dot(r, g, b,
+		      _mm_set1_epi32(PAIR(UBVR, -VG)), _mm_set1_epi32(PAIR(-VB, 0)),
+		      _mm_set1_epi32(UV_OFFSET));
+}
+
+/* Average the 2x2 blocks of two rows of 8 chroma samples */
+__attribute__((target("sse2")))
+static inline __m128i sse2_subsample(__m128i c0, __m128i c1)
+{
+	__m128i sum = _mm_madd_epi16(_mm_add_epi16(c0, c1), _mm_set1_epi16(1));
+	return _mm_srai_epi32(sum, 2);
+}
+
+__attribute__((target("sse2")))
+static void convert_rows_sse2(const uint16_t *rgb0, const uint16_t *rgb1,
+			      uint8_t *y0, uint8_t *y1,
+			      uint8_t *u, uint8_t *v, int width)
+{
+	int n;
+
+	for (n = 0; n + 16 <= width; n += 16) {
+		__m128i ya[4], ua[4], va[4];
+		__m128i cu[2], cv[2];
+		int i;
+
+		for (i = 0; i < 2; i++) {
+			sse2_pixels(_mm_loadu_si128((const __m128i *)(rgb0 + n + 8*i)),
+				    &ya[i], &ua[i], &va[i]);
+			sse2_pixels(_mm_loadu_si128((const __m128i *)(rgb1 + n + 8*i)),
+				    &ya[i+2], &ua[i+2], &va[i+2]);
+
+			cu[i] = sse2_subsample(ua[i], ua[i+2]);
+			cv[i] = sse2_subsample(va[i], va[i+2]);
 		}
-		yuv += y_stride;
+
+		_mm_storeu_si128((__m128i *)(y0 + n), _mm_packus_epi16(ya[0], ya[1]));
+		_mm_storeu_si128((__m128i *)(y1 + n), _mm_packus_epi16(ya[2], ya[3]));
+
+		cu[0] = _mm_packs_epi32(cu[0], cu[1]);
+		cv[0] = _mm_packs_epi32(cv[0], cv[1]);
+		_mm_storel_epi64((__m128i *)(u + n/2), _mm_packus_epi16(cu[0], cu[0]));
+		_mm_storel_epi64((__m128i *)(v + n/2), _mm_packus_epi16(cv[0], cv[0]));
 	}
 
-	tl = tmp; tr = tl + 1;
-	bl = tl + width; br = bl + 1;
-	for (i = 0; i < height/2; i ++) {
-		for (j = 0; j < width/2; j ++) {
-			yuv[j] = ((int)*tl + *tr + *bl + *br) >> 2;
-			tl += 2; tr += 2;
-			bl += 2; br += 2;
+	if (n < width)
+		convert_rows_generic(rgb0 + n, rgb1 + n, y0 + n, y1 + n,
+				     u + n/2, v + n/2, width - n);
+}
+
+__attribute__((target("avx2")))
+static inline void avx2_expand(__m256i p, __m256i *r, __m256i *g, __m256i *b)
+{
+	__m256i r5 = _mm256_srli_epi16(p, 11);
+	__m256i g6 = _mm256_and_si256(_mm256_srli_epi16(p, 5), _mm256_set1_epi16(0x3f));
+	__m256i b5 = _mm256_and_si256(p, _mm256_set1_epi16(0x1f));
+
+	*r = _mm256_or_si256(_mm256_slli_epi16(r5, 3), _mm256_srli_epi16(r5, 2));
+	*g = _mm256_or_si256(_mm256_slli_epi16(g6, 2), _mm256_srli_epi16(g6, 4));
+	*b = _mm256_or_si256(_mm256_slli_epi16(b5, 3), _mm256_srli_epi16(b5, 2));
+}
+
+/*
+ * As sse2_dot() for 16 pixels. The unpacks and packs all work within
+ * each 128 bit half, so the pixels come out in their original order.
+ */
+__attribute__((target("avx2")))
+static inline __m256i avx2_dot(__m256i r, __m256i g, __m256i b,
+			       __m256i rg, __m256i b0, __m256i offset)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i lo, hi;
+
+	lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(r, g), rg),
+			      _mm256_madd_epi16(_mm256_unpacklo_epi16(b, zero), b0));
+	hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(r, g), rg),
+			      _mm256_madd_epi16(_mm256_unpackhi_epi16(b, zero), b0));
+
+	lo = _mm256_srai_epi32(_mm256_add_epi32(lo, offset), 15);
+	hi = _mm256_srai_epi32(_mm256_add_epi32(hi, offset), 15);
+
+	return _mm256_packs_epi32(lo, hi);
+}
+
+__attribute__((target("avx2")))
+static inline void avx2_pixels(__m256i p, __m256i *y, __m256i *u, __m256i *v)
+{
+	__m256i r, g, b;
+
+	avx2_expand(p, &r, &g, &b);
+	*y = avx2_dot(r, g, b,
+		      _mm256_set1_epi32(PAIR(YR, YG)), _mm256_set1_epi32(PAIR(YB, 0)),
+		      _mm256_set1_epi32(Y_OFFSET));
+	*u = avx2_dot(r, g, b,
+		      _mm256_set1_epi32(PAIR(-UR, -UG)), _mm256_set1_epi32(PAIR(UBVR, 0)),
+		      _mm256_set1_epi32(UV_OFFSET));
+	*v = avx2_dot(r, g, b,
+		      _mm256_set1_epi32(PAIR(UBVR, -VG)), _mm256_set1_epi32(PAIR(-VB, 0)),
+		      _mm256_set1_epi32(UV_OFFSET));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_subsample(__m256i c0, __m256i c1)
+{
+	__m256i sum = _mm256_madd_epi16(_mm256_add_epi16(c0, c1), _mm256_set1_epi16(1));
+	return _mm256_srai_epi32(sum, 2);
+}
+
+/* Packs 16 lanes of 16 bits, in order, into 16 bytes */
+__attribute__((target("avx2")))
+static inline __m128i avx2_pack(__m256i x)
+{
+	return _mm_packus_epi16(_mm256_castsi256_si128(x),
+				_mm256_extracti128_si256(x, 1));
+}
+
+__attribute__((target("avx2")))
+static void convert_rows_avx2(const uint16_t *rgb0, const uint16_t *rgb1,
+			      uint8_t *y0, uint8_t *y1,
+			      uint8_t *u, uint8_t *v, int width)
+{
+	int n;
+
+	for (n = 0; n + 32 <= width; n += 32) {
+		__m256i ya[4], ua[4], va[4];
+		__m256i cu[2], cv[2];
+		int i;
+
+		for (i = 0; i < 2; i++) {
+			avx2_pixels(_mm256_loadu_si256((const __m256i *)(rgb0 + n + 16*i)),
+				    &ya[i], &ua[i], &va[i]);
+			avx2_pixels(_mm256_loadu_si256((const __m256i *)(rgb1 + n + 16*i)),
+				    &ya[i+2], &ua[i+2], &va[i+2]);
+
+			cu[i] = avx2_subsample(ua[i], ua[i+2]);
+			cv[i] = avx2_subsample(va[i], va[i+2]);
+		}
+
+		for (i = 0; i < 2; i++) {
+			_mm_storeu_si128((__m128i *)(y0 + n + 16*i), avx2_pack(ya[i]));
+			_mm_storeu_si128((__m128i *)(y1 + n + 16*i), avx2_pack(ya[i+2]));
 		}
-		yuv += uv_stride;
 
-		tl += width; tr += width;
-		bl += width; br += width;
+		/* packs interleaves the halves, put them back in order */
+		cu[0] = _mm256_permute4x64_epi64(_mm256_packs_epi32(cu[0], cu[1]), 0xd8);
+		cv[0] = _mm256_permute4x64_epi64(_mm256_packs_epi32(cv[0], cv[1]), 0xd8);
+		_mm_storeu_si128((__m128i *)(u + n/2), avx2_pack(cu[0]));
+		_mm_storeu_si128((__m128i *)(v + n/2), avx2_pack(cv[0]));
 	}
 
-	tl = tmp + width*height; tr = tl + 1;
-	bl = tl + width; br = bl + 1;
-	for (i = 0; i < height/2; i++) {
-		for (j = 0; j < width/2; j++) {
-			yuv[j] = ((int)*tl + *tr + *bl + *br) >> 2;
-			tl += 2; tr += 2;
-			bl += 2; br += 2;
+	if (n < width)
+		convert_rows_sse2(rgb0 + n, rgb1 + n, y0 + n, y1 + n,
+				  u + n/2, v + n/2, width - n);
+}
+#endif
+
+static const struct {
+	const char *name;
+	unsigned features;
+	convert_rows_func func;
+} impls[] = {
+#if defined(__x86_64__)
+	{ "avx2", AVX2, convert_rows_avx2 },
+	{ "sse2", SSE2, convert_rows_sse2 },
+#endif
+	{ "generic", 0, convert_rows_generic },
+};
+
+static int impl = sizeof(impls) / sizeof(impls[0]) - 1;
+
+/* Picks the fastest converter supported by this cpu */
+void rgb2yuv_init(void)
+{
+	unsigned features = igt_x86_features();
+	int n;
+
+	for (n = 0; n < sizeof(impls) / sizeof(impls[0]); n++) {
+		if ((impls[n].features & features) == impls[n].features) {
+			impl = n;
+			break;
 		}
-		yuv += uv_stride;
+	}
+}
+
+/* Forces the use of the named converter, if supported */
+int rgb2yuv_select(const char *name)
+{
+	unsigned features = igt_x86_features();
+	int n;
 
-		tl += width; tr += width;
-		bl += width; br += width;
+	for (n = 0; n < sizeof(impls) / sizeof(impls[0]); n++) {
+		if (strcmp(impls[n].name, name))
+			continue;
+
+		if ((impls[n].features & features) != impls[n].features)
+			return 0;
+
+		impl = n;
+		return 1;
 	}
 
-	free(tmp);
-	return 1;
+	return 0;
+}
+
+const char *rgb2yuv_name(void)
+{
+	return impls[impl].name;
+}
+
+void rgb2yuv_rect(const uint8_t *rgb, int rgb_stride,
+		  uint8_t *yuv, int y_stride, int uv_stride,
+		  int width, int height,
+		  int x, int y, int w, int h)
+{
+	const convert_rows_func convert_rows = impls[impl].func;
+	uint8_t *u = yuv + y_stride * height;
+	uint8_t *v = u + uv_stride * (height / 2);
+	int x1 = x + w, y1 = y + h;
+	int n;
+
+	x &= ~1;
+	y &= ~1;
+	x1 = (x1 + 1) & ~1;
+	y1 = (y1 + 1) & ~1;
+	if (x1 > width)
+		x1 = width;
+	if (y1 > height)
+		y1 = height;
+	if (x >= x1 || y >= y1)
+		return;
+
+	for (; y + 1 < y1; y += 2) {
+		const uint16_t *rgb0 = (const uint16_t *)(rgb + y * rgb_stride);
+		const uint16_t *rgb1 = (const uint16_t *)(rgb + (y + 1) * rgb_stride);
+		uint8_t *out0 = yuv + y * y_stride;
+		uint8_t *out1 = out0 + y_stride;
+
+		convert_rows(rgb0 + x, rgb1 + x, out0 + x, out1 + x,
+			     u + (y/2) * uv_stride + x/2,
+			     v + (y/2) * uv_stride + x/2,
+			     (x1 - x) & ~1);
+
+		/* odd width, the last column has no chroma of its own */
+		if ((x1 - x) & 1) {
+			out0[x1 - 1] = luma(rgb0[x1 - 1]);
+			out1[x1 - 1] = luma(rgb1[x1 - 1]);
+		}
+	}
+
+	/* likewise for the last row of an odd height */
+	if (y < y1) {
+		const uint16_t *rgb0 = (const uint16_t *)(rgb + y * rgb_stride);
+
+		for (n = x; n < x1; n++)
+			yuv[y * y_stride + n] = luma(rgb0[n]);
+	}
 }
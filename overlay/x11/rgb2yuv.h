@@ -25,12 +25,20 @@
 #ifndef RGB2YUV_H
 #define RGB2YUV_H
 
-#include <X11/Xlib.h>
-#include <X11/extensions/Xvlib.h>
-#include <cairo.h>
 #include <stdint.h>
 
 void rgb2yuv_init(void);
-int rgb2yuv(cairo_surface_t *rgb, XvImage *image, uint8_t *yuv);
+int rgb2yuv_select(const char *name);
+const char *rgb2yuv_name(void);
+
+/*
+ * Converts the x,y,w,h rectangle of a width x height RGB565 image into
+ * the planar YUV 4:2:0 image at yuv: the Y plane followed by the U and V
+ * planes. The rectangle is grown to cover whole chroma blocks.
+ */
+void rgb2yuv_rect(const uint8_t *rgb, int rgb_stride,
+		  uint8_t *yuv, int y_stride, int uv_stride,
+		  int width, int height,
+		  int x, int y, int w, int h);
 
 #endif /* RGB2YUV_H */
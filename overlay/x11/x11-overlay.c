@@ -71,13 +71,59 @@ static int noop(Display *dpy, XErrorEvent *event)
 	return 0;
 }
 
-static void x11_overlay_show(struct overlay *overlay)
+static void x11_overlay_show(struct overlay *overlay,
+			     const cairo_region_t *damage)
 {
 	struct x11_overlay *priv = to_x11_overlay(overlay);
 
-	if (priv->image->id == FOURCC_XVMC)
-		rgb2yuv(priv->base.surface, priv->image, priv->map);
-	else
+	if (priv->image->id == FOURCC_XVMC) {
+		cairo_surface_t *surface = priv->base.surface;
+		const uint8_t *rgb = cairo_image_surface_get_data(surface);
+		int stride = cairo_image_surface_get_stride(surface);
+
+		if (damage && priv->visible) {
+			int n;
+
+			for (n = 0; n < cairo_region_num_rectangles(damage); n++) {
+				cairo_rectangle_int_t r;
+
+				cairo_region_get_rectangle(damage, n, &r);
+				rgb2yuv_rect(rgb, stride, priv->map,
+					     priv->image->pitches[0],
+					     priv->image->pitches[1],
+					     priv->image->width,
+					     priv->image->height,
+					     r.x, r.y, r.width, r.height);
+			}
+		} else {
+			rgb2yuv_rect(rgb, stride, priv->map,
+				     priv->image->pitches[0],
+				     priv->image->pitches[1],
+				     priv->image->width,
+				     priv->image->height,
+				     0, 0,
+				     priv->image->width,
+				     priv->image->height);
+		}
+	} else if (damage && priv->visible) {
+		int stride = priv->image->pitches[0];
+		int cpp = priv->image->id == FOURCC_RGB565 ? 2 : 4;
+		int n, y;
+
+		for (n = 0; n < cairo_region_num_rectangles(damage); n++) {
+			cairo_rectangle_int_t r;
+			int offset;
+
+			cairo_region_get_rectangle(damage, n, &r);
+			offset = r.y * stride + r.x * cpp;
+			for (y = 0; y < r.height; y++) {
+				memcpy((uint8_t *)priv->map + offset,
+				       (uint8_t *)priv->mem + offset,
+				       r.width * cpp);
+				offset += stride;
+			}
+		}
+	} else
 		memcpy(priv->map, priv->mem, priv->size);
 
 	if (!priv->visible) {
@@ -53,12 +53,24 @@ static int noop(Display *dpy, XErrorEvent *event)
 	return 0;
 }
 
-static void x11_window_show(struct overlay *overlay)
+static void x11_window_show(struct overlay *overlay,
+			    const cairo_region_t *damage)
 {
 	struct x11_window *priv = to_x11_window(overlay);
 	cairo_t *cr;
 
 	cr = cairo_create(priv->front);
+	if (damage && priv->visible) {
+		int n;
+
+		for (n = 0; n < cairo_region_num_rectangles(damage); n++) {
+			cairo_rectangle_int_t r;
+
+			cairo_region_get_rectangle(damage, n, &r);
+			cairo_rectangle(cr, r.x, r.y, r.width, r.height);
+		}
+		cairo_clip(cr);
+	}
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 	cairo_set_source_surface(cr, priv->base.surface, 0, 0);
 	cairo_paint(cr);
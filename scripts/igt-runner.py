@@ -0,0 +1,422 @@
+#!/usr/bin/env python3
+#
+# Copyright © 2016 Intel Corporation
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice (including the next
+# paragraph) shall be included in all copies or substantial portions of the
+# Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+
+#
+# Runs igt tests without piglit, several subtests at a time.
+#
+# Each binary is enumerated with --list-subtests and every subtest becomes a
+# job run with --run-subtest; binaries without subtests run as a single job.
+# Jobs only run concurrently if the resources they claim in the resource
+# file (tests/igt-resources.txt by default) allow it. The duration of every
+# job is kept in a timings file so that the next run can start the longest
+# jobs first. Results are appended to results.jsonl as each job finishes, one
+# JSON object per line, which also lets an interrupted run be resumed.
+#
+
+import argparse
+import fnmatch
+import json
+import os
+import queue
+import re
+import signal
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+ROOT = os.path.realpath(os.path.join(os.path.dirname(__file__), '..'))
+
+IGT_EXIT_SUCCESS = 0
+IGT_EXIT_SKIP = 77
+IGT_EXIT_TIMEOUT = 78
+IGT_EXIT_INVALID = 79
+
+# Every job shares these; claiming one in the resource file takes it
+# exclusively instead.
+SHARED_RESOURCES = ('system', 'gpu')
+
+
+class Job(object):
+    def __init__(self, binary, subtest=None):
+        self.binary = binary
+        self.subtest = subtest
+        test = os.path.basename(binary)
+        self.name = test if subtest is None else test + '/' + subtest
+        self.claims = set()
+        self.estimate = None
+
+    def command(self):
+        if self.subtest is None:
+            return [self.binary]
+        return [self.binary, '--run-subtest', self.subtest]
+
+    def is_barrier(self):
+        return any(r in self.claims for r in SHARED_RESOURCES)
+
+
+def read_test_list(test_root):
+    path = os.path.join(test_root, 'test-list.txt')
+    with open(path) as f:
+        names = f.read().split()
+    return [os.path.join(test_root, n) for n in names
+            if n not in ('TESTLIST', 'END')]
+
+
+def enumerate_binary(binary):
+    """Returns the jobs of @binary, or an error string."""
+    try:
+        p = subprocess.run([binary, '--list-subtests'],
+                           stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                           universal_newlines=True, timeout=60)
+    except (OSError, subprocess.TimeoutExpired) as e:
+        return str(e)
+
+    subtests = p.stdout.split()
+    if p.returncode == IGT_EXIT_INVALID and not subtests:
+        return [Job(binary)]
+    if p.returncode == IGT_EXIT_SUCCESS and subtests:
+        return [Job(binary, s) for s in subtests]
+
+    return '--list-subtests failed with %d' % p.returncode
+
+
+def read_resources(path):
+    rules = []
+    if not path or not os.path.exists(path):
+        return rules
+
+    with open(path) as f:
+        for line in f:
+            fields = line.split('#', 1)[0].split()
+            if len(fields) >= 2:
+                rules.append((fields[0], set(fields[1:])))
+    return rules
+
+
+def apply_resources(jobs, rules):
+    for job in jobs:
+        test = job.name.split('/', 1)[0]
+        for pattern, claims in rules:
+            if fnmatch.fnmatchcase(job.name, pattern) or \
+               fnmatch.fnmatchcase(test, pattern):
+                job.claims |= claims
+
+
+def read_timings(path):
+    try:
+        with open(path) as f:
+            return json.load(f)
+    except (OSError, ValueError):
+        return {}
+
+
+def write_timings(path, timings):
+    tmp = path + '.tmp'
+    with open(tmp, 'w') as f:
+        json.dump(timings, f, indent=1, sort_keys=True)
+    os.rename(tmp, path)
+
+
+def read_finished(path):
+    finished = set()
+    try:
+        with open(path) as f:
+            for line in f:
+                try:
+                    finished.add(json.loads(line)['name'])
+                except (ValueError, KeyError):
+                    pass    # torn last line of an interrupted run
+    except OSError:
+        pass
+    return finished
+
+
+class Scheduler(object):
+    """Picks runnable jobs under shared/exclusive resource claims."""
+
+    def __init__(self, jobs):
+        # Barrier jobs drain everything else, so keep them for the end
+        # rather than stalling the whole pool every time one comes up.
+        # Jobs without a known duration may be long, so they go first.
+        def key(job):
+            estimate = job.estimate
+            return (job.is_barrier(),
+                    0 if estimate is None else 1,
+                    -(estimate or 0))
+
+        self.pending = sorted(jobs, key=key)
+        self.shared = {}
+        self.exclusive = set()
+
+    def _claims(self, job):
+        shared = [r for r in SHARED_RESOURCES if r not in job.claims]
+        return shared, job.claims
+
+    def _available(self, job, reserved):
+        shared, exclusive = self._claims(job)
+        for r in shared:
+            if r in self.exclusive or r in reserved:
+                return False
+        for r in exclusive:
+            if r in self.exclusive or self.shared.get(r) or r in reserved:
+                return False
+        return True
+
+    def next(self):
+        # A job blocked on a resource reserves it, so that later jobs
+        # cannot keep it busy forever.
+        reserved = set()
+        for i, job in enumerate(self.pending):
+            if self._available(job, reserved):
+                del self.pending[i]
+                self._acquire(job)
+                return job
+            reserved |= job.claims
+        return None
+
+    def _acquire(self, job):
+        shared, exclusive = self._claims(job)
+        for r in shared:
+            self.shared[r] = self.shared.get(r, 0) + 1
+        self.exclusive |= exclusive
+
+    def release(self, job):
+        shared, exclusive = self._claims(job)
+        for r in shared:
+            self.shared[r] -= 1
+        self.exclusive -= exclusive
+
+
+running_procs = set()
+
+
+def kill_proc(proc):
+    # tests fork helpers, take down the whole process group
+    try:
+        os.killpg(proc.pid, signal.SIGKILL)
+    except OSError:
+        pass
+
+
+def read_accounting(path):
+    records = []
+    with open(path) as f:
+        for line in f:
+            try:
+                records.append(json.loads(line))
+            except ValueError:
+                pass
+    os.unlink(path)
+    return records
+
+
+def run_job(job, timeout, done):
+    # collect the per-subtest and per-fixture accounting of igt_core
+    fd, accounting = tempfile.mkstemp(prefix='igt-accounting-')
+    os.close(fd)
+    env = dict(os.environ, IGT_ACCOUNTING=accounting)
+
+    start = time.time()
+    try:
+        proc = subprocess.Popen(job.command(), env=env,
+                                stdout=subprocess.PIPE,
+                                stderr=subprocess.PIPE,
+                                universal_newlines=True, errors='replace',
+                                start_new_session=True)
+    except OSError as e:
+        # report the job rather than leave main() waiting for it
+        end = time.time()
+        os.unlink(accounting)
+        done.put((job, {
+            'name': job.name,
+            'result': 'fail',
+            'returncode': None,
+            'start': start,
+            'end': end,
+            'time': end - start,
+            'out': '',
+            'err': str(e) + '\n',
+            'accounting': [],
+        }))
+        return
+    running_procs.add(proc)
+    try:
+        out, err = proc.communicate(timeout=timeout)
+        killed = False
+    except subprocess.TimeoutExpired:
+        kill_proc(proc)
+        out, err = proc.communicate()
+        killed = True
+    end = time.time()
+    running_procs.discard(proc)
+
+    ret = proc.returncode
+    if killed:
+        result = 'incomplete'
+    elif ret == IGT_EXIT_SUCCESS:
+        result = 'pass'
+    elif ret == IGT_EXIT_SKIP:
+        result = 'skip'
+    elif ret == IGT_EXIT_TIMEOUT:
+        result = 'timeout'
+    elif ret < 0 or ret > 128:
+        result = 'crash'
+    else:
+        result = 'fail'
+
+    done.put((job, {
+        'name': job.name,
+        'result': result,
+        'returncode': ret,
+        'start': start,
+        'end': end,
+        'time': end - start,
+        'out': out,
+        'err': err,
+        'accounting': read_accounting(accounting),
+    }))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Run igt tests in parallel.',
+        epilog='Without TEST arguments, the tests listed in '
+               'TEST_ROOT/test-list.txt are run.')
+    parser.add_argument('tests', metavar='TEST', nargs='*',
+                        help='test binary to run')
+    parser.add_argument('-T', '--test-root', default=os.path.join(ROOT, 'tests'),
+                        help='directory of the test binaries (default: %(default)s)')
+    parser.add_argument('-r', '--results', default=os.path.join(ROOT, 'results'),
+                        help='results directory (default: %(default)s)')
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count() or 1,
+                        help='maximum number of concurrent jobs')
+    parser.add_argument('-m', '--resources',
+                        default=os.path.join(ROOT, 'tests', 'igt-resources.txt'),
+                        help='resource claims (default: %(default)s)')
+    parser.add_argument('--timings',
+                        help='timings database (default: RESULTS/timings.json)')
+    parser.add_argument('-t', '--include', action='append', default=[],
+                        help='only run jobs matching the regular expression')
+    parser.add_argument('-x', '--exclude', action='append', default=[],
+                        help='skip jobs matching the regular expression')
+    parser.add_argument('--timeout', type=float,
+                        help='kill jobs after this many seconds')
+    parser.add_argument('-l', '--list', action='store_true',
+                        help='list the jobs in scheduling order and exit')
+    parser.add_argument('-R', '--resume', action='store_true',
+                        help='skip jobs already recorded in RESULTS')
+    args = parser.parse_args()
+
+    binaries = args.tests or read_test_list(args.test_root)
+    timings_path = args.timings or os.path.join(args.results, 'timings.json')
+    results_path = os.path.join(args.results, 'results.jsonl')
+    timings = read_timings(timings_path)
+
+    jobs = []
+    errors = []
+    with ThreadPoolExecutor(max(args.jobs, 1)) as pool:
+        for binary, found in zip(binaries, pool.map(enumerate_binary, binaries)):
+            if isinstance(found, str):
+                errors.append((os.path.basename(binary), found))
+            else:
+                jobs.extend(found)
+
+    include = [re.compile(r) for r in args.include]
+    exclude = [re.compile(r) for r in args.exclude]
+    jobs = [j for j in jobs
+            if (not include or any(r.search(j.name) for r in include)) and
+            not any(r.search(j.name) for r in exclude)]
+
+    apply_resources(jobs, read_resources(args.resources))
+    for job in jobs:
+        job.estimate = timings.get(job.name)
+
+    if args.list:
+        for job in Scheduler(jobs).pending:
+            claims = ' [%s]' % ' '.join(sorted(job.claims)) if job.claims else ''
+            print(job.name + claims)
+        return 0
+
+    os.makedirs(args.results, exist_ok=True)
+    if args.resume:
+        finished = read_finished(results_path)
+        jobs = [j for j in jobs if j.name not in finished]
+        mode = 'a'
+    else:
+        mode = 'w'
+
+    failed = 0
+    with open(results_path, mode) as results:
+        for name, msg in errors:
+            print('%s: %s' % (name, msg), file=sys.stderr)
+            results.write(json.dumps({'name': name, 'result': 'fail',
+                                      'err': msg}) + '\n')
+            failed += 1
+        results.flush()
+
+        sched = Scheduler(jobs)
+        done = queue.Queue()
+        running = 0
+        total = len(jobs)
+        count = 0
+
+        try:
+            while sched.pending or running:
+                while running < args.jobs:
+                    job = sched.next()
+                    if job is None:
+                        break
+                    threading.Thread(target=run_job,
+                                     args=(job, args.timeout, done),
+                                     daemon=True).start()
+                    running += 1
+
+                job, result = done.get()
+                sched.release(job)
+                running -= 1
+                count += 1
+
+                results.write(json.dumps(result) + '\n')
+                results.flush()
+
+                timings[job.name] = round(result['time'], 3)
+                if result['result'] not in ('pass', 'skip'):
+                    failed += 1
+
+                print('[%*d/%d] %-10s %8.2fs %s' %
+                      (len(str(total)), count, total, result['result'],
+                       result['time'], job.name))
+                sys.stdout.flush()
+        finally:
+            for proc in list(running_procs):
+                kill_proc(proc)
+            write_timings(timings_path, timings)
+
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
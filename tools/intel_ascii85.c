@@ -0,0 +1,75 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "intel_ascii85.h"
+
+/*
+ * Decodes the ascii85 payload between in and end, as found in the i915
+ * error state, into a freshly allocated array of dwords.
+ *
+ * Returns the number of dwords stored in *out, or 0 on failure in which
+ * case nothing is allocated.
+ */
+int ascii85_decode(const char *in, const char *end, uint32_t **out)
+{
+	const char *p;
+	int len, i;
+
+	/* size the output exactly rather than growing it as we go */
+	len = 0;
+	for (p = in; p < end && *p >= '!' && *p <= 'z'; len++) {
+		if (*p == 'z') {
+			p++;
+		} else {
+			if (end - p < 5)
+				break;
+			p += 5;
+		}
+	}
+	if (len == 0)
+		return 0;
+
+	*out = malloc(sizeof(uint32_t)*len);
+	if (*out == NULL)
+		return 0;
+
+	for (i = 0; i < len; i++) {
+		uint32_t v = 0;
+
+		if (*in == 'z') {
+			in++;
+		} else {
+			v += in[0] - 33; v *= 85;
+			v += in[1] - 33; v *= 85;
+			v += in[2] - 33; v *= 85;
+			v += in[3] - 33; v *= 85;
+			v += in[4] - 33;
+			in += 5;
+		}
+		(*out)[i] = v;
+	}
+
+	return len;
+}
@@ -34,16 +34,29 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <intel_bufmgr.h>
 
 struct drm_intel_decode *ctx;
 
+struct input {
+	const char *filename;
+	void *data;
+	size_t size;
+	bool mapped;
+};
+
 static void
-read_bin_file(const char * filename)
+open_input(struct input *in, const char *filename)
 {
-	uint32_t buf[16384];
-	int fd, offset, ret;
+	struct stat st;
+	int fd;
+
+	memset(in, 0, sizeof(*in));
+	in->filename = filename;
 
 	if (!strcmp(filename, "-"))
 		fd = fileno(stdin);
@@ -55,102 +68,212 @@ read_bin_file(const char * filename)
 		exit (1);
 	}
 
-	drm_intel_decode_set_dump_past_end(ctx, 1);
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size) {
+		in->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (in->data != MAP_FAILED) {
+			madvise(in->data, st.st_size, MADV_SEQUENTIAL);
+			in->size = st.st_size;
+			in->mapped = true;
+			goto out;
+		}
+		in->data = NULL;
+	}
 
-	offset = 0;
-	while ((ret = read (fd, buf, sizeof(buf))) > 0) {
-		drm_intel_decode_set_batch_pointer(ctx, buf, offset, ret/4);
-		drm_intel_decode(ctx);
-		offset += ret;
+	/* Pipes and the like: slurp everything into one buffer instead */
+	for (;;) {
+		size_t alloc = in->size ? 2 * in->size : 1 << 20;
+		ssize_t ret;
+
+		in->data = realloc(in->data, alloc);
+		if (in->data == NULL) {
+			fprintf (stderr, "Out of memory.\n");
+			exit (1);
+		}
+
+		while (in->size < alloc) {
+			ret = read(fd, (char *)in->data + in->size, alloc - in->size);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0)
+				break;
+			in->size += ret;
+		}
+		if (in->size < alloc)
+			break;
 	}
-	close (fd);
+
+out:
+	if (fd != fileno(stdin))
+		close(fd);
 }
 
 static void
-read_data_file(const char * filename)
+close_input(struct input *in)
 {
-    FILE *file;
-    uint32_t *data = NULL;
-    int data_size = 0, count = 0, line_number = 0, matched;
-    char *line = NULL;
-    size_t line_size;
-    uint32_t offset, value;
-    uint32_t gtt_offset = 0;
-
-	if (!strcmp(filename, "-"))
-		file = stdin;
+	if (in->mapped)
+		munmap(in->data, in->size);
 	else
-		file = fopen (filename, "r");
+		free(in->data);
+}
 
-    if (file == NULL) {
-	fprintf (stderr, "Failed to open %s: %s\n",
-		 filename, strerror (errno));
-	exit (1);
-    }
+static void
+decode_bin(const struct input *in)
+{
+	drm_intel_decode_set_dump_past_end(ctx, 1);
+	drm_intel_decode_set_batch_pointer(ctx, in->data, 0, in->size / 4);
+	drm_intel_decode(ctx);
+}
 
-    while (getline (&line, &line_size, file) > 0) {
-	line_number++;
+static void
+read_bin_file(const char * filename)
+{
+	struct input in;
 
-	matched = sscanf (line, "%08x : %08x", &offset, &value);
-	if (matched != 2) {
-	    printf("ignoring line %s", line);
+	open_input(&in, filename);
+	decode_bin(&in);
+	close_input(&in);
+}
 
-	    continue;
-	}
+static inline int
+hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
 
-	count++;
+static inline bool
+is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+		c == '\v' || c == '\f';
+}
 
-	if (count > data_size) {
-	    data_size = data_size ? data_size * 2 : 1024;
-	    data = realloc (data, data_size * sizeof (uint32_t));
-	    if (data == NULL) {
-		fprintf (stderr, "Out of memory.\n");
-		exit (1);
-	    }
-	}
+/*
+ * Equivalent of sscanf("%08x") on the line [*p, end): skips leading
+ * whitespace and reads at most 8 hex digits.
+ */
+static bool
+parse_hex(const char **p, const char *end, uint32_t *value)
+{
+	const char *s = *p;
+	uint32_t v = 0;
+	int n, d;
 
-	data[count-1] = value;
-    }
+	while (s < end && is_space(*s))
+		s++;
 
-    if (count) {
-	drm_intel_decode_set_batch_pointer(ctx, data, gtt_offset, count);
-	drm_intel_decode(ctx);
-    }
+	if (end - s > 2 && s[0] == '0' && (s[1] | 0x20) == 'x' &&
+	    hex_digit(s[2]) >= 0)
+		s += 2;
+
+	for (n = 0; n < 8 && s < end && (d = hex_digit(*s)) >= 0; n++, s++)
+		v = v << 4 | d;
+	if (n == 0)
+		return false;
+
+	*p = s;
+	*value = v;
+	return true;
+}
+
+/* Parse one "offset : value" line, as sscanf("%08x : %08x") would */
+static bool
+parse_line(const char *s, const char *end, uint32_t *value)
+{
+	uint32_t offset;
+
+	if (!parse_hex(&s, end, &offset))
+		return false;
 
-    free (data);
-    free (line);
+	while (s < end && is_space(*s))
+		s++;
+	if (s == end || *s++ != ':')
+		return false;
 
-    fclose (file);
+	return parse_hex(&s, end, value);
 }
 
 static void
-read_autodetect_file(const char * filename)
+decode_data(const struct input *in)
 {
-	int binary = 0, c;
-	FILE *file;
+	const char *ptr = in->data, *end = ptr + in->size;
+	uint32_t *data = NULL;
+	size_t data_size = 0, count = 0;
+	uint32_t gtt_offset = 0;
+
+	while (ptr < end) {
+		const char *eol = memchr(ptr, '\n', end - ptr);
+		const char *next = eol ? eol + 1 : end;
+		uint32_t value;
+
+		if (!parse_line(ptr, eol ?: end, &value)) {
+			printf("ignoring line ");
+			fwrite(ptr, 1, next - ptr, stdout);
+			ptr = next;
+			continue;
+		}
+		ptr = next;
+
+		if (count == data_size) {
+			data_size = data_size ? data_size * 2 : 1024;
+			data = realloc (data, data_size * sizeof (uint32_t));
+			if (data == NULL) {
+				fprintf (stderr, "Out of memory.\n");
+				exit (1);
+			}
+		}
 
-	file = fopen (filename, "r");
-	if (file == NULL) {
-		fprintf (stderr, "Failed to open %s: %s\n",
-			 filename, strerror (errno));
-		exit (1);
+		data[count++] = value;
+	}
+
+	if (count) {
+		drm_intel_decode_set_batch_pointer(ctx, data, gtt_offset, count);
+		drm_intel_decode(ctx);
 	}
 
-	while ((c = fgetc(file)) != EOF) {
-		/* totally lazy binary detector */
-		if (c < 10) {
+	free (data);
+}
+
+static void
+read_data_file(const char * filename)
+{
+	struct input in;
+
+	open_input(&in, filename);
+	decode_data(&in);
+	close_input(&in);
+}
+
+static void
+read_autodetect_file(const char * filename)
+{
+	const unsigned char *ptr;
+	struct input in;
+	size_t len, n;
+	int binary = 0;
+
+	open_input(&in, filename);
+
+	/* totally lazy binary detector, only looking at the first page */
+	ptr = in.data;
+	len = in.size < 4096 ? in.size : 4096;
+	for (n = 0; n < len; n++) {
+		if (ptr[n] < 10) {
 			binary = 1;
 			break;
 		}
 	}
 
-	fclose(file);
-
 	if (binary == 1)
-		read_bin_file(filename);
+		decode_bin(&in);
 	else
-		read_data_file(filename);
+		decode_data(&in);
 
+	close_input(&in);
 }
 
 
@@ -47,7 +47,12 @@
 #include <unistd.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <err.h>
 #include <assert.h>
 #include <intel_bufmgr.h>
@@ -58,41 +63,42 @@
 #include "instdone.h"
 #include "intel_reg.h"
 #include "drmtest.h"
+#include "intel_ascii85.h"
 
 static uint32_t
-print_head(unsigned int reg)
+print_head(FILE *out, unsigned int reg)
 {
-	printf("    head = 0x%08x, wraps = %d\n", reg & (0x7ffff<<2), reg >> 21);
+	fprintf(out, "    head = 0x%08x, wraps = %d\n", reg & (0x7ffff<<2), reg >> 21);
 	return reg & (0x7ffff<<2);
 }
 
 static uint32_t
-print_ctl(unsigned int reg)
+print_ctl(FILE *out, unsigned int reg)
 {
 	uint32_t ring_length = 	(((reg & (0x1ff << 12)) >> 12) + 1) * 4096;
 
 #define BIT_STR(reg, x, on, off) ((1 << (x)) & reg) ? on : off
 
-	printf("    len=%d%s%s%s\n", ring_length,
-	       BIT_STR(reg, 0, ", enabled", ", disabled"),
-	       BIT_STR(reg, 10, ", semaphore wait ", ""),
-	       BIT_STR(reg, 11, ", rb wait ", "")
+	fprintf(out, "    len=%d%s%s%s\n", ring_length,
+		BIT_STR(reg, 0, ", enabled", ", disabled"),
+		BIT_STR(reg, 10, ", semaphore wait ", ""),
+		BIT_STR(reg, 11, ", rb wait ", "")
 		);
 #undef BIT_STR
 	return ring_length;
 }
 
 static void
-print_acthd(unsigned int reg, unsigned int ring_length)
+print_acthd(FILE *out, unsigned int reg, unsigned int ring_length)
 {
 	if ((reg & (0x7ffff << 2)) < ring_length)
-		printf("    at ring: 0x%08x\n", reg & (0x7ffff << 2));
+		fprintf(out, "    at ring: 0x%08x\n", reg & (0x7ffff << 2));
 	else
-		printf("    at batch: 0x%08x\n", reg);
+		fprintf(out, "    at batch: 0x%08x\n", reg);
 }
 
 static void
-print_instdone(uint32_t devid, unsigned int instdone, unsigned int instdone1)
+print_instdone(FILE *out, uint32_t devid, unsigned int instdone, unsigned int instdone1)
 {
 	int i;
 	static int once;
@@ -115,12 +121,12 @@ print_instdone(uint32_t devid, unsigned int instdone, unsigned int instdone1)
 		}
 
 		if (busy)
-			printf("    busy: %s\n", instdone_bits[i].name);
+			fprintf(out, "    busy: %s\n", instdone_bits[i].name);
 	}
 }
 
 static void
-print_i830_pgtbl_err(unsigned int reg)
+print_i830_pgtbl_err(FILE *out, unsigned int reg)
 {
 	const char *str;
 
@@ -141,7 +147,7 @@ print_i830_pgtbl_err(unsigned int reg)
 	}
 
 	if (str)
-		printf("    source = %s\n", str);
+		fprintf(out, "    source = %s\n", str);
 
 	switch(reg & 0x7) {
 	case 0x0: str  = "Invalid GTT"; break;
@@ -153,175 +159,175 @@ print_i830_pgtbl_err(unsigned int reg)
 	case 0x6: str = "Invalid Tiling"; break;
 	case 0x7: str = "Host to CAM"; break;
 	}
-	printf("    error = %s\n", str);
+	fprintf(out, "    error = %s\n", str);
 }
 
 static void
-print_i915_pgtbl_err(unsigned int reg)
+print_i915_pgtbl_err(FILE *out, unsigned int reg)
 {
 	if (reg & (1 << 29))
-		printf("    Cursor A: Invalid GTT PTE\n");
+		fprintf(out, "    Cursor A: Invalid GTT PTE\n");
 	if (reg & (1 << 28))
-		printf("    Cursor B: Invalid GTT PTE\n");
+		fprintf(out, "    Cursor B: Invalid GTT PTE\n");
 	if (reg & (1 << 27))
-		printf("    MT: Invalid tiling\n");
+		fprintf(out, "    MT: Invalid tiling\n");
 	if (reg & (1 << 26))
-		printf("    MT: Invalid GTT PTE\n");
+		fprintf(out, "    MT: Invalid GTT PTE\n");
 	if (reg & (1 << 25))
-		printf("    LC: Invalid tiling\n");
+		fprintf(out, "    LC: Invalid tiling\n");
 	if (reg & (1 << 24))
-		printf("    LC: Invalid GTT PTE\n");
+		fprintf(out, "    LC: Invalid GTT PTE\n");
 	if (reg & (1 << 23))
-		printf("    BIN VertexData: Invalid GTT PTE\n");
+		fprintf(out, "    BIN VertexData: Invalid GTT PTE\n");
 	if (reg & (1 << 22))
-		printf("    BIN Instruction: Invalid GTT PTE\n");
+		fprintf(out, "    BIN Instruction: Invalid GTT PTE\n");
 	if (reg & (1 << 21))
-		printf("    CS VertexData: Invalid GTT PTE\n");
+		fprintf(out, "    CS VertexData: Invalid GTT PTE\n");
 	if (reg & (1 << 20))
-		printf("    CS Instruction: Invalid GTT PTE\n");
+		fprintf(out, "    CS Instruction: Invalid GTT PTE\n");
 	if (reg & (1 << 19))
-		printf("    CS: Invalid GTT\n");
+		fprintf(out, "    CS: Invalid GTT\n");
 	if (reg & (1 << 18))
-		printf("    Overlay: Invalid tiling\n");
+		fprintf(out, "    Overlay: Invalid tiling\n");
 	if (reg & (1 << 16))
-		printf("    Overlay: Invalid GTT PTE\n");
+		fprintf(out, "    Overlay: Invalid GTT PTE\n");
 	if (reg & (1 << 14))
-		printf("    Display C: Invalid tiling\n");
+		fprintf(out, "    Display C: Invalid tiling\n");
 	if (reg & (1 << 12))
-		printf("    Display C: Invalid GTT PTE\n");
+		fprintf(out, "    Display C: Invalid GTT PTE\n");
 	if (reg & (1 << 10))
-		printf("    Display B: Invalid tiling\n");
+		fprintf(out, "    Display B: Invalid tiling\n");
 	if (reg & (1 << 8))
-		printf("    Display B: Invalid GTT PTE\n");
+		fprintf(out, "    Display B: Invalid GTT PTE\n");
 	if (reg & (1 << 6))
-		printf("    Display A: Invalid tiling\n");
+		fprintf(out, "    Display A: Invalid tiling\n");
 	if (reg & (1 << 4))
-		printf("    Display A: Invalid GTT PTE\n");
+		fprintf(out, "    Display A: Invalid GTT PTE\n");
 	if (reg & (1 << 1))
-		printf("    Host Invalid PTE data\n");
+		fprintf(out, "    Host Invalid PTE data\n");
 	if (reg & (1 << 0))
-		printf("    Host Invalid GTT PTE\n");
+		fprintf(out, "    Host Invalid GTT PTE\n");
 }
 
 static void
-print_i965_pgtbl_err(unsigned int reg)
+print_i965_pgtbl_err(FILE *out, unsigned int reg)
 {
 	if (reg & (1 << 26))
-		printf("    Invalid Sampler Cache GTT entry\n");
+		fprintf(out, "    Invalid Sampler Cache GTT entry\n");
 	if (reg & (1 << 24))
-		printf("    Invalid Render Cache GTT entry\n");
+		fprintf(out, "    Invalid Render Cache GTT entry\n");
 	if (reg & (1 << 23))
-		printf("    Invalid Instruction/State Cache GTT entry\n");
+		fprintf(out, "    Invalid Instruction/State Cache GTT entry\n");
 	if (reg & (1 << 22))
-		printf("    There is no ROC, this cannot occur!\n");
+		fprintf(out, "    There is no ROC, this cannot occur!\n");
 	if (reg & (1 << 21))
-		printf("    Invalid GTT entry during Vertex Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Vertex Fetch\n");
 	if (reg & (1 << 20))
-		printf("    Invalid GTT entry during Command Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Command Fetch\n");
 	if (reg & (1 << 19))
-		printf("    Invalid GTT entry during CS\n");
+		fprintf(out, "    Invalid GTT entry during CS\n");
 	if (reg & (1 << 18))
-		printf("    Invalid GTT entry during Cursor Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Cursor Fetch\n");
 	if (reg & (1 << 17))
-		printf("    Invalid GTT entry during Overlay Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Overlay Fetch\n");
 	if (reg & (1 << 8))
-		printf("    Invalid GTT entry during Display B Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Display B Fetch\n");
 	if (reg & (1 << 4))
-		printf("    Invalid GTT entry during Display A Fetch\n");
+		fprintf(out, "    Invalid GTT entry during Display A Fetch\n");
 	if (reg & (1 << 1))
-		printf("    Valid PTE references illegal memory\n");
+		fprintf(out, "    Valid PTE references illegal memory\n");
 	if (reg & (1 << 0))
-		printf("    Invalid GTT entry during fetch for host\n");
+		fprintf(out, "    Invalid GTT entry during fetch for host\n");
 }
 
 static void
-print_pgtbl_err(unsigned int reg, unsigned int devid)
+print_pgtbl_err(FILE *out, unsigned int reg, unsigned int devid)
 {
 	if (IS_965(devid)) {
-		return print_i965_pgtbl_err(reg);
+		return print_i965_pgtbl_err(out, reg);
 	} else if (IS_GEN3(devid)) {
-		return print_i915_pgtbl_err(reg);
+		return print_i915_pgtbl_err(out, reg);
 	} else {
-		return print_i830_pgtbl_err(reg);
+		return print_i830_pgtbl_err(out, reg);
 	}
 }
 
-static void print_ivb_error(unsigned int reg, unsigned int devid)
+static void print_ivb_error(FILE *out, unsigned int reg, unsigned int devid)
 {
 	if (reg & (1 << 0))
-		printf("    TLB page fault error (GTT entry not valid)\n");
+		fprintf(out, "    TLB page fault error (GTT entry not valid)\n");
 	if (reg & (1 << 1))
-		printf("    Invalid physical address in RSTRM interface (PAVP)\n");
+		fprintf(out, "    Invalid physical address in RSTRM interface (PAVP)\n");
 	if (reg & (1 << 2))
-		printf("    Invalid page directory entry error\n");
+		fprintf(out, "    Invalid page directory entry error\n");
 	if (reg & (1 << 3))
-		printf("    Invalid physical address in ROSTRM interface (PAVP)\n");
+		fprintf(out, "    Invalid physical address in ROSTRM interface (PAVP)\n");
 	if (reg & (1 << 4))
-		printf("    TLB page VTD translation generated an error\n");
+		fprintf(out, "    TLB page VTD translation generated an error\n");
 	if (reg & (1 << 5))
-		printf("    Invalid physical address in WRITE interface (PAVP)\n");
+		fprintf(out, "    Invalid physical address in WRITE interface (PAVP)\n");
 	if (reg & (1 << 6))
-		printf("    Page directory VTD translation generated error\n");
+		fprintf(out, "    Page directory VTD translation generated error\n");
 	if (reg & (1 << 8))
-		printf("    Cacheline containing a PD was marked as invalid\n");
+		fprintf(out, "    Cacheline containing a PD was marked as invalid\n");
 	if (IS_HASWELL(devid) && (reg >> 10) & 0x1f)
-		printf("    %d pending page faults\n", (reg >> 10) & 0x1f);
+		fprintf(out, "    %d pending page faults\n", (reg >> 10) & 0x1f);
 }
 
-static void print_snb_error(unsigned int reg)
+static void print_snb_error(FILE *out, unsigned int reg)
 {
 	if (reg & (1 << 0))
-		printf("    TLB page fault error (GTT entry not valid)\n");
+		fprintf(out, "    TLB page fault error (GTT entry not valid)\n");
 	if (reg & (1 << 1))
-		printf("    Context page GTT translation generated a fault (GTT entry not valid)\n");
+		fprintf(out, "    Context page GTT translation generated a fault (GTT entry not valid)\n");
 	if (reg & (1 << 2))
-		printf("    Invalid page directory entry error\n");
+		fprintf(out, "    Invalid page directory entry error\n");
 	if (reg & (1 << 3))
-		printf("    HWS page GTT translation generated a page fault (GTT entry not valid)\n");
+		fprintf(out, "    HWS page GTT translation generated a page fault (GTT entry not valid)\n");
 	if (reg & (1 << 4))
-		printf("    TLB page VTD translation generated an error\n");
+		fprintf(out, "    TLB page VTD translation generated an error\n");
 	if (reg & (1 << 5))
-		printf("    Context page VTD translation generated an error\n");
+		fprintf(out, "    Context page VTD translation generated an error\n");
 	if (reg & (1 << 6))
-		printf("    Page directory VTD translation generated error\n");
+		fprintf(out, "    Page directory VTD translation generated error\n");
 	if (reg & (1 << 7))
-		printf("    HWS page VTD translation generated an error\n");
+		fprintf(out, "    HWS page VTD translation generated an error\n");
 	if (reg & (1 << 8))
-		printf("    Cacheline containing a PD was marked as invalid\n");
+		fprintf(out, "    Cacheline containing a PD was marked as invalid\n");
 }
 
-static void print_bdw_error(unsigned int reg, unsigned int devid)
+static void print_bdw_error(FILE *out, unsigned int reg, unsigned int devid)
 {
-	print_ivb_error(reg, devid);
+	print_ivb_error(out, reg, devid);
 
 	if (reg & (1 << 10))
-		printf("    Non WB memory type for Advanced Context\n");
+		fprintf(out, "    Non WB memory type for Advanced Context\n");
 	if (reg & (1 << 11))
-		printf("    PASID not enabled\n");
+		fprintf(out, "    PASID not enabled\n");
 	if (reg & (1 << 12))
-		printf("    PASID boundary violation\n");
+		fprintf(out, "    PASID boundary violation\n");
 	if (reg & (1 << 13))
-		printf("    PASID not valid\n");
+		fprintf(out, "    PASID not valid\n");
 	if (reg & (1 << 14))
-		printf("    PASID was zero for untranslated request\n");
+		fprintf(out, "    PASID was zero for untranslated request\n");
 	if (reg & (1 << 15))
-		printf("    Context was not marked as present when doing DMA\n");
+		fprintf(out, "    Context was not marked as present when doing DMA\n");
 }
 
 static void
-print_error(unsigned int reg, unsigned int devid)
+print_error(FILE *out, unsigned int reg, unsigned int devid)
 {
 	switch (intel_gen(devid)) {
-	case 8: return print_bdw_error(reg, devid);
-	case 7: return print_ivb_error(reg, devid);
-	case 6: return print_snb_error(reg);
+	case 8: return print_bdw_error(out, reg, devid);
+	case 7: return print_ivb_error(out, reg, devid);
+	case 6: return print_snb_error(out, reg);
 	}
 }
 
 static void
-print_snb_fence(unsigned int devid, uint64_t fence)
+print_snb_fence(FILE *out, unsigned int devid, uint64_t fence)
 {
-	printf("    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %u\n",
+	fprintf(out, "    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %u\n",
 			fence & 1 ? "" : "in",
 			fence & (1<<1) ? 'y' : 'x',
 			(int)(((fence>>32)&0xfff)+1)*128,
@@ -330,9 +336,9 @@ print_snb_fence(unsigned int devid, uint64_t fence)
 }
 
 static void
-print_i965_fence(unsigned int devid, uint64_t fence)
+print_i965_fence(FILE *out, unsigned int devid, uint64_t fence)
 {
-	printf("    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %u\n",
+	fprintf(out, "    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %u\n",
 			fence & 1 ? "" : "in",
 			fence & (1<<1) ? 'y' : 'x',
 			(int)(((fence>>2)&0x1ff)+1)*128,
@@ -341,7 +347,7 @@ print_i965_fence(unsigned int devid, uint64_t fence)
 }
 
 static void
-print_i915_fence(unsigned int devid, uint64_t fence)
+print_i915_fence(FILE *out, unsigned int devid, uint64_t fence)
 {
 	unsigned tile_width;
 	if ((fence & 12) && !IS_915(devid))
@@ -349,7 +355,7 @@ print_i915_fence(unsigned int devid, uint64_t fence)
 	else
 		tile_width = 512;
 
-	printf("    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %i\n",
+	fprintf(out, "    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %i\n",
 			fence & 1 ? "" : "in",
 			fence & (1<<12) ? 'y' : 'x',
 			(1<<((fence>>4)&0xf))*tile_width,
@@ -358,9 +364,9 @@ print_i915_fence(unsigned int devid, uint64_t fence)
 }
 
 static void
-print_i830_fence(unsigned int devid, uint64_t fence)
+print_i830_fence(FILE *out, unsigned int devid, uint64_t fence)
 {
-	printf("    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %i\n",
+	fprintf(out, "    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %i\n",
 			fence & 1 ? "" : "in",
 			fence & (1<<12) ? 'y' : 'x',
 			(1<<((fence>>4)&0xf))*128,
@@ -369,21 +375,21 @@ print_i830_fence(unsigned int devid, uint64_t fence)
 }
 
 static void
-print_fence(unsigned int devid, uint64_t fence)
+print_fence(FILE *out, unsigned int devid, uint64_t fence)
 {
 	if (IS_GEN6(devid) || IS_GEN7(devid)) {
-		return print_snb_fence(devid, fence);
+		return print_snb_fence(out, devid, fence);
 	} else if (IS_GEN4(devid) || IS_GEN5(devid)) {
-		return print_i965_fence(devid, fence);
+		return print_i965_fence(out, devid, fence);
 	} else if (IS_GEN3(devid)) {
-		return print_i915_fence(devid, fence);
+		return print_i915_fence(out, devid, fence);
 	} else {
-		return print_i830_fence(devid, fence);
+		return print_i830_fence(out, devid, fence);
 	}
 }
 
 static void
-print_fault_reg(unsigned devid, uint32_t reg)
+print_fault_reg(FILE *out, unsigned devid, uint32_t reg)
 {
 	const char *gen7_types[] = { "Page",
 				     "Invalid PD",
@@ -402,26 +408,26 @@ print_fault_reg(unsigned devid, uint32_t reg)
 		return;
 
 	if (reg & (1 << 0))
-		printf("    Valid\n");
+		fprintf(out, "    Valid\n");
 	else
 		return;
 
 	if (intel_gen(devid) < 8)
-		printf("    %s Fault (%s)\n", gen7_types[reg >> 1 & 0x3],
-		       reg & (1 << 11) ? "GGTT" : "PPGTT");
+		fprintf(out, "    %s Fault (%s)\n", gen7_types[reg >> 1 & 0x3],
+			reg & (1 << 11) ? "GGTT" : "PPGTT");
 	else
-		printf("    Invalid %s Fault\n", gen8_types[reg >> 1 & 0x3]);
+		fprintf(out, "    Invalid %s Fault\n", gen8_types[reg >> 1 & 0x3]);
 
 	if (intel_gen(devid) < 8)
-		printf("    Address 0x%08x\n", reg & ~((1 << 12)-1));
+		fprintf(out, "    Address 0x%08x\n", reg & ~((1 << 12)-1));
 	else
-		printf("    Engine %s\n", engine[reg >> 12 & 0x7]);
+		fprintf(out, "    Engine %s\n", engine[reg >> 12 & 0x7]);
 
-	printf("    Source ID %d\n", reg >> 3 & 0xff);
+	fprintf(out, "    Source ID %d\n", reg >> 3 & 0xff);
 }
 
 static void
-print_fault_data(unsigned devid, uint32_t data1, uint32_t data0)
+print_fault_data(FILE *out, unsigned devid, uint32_t data1, uint32_t data0)
 {
 	uint64_t address;
 
@@ -429,41 +435,93 @@ print_fault_data(unsigned devid, uint32_t data1, uint32_t data0)
 		return;
 
 	address = ((uint64_t)(data0) << 12) | ((uint64_t)data1 & 0xf) << 44;
-	printf("    Address 0x%016" PRIx64 " %s\n", address,
-	       data1 & (1 << 4) ? "GGTT" : "PPGTT");
+	fprintf(out, "    Address 0x%016" PRIx64 " %s\n", address,
+		data1 & (1 << 4) ? "GGTT" : "PPGTT");
 }
 
+
 #define MAX_RINGS 10 /* I really hope this never... */
 
-static void decode(struct drm_intel_decode *ctx,
-		   const char *buffer_name,
-		   const char *ring_name,
-		   uint64_t gtt_offset,
-		   uint32_t head_offset,
-		   uint32_t *data,
-		   int *count)
-{
-	if (!*count)
-		return;
+/*
+ * An error state is decoded in two phases. A single pass over the input
+ * (scan_error_state()) copies the register dump to the output and turns
+ * every buffer into a struct section, recording where its ascii85 payload
+ * lies in the input. The sections are handed to a pool of worker threads
+ * as soon as they are found, each decoding into its own memory stream,
+ * and write_error_state() emits them in file order as they complete.
+ */
+
+struct section {
+	struct section *next; /* in the work queue */
+
+	/* everything printed between the previous buffer and this one */
+	char *text;
+	size_t text_len;
+
+	uint32_t devid;
+	bool has_acthd;
+	uint32_t acthd;
+
+	const char *buffer_name;
+	char *ring_name;
+	uint64_t gtt_offset;
+	uint32_t head_offset;
+
+	/* either an ascii85 payload within the input, or the dwords */
+	const char *ascii85, *ascii85_end;
+	bool compressed;
+	uint32_t *data;
+	int count;
+
+	char *output;
+	size_t output_len;
+	bool failed;
+	bool done;
+};
+
+struct error_state {
+	struct section **sections;
+	unsigned num_sections, max_sections;
+
+	char *tail;
+	size_t tail_len;
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t queued;
+	pthread_cond_t done;
+	struct section *head, **tail;
+	pthread_t *threads;
+	int num_threads;
+	bool quit;
+} pool = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.queued = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+	.tail = &pool.head,
+};
 
-	printf("%s (%s) at 0x%08x_%08x", buffer_name, ring_name,
-	       (unsigned)(gtt_offset >> 32),
-	       (unsigned)(gtt_offset & 0xffffffff));
-	if (head_offset != -1)
-		printf("; HEAD points to: 0x%08x_%08x",
-		       (unsigned)((head_offset + gtt_offset) >> 32),
-		       (unsigned)((head_offset + gtt_offset) & 0xffffffff));
-	printf("\n");
+/*
+ * libdrm's decoder keeps its state in file-static variables, so only one
+ * drm_intel_decode() may run at a time in a process. Unpacking the
+ * buffers is where the time goes and that runs in parallel, batch mode
+ * uses a process per file to decode in parallel as well.
+ */
+static pthread_mutex_t decode_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-	drm_intel_decode_set_batch_pointer(ctx, data, gtt_offset, *count);
-	drm_intel_decode(ctx);
-	*count = 0;
+static void
+out_of_memory(void)
+{
+	fprintf(stderr, "Out of memory.\n");
+	exit(1);
 }
 
 static int zlib_inflate(uint32_t **ptr, int len)
 {
 	struct z_stream_s zstream;
-	void *out;
+	size_t size;
+	void *out, *tmp;
 
 	memset(&zstream, 0, sizeof(zstream));
 
@@ -473,9 +531,15 @@ static int zlib_inflate(uint32_t **ptr, int len)
 	if (inflateInit(&zstream) != Z_OK)
 		return 0;
 
-	out = malloc(128*4096); /* approximate obj size */
+	/* objects are mostly sparse, start from a generous estimate */
+	size = 16*len > 4096 ? 16*len : 4096;
+	out = malloc(size);
+	if (out == NULL) {
+		inflateEnd(&zstream);
+		return 0;
+	}
 	zstream.next_out = out;
-	zstream.avail_out = 40*len;
+	zstream.avail_out = size;
 
 	do {
 		switch (inflate(&zstream, Z_SYNC_FLUSH)) {
@@ -485,20 +549,24 @@ static int zlib_inflate(uint32_t **ptr, int len)
 			break;
 		default:
 			inflateEnd(&zstream);
+			free(out);
 			return 0;
 		}
 
 		if (zstream.avail_out)
 			break;
 
-		out = realloc(out, 2*zstream.total_out);
-		if (out == NULL) {
+		size *= 2;
+		tmp = realloc(out, size);
+		if (tmp == NULL) {
 			inflateEnd(&zstream);
+			free(out);
 			return 0;
 		}
+		out = tmp;
 
 		zstream.next_out = (unsigned char *)out + zstream.total_out;
-		zstream.avail_out = zstream.total_out;
+		zstream.avail_out = size - zstream.total_out;
 	} while (1);
 end:
 	inflateEnd(&zstream);
@@ -507,277 +575,822 @@ end:
 	return zstream.total_out / 4;
 }
 
-static int ascii85_decode(const char *in, uint32_t **out, bool inflate)
+static void decode_section(struct section *s)
+{
+	struct drm_intel_decode *ctx;
+	FILE *out;
+
+	if (s->ascii85) {
+		s->count = ascii85_decode(s->ascii85, s->ascii85_end, &s->data);
+		if (s->count && s->compressed)
+			s->count = zlib_inflate(&s->data, s->count);
+		if (s->count == 0) {
+			s->failed = true;
+			return;
+		}
+	}
+
+	out = open_memstream(&s->output, &s->output_len);
+	if (out == NULL)
+		out_of_memory();
+
+	fprintf(out, "%s (%s) at 0x%08x_%08x", s->buffer_name, s->ring_name,
+		(unsigned)(s->gtt_offset >> 32),
+		(unsigned)(s->gtt_offset & 0xffffffff));
+	if (s->head_offset != -1)
+		fprintf(out, "; HEAD points to: 0x%08x_%08x",
+			(unsigned)((s->head_offset + s->gtt_offset) >> 32),
+			(unsigned)((s->head_offset + s->gtt_offset) & 0xffffffff));
+	fprintf(out, "\n");
+
+	pthread_mutex_lock(&decode_mutex);
+	ctx = drm_intel_decode_context_alloc(s->devid);
+	if (ctx) {
+		if (s->has_acthd)
+			drm_intel_decode_set_head_tail(ctx, s->acthd, 0xffffffff);
+		drm_intel_decode_set_output_file(ctx, out);
+		drm_intel_decode_set_batch_pointer(ctx, s->data,
+						   s->gtt_offset, s->count);
+		drm_intel_decode(ctx);
+		drm_intel_decode_context_free(ctx);
+	}
+	pthread_mutex_unlock(&decode_mutex);
+
+	fclose(out);
+
+	free(s->data);
+	s->data = NULL;
+}
+
+static void *worker(void *arg)
 {
-	int len = 0, size = 1024;
+	struct section *s;
 
-	*out = realloc(*out, sizeof(uint32_t)*size);
-	if (*out == NULL)
-		return 0;
+	pthread_mutex_lock(&pool.mutex);
+	for (;;) {
+		while (pool.head == NULL && !pool.quit)
+			pthread_cond_wait(&pool.queued, &pool.mutex);
+		if (pool.head == NULL)
+			break;
 
-	while (*in >= '!' && *in <= 'z') {
-		uint32_t v = 0;
+		s = pool.head;
+		pool.head = s->next;
+		if (pool.head == NULL)
+			pool.tail = &pool.head;
+		pthread_mutex_unlock(&pool.mutex);
 
-		if (len == size) {
-			size *= 2;
-			*out = realloc(*out, sizeof(uint32_t)*size);
-			if (*out == NULL)
-				return 0;
-		}
+		decode_section(s);
 
-		if (*in == 'z') {
-			in++;
-		} else {
-			v += in[0] - 33; v *= 85;
-			v += in[1] - 33; v *= 85;
-			v += in[2] - 33; v *= 85;
-			v += in[3] - 33; v *= 85;
-			v += in[4] - 33;
-			in += 5;
+		pthread_mutex_lock(&pool.mutex);
+		s->done = true;
+		pthread_cond_broadcast(&pool.done);
+	}
+	pthread_mutex_unlock(&pool.mutex);
+
+	return NULL;
+}
+
+static void pool_init(int num_threads)
+{
+	int i;
+
+	pool.threads = calloc(num_threads, sizeof(*pool.threads));
+	if (pool.threads == NULL)
+		out_of_memory();
+
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&pool.threads[i], NULL, worker, NULL))
+			break;
+	}
+	pool.num_threads = i;
+	if (pool.num_threads == 0) {
+		fprintf(stderr, "Failed to create worker threads.\n");
+		exit(1);
+	}
+}
+
+static void pool_fini(void)
+{
+	int i;
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.quit = true;
+	pthread_cond_broadcast(&pool.queued);
+	pthread_mutex_unlock(&pool.mutex);
+
+	for (i = 0; i < pool.num_threads; i++)
+		pthread_join(pool.threads[i], NULL);
+	free(pool.threads);
+}
+
+static void queue_section(struct section *s)
+{
+	pthread_mutex_lock(&pool.mutex);
+	*pool.tail = s;
+	pool.tail = &s->next;
+	pthread_cond_signal(&pool.queued);
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+static void wait_section(struct section *s)
+{
+	pthread_mutex_lock(&pool.mutex);
+	while (!s->done)
+		pthread_cond_wait(&pool.done, &pool.mutex);
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+static inline int
+hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+static inline bool
+is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+		c == '\v' || c == '\f';
+}
+
+/*
+ * A minimal sscanf() for the fixed formats of the error state: whitespace
+ * in @pattern matches any amount of whitespace, everything else must match
+ * exactly. Returns the position after the match, or NULL.
+ */
+static const char *
+match(const char *s, const char *end, const char *pattern)
+{
+	if (s == NULL)
+		return NULL;
+
+	while (*pattern) {
+		if (is_space(*pattern)) {
+			while (s < end && is_space(*s))
+				s++;
+			pattern++;
+			continue;
 		}
-		(*out)[len++] = v;
+
+		if (s == end || *s != *pattern)
+			return NULL;
+		s++, pattern++;
+	}
+
+	return s;
+}
+
+/* As %x with a maximum field width, or none if @width is 0 */
+static const char *
+parse_hex(const char *s, const char *end, int width, uint64_t *value)
+{
+	const char *digits;
+	uint64_t v = 0;
+	int d;
+
+	if (s == NULL)
+		return NULL;
+
+	while (s < end && is_space(*s))
+		s++;
+
+	if (width && width < end - s)
+		end = s + width;
+
+	if (end - s > 2 && s[0] == '0' && (s[1] | 0x20) == 'x' &&
+	    hex_digit(s[2]) >= 0)
+		s += 2;
+
+	digits = s;
+	while (s < end && (d = hex_digit(*s)) >= 0) {
+		v = v << 4 | d;
+		s++;
+	}
+	if (s == digits)
+		return NULL;
+
+	*value = v;
+	return s;
+}
+
+/* As %i, without keeping the value */
+static const char *
+skip_int(const char *s, const char *end)
+{
+	const char *digits;
+
+	if (s == NULL)
+		return NULL;
+
+	while (s < end && is_space(*s))
+		s++;
+	if (s < end && (*s == '-' || *s == '+'))
+		s++;
+
+	digits = s;
+	while (s < end && (hex_digit(*s) >= 0 || (*s | 0x20) == 'x'))
+		s++;
+
+	return s == digits ? NULL : s;
+}
+
+static bool
+scan_reg(const char *line, const char *end,
+	 const char *pattern, uint32_t *reg)
+{
+	uint64_t value;
+
+	if (!parse_hex(match(line, end, pattern), end, 8, &value))
+		return false;
+
+	*reg = value;
+	return true;
+}
+
+struct scanner {
+	struct error_state *state;
+
+	FILE *out;
+	char *text;
+	size_t text_len;
+
+	uint32_t devid;
+	bool has_acthd;
+	uint32_t acthd;
+
+	const char *buffer_name;
+	char *ring_name;
+	uint64_t gtt_offset;
+	uint32_t head_offset;
+
+	uint32_t *data;
+	int count, data_size;
+};
+
+static void open_text(struct scanner *s)
+{
+	s->out = open_memstream(&s->text, &s->text_len);
+	if (s->out == NULL)
+		out_of_memory();
+}
+
+static struct section *new_section(struct scanner *s)
+{
+	struct error_state *state = s->state;
+	struct section *section;
+
+	section = calloc(1, sizeof(*section));
+	if (section == NULL)
+		out_of_memory();
+
+	fclose(s->out);
+	section->text = s->text;
+	section->text_len = s->text_len;
+	open_text(s);
+
+	section->devid = s->devid;
+	section->has_acthd = s->has_acthd;
+	section->acthd = s->acthd;
+	section->buffer_name = s->buffer_name;
+	if (s->ring_name) {
+		section->ring_name = strdup(s->ring_name);
+		if (section->ring_name == NULL)
+			out_of_memory();
+	}
+	section->gtt_offset = s->gtt_offset;
+	section->head_offset = s->head_offset;
+
+	if (state->num_sections == state->max_sections) {
+		state->max_sections = state->max_sections ? 2 * state->max_sections : 64;
+		state->sections = realloc(state->sections,
+					  state->max_sections * sizeof(*state->sections));
+		if (state->sections == NULL)
+			out_of_memory();
 	}
+	state->sections[state->num_sections++] = section;
 
-	if (!inflate)
-		return len;
+	return section;
+}
+
+/* Hand the dwords collected so far over for decoding */
+static void flush_data(struct scanner *s)
+{
+	struct section *section;
 
-	return zlib_inflate(out, len);
+	if (!s->count)
+		return;
+
+	section = new_section(s);
+	section->data = s->data;
+	section->count = s->count;
+	queue_section(section);
+
+	s->data = NULL;
+	s->count = s->data_size = 0;
 }
 
+static const struct {
+	const char *pattern;
+	const char *buffer_name;
+	bool ring;
+} section_types[] = {
+	{ "--- gtt_offset = 0x", "batch buffer", false },
+	{ "--- ringbuffer = 0x", "ring buffer", true },
+	{ "--- HW Context = 0x", "HW Context", false },
+};
+
 static void
-read_data_file(FILE *file)
+scan_error_state(struct error_state *state, const char *data, size_t size)
 {
-	struct drm_intel_decode *decode_ctx = NULL;
-	uint32_t devid = PCI_CHIP_I855_GM;
-	uint32_t *data = NULL;
+	struct scanner s = {
+		.state = state,
+		.devid = PCI_CHIP_I855_GM,
+		.buffer_name = "batch buffer",
+		.head_offset = -1,
+	};
+	const char *end = data + size;
+	const char *line, *eol;
 	uint32_t head[MAX_RINGS];
 	int head_idx = 0;
 	int num_rings = 0;
-	long long unsigned fence;
-	int data_size = 0, count = 0, line_number = 0, matched;
-	char *line = NULL;
-	size_t line_size;
-	uint32_t offset, value, ring_length = 0;
-	uint64_t gtt_offset = 0, new_gtt_offset;
-	uint32_t head_offset = -1;
-	const char *buffer_name = "batch buffer";
-	char *ring_name = NULL;
-
-	while (getline(&line, &line_size, file) > 0) {
-		char *dashes;
-		line_number++;
-
-		dashes = strstr(line, "---");
+	uint32_t ring_length = 0;
+
+	open_text(&s);
+
+	for (line = data; line < end; line = eol) {
+		const char *dashes, *p;
+		uint64_t offset, value, fence, data0, data1;
+		uint32_t reg;
+		unsigned int i;
+
+		eol = memchr(line, '\n', end - line);
+		eol = eol ? eol + 1 : end;
+
+		dashes = memmem(line, eol - line, "---", 3);
 		if (dashes) {
-			uint32_t lo, hi;
-			char *new_ring_name = malloc(dashes - line);
-			strncpy(new_ring_name, line, dashes - line);
-			new_ring_name[dashes - line - 1] = '\0';
-
-			matched = sscanf(dashes, "--- gtt_offset = 0x%08x %08x\n",
-					 &hi, &lo);
-			if (matched > 0) {
-				new_gtt_offset = hi;
-				if (matched == 2) {
-					new_gtt_offset <<= 32;
-					new_gtt_offset |= lo;
-				}
-
-				decode(decode_ctx,
-				       buffer_name, ring_name,
-				       gtt_offset, head_offset,
-				       data, &count);
-				gtt_offset = new_gtt_offset;
-				head_offset = -1;
-				free(ring_name);
-				ring_name = new_ring_name;
-				buffer_name = "batch buffer";
-				continue;
-			}
+			for (i = 0; i < ARRAY_SIZE(section_types); i++) {
+				uint64_t hi, lo;
 
-			matched = sscanf(dashes, "--- ringbuffer = 0x%08x %08x\n",
-					 &hi, &lo);
-			if (matched > 0) {
-				new_gtt_offset = hi;
-				if (matched == 2) {
-					new_gtt_offset <<= 32;
-					new_gtt_offset |= lo;
-				}
-
-				decode(decode_ctx,
-				       buffer_name, ring_name,
-				       gtt_offset, head_offset,
-				       data, &count);
-				gtt_offset = new_gtt_offset;
-				if (head_idx < num_rings)
-					head_offset = head[head_idx++];
-				else
-					head_offset = -1;
-				free(ring_name);
-				ring_name = new_ring_name;
-				buffer_name = "ring buffer";
-				continue;
-			}
+				p = parse_hex(match(dashes, eol,
+						    section_types[i].pattern),
+					      eol, 8, &hi);
+				if (p == NULL)
+					continue;
 
-			matched = sscanf(dashes, "--- HW Context = 0x%08x %08x\n",
-					 &hi, &lo);
-			if (matched > 0) {
-				new_gtt_offset = hi;
-				if (matched == 2) {
-					new_gtt_offset <<= 32;
-					new_gtt_offset |= lo;
-				}
-
-				decode(decode_ctx,
-				       buffer_name, ring_name,
-				       gtt_offset, head_offset,
-				       data, &count);
-				gtt_offset = new_gtt_offset;
-				head_offset = -1;
-				free(ring_name);
-				ring_name = new_ring_name;
-				buffer_name = "HW Context";
-				continue;
+				flush_data(&s);
+
+				s.gtt_offset = hi;
+				if (parse_hex(p, eol, 8, &lo))
+					s.gtt_offset = s.gtt_offset << 32 | lo;
+
+				s.head_offset = -1;
+				if (section_types[i].ring && head_idx < num_rings)
+					s.head_offset = head[head_idx++];
+
+				free(s.ring_name);
+				s.ring_name = strndup(line, dashes > line ? dashes - line - 1 : 0);
+				s.buffer_name = section_types[i].buffer_name;
+				break;
 			}
+			if (i < ARRAY_SIZE(section_types))
+				continue;
 		}
 
 		if (line[0] == ':' || line[0] == '~') {
-			count = ascii85_decode(line+1, &data, line[0] == ':');
-			if (count == 0) {
-				fprintf(stderr, "ASCII85 decode failed.\n");
-				exit(1);
-			}
-			decode(decode_ctx,
-			       buffer_name, ring_name,
-			       gtt_offset, head_offset,
-			       data, &count);
+			struct section *section;
+
+			/* any dwords seen before are superseded, as ever */
+			s.count = 0;
+
+			section = new_section(&s);
+			section->ascii85 = line + 1;
+			section->ascii85_end = eol;
+			section->compressed = line[0] == ':';
+			queue_section(section);
 			continue;
 		}
 
-		matched = sscanf(line, "%08x : %08x", &offset, &value);
-		if (matched != 2) {
-			unsigned int reg, reg2;
-
+		p = parse_hex(line, eol, 8, &offset);
+		if (!parse_hex(match(p, eol, " : "), eol, 8, &value)) {
 			/* display reg section is after the ringbuffers, don't mix them */
-			decode(decode_ctx,
-			       buffer_name, ring_name,
-			       gtt_offset, head_offset,
-			       data, &count);
-
-			printf("%s", line);
-
-			matched = sscanf(line, "PCI ID: 0x%04x\n", &reg);
-			if (matched == 0)
-				matched = sscanf(line, " PCI ID: 0x%04x\n", &reg);
-			if (matched == 0) {
-				const char *pci_id_start = strstr(line, "PCI ID");
-				if (pci_id_start)
-					matched = sscanf(pci_id_start, "PCI ID: 0x%04x\n", &reg);
-			}
-			if (matched == 1) {
-				devid = reg;
-				printf("Detected GEN%i chipset\n",
-						intel_gen(devid));
+			flush_data(&s);
+
+			fwrite(line, 1, eol - line, s.out);
 
-				decode_ctx = drm_intel_decode_context_alloc(devid);
+			p = memmem(line, eol - line, "PCI ID", 6);
+			if (parse_hex(match(p, eol, "PCI ID: 0x"), eol, 4, &value)) {
+				s.devid = value;
+				fprintf(s.out, "Detected GEN%i chipset\n",
+					intel_gen(s.devid));
+				s.has_acthd = false;
 			}
 
-			matched = sscanf(line, "  CTL: 0x%08x\n", &reg);
-			if (matched == 1)
-				ring_length = print_ctl(reg);
+			if (scan_reg(line, eol, "  CTL: 0x", &reg))
+				ring_length = print_ctl(s.out, reg);
 
-			matched = sscanf(line, "  HEAD: 0x%08x\n", &reg);
-			if (matched == 1) {
-				head[num_rings++] = print_head(reg);
+			if (scan_reg(line, eol, "  HEAD: 0x", &reg)) {
+				reg = print_head(s.out, reg);
+				if (num_rings < MAX_RINGS)
+					head[num_rings++] = reg;
 			}
 
-			matched = sscanf(line, "  ACTHD: 0x%08x\n", &reg);
-			if (matched == 1) {
-				print_acthd(reg, ring_length);
-				drm_intel_decode_set_head_tail(decode_ctx, reg, 0xffffffff);
+			if (scan_reg(line, eol, "  ACTHD: 0x", &reg)) {
+				print_acthd(s.out, reg, ring_length);
+				s.has_acthd = true;
+				s.acthd = reg;
 			}
 
-			matched = sscanf(line, "  PGTBL_ER: 0x%08x\n", &reg);
-			if (matched == 1 && reg)
-				print_pgtbl_err(reg, devid);
+			if (scan_reg(line, eol, "  PGTBL_ER: 0x", &reg) && reg)
+				print_pgtbl_err(s.out, reg, s.devid);
 
-			matched = sscanf(line, "  ERROR: 0x%08x\n", &reg);
-			if (matched == 1 && reg)
-				print_error(reg, devid);
+			if (scan_reg(line, eol, "  ERROR: 0x", &reg) && reg)
+				print_error(s.out, reg, s.devid);
 
-			matched = sscanf(line, "  INSTDONE: 0x%08x\n", &reg);
-			if (matched == 1)
-				print_instdone(devid, reg, -1);
+			if (scan_reg(line, eol, "  INSTDONE: 0x", &reg))
+				print_instdone(s.out, s.devid, reg, -1);
 
-			matched = sscanf(line, "  INSTDONE1: 0x%08x\n", &reg);
-			if (matched == 1)
-				print_instdone(devid, -1, reg);
+			if (scan_reg(line, eol, "  INSTDONE1: 0x", &reg))
+				print_instdone(s.out, s.devid, -1, reg);
 
-			matched = sscanf(line, "  fence[%i] = %Lx\n", &reg, &fence);
-			if (matched == 2)
-				print_fence(devid, fence);
+			p = skip_int(match(line, eol, "  fence["), eol);
+			if (parse_hex(match(p, eol, "] = "), eol, 0, &fence))
+				print_fence(s.out, s.devid, fence);
 
-			matched = sscanf(line, "  FAULT_REG: 0x%08x\n", &reg);
-			if (matched == 1 && reg)
-				print_fault_reg(devid, reg);
+			if (scan_reg(line, eol, "  FAULT_REG: 0x", &reg) && reg)
+				print_fault_reg(s.out, s.devid, reg);
 
-			matched = sscanf(line, "  FAULT_TLB_DATA: 0x%08x 0x%08x\n", &reg, &reg2);
-			if (matched == 2)
-				print_fault_data(devid, reg, reg2);
+			p = parse_hex(match(line, eol, "  FAULT_TLB_DATA: 0x"),
+				      eol, 8, &data1);
+			if (parse_hex(match(p, eol, " 0x"), eol, 8, &data0))
+				print_fault_data(s.out, s.devid, data1, data0);
 
 			continue;
 		}
 
-		count++;
+		s.count++;
+
+		if (s.count > s.data_size) {
+			s.data_size = s.data_size ? s.data_size * 2 : 1024;
+			s.data = realloc(s.data, s.data_size * sizeof (uint32_t));
+			if (s.data == NULL)
+				out_of_memory();
+		}
+
+		s.data[s.count-1] = value;
+	}
+
+	flush_data(&s);
+
+	fclose(s.out);
+	state->tail = s.text;
+	state->tail_len = s.text_len;
+
+	free(s.data);
+	free(s.ring_name);
+}
+
+/*
+ * Write out the error state in order, waiting for each buffer to be
+ * decoded in turn. Every section is waited upon even after a failure as
+ * the workers may still be reading the input.
+ */
+static int
+write_error_state(struct error_state *state, const char *name, FILE *file)
+{
+	bool failed = false;
+	unsigned i;
+
+	for (i = 0; i < state->num_sections; i++) {
+		struct section *s = state->sections[i];
+
+		if (!failed)
+			fwrite(s->text, 1, s->text_len, file);
+
+		wait_section(s);
+		if (s->failed && !failed) {
+			fprintf(stderr, "%s: ASCII85 decode failed.\n", name);
+			failed = true;
+		}
+
+		if (!failed)
+			fwrite(s->output, 1, s->output_len, file);
+
+		free(s->text);
+		free(s->output);
+		free(s->data);
+		free(s->ring_name);
+		free(s);
+	}
+	if (!failed)
+		fwrite(state->tail, 1, state->tail_len, file);
+
+	free(state->sections);
+	free(state->tail);
+
+	return failed;
+}
+
+struct input {
+	void *data;
+	size_t size;
+	bool mapped;
+};
+
+static int
+read_input(struct input *in, int fd)
+{
+	struct stat st;
+
+	memset(in, 0, sizeof(*in));
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size) {
+		in->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (in->data != MAP_FAILED) {
+			madvise(in->data, st.st_size, MADV_SEQUENTIAL);
+			in->size = st.st_size;
+			in->mapped = true;
+			return 0;
+		}
+		in->data = NULL;
+	}
+
+	/* debugfs, sysfs and pipes: read everything into one buffer */
+	for (;;) {
+		size_t alloc = in->size ? 2 * in->size : 1 << 20;
+		ssize_t ret;
 
-		if (count > data_size) {
-			data_size = data_size ? data_size * 2 : 1024;
-			data = realloc(data, data_size * sizeof (uint32_t));
-			if (data == NULL) {
-				fprintf(stderr, "Out of memory.\n");
-				exit(1);
+		in->data = realloc(in->data, alloc);
+		if (in->data == NULL)
+			out_of_memory();
+
+		while (in->size < alloc) {
+			ret = read(fd, (char *)in->data + in->size, alloc - in->size);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret < 0) {
+				free(in->data);
+				return -1;
 			}
+			if (ret == 0)
+				break;
+			in->size += ret;
+		}
+		if (in->size < alloc)
+			return 0;
+	}
+}
+
+static void
+close_input(struct input *in)
+{
+	if (in->mapped)
+		munmap(in->data, in->size);
+	else
+		free(in->data);
+}
+
+static int
+decode_error_state(int fd, const char *name, FILE *file)
+{
+	struct error_state state;
+	struct input in;
+	int ret;
+
+	if (read_input(&in, fd)) {
+		fprintf(stderr, "Failed to read %s: %s\n", name, strerror(errno));
+		return 1;
+	}
+
+	memset(&state, 0, sizeof(state));
+	scan_error_state(&state, in.data, in.size);
+	ret = write_error_state(&state, name, file);
+
+	close_input(&in);
+	return ret;
+}
+
+struct batch_job {
+	pid_t pid;
+	const char *name;
+	FILE *tmp;
+};
+
+/* Decode one file of the batch in a child process */
+static void
+start_job(struct batch_job *job, const char *dir, const char *outdir)
+{
+	char *path, *output;
+	FILE *file;
+	int fd, ret;
+
+	job->tmp = NULL;
+	if (outdir == NULL) {
+		job->tmp = tmpfile();
+		if (job->tmp == NULL)
+			err(1, "Failed to create a temporary file");
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+
+	job->pid = fork();
+	if (job->pid < 0)
+		err(1, "fork");
+	if (job->pid)
+		return;
+
+	ret = asprintf(&path, "%s/%s", dir, job->name);
+	assert(ret > 0);
+
+	if (outdir) {
+		ret = asprintf(&output, "%s/%s.txt", outdir, job->name);
+		assert(ret > 0);
+
+		file = fopen(output, "w");
+		if (file == NULL) {
+			fprintf(stderr, "Failed to create %s: %s\n",
+				output, strerror(errno));
+			_exit(1);
+		}
+	} else {
+		file = job->tmp;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n",
+			path, strerror(errno));
+		_exit(1);
+	}
+
+	pool_init(1);
+	ret = decode_error_state(fd, path, file);
+	if (fclose(file))
+		ret = 1;
+
+	_exit(ret);
+}
+
+static int
+finish_job(struct batch_job *job)
+{
+	int status;
+
+	while (waitpid(job->pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			err(1, "waitpid");
+	}
+
+	if (job->tmp) {
+		char buf[65536];
+		size_t len;
+
+		printf("==> %s <==\n", job->name);
+
+		rewind(job->tmp);
+		while ((len = fread(buf, 1, sizeof(buf), job->tmp)))
+			fwrite(buf, 1, len, stdout);
+		fclose(job->tmp);
+	}
+
+	return !WIFEXITED(status) || WEXITSTATUS(status);
+}
+
+/*
+ * Decode every error state in @dir, up to @max_jobs at a time. The results
+ * go to <outdir>/<name>.txt, or are concatenated on stdout in name order.
+ */
+static int
+decode_directory(const char *dir, const char *outdir, int max_jobs)
+{
+	struct dirent **names;
+	struct batch_job *jobs;
+	int num_names, first = 0, running = 0;
+	int i, ret = 0;
+
+	num_names = scandir(dir, &names, NULL, alphasort);
+	if (num_names < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n",
+			dir, strerror(errno));
+		return 1;
+	}
+
+	jobs = calloc(max_jobs, sizeof(*jobs));
+	if (jobs == NULL)
+		out_of_memory();
+
+	for (i = 0; i < num_names; i++) {
+		struct stat st;
+		char *path;
+
+		if (asprintf(&path, "%s/%s", dir, names[i]->d_name) < 0)
+			out_of_memory();
+		if (stat(path, &st) || !S_ISREG(st.st_mode)) {
+			free(path);
+			continue;
 		}
+		free(path);
 
-		data[count-1] = value;
+		if (running == max_jobs) {
+			ret |= finish_job(&jobs[first]);
+			first = (first + 1) % max_jobs;
+			running--;
+		}
+
+		jobs[(first + running) % max_jobs].name = names[i]->d_name;
+		start_job(&jobs[(first + running) % max_jobs], dir, outdir);
+		running++;
+	}
+
+	while (running) {
+		ret |= finish_job(&jobs[first]);
+		first = (first + 1) % max_jobs;
+		running--;
 	}
 
-	decode(decode_ctx,
-	       buffer_name, ring_name,
-	       gtt_offset, head_offset,
-	       data, &count);
+	for (i = 0; i < num_names; i++)
+		free(names[i]);
+	free(names);
+	free(jobs);
 
-	free(data);
-	free(line);
-	free(ring_name);
+	return ret;
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr,
+			"intel_gpu_decode: Parse an Intel GPU i915_error_state\n"
+			"Usage:\n"
+			"\t%s [-j <threads>] [<file>]\n"
+			"\t%s -b [-j <jobs>] [-o <outdir>] <directory>\n"
+			"\n"
+			"With no arguments, debugfs-dri-directory is probed for in "
+			"/debug and \n"
+			"/sys/kernel/debug.  Otherwise, it may be "
+			"specified.  If a file is given,\n"
+			"it is parsed as an GPU dump in the format of "
+			"/debug/dri/0/i915_error_state.\n"
+			"\n"
+			"With -b, every file in the directory is decoded, <jobs> at a "
+			"time, and\n"
+			"written to <outdir>/<file>.txt or else one after another "
+			"to stdout.\n",
+			argv0, argv0);
 }
 
 int
 main(int argc, char *argv[])
 {
-	FILE *file;
 	const char *path;
+	const char *outdir = NULL;
 	char *filename = NULL;
 	struct stat st;
-	int error;
-
-	if (argc > 2) {
-		fprintf(stderr,
-				"intel_gpu_decode: Parse an Intel GPU i915_error_state\n"
-				"Usage:\n"
-				"\t%s [<file>]\n"
-				"\n"
-				"With no arguments, debugfs-dri-directory is probed for in "
-				"/debug and \n"
-				"/sys/kernel/debug.  Otherwise, it may be "
-				"specified.  If a file is given,\n"
-				"it is parsed as an GPU dump in the format of "
-				"/debug/dri/0/i915_error_state.\n",
-				argv[0]);
+	bool batch = false;
+	int threads;
+	int error, fd, ret, c;
+
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((c = getopt(argc, argv, "bj:o:h")) != -1) {
+		switch (c) {
+		case 'b':
+			batch = true;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'o':
+			outdir = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (threads < 1)
+		threads = 1;
+
+	if (batch) {
+		if (optind != argc - 1) {
+			usage(argv[0]);
+			return 1;
+		}
+
+		return decode_directory(argv[optind], outdir, threads);
+	}
+
+	if (optind < argc - 1 || outdir) {
+		usage(argv[0]);
 		return 1;
 	}
 
-	if (argc == 1) {
+	if (optind == argc) {
 		if (isatty(0)) {
 			path = "/sys/class/drm/card0/error";
 			error = stat(path, &st);
@@ -796,11 +1409,13 @@ main(int argc, char *argv[])
 				     "\tsudo mount -t debugfs debugfs /sys/kernel/debug\n");
 			}
 		} else {
-			read_data_file(stdin);
-			exit(0);
+			pool_init(threads);
+			ret = decode_error_state(0, "stdin", stdout);
+			pool_fini();
+			return ret;
 		}
 	} else {
-		path = argv[1];
+		path = argv[optind];
 		error = stat(path, &st);
 		if (error != 0) {
 			fprintf(stderr, "Error opening %s: %s\n",
@@ -810,44 +1425,44 @@ main(int argc, char *argv[])
 	}
 
 	if (S_ISDIR(st.st_mode)) {
-		int ret;
-
 		ret = asprintf(&filename, "%s/i915_error_state", path);
 		assert(ret > 0);
-		file = fopen(filename, "r");
-		if (!file) {
+		fd = open(filename, O_RDONLY);
+		if (fd < 0) {
 			int minor;
 			for (minor = 0; minor < 64; minor++) {
 				free(filename);
 				ret = asprintf(&filename, "%s/%d/i915_error_state", path, minor);
 				assert(ret > 0);
 
-				file = fopen(filename, "r");
-				if (file)
+				fd = open(filename, O_RDONLY);
+				if (fd >= 0)
 					break;
 			}
 		}
-		if (!file) {
+		if (fd < 0) {
 			fprintf(stderr, "Failed to find i915_error_state beneath %s\n",
 					path);
 			exit (1);
 		}
+		path = filename;
 	} else {
-		file = fopen(path, "r");
-		if (!file) {
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
 			fprintf(stderr, "Failed to open %s: %s\n",
 					path, strerror(errno));
 			exit (1);
 		}
 	}
 
-	read_data_file(file);
-	fclose(file);
+	pool_init(threads);
+	ret = decode_error_state(fd, path, stdout);
+	pool_fini();
+	close(fd);
 
-	if (filename != path)
-		free(filename);
+	free(filename);
 
-	return 0;
+	return ret;
 }
 
 /* vim: set ts=8 sw=8 tw=0 cino=:0,(0 noet :*/
@@ -43,27 +43,14 @@
 #include <termios.h>
 #endif
 #include "intel_io.h"
-#include "instdone.h"
 #include "intel_reg.h"
 #include "intel_chipset.h"
-
-#define  FORCEWAKE	    0xA18C
-#define  FORCEWAKE_ACK	    0x130090
+#include "intel_gpu_sampler.h"
 
 #define SAMPLES_PER_SEC             10000
-#define SAMPLES_TO_PERCENT_RATIO    (SAMPLES_PER_SEC / 100)
-
-#define MAX_NUM_TOP_BITS            100
-
-#define HAS_STATS_REGS(devid)		IS_965(devid)
 
-struct top_bit {
-	struct instdone_bit *bit;
-	int count;
-} top_bits[MAX_NUM_TOP_BITS];
-struct top_bit *top_bits_sorted[MAX_NUM_TOP_BITS];
-
-static uint32_t instdone, instdone1;
+static struct intel_gpu_sampler sampler;
+static struct intel_gpu_sampler_bit *top_bits_sorted[MAX_INSTDONE_BITS];
 
 static const char *bars[] = {
 	" ",
@@ -77,59 +64,11 @@ static const char *bars[] = {
 	"█"
 };
 
-enum stats_counts {
-	IA_VERTICES,
-	IA_PRIMITIVES,
-	VS_INVOCATION,
-	GS_INVOCATION,
-	GS_PRIMITIVES,
-	CL_INVOCATION,
-	CL_PRIMITIVES,
-	PS_INVOCATION,
-	PS_DEPTH,
-	STATS_COUNT
-};
-
-const uint32_t stats_regs[STATS_COUNT] = {
-	IA_VERTICES_COUNT_QW,
-	IA_PRIMITIVES_COUNT_QW,
-	VS_INVOCATION_COUNT_QW,
-	GS_INVOCATION_COUNT_QW,
-	GS_PRIMITIVES_COUNT_QW,
-	CL_INVOCATION_COUNT_QW,
-	CL_PRIMITIVES_COUNT_QW,
-	PS_INVOCATION_COUNT_QW,
-	PS_DEPTH_COUNT_QW,
-};
-
-const char *stats_reg_names[STATS_COUNT] = {
-	"vert fetch",
-	"prim fetch",
-	"VS invocations",
-	"GS invocations",
-	"GS prims",
-	"CL invocations",
-	"CL prims",
-	"PS invocations",
-	"PS depth pass",
-};
-
-uint64_t stats[STATS_COUNT];
-uint64_t last_stats[STATS_COUNT];
-
-static unsigned long
-gettime(void)
-{
-    struct timeval t;
-    gettimeofday(&t, NULL);
-    return (t.tv_usec + (t.tv_sec * 1000000));
-}
-
 static int
 top_bits_sort(const void *a, const void *b)
 {
-	struct top_bit * const *bit_a = a;
-	struct top_bit * const *bit_b = b;
+	struct intel_gpu_sampler_bit * const *bit_a = a;
+	struct intel_gpu_sampler_bit * const *bit_b = b;
 	int a_count = (*bit_a)->count;
 	int b_count = (*bit_b)->count;
 
@@ -141,19 +80,6 @@ top_bits_sort(const void *a, const void *b)
 		return -1;
 }
 
-static void
-update_idle_bit(struct top_bit *top_bit)
-{
-	uint32_t reg_val;
-
-	if (top_bit->bit->reg == INSTDONE_1)
-		reg_val = instdone1;
-	else
-		reg_val = instdone;
-
-	if ((reg_val & top_bit->bit->bit) == 0)
-		top_bit->count++;
-}
 
 static void
 print_clock(const char *name, int clock) {
@@ -310,56 +236,14 @@ print_percentage_bar(float percent, int cur_line_len)
 	printf("%*s", PERCENTAGE_BAR_END - cur_line_len, "");
 }
 
-struct ring {
-	const char *name;
-	uint32_t mmio;
-	int head, tail, size;
-	uint64_t full;
-	int idle;
-};
-
-static uint32_t ring_read(struct ring *ring, uint32_t reg)
-{
-	return INREG(ring->mmio + reg);
-}
-
-static void ring_init(struct ring *ring)
-{
-	ring->size = (((ring_read(ring, RING_LEN) & RING_NR_PAGES) >> 12) + 1) * 4096;
-}
-
-static void ring_reset(struct ring *ring)
-{
-	ring->idle = ring->full = 0;
-}
-
-static void ring_sample(struct ring *ring)
-{
-	int full;
-
-	if (!ring->size)
-		return;
-
-	ring->head = ring_read(ring, RING_HEAD) & HEAD_ADDR;
-	ring->tail = ring_read(ring, RING_TAIL) & TAIL_ADDR;
-
-	if (ring->tail == ring->head)
-		ring->idle++;
-
-	full = ring->tail - ring->head;
-	if (full < 0)
-		full += ring->size;
-	ring->full += full;
-}
-
-static void ring_print_header(FILE *out, struct ring *ring)
+static void ring_print_header(FILE *out, struct intel_gpu_sampler_ring *ring)
 {
     fprintf(out, "%.6s%%\tops\t",
             ring->name
           );
 }
 
-static void ring_print(struct ring *ring, unsigned long samples_per_sec)
+static void ring_print(struct intel_gpu_sampler_ring *ring, unsigned long samples_per_sec)
 {
 	int percent_busy, len;
 
@@ -376,7 +260,7 @@ static void ring_print(struct ring *ring, unsigned long samples_per_sec)
 		   ring->size);
 }
 
-static void ring_log(struct ring *ring, unsigned long samples_per_sec,
+static void ring_log(struct intel_gpu_sampler_ring *ring, unsigned long samples_per_sec,
 		FILE *output)
 {
 	if (ring->size)
@@ -409,21 +293,8 @@ usage(const char *appname)
 
 int main(int argc, char **argv)
 {
-	uint32_t devid;
 	struct pci_device *pci_dev;
-	struct ring render_ring = {
-		.name = "render",
-		.mmio = 0x2030,
-	}, bsd_ring = {
-		.name = "bitstream",
-		.mmio = 0x4030,
-	}, bsd6_ring = {
-		.name = "bitstream",
-		.mmio = 0x12030,
-	}, blt_ring = {
-		.name = "blitter",
-		.mmio = 0x22030,
-	};
+	struct timeval start;
 	int i, ch;
 	int samples_per_sec = SAMPLES_PER_SEC;
 	FILE *output = NULL;
@@ -434,6 +305,7 @@ int main(int argc, char **argv)
 	char *cmd=NULL;
 	int interactive=1;
 
+
 	/* Parse options? */
 	while ((ch = getopt(argc, argv, "s:o:e:h")) != -1) {
 		switch (ch) {
@@ -472,9 +344,6 @@ int main(int argc, char **argv)
 	}
 
 	pci_dev = intel_get_pci_device();
-	devid = pci_dev->device_id;
-	intel_mmio_use_pci_bar(pci_dev);
-	init_instdone_definitions(devid);
 
 	/* Do we have a command to run? */
 	if (cmd != NULL) {
@@ -504,130 +373,52 @@ int main(int argc, char **argv)
 		}
 	}
 
-	for (i = 0; i < num_instdone_bits; i++) {
-		top_bits[i].bit = &instdone_bits[i];
-		top_bits[i].count = 0;
-		top_bits_sorted[i] = &top_bits[i];
-	}
-
-	/* Grab access to the registers */
-	intel_register_access_init(pci_dev, 0);
-
-	ring_init(&render_ring);
-	if (IS_GEN4(devid) || IS_GEN5(devid))
-		ring_init(&bsd_ring);
-	if (IS_GEN6(devid) || IS_GEN7(devid)) {
-		ring_init(&bsd6_ring);
-		ring_init(&blt_ring);
-	}
-
-	/* Initialize GPU stats */
-	if (HAS_STATS_REGS(devid)) {
-		for (i = 0; i < STATS_COUNT; i++) {
-			uint32_t stats_high, stats_low, stats_high_2;
-
-			do {
-				stats_high = INREG(stats_regs[i] + 4);
-				stats_low = INREG(stats_regs[i]);
-				stats_high_2 = INREG(stats_regs[i] + 4);
-			} while (stats_high != stats_high_2);
-
-			last_stats[i] = (uint64_t)stats_high << 32 |
-				stats_low;
-		}
-	}
+	intel_gpu_sampler_init(&sampler, pci_dev);
+	for (i = 0; i < sampler.num_bits; i++)
+		top_bits_sorted[i] = &sampler.bits[i];
 
+	gettimeofday(&start, NULL);
 	for (;;) {
-		int j;
-		unsigned long long t1, ti, tf, t2;
-		unsigned long long def_sleep = 1000000 / samples_per_sec;
-		unsigned long long last_samples_per_sec = samples_per_sec;
+		unsigned long samples;
 		unsigned short int max_lines;
 		struct winsize ws;
+		struct timeval now;
 		char clear_screen[] = {0x1b, '[', 'H',
 				       0x1b, '[', 'J',
 				       0x0};
 		int percent;
 		int len;
 
-		t1 = gettime();
-
-		ring_reset(&render_ring);
-		ring_reset(&bsd_ring);
-		ring_reset(&bsd6_ring);
-		ring_reset(&blt_ring);
-
-		for (i = 0; i < samples_per_sec; i++) {
-			long long interval;
-			ti = gettime();
-			if (IS_965(devid)) {
-				instdone = INREG(INSTDONE_I965);
-				instdone1 = INREG(INSTDONE_1);
-			} else
-				instdone = INREG(INSTDONE);
-
-			for (j = 0; j < num_instdone_bits; j++)
-				update_idle_bit(&top_bits[j]);
-
-			ring_sample(&render_ring);
-			ring_sample(&bsd_ring);
-			ring_sample(&bsd6_ring);
-			ring_sample(&blt_ring);
-
-			tf = gettime();
-			if (tf - t1 >= 1000000) {
-				/* We are out of sync, bail out */
-				last_samples_per_sec = i+1;
-				break;
-			}
-			interval = def_sleep - (tf - ti);
-			if (interval > 0)
-				usleep(interval);
-		}
-
-		if (HAS_STATS_REGS(devid)) {
-			for (i = 0; i < STATS_COUNT; i++) {
-				uint32_t stats_high, stats_low, stats_high_2;
-
-				do {
-					stats_high = INREG(stats_regs[i] + 4);
-					stats_low = INREG(stats_regs[i]);
-					stats_high_2 = INREG(stats_regs[i] + 4);
-				} while (stats_high != stats_high_2);
-
-				stats[i] = (uint64_t)stats_high << 32 |
-					stats_low;
-			}
-		}
+		intel_gpu_sampler_run(&sampler, samples_per_sec);
+		samples = sampler.samples;
 
-		qsort(top_bits_sorted, num_instdone_bits,
-		      sizeof(struct top_bit *), top_bits_sort);
+		qsort(top_bits_sorted, sampler.num_bits,
+		      sizeof(top_bits_sorted[0]), top_bits_sort);
 
 		/* Limit the number of lines printed to the terminal height so the
 		 * most important info (at the top) will stay on screen. */
 		max_lines = -1;
 		if (ioctl(0, TIOCGWINSZ, &ws) != -1)
 			max_lines = ws.ws_row - 6; /* exclude header lines */
-		if (max_lines >= num_instdone_bits)
-			max_lines = num_instdone_bits;
+		if (max_lines >= sampler.num_bits)
+			max_lines = sampler.num_bits;
 
-		t2 = gettime();
-		elapsed_time += (t2 - t1) / 1000000.0;
+		gettimeofday(&now, NULL);
+		elapsed_time = (now.tv_sec - start.tv_sec) +
+			(now.tv_usec - start.tv_usec) / 1000000.0;
 
 		if (interactive) {
 			printf("%s", clear_screen);
 			print_clock_info(pci_dev);
 
-			ring_print(&render_ring, last_samples_per_sec);
-			ring_print(&bsd_ring, last_samples_per_sec);
-			ring_print(&bsd6_ring, last_samples_per_sec);
-			ring_print(&blt_ring, last_samples_per_sec);
+			for (i = 0; i < SAMPLER_NUM_RINGS; i++)
+				ring_print(&sampler.ring[i], samples);
 
 			printf("\n%30s  %s\n", "task", "percent busy");
 			for (i = 0; i < max_lines; i++) {
 				if (top_bits_sorted[i]->count > 0) {
 					percent = (top_bits_sorted[i]->count * 100) /
-						last_samples_per_sec;
+						samples;
 					len = printf("%30s: %3d%%: ",
 							 top_bits_sorted[i]->bit->name,
 							 percent);
@@ -636,12 +427,11 @@ int main(int argc, char **argv)
 					printf("%*s", PERCENTAGE_BAR_END, "");
 				}
 
-				if (i < STATS_COUNT && HAS_STATS_REGS(devid)) {
-					printf("%13s: %llu (%lld/sec)",
-						   stats_reg_names[i],
-						   (long long)stats[i],
-						   (long long)(stats[i] - last_stats[i]));
-					last_stats[i] = stats[i];
+				if (i < STATS_COUNT && sampler.has_stats) {
+					printf("%13s: %llu (%.0f/sec)",
+						   intel_gpu_stats_names[i],
+						   (long long)sampler.stats.values[i],
+						   intel_counters_rate(&sampler.stats, i));
 				} else {
 					if (!top_bits_sorted[i]->count)
 						break;
@@ -653,50 +443,27 @@ int main(int argc, char **argv)
 			/* Print headers for columns at first run */
 			if (print_headers) {
 				fprintf(output, "# time\t");
-				ring_print_header(output, &render_ring);
-				ring_print_header(output, &bsd_ring);
-				ring_print_header(output, &bsd6_ring);
-				ring_print_header(output, &blt_ring);
-				for (i = 0; i < MAX_NUM_TOP_BITS; i++) {
-					if (i < STATS_COUNT && HAS_STATS_REGS(devid)) {
-						fprintf(output, "%.6s\t",
-							   stats_reg_names[i]
-							   );
-					}
-					if (!top_bits[i].count)
-						continue;
-				}
+				for (i = 0; i < SAMPLER_NUM_RINGS; i++)
+					ring_print_header(output, &sampler.ring[i]);
+				for (i = 0; i < STATS_COUNT && sampler.has_stats; i++)
+					fprintf(output, "%.6s\t",
+						intel_gpu_stats_names[i]);
 				fprintf(output, "\n");
 				print_headers = 0;
 			}
 
 			/* Print statistics */
 			fprintf(output, "%.2f\t", elapsed_time);
-			ring_log(&render_ring, last_samples_per_sec, output);
-			ring_log(&bsd_ring, last_samples_per_sec, output);
-			ring_log(&bsd6_ring, last_samples_per_sec, output);
-			ring_log(&blt_ring, last_samples_per_sec, output);
-
-			for (i = 0; i < MAX_NUM_TOP_BITS; i++) {
-				if (i < STATS_COUNT && HAS_STATS_REGS(devid)) {
-					fprintf(output, "%"PRIu64"\t",
-						   stats[i] - last_stats[i]);
-					last_stats[i] = stats[i];
-				}
-					if (!top_bits[i].count)
-						continue;
-			}
+			for (i = 0; i < SAMPLER_NUM_RINGS; i++)
+				ring_log(&sampler.ring[i], samples, output);
+
+			for (i = 0; i < STATS_COUNT && sampler.has_stats; i++)
+				fprintf(output, "%.0f\t",
+					intel_counters_rate(&sampler.stats, i));
 			fprintf(output, "\n");
 			fflush(output);
 		}
 
-		for (i = 0; i < num_instdone_bits; i++) {
-			top_bits_sorted[i]->count = 0;
-
-			if (i < STATS_COUNT)
-				last_stats[i] = stats[i];
-		}
-
 		/* Check if child has gone */
 		if (child_pid > 0) {
 			int res;
@@ -711,8 +478,9 @@ int main(int argc, char **argv)
 		}
 	}
 
-	fclose(output);
+	if (output)
+		fclose(output);
 
-	intel_register_access_fini();
+	intel_gpu_sampler_fini(&sampler);
 	return 0;
 }
@@ -41,81 +41,61 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "intel_io.h"
-#include "instdone.h"
-#include "intel_reg.h"
 #include "intel_chipset.h"
+#include "intel_gpu_sampler.h"
+#include "overlay/debugfs.h"
+#include "overlay/gpu-freq.h"
+#include "overlay/gpu-perf.h"
+#include "overlay/power.h"
+#include "overlay/rc6.h"
 
 #include "netup_get_statistics.h"
 
-#define  FORCEWAKE      0xA18C
-#define  FORCEWAKE_ACK      0x130090
-
 #define SAMPLES_PER_SEC             10000
-#define SAMPLES_TO_PERCENT_RATIO    (SAMPLES_PER_SEC / 100)
-
-#define MAX_NUM_TOP_BITS            100
-
-#define HAS_STATS_REGS(devid)       IS_965(devid)
-
+#define MAX_CLIENTS                 16      /* busiest clients reported per window */
+#define CLIENT_EXPIRE               10      /* seconds before an idle client is forgotten */
 
 int samples_per_sec = SAMPLES_PER_SEC;
-unsigned long long last_samples_per_sec;
-uint32_t devid;
+int per_client_stats = 0;
 
-static uint32_t instdone, instdone1;
+static struct intel_gpu_sampler sampler;
 
-struct top_bit top_bits[MAX_NUM_TOP_BITS];
-
-struct top_bit *top_bits_sorted[MAX_NUM_TOP_BITS];
+/*
+ * Frequency, RC6 and energy, read once per window from the i915 perf
+ * counters, falling back to sysfs/debugfs files that are kept open, see
+ * overlay/gpu-freq.c, overlay/rc6.c and overlay/power.c.
+ */
+static struct gpu_freq freq;
+static struct rc6 rc6;
+static struct power power;
+static int has_freq, has_rc6, has_power;
 
-const uint32_t stats_regs[STATS_COUNT] = {
-    IA_VERTICES_COUNT_QW,
-    IA_PRIMITIVES_COUNT_QW,
-    VS_INVOCATION_COUNT_QW,
-    GS_INVOCATION_COUNT_QW,
-    GS_PRIMITIVES_COUNT_QW,
-    CL_INVOCATION_COUNT_QW,
-    CL_PRIMITIVES_COUNT_QW,
-    PS_INVOCATION_COUNT_QW,
-    PS_DEPTH_COUNT_QW,
-};
+/*
+ * Per-client attribution from the i915 request tracepoints, see
+ * overlay/gpu-perf.c. The perf rings are drained once per window and the
+ * busiest MAX_CLIENTS clients of that window are kept for the report.
+ */
+static struct gpu_perf perf;
+static int has_perf;
 
-const char *stats_reg_names[STATS_COUNT] = {
-    "vert fetch",
-    "prim fetch",
-    "VS invocations",
-    "GS invocations",
-    "GS prims",
-    "CL invocations",
-    "CL prims",
-    "PS invocations",
-    "PS depth pass",
+struct client_window
+{
+    pid_t pid;
+    char name[64];
+    uint64_t requests;
+    uint32_t ring_requests[MAX_RINGS];
+    uint64_t wait_time;     /* ns */
 };
 
-uint64_t stats[STATS_COUNT];
-uint64_t last_stats[STATS_COUNT];
-
-struct ring render_ring = {
-    .name = "render",
-    .mmio = 0x2030,
-};
-    
-struct ring bsd_ring = {
-    .name = "bitstream",
-    .mmio = 0x4030,
-};
-    
-struct ring bsd6_ring = {
-    .name = "bitstream",
-    .mmio = 0x12030,
-};
-    
-struct ring blt_ring = {
-    .name = "blitter",
-    .mmio = 0x22030,
-};
+static struct client_window clients[MAX_CLIENTS];
+static int num_clients;
+static uint64_t window_requests[MAX_RINGS];
+static uint64_t last_requests[MAX_RINGS];
+static uint64_t window_ns;
+static uint64_t last_window;
 
 char * out_buffer = NULL;
 size_t len_buffer = 0;
@@ -162,7 +142,7 @@ void _print(const char * format, ...)
 
 
 void 
-ring_print(struct ring *ring, unsigned long samples_per_sec)
+ring_print(const struct intel_gpu_sampler_ring *ring, unsigned long samples_per_sec)
 {
     int percent_busy;
 
@@ -179,134 +159,271 @@ ring_print(struct ring *ring, unsigned long samples_per_sec)
     _print("  },\r\n");
 }
 
-    
-unsigned long
-gettime(void)
-{
-    struct timeval t;
-    gettimeofday(&t, NULL);
-    return (t.tv_usec + (t.tv_sec * 1000000));
-}
 
-static void
-update_idle_bit(struct top_bit *top_bit)
+static uint64_t now_ns()
 {
-    uint32_t reg_val;
+    struct timespec ts;
 
-    if (top_bit->bit->reg == INSTDONE_1)
-        reg_val = instdone1;
-    else
-        reg_val = instdone;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-    if ((reg_val & top_bit->bit->bit) == 0)
-        top_bit->count++;
+static void init_telemetry()
+{
+    has_freq = gpu_freq_init(&freq) == 0;
+    has_rc6 = rc6_init(&rc6) == 0;
+    has_power = power_init(&power) == 0;
+
+    if (!has_freq)
+        fprintf(stderr, "GPU frequency unavailable\r\n");
+    if (!has_rc6)
+        fprintf(stderr, "RC6 residency unavailable\r\n");
+    if (!has_power)
+        fprintf(stderr, "GPU energy unavailable\r\n");
+
+    /* The first readings only set the baseline for the first window */
+    if (has_freq)
+        gpu_freq_update(&freq);
+    if (has_rc6)
+        rc6_update(&rc6);
+    if (has_power)
+        power_update(&power);
 }
 
-static uint32_t 
-ring_read(struct ring *ring, uint32_t reg)
+static void update_telemetry()
 {
-    return INREG(ring->mmio + reg);
+    if (has_freq)
+        gpu_freq_update(&freq);
+    if (has_rc6)
+        rc6_update(&rc6);
+    if (has_power)
+        power_update(&power);
 }
 
-static void 
-ring_init(struct ring *ring)
+static void fini_telemetry()
 {
-    ring->size = (((ring_read(ring, RING_LEN) & RING_NR_PAGES) >> 12) + 1) * 4096;
+    if (has_freq)
+        gpu_freq_fini(&freq);
+    if (has_rc6)
+        rc6_fini(&rc6);
+    if (has_power)
+        power_fini(&power);
+    has_freq = has_rc6 = has_power = 0;
 }
 
-void ring_reset(struct ring *ring)
+static void print_telemetry()
 {
-    ring->idle = ring->full = 0;
+    _print("  \"frequency\":\r\n");
+    _print("  {\r\n");
+    _print("    \"actual_mhz\": \"%d\",\r\n", has_freq ? freq.current : 0);
+    _print("    \"requested_mhz\": \"%d\",\r\n", has_freq ? freq.request : 0);
+    _print("    \"min_mhz\": \"%d\",\r\n", has_freq ? freq.min : 0);
+    _print("    \"max_mhz\": \"%d\"\r\n", has_freq ? freq.max : 0);
+    _print("  },\r\n");
+
+    _print("  \"rc6\":\r\n");
+    _print("  {\r\n");
+    _print("    \"residency_percent\": \"%d\",\r\n", has_rc6 ? rc6.rc6_combined : 0);
+    _print("    \"rc6_percent\": \"%d\",\r\n", has_rc6 ? rc6.rc6 : 0);
+    _print("    \"rc6p_percent\": \"%d\",\r\n", has_rc6 ? rc6.rc6p : 0);
+    _print("    \"rc6pp_percent\": \"%d\"\r\n", has_rc6 ? rc6.rc6pp : 0);
+    _print("  },\r\n");
+
+    _print("  \"power\":\r\n");
+    _print("  {\r\n");
+    _print("    \"power_mw\": \"%llu\",\r\n",
+           (unsigned long long)(has_power ? power.power_mW : 0));
+    _print("    \"energy_uj\": \"%llu\"\r\n",
+           (unsigned long long)(has_power ? power.energy_uJ : 0));
+    _print("  }");
 }
 
-static void 
-ring_sample(struct ring *ring)
+static void init_clients()
 {
-    int full;
+    gpu_perf_init(&perf, 0);
+    perf.expire = CLIENT_EXPIRE;
 
-    if (!ring->size)
+    if (perf.error || perf.map == NULL)
+    {
+        fprintf(stderr, "Per-client statistics unavailable: %s\r\n",
+                perf.error ? perf.error : "cannot map perf buffers");
+        gpu_perf_fini(&perf);
         return;
+    }
 
-    ring->head = ring_read(ring, RING_HEAD) & HEAD_ADDR;
-    ring->tail = ring_read(ring, RING_TAIL) & TAIL_ADDR;
+    has_perf = 1;
+    last_window = now_ns();
+}
 
-    if (ring->tail == ring->head)
-        ring->idle++;
+/* Copies a comm, replacing the characters JSON would need escaped */
+static void client_name(char *dst, const char *src, size_t len)
+{
+    size_t i;
 
-    full = ring->tail - ring->head;
-    if (full < 0)
-        full += ring->size;
-    ring->full += full;
+    for (i = 0; i < len - 1 && src[i]; i++)
+        dst[i] = (src[i] < 0x20 || src[i] == '"' || src[i] == '\\') ? '?' : src[i];
+    dst[i] = '\0';
 }
 
-
-void init_device()
+static void add_client(const struct gpu_perf_comm *comm, uint64_t requests)
 {
-    struct pci_device *pci_dev;
-    
-    pci_dev = intel_get_pci_device();
-    devid = pci_dev->device_id;
-    intel_mmio_use_pci_bar(pci_dev);
-    init_instdone_definitions(devid);
+    struct client_window *c;
+    int i;
 
-    for(int i = 0; i < num_instdone_bits; i++)
+    /* clients[] is kept sorted by requests, busiest first */
+    if (num_clients == MAX_CLIENTS)
     {
-        top_bits[i].bit = &instdone_bits[i];
-        top_bits[i].count = 0;
-        top_bits_sorted[i] = &top_bits[i];
+        if (requests <= clients[MAX_CLIENTS - 1].requests)
+            return;
+        num_clients--;
     }
 
-    // Grab access to the registers
-    intel_register_access_init(pci_dev, 0);
-    
-    ring_init(&render_ring);
-    if (IS_GEN4(devid) || IS_GEN5(devid))
+    for (i = num_clients; i > 0 && clients[i - 1].requests < requests; i--)
+        clients[i] = clients[i - 1];
+    num_clients++;
+
+    c = &clients[i];
+    c->pid = comm->pid;
+    client_name(c->name, comm->name, sizeof(c->name));
+    c->requests = requests;
+    for (int n = 0; n < MAX_RINGS; n++)
+        c->ring_requests[n] = comm->nr_requests[n];
+    c->wait_time = comm->wait_time;
+}
+
+static void update_clients()
+{
+    struct gpu_perf_comm *comm;
+    uint64_t now;
+
+    gpu_perf_update(&perf);
+
+    now = now_ns();
+    window_ns = now - last_window;
+    last_window = now;
+
+    for (int n = 0; n < MAX_RINGS; n++)
     {
-        fprintf(stderr, "GEN4 or GEN5 detected\r\n");
-        ring_init(&bsd_ring);
+        window_requests[n] = perf.total.requests[n] - last_requests[n];
+        last_requests[n] = perf.total.requests[n];
     }
-    if (IS_GEN6(devid) || IS_GEN7(devid))
+
+    num_clients = 0;
+    for (comm = perf.comm; comm; comm = comm->next)
     {
-        fprintf(stderr, "GEN6 or GEN7 detected\r\n");
-        ring_init(&bsd6_ring);
-        ring_init(&blt_ring);
+        uint64_t requests = 0;
+
+        for (int n = 0; n < MAX_RINGS; n++)
+            requests += comm->nr_requests[n];
+
+        if (comm->name[0] && (requests || comm->wait_time))
+            add_client(comm, requests);
+
+        memset(comm->nr_requests, 0, sizeof(comm->nr_requests));
+        comm->wait_time = 0;
+        comm->nr_sema = 0;
+        comm->nr_flips = 0;
     }
-    if (IS_GEN8(devid))
+}
+
+/*
+ * Busy percentage of the sampled ring behind each tracepoint ring, or -1
+ * when that ring is not sampled.
+ */
+static void perf_ring_busy(const struct intel_gpu_sampler *s, int busy[MAX_RINGS])
+{
+    const struct intel_gpu_sampler_ring *ring[MAX_RINGS] = {
+        &s->ring[SAMPLER_RING_RENDER],
+        s->ring[SAMPLER_RING_BSD].size ? &s->ring[SAMPLER_RING_BSD] : &s->ring[SAMPLER_RING_BSD6],
+        &s->ring[SAMPLER_RING_BLT],
+        NULL,
+    };
+
+    for (int n = 0; n < MAX_RINGS; n++)
     {
-        fprintf(stderr, "GEN8 detected\r\n");
-        ring_init(&bsd6_ring);
-        ring_init(&blt_ring);
+        if (ring[n] && ring[n]->size && s->samples)
+            busy[n] = 100 - 100 * ring[n]->idle / s->samples;
+        else
+            busy[n] = -1;
     }
-    if (IS_GEN9(devid))
+}
+
+/*
+ * A client's share of the busy time is estimated by splitting the busy
+ * time of each ring between clients in proportion to the requests they
+ * submitted to it during the window. Rings that are not sampled count
+ * as fully busy while they have requests.
+ */
+static double client_busy_share(const struct client_window *c, const int busy[MAX_RINGS])
+{
+    double share = 0, total = 0;
+
+    for (int n = 0; n < MAX_RINGS; n++)
     {
-        fprintf(stderr, "GEN9 detected\r\n");
-        ring_init(&bsd6_ring);
-        ring_init(&blt_ring);
+        double weight;
+
+        if (!window_requests[n])
+            continue;
+
+        weight = busy[n] < 0 ? 100 : busy[n];
+        share += weight * c->ring_requests[n] / window_requests[n];
+        total += weight;
     }
 
-    // Initialize GPU stats
-    if (HAS_STATS_REGS(devid))
-    {
-        for (int i = 0; i < STATS_COUNT; i++) 
-        {
-            uint32_t stats_high, stats_low, stats_high_2;
+    return total ? 100 * share / total : 0;
+}
+
+static void print_clients(const struct intel_gpu_sampler *s)
+{
+    double seconds = window_ns ? window_ns / 1e9 : 1;
+    int busy[MAX_RINGS];
 
-            do
-            {
-                stats_high = INREG(stats_regs[i] + 4);
-                stats_low = INREG(stats_regs[i]);
-                stats_high_2 = INREG(stats_regs[i] + 4);
-            } while (stats_high != stats_high_2);
+    perf_ring_busy(s, busy);
 
-            last_stats[i] = (uint64_t)stats_high << 32 | stats_low;
-        }
+    _print("  \"clients\":\r\n");
+    _print("  [\r\n");
+    for (int i = 0; i < num_clients; i++)
+    {
+        const struct client_window *c = &clients[i];
+
+        _print("    {\r\n");
+        _print("      \"pid\": \"%d\",\r\n", (int)c->pid);
+        _print("      \"comm\": \"%s\",\r\n", c->name);
+        _print("      \"requests_per_second\": \"%.0f\",\r\n", c->requests / seconds);
+        _print("      \"wait_ms_per_second\": \"%.1f\",\r\n", c->wait_time / 1e6 / seconds);
+        _print("      \"busy_share\": \"%.0f\"\r\n", client_busy_share(c, busy));
+        _print("    }");
+        if(i < num_clients - 1)
+            _print(",");
+        _print("\r\n");
     }
+    _print("  ]\r\n");
+}
+
+
+void init_device()
+{
+    struct pci_device *pci_dev;
+    
+    pci_dev = intel_get_pci_device();
+    intel_gpu_sampler_init(&sampler, pci_dev);
+
+    fprintf(stderr, "GEN%d detected\r\n", intel_gen(sampler.devid));
+
+    debugfs_init();
+    init_telemetry();
+    if (per_client_stats)
+        init_clients();
 }
 
 
 void deinit_device()
 {
-    intel_register_access_fini();
+    intel_gpu_sampler_fini(&sampler);
+    fini_telemetry();
+    if (has_perf)
+        gpu_perf_fini(&perf);
+    has_perf = 0;
     if(out_buffer)
         free(out_buffer);
     len_buffer = 0;
@@ -315,86 +432,29 @@ void deinit_device()
 
 void get_device_params()
 {
-    int j, i;
-    unsigned long long t1, ti, tf;
-    unsigned long long def_sleep = 1000000 / samples_per_sec;
-    last_samples_per_sec = samples_per_sec;
-
-    t1 = gettime();
-
-    ring_reset(&render_ring);
-    ring_reset(&bsd_ring);
-    ring_reset(&bsd6_ring);
-    ring_reset(&blt_ring);
-
-    for (i = 0; i < samples_per_sec; i++)
-    {
-        long long interval;
-        ti = gettime();
-        if (IS_965(devid))
-        {
-            instdone = INREG(INSTDONE_I965);
-            instdone1 = INREG(INSTDONE_1);
-        }
-        else
-            instdone = INREG(INSTDONE);
-
-        for (j = 0; j < num_instdone_bits; j++)
-            update_idle_bit(&top_bits[j]);
-
-        ring_sample(&render_ring);
-        ring_sample(&bsd_ring);
-        ring_sample(&bsd6_ring);
-        ring_sample(&blt_ring);
-
-        tf = gettime();
-        if (tf - t1 >= 1000000)
-        {
-            // We are out of sync, bail out
-            last_samples_per_sec = i+1;
-            break;
-        }
-        interval = def_sleep - (tf - ti);
-        if (interval > 0)
-            usleep(interval);
-    }
-
-    if (HAS_STATS_REGS(devid))
-    {
-        for (i = 0; i < STATS_COUNT; i++) 
-        {
-            uint32_t stats_high, stats_low, stats_high_2;
-            do
-            {
-                stats_high = INREG(stats_regs[i] + 4);
-                stats_low = INREG(stats_regs[i]);
-                stats_high_2 = INREG(stats_regs[i] + 4);
-            } while (stats_high != stats_high_2);
-
-            stats[i] = (uint64_t)stats_high << 32 | stats_low;
-        }
-    }
+    intel_gpu_sampler_run(&sampler, samples_per_sec);
+    update_telemetry();
+    if (has_perf)
+        update_clients();
 }
 
-void print_device_params()
+void print_sampler_params(const struct intel_gpu_sampler *s)
 {
     int percent;
 
     _print("Content-type: text/json\r\n\r\n");
     _print("{\r\n");
-    ring_print(&render_ring, last_samples_per_sec);
-    ring_print(&bsd_ring, last_samples_per_sec);
-    ring_print(&bsd6_ring, last_samples_per_sec);
-    ring_print(&blt_ring, last_samples_per_sec);
+    for (int i = 0; i < SAMPLER_NUM_RINGS; i++)
+        ring_print(&s->ring[i], s->samples);
     _print("  \"instdone bits\":\r\n");
     _print("  {\r\n");
-    for (int i = 0; i < num_instdone_bits; i++)
+    for (int i = 0; i < s->num_bits; i++)
     {
-        percent = (top_bits_sorted[i]->count * 100) / last_samples_per_sec;
+        percent = (s->bits[i].count * 100) / s->samples;
         _print("    \"%s\": \"%d\"",
-               top_bits_sorted[i]->bit->name,
+               s->bits[i].bit->name,
                percent);
-        if(i < num_instdone_bits - 1)
+        if(i < s->num_bits - 1)
             _print(",");
         _print("\r\n");
     }
@@ -404,25 +464,39 @@ void print_device_params()
     _print("  {\r\n");
     for (int i = 0; i < STATS_COUNT; i++)
     {
-        _print("    \"%s\":\r\n", stats_reg_names[i]);
+        uint64_t total = s->has_stats ? s->stats.values[i] : 0;
+        double rate = s->has_stats ? intel_counters_rate(&s->stats, i) : 0;
+
+        _print("    \"%s\":\r\n", intel_gpu_stats_names[i]);
         _print("    {\r\n");
-        _print("      \"total_count\": \"%llu\",\r\n", (long long)stats[i]);
-        _print("      \"speed_per_second\": \"%lld\"\r\n", (long long)(stats[i] - last_stats[i]));
+        _print("      \"total_count\": \"%llu\",\r\n", (long long)total);
+        _print("      \"speed_per_second\": \"%.0f\"\r\n", rate);
         _print("    }");
         if(i < STATS_COUNT - 1)
             _print(",");
         _print("\r\n");
-        last_stats[i] = stats[i];
     }
-    _print("  }\r\n");
+    _print("  },\r\n");
+
+    print_telemetry();
+
+    if (has_perf)
+    {
+        _print(",\r\n");
+        print_clients(s);
+    }
+    else
+        _print("\r\n");
     
     _print("}\r\n");
 }
 
+void print_device_params()
+{
+    print_sampler_params(&sampler);
+}
+
 void reset_params_values()
 {
-    int i;
     empty_buffer();
-    for (i = 0; i < num_instdone_bits; i++)
-            top_bits_sorted[i]->count = 0;
-}
\ No newline at end of file
+}
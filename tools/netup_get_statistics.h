@@ -3,42 +3,17 @@
 
 #include <stdint.h>
 
-struct ring 
-{
-    const char *name;
-    uint32_t mmio;
-    int head, tail, size;
-    uint64_t full;
-    int idle;
-};
-
-struct top_bit 
-{
-    struct instdone_bit *bit;
-    int count;
-};
-
-enum stats_counts 
-{
-    IA_VERTICES,
-    IA_PRIMITIVES,
-    VS_INVOCATION,
-    GS_INVOCATION,
-    GS_PRIMITIVES,
-    CL_INVOCATION,
-    CL_PRIMITIVES,
-    PS_INVOCATION,
-    PS_DEPTH,
-    STATS_COUNT
-};
+struct intel_gpu_sampler;
 
 void init_device();
 void deinit_device();
 void get_device_params();
 void print_device_params();
+void print_sampler_params(const struct intel_gpu_sampler *s);
 void reset_params_values();
 
 extern int samples_per_sec;
+extern int per_client_stats;
 extern char * out_buffer;
 
 #endif
\ No newline at end of file
@@ -58,6 +58,8 @@ usage(const char *appname)
             std::endl <<
             "The following parameters apply:" << std::endl <<
             "[-s <samples>]       samples per seconds (default " << samples_per_sec << ")" << std::endl << 
+            "[-p]                 report per-client usage from the i915 tracepoints" << std::endl <<
+            "                     (needs permission to open perf tracepoints)" << std::endl <<
             "[-h]                 show this help screen" << std::endl <<
             std::endl;
 
@@ -90,7 +92,7 @@ void get_device_statistics()
 int main(int argc, char **argv)
 {   
     int ch;
-    while ((ch = getopt(argc, argv, "s:h")) != -1) 
+    while ((ch = getopt(argc, argv, "s:ph")) != -1) 
     {
         switch (ch) 
         {
@@ -101,6 +103,9 @@ int main(int argc, char **argv)
                 exit(1);
             }
             break;
+        case 'p':
+            per_client_stats = 1;
+            break;
         case 'h':
             usage(argv[0]);
             exit(0);